@@ -0,0 +1,62 @@
+/**
+ * @file FreeRTOSConfig.h
+ * @brief Kernel configuration of the RTOS build (RTOS_ENABLE, sched.h).
+ *
+ * Static allocation only, like the rest of the firmware: no heap file is
+ * linked. The kernel masks interrupts from IRQ_PRIO_WAKE down, the link
+ * and the sampler above it are never held off by a critical section and
+ * must not call the kernel; SysTick drops to the lowest level.
+ */
+
+#ifndef FREERTOS_CONFIG_H
+#define FREERTOS_CONFIG_H
+
+#include <stdint.h>
+#include "irq_plan.h"
+#include "sched.h"
+
+extern uint32_t SystemCoreClock;
+
+#define configUSE_PREEMPTION                    1
+#define configUSE_PORT_OPTIMISED_TASK_SELECTION 1
+#define configUSE_TICKLESS_IDLE                 1
+#define configEXPECTED_IDLE_TIME_BEFORE_SLEEP   2
+#define configCPU_CLOCK_HZ                      (SystemCoreClock)
+#define configTICK_RATE_HZ                      ((TickType_t)1000)
+#define configMAX_PRIORITIES                    (SCHED_TASKS + 1)
+#define configMINIMAL_STACK_SIZE                ((uint16_t)128)
+#define configMAX_TASK_NAME_LEN                 8
+#define configUSE_16_BIT_TICKS                  0
+#define configIDLE_SHOULD_YIELD                 1
+#define configUSE_TASK_NOTIFICATIONS            1
+#define configUSE_MUTEXES                       0
+#define configUSE_COUNTING_SEMAPHORES           0
+#define configQUEUE_REGISTRY_SIZE               0
+#define configUSE_IDLE_HOOK                     0
+#define configUSE_TICK_HOOK                     0
+#define configUSE_TIMERS                        0
+#define configUSE_CO_ROUTINES                   0
+#define configCHECK_FOR_STACK_OVERFLOW          2
+#define configSUPPORT_STATIC_ALLOCATION         1
+#define configSUPPORT_DYNAMIC_ALLOCATION        0
+
+#define INCLUDE_vTaskDelay                      1
+#define INCLUDE_xTaskGetSchedulerState          1
+
+// 4 priority bits on the STM32F4
+#define configPRIO_BITS                         4
+#define configKERNEL_INTERRUPT_PRIORITY         (15 << (8 - configPRIO_BITS))
+#define configMAX_SYSCALL_INTERRUPT_PRIORITY    (IRQ_PRIO_WAKE << (8 - configPRIO_BITS))
+
+#define configASSERT(x) do { if ((x) == 0) { __asm volatile ("cpsid i"); for (;;) { } } } while (0)
+
+// TIM5 keeps the HAL tick right across a tickless sleep
+#define configPRE_SLEEP_PROCESSING(x)           SchedRtosPreSleep()
+#define configPOST_SLEEP_PROCESSING(x)          SchedRtosPostSleep()
+
+// port.c provides the SVC and PendSV handlers under the vector names,
+// stm32f4xx_it.c leaves them out and forwards SysTick
+#define vPortSVCHandler    SVC_Handler
+#define xPortPendSVHandler PendSV_Handler
+
+#endif /* FREERTOS_CONFIG_H */
@@ -0,0 +1,91 @@
+/**
+ * @file bench.h
+ * @brief Hardware-in-the-loop latency benchmark mode.
+ *
+ * A bench build plays a fixed key pattern and measures how long every
+ * change takes to show up in the data the master reads. The pattern steps
+ * every BENCH_STEP_MS from the SysTick interrupt:
+ *   BENCH_PATTERN_ROLL     press the bench keys one after the other, then
+ *                          release them in the same order, one change per step
+ *   BENCH_PATTERN_CHORD    press and release all bench keys at once
+ *   BENCH_PATTERN_CHATTER  toggle the first bench key, bouncing it every
+ *                          millisecond for BENCH_CHATTER_MS before it settles
+ *
+ * The stimulus reaches the firmware in one of two ways:
+ *   BENCH_MODE_INJECT    the pressed keys are ANDed into every raw key word
+ *                        before the debounce, keys 0..BENCH_KEYS-1
+ *   BENCH_MODE_LOOPBACK  open-drain outputs from BENCH_LOOPBACK_MAP pull
+ *                        their key inputs low through a wire, so sampling,
+ *                        EXTI and DMA capture are covered as well
+ *
+ * The stimulus time is taken on TIM5 as the level is applied. The first
+ * RIGHT_KEYBOARD_REG_KEYS or RIGHT_KEYBOARD_REG_DELTA read whose data
+ * matches the new level ends the measurement. A change still unseen when
+ * the next one starts counts as missed. Results are read from
+ * RIGHT_KEYBOARD_REG_BENCH; LATENCY_STATS breaks the same changes down by
+ * stage. Chords wider than REPORT_MAX_KEYS never match.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "stm32f4xx_hal.h"
+
+#define BENCH_MODE_OFF      0
+#define BENCH_MODE_INJECT   1
+#define BENCH_MODE_LOOPBACK 2
+
+#ifndef BENCH_MODE
+#define BENCH_MODE BENCH_MODE_OFF
+#endif
+
+#define BENCH_PATTERN_ROLL    0
+#define BENCH_PATTERN_CHORD   1
+#define BENCH_PATTERN_CHATTER 2
+
+#ifndef BENCH_PATTERN
+#define BENCH_PATTERN BENCH_PATTERN_ROLL
+#endif
+
+// Time between two pattern steps, must exceed the worst expected latency
+#ifndef BENCH_STEP_MS
+#define BENCH_STEP_MS 40u
+#endif
+
+// Bounce time of BENCH_PATTERN_CHATTER
+#ifndef BENCH_CHATTER_MS
+#define BENCH_CHATTER_MS 3u
+#endif
+
+// Keys driven in BENCH_MODE_INJECT
+#ifndef BENCH_KEYS
+#define BENCH_KEYS 4u
+#endif
+
+// X(key index, port letter, pin number) of the loopback outputs, each wired
+// to the input of its key; pins that are not keys, SWD, SWO or I2C
+#ifndef BENCH_LOOPBACK_MAP
+#define BENCH_LOOPBACK_MAP(X) \
+    X(0, C, 14) X(1, C, 15) X(2, A, 12)
+#endif
+
+// Benchmark register, little endian
+typedef struct __attribute__((packed)) {
+    uint32_t stimuli;           // Changes played
+    uint32_t observed;          // Changes seen in a report read
+    uint32_t missed;            // Changes overtaken by the next one unseen
+    uint32_t min_us;            // Stimulus to the address match of that read
+    uint32_t mean_us;
+    uint32_t max_us;
+    uint8_t  mode;              // BENCH_MODE
+    uint8_t  pattern;           // BENCH_PATTERN
+} BenchReport;
+
+// Function prototypes
+void BenchInit(void);
+void BenchTick(void);
+uint32_t BenchInjectedKeys(void);
+void BenchObserve(uint32_t pressed, uint32_t now);
+void BenchSnapshot(BenchReport *report);
+
+#endif /* BENCH_H */
@@ -0,0 +1,76 @@
+/**
+ * @file board.h
+ * @brief Board profiles of the right-half hardware variants.
+ *
+ * BOARD picks a variant and only sets the defaults of the options that
+ * describe it; any of them can still be given on its own, and BOARD_CUSTOM
+ * leaves every option at its usual default.
+ *
+ *   BOARD_DIRECT_24  one pin per key, KEY_MAP (keyboard_layout.h), 24 keys
+ *   BOARD_MATRIX_30  5 x 6 diode matrix (keyboard_matrix.h), columns
+ *                    strobed by TIM1/DMA2
+ *   BOARD_HALL_24    Hall sensors, 3 ADC inputs behind 8:1 muxes
+ *                    (hall_sensor.h), sampled by TIM3/DMA
+ *
+ * Everything downstream is resolved by the preprocessor from KEY_WIRING
+ * and the pin map of the variant (KEY_MAP, MATRIX_COL_MAP,
+ * HALL_CHANNEL_MAP): each build compiles only its own gather kernel, masks
+ * and pin setup, and no code tests the board at run time. NUM_KEYS follows
+ * the pin map. The board is reported in RightKeyboardConfig.board.
+ *
+ * I2C1 sits on PB6/PB7 or, with BOARD_I2C_SCL_PIN 8, on PB8/PB9 (AF4 both).
+ */
+
+#ifndef BOARD_H
+#define BOARD_H
+
+#define BOARD_CUSTOM    0
+#define BOARD_DIRECT_24 1
+#define BOARD_MATRIX_30 2
+#define BOARD_HALL_24   3
+
+#ifndef BOARD
+#define BOARD BOARD_CUSTOM
+#endif
+
+#if BOARD == BOARD_DIRECT_24
+#ifndef KEY_WIRING
+#define KEY_WIRING KEY_WIRING_DIRECT
+#endif
+#elif BOARD == BOARD_MATRIX_30
+#ifndef KEY_WIRING
+#define KEY_WIRING KEY_WIRING_MATRIX
+#endif
+#ifndef SCAN_MODE
+#define SCAN_MODE SCAN_MODE_DMA
+#endif
+#ifndef MATRIX_ROWS
+#define MATRIX_ROWS 5
+#endif
+#elif BOARD == BOARD_HALL_24
+#ifndef KEY_WIRING
+#define KEY_WIRING KEY_WIRING_HALL
+#endif
+#ifndef SCAN_MODE
+#define SCAN_MODE SCAN_MODE_DMA
+#endif
+#ifndef HALL_MUX_WAYS
+#define HALL_MUX_WAYS 8
+#endif
+#elif BOARD != BOARD_CUSTOM
+#error "Unknown BOARD"
+#endif
+
+// I2C1 (or USART1) pins on GPIOB
+#ifndef BOARD_I2C_SCL_PIN
+#define BOARD_I2C_SCL_PIN 6
+#define BOARD_I2C_SDA_PIN 7
+#endif
+
+#define BOARD_I2C_PINS ((1u << BOARD_I2C_SCL_PIN) | (1u << BOARD_I2C_SDA_PIN))
+
+#if !(BOARD_I2C_SCL_PIN == 6 && BOARD_I2C_SDA_PIN == 7) && !(BOARD_I2C_SCL_PIN == 8 && BOARD_I2C_SDA_PIN == 9)
+#error "I2C1 is on PB6/PB7 or PB8/PB9"
+#endif
+
+#endif /* BOARD_H */
@@ -0,0 +1,41 @@
+/**
+ * @file chatter_stats.h
+ * @brief Per-key raw versus accepted transition counts and bounce bursts.
+ *
+ * A burst starts with an accepted edge and grows while further raw edges on
+ * that key follow within CHATTER_BURST_GAP_US of each other; its length is
+ * the time from the accepted edge to the last raw one. A healthy switch
+ * shows raw_edges close to accepted and short bursts, a chattering one
+ * many raw edges per accepted one and bursts near the debounce time.
+ *
+ * Only edges the scan samples are seen, so the numbers mean most with
+ * SCAN_MODE_DMA or the fast SCAN_RATE_ADAPTIVE rate.
+ */
+
+#ifndef CHATTER_STATS_H
+#define CHATTER_STATS_H
+
+#include <stdint.h>
+
+// Count raw and accepted edges per key (0 = compiled out)
+#ifndef CHATTER_STATS
+#define CHATTER_STATS 0
+#endif
+
+// Largest gap between two raw edges of one burst, in microseconds
+#ifndef CHATTER_BURST_GAP_US
+#define CHATTER_BURST_GAP_US 10000u
+#endif
+
+// One table entry per key, little endian, all fields saturate
+typedef struct __attribute__((packed)) {
+    uint16_t raw_edges;     // Raw level changes seen
+    uint16_t accepted;      // Changes the debounce let through
+    uint16_t burst_max_us;  // Longest bounce burst
+} ChatterKeyStats;
+
+// Function prototypes
+void ChatterUpdate(uint32_t raw_changed, uint32_t accepted, uint32_t now);
+void ChatterSnapshot(ChatterKeyStats *table);
+
+#endif /* CHATTER_STATS_H */
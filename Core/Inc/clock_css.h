@@ -0,0 +1,51 @@
+/**
+ * @file clock_css.h
+ * @brief HSE crystal supervision: fall back to HSI instead of stopping.
+ *
+ * With CLOCK_PLL_SOURCE_HSE the PLL runs from the 25 MHz crystal, good to
+ * a few tens of ppm against about 1 % for HSI over temperature, which the
+ * microsecond timestamps, the time sync to the master and the I2C bit
+ * rate all inherit. A board with a dead or missing crystal must still come
+ * up, so with CLOCK_CSS_ENABLE:
+ *
+ *   - a crystal that does not start within HSE_STARTUP_TIMEOUT at boot:
+ *     SystemClock_Config() programs the same PLL output from HSI instead,
+ *   - a crystal that stops later: the clock security system switches
+ *     SYSCLK to HSI and raises NMI; ClockCssIRQHandler() restarts the PLL
+ *     from HSI with the same output within one PLL lock time, so every bus
+ *     and timer clock comes back unchanged.
+ *
+ * Either way HSE stays unused for the rest of the boot (STOP exits rerun
+ * SystemClock_Config() without waiting for it again) and the failure is
+ * counted in RightKeyboardCounters.hse_failures. Only the accuracy drops.
+ *
+ * The NMI vector branches to ClockCssNmiEntry() first, which hands any
+ * other NMI on to the fault hook untouched (retained.h). Not available with
+ * CLOCK_PROFILE_GOVERNOR, which owns the clock switches.
+ */
+
+#ifndef CLOCK_CSS_H
+#define CLOCK_CSS_H
+
+#include "right_side_keyboard.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Fall back to HSI on a failed crystal (0 = a crystal that does not start
+// ends in Error_Handler())
+#ifndef CLOCK_CSS_ENABLE
+#define CLOCK_CSS_ENABLE (CLOCK_PLL_SOURCE == CLOCK_PLL_SOURCE_HSE && CLOCK_PROFILE != CLOCK_PROFILE_GOVERNOR)
+#endif
+
+#if CLOCK_CSS_ENABLE && (CLOCK_PLL_SOURCE != CLOCK_PLL_SOURCE_HSE || CLOCK_PROFILE == CLOCK_PROFILE_GOVERNOR)
+#error "CLOCK_CSS_ENABLE needs the PLL on the HSE crystal and a fixed clock profile"
+#endif
+
+// Function prototypes
+bool ClockCssHseUsable(void);
+void ClockCssHseFailed(void);
+uint32_t ClockCssFailures(void);
+void ClockCssNmiEntry(void);
+void ClockCssIRQHandler(void);
+
+#endif /* CLOCK_CSS_H */
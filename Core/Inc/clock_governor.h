@@ -0,0 +1,23 @@
+/**
+ * @file clock_governor.h
+ * @brief Run-time switching between an idle and a boost system clock.
+ *
+ * With CLOCK_PROFILE_GOVERNOR the core runs from the PLL at 64 MHz while keys
+ * change or the master talks to us, and falls back to HSI 16 MHz with the PLL
+ * stopped after CLOCK_GOVERNOR_IDLE_MS without activity. The APB dividers are
+ * picked so both PCLKs stay at 8 MHz and the timer clocks at 16 MHz in both
+ * states, so the I2C timing, the DMA sample rate (TIM1) and the microsecond
+ * time base (TIM5) never change.
+ */
+
+#ifndef CLOCK_GOVERNOR_H
+#define CLOCK_GOVERNOR_H
+
+#include "stm32f4xx_hal.h"
+#include <stdbool.h>
+
+// Function prototypes
+void ClockGovernorService(uint32_t activity);
+bool ClockGovernorBoosted(void);
+
+#endif /* CLOCK_GOVERNOR_H */
@@ -0,0 +1,81 @@
+/**
+ * @file config_store.h
+ * @brief Run-time settings kept in a flash log across resets.
+ *
+ * The last 128 KB sector (sector 7, 0x08060000, cut from the FLASH region
+ * of the linker script) holds an append-only log of key/value records.
+ * Each record is one header word and the value padded to whole words:
+ *
+ *   key, length, CRC-8 (crc8.h) over key, length and value, commit byte
+ *
+ * The header goes in first with the commit byte erased (0xFF), then the
+ * value, then the commit byte is cleared to 0x00; a record torn by a reset
+ * is skipped on the next load. ConfigStoreInit() reads the log once, front
+ * to back, and keeps the newest committed value of every key in RAM, so
+ * lookups never touch flash again.
+ *
+ * Writes only update the RAM copy. ConfigStoreService() appends the
+ * changed keys from the main loop, one record per pass, once neither keys
+ * nor the link moved for CONFIG_STORE_QUIET_MS and no transfer is under
+ * way. Programming a word stalls flash fetches for about 16 us, so an
+ * interrupt that fires meanwhile (from flash) starts that much later.
+ *
+ * A sector erase blocks flash for up to a few seconds, so it only happens
+ * at boot: once the log is fuller than CONFIG_STORE_COMPACT_PERCENT it is
+ * erased and the RAM copy written back, with the watchdog fed from SRAM
+ * meanwhile. A log that fills up at run time keeps its changes in RAM
+ * until that next boot.
+ */
+
+#ifndef CONFIG_STORE_H
+#define CONFIG_STORE_H
+
+#include "stm32f4xx_hal.h"
+#include "debounce.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Keep master writes to the settings and debounce registers across resets
+// (0 = compiled out, every boot starts from the build defaults)
+#ifndef CONFIG_STORE_ENABLE
+#define CONFIG_STORE_ENABLE 0
+#endif
+
+// Log sector, outside the FLASH region of STM32F411CEUX_FLASH.ld
+#define CONFIG_STORE_SECTOR FLASH_SECTOR_7
+#define CONFIG_STORE_ADDR   0x08060000u
+#define CONFIG_STORE_SIZE   (128u * 1024u)
+
+// Largest value, in bytes
+#ifndef CONFIG_STORE_VALUE_MAX
+#define CONFIG_STORE_VALUE_MAX 16
+#endif
+
+// Time without key changes or transfers before a record is written
+#ifndef CONFIG_STORE_QUIET_MS
+#define CONFIG_STORE_QUIET_MS 2000u
+#endif
+
+// Log fill level that makes the next boot compact it
+#ifndef CONFIG_STORE_COMPACT_PERCENT
+#define CONFIG_STORE_COMPACT_PERCENT 75u
+#endif
+
+#if CONFIG_STORE_VALUE_MAX < 1 || CONFIG_STORE_VALUE_MAX > 252
+#error "CONFIG_STORE_VALUE_MAX must be between 1 and 252"
+#endif
+
+// Keys of the stored values
+typedef enum {
+    CONFIG_KEY_SETTINGS,                // RightKeyboardSettings up to the counters
+    CONFIG_KEY_DEBOUNCE,                // RightKeyboardDebounceProfile of profile 0...
+    CONFIG_KEYS = CONFIG_KEY_DEBOUNCE + DEBOUNCE_PROFILES
+} ConfigKey;
+
+// Function prototypes
+void ConfigStoreInit(void);
+bool ConfigStoreGet(ConfigKey key, void *value, uint32_t len);
+void ConfigStoreSet(ConfigKey key, const void *value, uint32_t len);
+void ConfigStoreService(uint32_t activity);
+
+#endif /* CONFIG_STORE_H */
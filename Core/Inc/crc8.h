@@ -0,0 +1,20 @@
+/**
+ * @file crc8.h
+ * @brief CRC-8 used to protect the frames sent to the left half.
+ *
+ * Polynomial 0x07, initial value 0x00, no reflection (the SMBus PEC
+ * variant), so a master can reuse an existing PEC routine to check frames.
+ */
+
+#ifndef CRC8_H
+#define CRC8_H
+
+#include <stdint.h>
+
+// Initial CRC value
+#define CRC8_INIT 0x00
+
+// Function prototypes
+uint8_t Crc8Update(uint8_t crc, const uint8_t *data, uint32_t len);
+
+#endif /* CRC8_H */
@@ -0,0 +1,216 @@
+/**
+ * @file debounce.h
+ * @brief Debounce engines that work on packed key words.
+ *
+ * Every engine takes the raw key word (bit n = key n, 1 = released) and
+ * returns the debounced word. None of them touch the HAL, so they can be
+ * reused by any scan source and built for the host as they are. Times are
+ * in microseconds on any free-running 32-bit counter.
+ *
+ * The ...Active() helpers return the keys an engine still has work for.
+ * With none, an update with the same raw word returns the same debounced
+ * word and leaves nothing behind that a later update depends on, so the
+ * caller may skip it.
+ */
+
+#ifndef DEBOUNCE_H
+#define DEBOUNCE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Vertical counter state: one 2-bit counter per key, stored as two bit-planes
+typedef struct {
+    uint32_t state;     // Debounced key word
+    uint32_t cnt0;      // Counter bit 0 of every key
+    uint32_t cnt1;      // Counter bit 1 of every key
+} VerticalCounter;
+
+// Lockout state: an edge is taken at once, then the key ignores its pin
+// until its countdown has run out. Two words of key state plus one 16-bit
+// timer per key, 80 bytes for 32 keys.
+typedef struct {
+    uint32_t state;         // Debounced key word
+    uint32_t locked;        // Keys whose lockout is still running
+    uint32_t last_us;       // Latest sample time the countdowns refer to
+    uint16_t lockout_us;    // Lockout length, at most 65535 us
+    uint16_t remain[32];    // Lockout time left per key after last_us, valid while locked
+} LockoutDebounce;
+
+// Window profiles of the asymmetric engine
+#ifndef DEBOUNCE_PROFILES
+#define DEBOUNCE_PROFILES 4
+#endif
+
+// Window pair shared by a group of keys, every key is in exactly one group
+typedef struct {
+    uint32_t keys;          // Keys using this profile
+    uint16_t press_us;      // Press window, at most 65535 us
+    uint16_t release_us;    // Release window, at most 65535 us
+} DebounceProfile;
+
+// Asymmetric state: press and release each have a policy and a window.
+// An eager direction takes the edge at once and then ignores the pin like
+// the lockout engine, a deferred one takes it only once the new level has
+// been seen on every sample for the whole window. Policies are key masks
+// and windows come from the key's profile, so mixed switch types cost one
+// loop per profile, not a branch per key. A key is always either locked,
+// pending or idle, so both share one timer per key, 120 bytes for 32 keys
+// and 4 profiles.
+typedef struct {
+    uint32_t state;         // Debounced key word
+    uint32_t locked;        // Keys in an eager lockout
+    uint32_t pending;       // Keys waiting out a deferred window
+    uint32_t press_eager;   // Keys whose press is eager, deferred otherwise
+    uint32_t release_eager; // Keys whose release is eager, deferred otherwise
+    uint32_t last_us;       // Latest sample time the countdowns refer to
+    DebounceProfile profile[DEBOUNCE_PROFILES];
+    uint16_t remain[32];    // Window time left per key after last_us, valid while locked or pending
+} AsymDebounce;
+
+// Adaptive state: the lockout engine with a window per key that follows the
+// key's observed bounce. Raw edges inside a lockout measure the bounce from
+// the accepted edge, an accepted edge shortly after the previous one counts
+// as bounce that outlasted the window. 284 bytes for 32 keys.
+typedef struct {
+    uint32_t state;         // Debounced key word
+    uint32_t locked;        // Keys whose lockout is still running
+    uint32_t raw;           // Raw key word of the previous sample
+    uint32_t measured;      // Keys with an accepted edge since init
+    uint32_t last_us;       // Latest sample time the countdowns refer to
+    uint16_t min_us;        // Window bounds
+    uint16_t max_us;
+    uint16_t margin_us;     // Window above the bounce estimate
+    uint16_t remain[32];    // Lockout time left per key after last_us, valid while locked
+    uint16_t bounce_us[32]; // Bounce estimate per key
+    uint32_t accepted_us[32];   // Time of the key's last accepted edge, valid while measured
+} AdaptiveDebounce;
+
+// Sample-count state: one 6-bit counter per key, stored as bit-planes like
+// the vertical counter. A key's counter runs while its raw level differs
+// from the debounced one, the key flips once it reaches the press or
+// release count. No time source involved, 32 bytes for 32 keys.
+#define SAMPLE_DEBOUNCE_BITS 6
+#define SAMPLE_DEBOUNCE_MAX  ((1u << SAMPLE_DEBOUNCE_BITS) - 1u)
+
+typedef struct {
+    uint32_t state;                         // Debounced key word
+    uint32_t count[SAMPLE_DEBOUNCE_BITS];   // Counter bit n of every key
+    uint8_t  press_samples;                 // Samples a press must hold, 1..SAMPLE_DEBOUNCE_MAX
+    uint8_t  release_samples;               // Samples a release must hold, 1..SAMPLE_DEBOUNCE_MAX
+} SampleDebounce;
+
+// Integrator state: one saturating 8-bit counter per key, four keys to a
+// word, so the Cortex-M4 SIMD instructions step four keys at once. Every
+// sample moves a counter one step towards the raw level, between 0
+// (pressed) and samples (released), and the key flips when its counter
+// reaches the far end: an edge needs that many more samples at the new
+// level than at the old one, a glitch only delays it. No time source
+// involved, 44 bytes for 32 keys.
+#define INTEGRATOR_DEBOUNCE_WORDS 8
+
+typedef struct {
+    uint32_t state;                             // Debounced key word
+    uint32_t moving;                            // Keys whose counter is off the end of their level
+    uint32_t count[INTEGRATOR_DEBOUNCE_WORDS];  // Byte n of word w = key 4w + n
+    uint8_t  samples;                           // Counter range, 1..255
+} IntegratorDebounce;
+
+// Function prototypes
+void VerticalCounterInit(VerticalCounter *vc, uint32_t initial);
+uint32_t VerticalCounterUpdate(VerticalCounter *vc, uint32_t raw);
+void LockoutDebounceInit(LockoutDebounce *ld, uint32_t initial, uint32_t lockout_us);
+uint32_t LockoutDebounceUpdate(LockoutDebounce *ld, uint32_t raw, uint32_t now);
+void AsymDebounceInit(AsymDebounce *ad, uint32_t initial, bool press_eager, uint32_t press_us,
+                      bool release_eager, uint32_t release_us);
+bool AsymDebounceSetProfile(AsymDebounce *ad, uint32_t index, uint32_t keys, bool press_eager,
+                            uint32_t press_us, bool release_eager, uint32_t release_us);
+uint32_t AsymDebounceUpdate(AsymDebounce *ad, uint32_t raw, uint32_t now);
+void AdaptiveDebounceInit(AdaptiveDebounce *ad, uint32_t initial, uint32_t start_us, uint32_t min_us,
+                          uint32_t max_us, uint32_t margin_us);
+uint32_t AdaptiveDebounceUpdate(AdaptiveDebounce *ad, uint32_t raw, uint32_t now);
+uint32_t AdaptiveDebounceWindow(const AdaptiveDebounce *ad, uint32_t key);
+void SampleDebounceInit(SampleDebounce *sd, uint32_t initial, uint32_t press_samples, uint32_t release_samples);
+uint32_t SampleDebounceUpdate(SampleDebounce *sd, uint32_t raw);
+void IntegratorDebounceInit(IntegratorDebounce *id, uint32_t initial, uint32_t samples);
+uint32_t IntegratorDebounceUpdate(IntegratorDebounce *id, uint32_t raw);
+
+/**
+ * Get the keys whose raw level is not accepted yet or whose counter runs
+ */
+static inline uint32_t VerticalCounterActive(const VerticalCounter *vc, uint32_t raw)
+{
+    return (raw ^ vc->state) | ~(vc->cnt0 & vc->cnt1);
+}
+
+/**
+ * Get the keys whose raw level is not accepted yet or whose lockout runs
+ */
+static inline uint32_t LockoutDebounceActive(const LockoutDebounce *ld, uint32_t raw)
+{
+    return (raw ^ ld->state) | ld->locked;
+}
+
+/**
+ * Get the keys whose raw level is not accepted yet or whose window runs
+ */
+static inline uint32_t AsymDebounceActive(const AsymDebounce *ad, uint32_t raw)
+{
+    return (raw ^ ad->state) | ad->locked | ad->pending;
+}
+
+/**
+ * Get the keys whose raw level is not accepted yet or whose lockout runs
+ */
+static inline uint32_t AdaptiveDebounceActive(const AdaptiveDebounce *ad, uint32_t raw)
+{
+    return (raw ^ ad->state) | ad->locked;
+}
+
+/**
+ * Get the keys whose raw level is not accepted yet or whose counter runs
+ */
+static inline uint32_t SampleDebounceActive(const SampleDebounce *sd, uint32_t raw)
+{
+    uint32_t counting = 0;
+
+    for (uint32_t i = 0; i < SAMPLE_DEBOUNCE_BITS; i++) {
+        counting |= sd->count[i];
+    }
+    return (raw ^ sd->state) | counting;
+}
+
+/**
+ * Get the keys whose raw level is not accepted yet or whose counter is off
+ * the end of its level
+ */
+static inline uint32_t IntegratorDebounceActive(const IntegratorDebounce *id, uint32_t raw)
+{
+    return (raw ^ id->state) | id->moving;
+}
+
+/**
+ * Check whether every key is stable, raw level accepted and no lockout running
+ */
+static inline bool LockoutDebounceSettled(const LockoutDebounce *ld, uint32_t raw)
+{
+    return LockoutDebounceActive(ld, raw) == 0;
+}
+
+/**
+ * Check whether every key is stable, raw level accepted and no window running
+ */
+static inline bool AsymDebounceSettled(const AsymDebounce *ad, uint32_t raw)
+{
+    return AsymDebounceActive(ad, raw) == 0;
+}
+
+/**
+ * Check whether every key is stable, raw level accepted and no lockout running
+ */
+static inline bool AdaptiveDebounceSettled(const AdaptiveDebounce *ad, uint32_t raw)
+{
+    return AdaptiveDebounceActive(ad, raw) == 0;
+}
+
+#endif /* DEBOUNCE_H */
@@ -0,0 +1,154 @@
+/**
+ * @file debounce_bench.h
+ * @brief Side-by-side benchmark of the debounce engines over key traces.
+ *
+ * Every engine of debounce.h runs over the same trace of raw key words,
+ * with the settings the firmware would give it. A trace is a list of
+ * DebounceBenchSample, the RawSample layout of raw_capture.h, so a dump
+ * of RIGHT_KEYBOARD_REG_CAPTURE can be replayed as it is. Synthetic
+ * traces come from a seeded generator:
+ *   DEBOUNCE_BENCH_CLEAN    taps without bounce, the latency floor
+ *   DEBOUNCE_BENCH_BOUNCE   every edge bounces for up to 2 ms
+ *   DEBOUNCE_BENCH_CHATTER  worn switches: bounce up to 6 ms, past a 5 ms
+ *                           lockout, and short dropouts while held
+ *   DEBOUNCE_BENCH_ROLL     fast rolls, short holds and gaps on every key
+ *
+ * The reference is the trace itself, looked at afterwards: a key changed
+ * when its raw level moved and then held for settle_us, at the time of the
+ * first raw edge of that burst. Shorter excursions are noise. Per engine:
+ *   - clock ticks per update (mean and worst), less the cost of reading
+ *     the clock, and the bytes of engine state,
+ *   - press and release latency from the reference edge to the engine's
+ *     edge, as min/mean/max and a histogram of DEBOUNCE_BENCH_BUCKET_US
+ *     buckets (the last one collects everything above),
+ *   - missed changes (no engine edge within match_us) and phantom edges
+ *     (an engine edge with no reference change to match).
+ *
+ * Nothing here touches the HAL. On the host the debounce_bench target of
+ * Host/CMakeLists.txt builds it with DEBOUNCE_BENCH_HOST=1, and
+ *   debounce_bench [capture.bin ...]
+ * runs the synthetic traces and every dump given, ticks = nanoseconds. It
+ * fails if an engine that waits for the new level to hold misses or
+ * invents a change on the clean or bounce trace.
+ * On the device DEBOUNCE_BENCH=1 runs one trace per scheduler slot, the
+ * synthetic ones after boot and every RAW_CAPTURE once it froze, ticks =
+ * DWT cycles; the results sit in debounce_bench_results for the debugger.
+ */
+
+#ifndef DEBOUNCE_BENCH_H
+#define DEBOUNCE_BENCH_H
+
+#include "debounce.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Run the engine benchmark on the device (0 = compiled out)
+#ifndef DEBOUNCE_BENCH
+#define DEBOUNCE_BENCH 0
+#endif
+
+// Host build with a main() instead of the firmware glue
+#ifndef DEBOUNCE_BENCH_HOST
+#define DEBOUNCE_BENCH_HOST 0
+#endif
+
+// Samples per synthetic trace, 8 bytes each
+#ifndef DEBOUNCE_BENCH_SAMPLES
+#define DEBOUNCE_BENCH_SAMPLES 2048u
+#endif
+
+// Sample period of the synthetic traces in microseconds
+#ifndef DEBOUNCE_BENCH_PERIOD_US
+#define DEBOUNCE_BENCH_PERIOD_US 1000u
+#endif
+
+// Keys the synthetic traces move, keys 0..n-1
+#ifndef DEBOUNCE_BENCH_KEYS
+#define DEBOUNCE_BENCH_KEYS 4u
+#endif
+
+// Reference changes kept per trace
+#ifndef DEBOUNCE_BENCH_CHANGES
+#define DEBOUNCE_BENCH_CHANGES 256u
+#endif
+
+// Latency histogram
+#ifndef DEBOUNCE_BENCH_BUCKETS
+#define DEBOUNCE_BENCH_BUCKETS 16u
+#endif
+
+#ifndef DEBOUNCE_BENCH_BUCKET_US
+#define DEBOUNCE_BENCH_BUCKET_US 1000u
+#endif
+
+#if DEBOUNCE_BENCH_KEYS < 1 || DEBOUNCE_BENCH_KEYS > 32
+#error "DEBOUNCE_BENCH_KEYS must be 1 to 32"
+#endif
+
+// Engines, in the order of DEBOUNCE_ALGORITHM (right_side_keyboard.h)
+#define DEBOUNCE_BENCH_ENGINES 6u
+
+// Synthetic trace kinds, see above
+#define DEBOUNCE_BENCH_CLEAN       0u
+#define DEBOUNCE_BENCH_BOUNCE      1u
+#define DEBOUNCE_BENCH_CHATTER     2u
+#define DEBOUNCE_BENCH_ROLL        3u
+#define DEBOUNCE_BENCH_SYNTH_KINDS 4u
+
+// One raw key word, same layout as RawSample
+typedef struct __attribute__((packed)) {
+    uint32_t time_us;
+    uint32_t keys;              // Bit n = key n, 1 = released
+} DebounceBenchSample;
+
+// Engine settings, DebounceBenchDefaults() or the firmware's
+typedef struct {
+    uint32_t lockout_us;        // Lockout engine, adaptive start
+    bool     press_eager;       // Asymmetric engine
+    bool     release_eager;
+    uint32_t press_us;
+    uint32_t release_us;
+    uint32_t adaptive_min_us;   // Adaptive engine bounds
+    uint32_t adaptive_max_us;
+    uint32_t adaptive_margin_us;
+    uint8_t  press_samples;     // Sample-count engine, 0 = press_us/release_us
+    uint8_t  release_samples;   // over the trace's mean sample period
+    uint8_t  integrator_samples;    // Integrator engine, 0 = lockout_us over that period
+    uint32_t settle_us;         // Reference: hold time of a real change
+    uint32_t match_us;          // Latest engine edge that still matches
+} DebounceBenchConfig;
+
+typedef struct {
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint32_t sum_us;
+    uint16_t histogram[DEBOUNCE_BENCH_BUCKETS];
+} DebounceBenchLatency;
+
+// Result of one engine over one trace
+typedef struct {
+    uint8_t  engine;            // DEBOUNCE_ALGORITHM value
+    uint16_t state_bytes;       // sizeof the engine state
+    uint32_t samples;
+    uint32_t ticks_mean;        // Clock ticks per update
+    uint32_t ticks_max;
+    uint32_t changes;           // Reference changes in the trace
+    uint32_t missed;
+    uint32_t phantom;
+    DebounceBenchLatency press;
+    DebounceBenchLatency release;
+} DebounceBenchResult;
+
+// Free-running clock the updates are timed with
+typedef uint32_t (*DebounceBenchClock)(void);
+
+// Function prototypes
+void DebounceBenchDefaults(DebounceBenchConfig *config);
+uint32_t DebounceBenchSynth(DebounceBenchSample *trace, uint32_t max, uint32_t kind,
+                            uint32_t period_us, uint32_t seed);
+void DebounceBenchRun(const DebounceBenchSample *trace, uint32_t count, const DebounceBenchConfig *config,
+                      DebounceBenchClock clock, DebounceBenchResult results[DEBOUNCE_BENCH_ENGINES]);
+void DebounceBenchService(void);
+
+#endif /* DEBOUNCE_BENCH_H */
@@ -0,0 +1,40 @@
+/**
+ * @file deep_idle.h
+ * @brief STOP mode after a long idle period, woken by keys or the I2C bus.
+ *
+ * After DEEP_IDLE_AFTER_MS without key changes or I2C transfers the core
+ * enters STOP with the low-power regulator. It wakes on:
+ *   - an edge on any key that owns its EXTI line (SCAN_MODE_EXTI setup),
+ *   - SDA falling on PB7 (the START of any master transfer), borrowed from
+ *     key PA7 for the duration of STOP,
+ *   - the RTC wakeup timer every DEEP_IDLE_POLL_MS, which samples the keys
+ *     without an EXTI line of their own and goes straight back to sleep
+ *     while nothing moved.
+ *
+ * When the host suspends, the master writes RIGHT_KEYBOARD_POWER_STOP to
+ * the power register and STOP follows after DEEP_IDLE_GRACE_MS instead of
+ * the full idle period, until a key press resumes.
+ *
+ * I2C1 is not clocked in STOP, so the transfer that wakes us is NACKed and
+ * the master has to retry; the first retry after the clocks are back is
+ * served normally.
+ *
+ * Wake to first valid report: STOP exit on HSI (~15 us with the low-power
+ * regulator), PLL relock for the PLL clock profiles (~100-200 us), then one
+ * main loop scan. The first two are measured with the DWT cycle counter and
+ * published as deep_idle_wake_us in RightKeyboardCounters.
+ */
+
+#ifndef DEEP_IDLE_H
+#define DEEP_IDLE_H
+
+#include "stm32f4xx_hal.h"
+#include <stdbool.h>
+
+// Function prototypes
+bool DeepIdleInit(void);
+void DeepIdleService(uint32_t activity);
+void DeepIdleStats(uint32_t *entries, uint32_t *wake_us);
+void DeepIdleRtcIRQHandler(void);
+
+#endif /* DEEP_IDLE_H */
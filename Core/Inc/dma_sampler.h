@@ -0,0 +1,69 @@
+/**
+ * @file dma_sampler.h
+ * @brief Timer-triggered DMA sampling of the key ports.
+ *
+ * TIM1 paces DMA2 so that GPIOA->IDR and GPIOB->IDR are copied into a RAM
+ * ring at a fixed rate without CPU involvement. The CPU only runs on the
+ * half/full-transfer interrupts and debounces one half of the ring at a time.
+ *
+ * With KEY_WIRING_MATRIX the TIM1 update stream writes the column strobes
+ * to MATRIX_COL_PORT->BSRR instead, and the compare stream captures the
+ * rows half a period later. Each sample is one column, MATRIX_COLS samples
+ * make a frame and every ring half holds whole frames.
+ */
+
+#ifndef DMA_SAMPLER_H
+#define DMA_SAMPLER_H
+
+#include "stm32f4xx_hal.h"
+#include "right_side_keyboard.h"
+#include <stdbool.h>
+
+// Sampling rate in Hz (1 kHz - 8 kHz), one column per sample with a matrix
+#ifndef DMA_SAMPLE_RATE_HZ
+#if KEY_WIRING == KEY_WIRING_MATRIX
+#define DMA_SAMPLE_RATE_HZ 8000
+#else
+#define DMA_SAMPLE_RATE_HZ 4000
+#endif
+#endif
+
+// Number of samples per port in the ring, must be even (two halves)
+#ifndef DMA_SAMPLE_RING_LEN
+#if KEY_WIRING == KEY_WIRING_MATRIX
+#define DMA_SAMPLE_RING_LEN (4 * MATRIX_COLS)
+#else
+#define DMA_SAMPLE_RING_LEN 16
+#endif
+#endif
+
+// Time between two samples in microseconds
+#define DMA_SAMPLE_PERIOD_US (1000000u / DMA_SAMPLE_RATE_HZ)
+
+#if DMA_SAMPLE_RATE_HZ < 1000 || DMA_SAMPLE_RATE_HZ > 8000
+#error "DMA_SAMPLE_RATE_HZ must be between 1000 and 8000"
+#endif
+
+#if (DMA_SAMPLE_RING_LEN % 2) != 0
+#error "DMA_SAMPLE_RING_LEN must be even"
+#endif
+
+#if KEY_WIRING == KEY_WIRING_MATRIX
+// Time between two complete matrix frames in microseconds
+#define DMA_MATRIX_FRAME_US (MATRIX_COLS * DMA_SAMPLE_PERIOD_US)
+
+#if (DMA_SAMPLE_RING_LEN % (2 * MATRIX_COLS)) != 0
+#error "DMA_SAMPLE_RING_LEN must hold whole matrix frames in each half"
+#endif
+#endif
+
+// DMA handles, serviced from stm32f4xx_it.c
+extern DMA_HandleTypeDef hdma_tim1_up;
+extern DMA_HandleTypeDef hdma_tim1_ch1;
+
+// Function prototypes
+bool DmaSamplerInit(void);
+bool DmaSamplerStart(void);
+void DmaSamplerStop(void);
+
+#endif /* DMA_SAMPLER_H */
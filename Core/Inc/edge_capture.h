@@ -0,0 +1,87 @@
+/**
+ * @file edge_capture.h
+ * @brief Hardware edge timestamps for latency-critical keys on TIM5.
+ *
+ * The keys wired to PA1-PA3 can be taken off the sampled path and onto
+ * TIM5 CH2-CH4 (AF2) in input capture mode on both edges. TIM5 is the
+ * microsecond time base (timebase.h), so a captured CCRx is already in the
+ * time domain of every other KeyEvent timestamp and of TimebaseNowUs(),
+ * no conversion and no second timer.
+ *
+ * Per key, in the TIM5 interrupt:
+ *   - the first edge after a quiet EDGE_CAPTURE_LOCKOUT_US flips the key
+ *     at once and keeps the captured count as its edge time,
+ *   - edges inside the lockout only move the time of the last edge,
+ *   - then a scan is requested, so the event is queued on the next pass
+ *     through the main loop instead of the next scan period.
+ * The scan takes these keys from EdgeCaptureUpdate() instead of its
+ * debounce, and queues their events with the captured time. Once a key's
+ * lockout is over the scan checks its pin: a level that differs from the
+ * state (the release edge fell inside the lockout of a short tap) flips it
+ * with the time of the last captured edge. Lockout and a pending check
+ * keep the scan unsettled, so EXTI bursts and adaptive polling carry on
+ * until the check ran.
+ *
+ * The input filter rejects glitches of a few timer clocks; bounce is left
+ * to the lockout. TIM5 stops in STOP mode: the edge that wakes the core
+ * from DEEP_IDLE_ENABLE is not captured and is picked up by the check with
+ * the wake-up time instead.
+ */
+
+#ifndef EDGE_CAPTURE_H
+#define EDGE_CAPTURE_H
+
+#include "right_side_keyboard.h"
+#include "keyboard_layout.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Timestamp keys with TIM5 input capture (0 = compiled out)
+#ifndef EDGE_CAPTURE_ENABLE
+#define EDGE_CAPTURE_ENABLE 0
+#endif
+
+// Captured pins on port A, any of PA1 (CH2), PA2 (CH3) and PA3 (CH4)
+#ifndef EDGE_CAPTURE_PINS
+#define EDGE_CAPTURE_PINS 0x000Eu
+#endif
+
+// Quiet time before the next edge of a key counts, in microseconds
+#ifndef EDGE_CAPTURE_LOCKOUT_US
+#define EDGE_CAPTURE_LOCKOUT_US (DEBOUNCE_TIME_MS * 1000u)
+#endif
+
+// TIM5 ICxF input filter, 0-15 (2 = fCK_INT, 4 samples)
+#ifndef EDGE_CAPTURE_FILTER
+#define EDGE_CAPTURE_FILTER 2
+#endif
+
+#if EDGE_CAPTURE_ENABLE
+#if KEY_WIRING != KEY_WIRING_DIRECT
+#error "EDGE_CAPTURE_ENABLE needs direct-wired keys on PA1-PA3"
+#endif
+
+#if (EDGE_CAPTURE_PINS & ~0x000Eu) != 0 || EDGE_CAPTURE_PINS == 0
+#error "EDGE_CAPTURE_PINS must pick from PA1, PA2 and PA3 (TIM5 CH2-CH4)"
+#endif
+
+#if EDGE_CAPTURE_FILTER > 15
+#error "EDGE_CAPTURE_FILTER must be 0 to 15"
+#endif
+
+_Static_assert((KEY_MASK_A & EDGE_CAPTURE_PINS) == EDGE_CAPTURE_PINS,
+               "EDGE_CAPTURE_PINS lists a pin without a key in KEY_MAP");
+
+// Key word bits of the captured keys
+#define EDGE_CAPTURE_KEYS KEY_GATHER(EDGE_CAPTURE_PINS, 0u)
+#else
+#define EDGE_CAPTURE_KEYS 0u
+#endif
+
+// Function prototypes
+void EdgeCaptureInit(uint32_t raw_keys);
+uint32_t EdgeCaptureUpdate(uint32_t raw_keys, uint32_t now, bool *settled);
+uint32_t EdgeCaptureTime(uint32_t key);
+void EdgeCaptureIRQHandler(void);
+
+#endif /* EDGE_CAPTURE_H */
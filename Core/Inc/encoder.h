@@ -0,0 +1,75 @@
+/**
+ * @file encoder.h
+ * @brief Rotary encoder decoded by TIM2 in quadrature encoder mode.
+ *
+ * The A and B outputs go to TIM2 CH1 on PA15 and CH2 on PB3 (AF1, pull-up,
+ * common pin to ground). Encoder mode 3 counts every edge of both inputs
+ * up or down in the 32-bit counter, behind the input filter, so no step
+ * costs an interrupt or depends on the scan rate.
+ *
+ * The firmware only reads the counter:
+ *   - RIGHT_KEYBOARD_REG_ENCODER returns the position, so a lost or
+ *     repeated read costs nothing; the master takes the difference,
+ *   - with an event report the scan queues the whole detents turned since
+ *     the last one as one KeyEvent with key KEY_EVENT_ENCODER and the
+ *     signed count in pressed (at most +-127 per event).
+ *
+ * TIM2 stops in STOP mode: turns during DEEP_IDLE_ENABLE's STOP are lost
+ * and do not wake the core.
+ */
+
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include "right_side_keyboard.h"
+#include "trace.h"
+#include <stdint.h>
+
+// Rotary encoder on TIM2 (0 = compiled out)
+#ifndef ENCODER_ENABLE
+#define ENCODER_ENABLE 0
+#endif
+
+// Counts per detent, 4 for the usual full-cycle-per-click encoders
+#ifndef ENCODER_STEPS_PER_DETENT
+#define ENCODER_STEPS_PER_DETENT 4
+#endif
+
+// TIM2 IC1F/IC2F input filter, 0-15 (10 = fDTS / 16, 8 samples)
+#ifndef ENCODER_FILTER
+#define ENCODER_FILTER 10
+#endif
+
+// Count the other way round (1 = swap clockwise and counter-clockwise)
+#ifndef ENCODER_REVERSE
+#define ENCODER_REVERSE 0
+#endif
+
+#if ENCODER_STEPS_PER_DETENT < 1 || ENCODER_FILTER > 15
+#error "ENCODER_STEPS_PER_DETENT must be at least 1, ENCODER_FILTER 0 to 15"
+#endif
+
+#if ENCODER_ENABLE && LINK_TRANSPORT == LINK_TRANSPORT_SPI
+#error "ENCODER_ENABLE uses PA15, the SPI link's NSS"
+#endif
+
+#if ENCODER_ENABLE && TRACE_ITM
+#error "ENCODER_ENABLE uses PB3, the SWO pin of TRACE_ITM"
+#endif
+
+#if ENCODER_ENABLE && SCAN_MODE == SCAN_MODE_EXTI && REPORT_RECORDS_EVENTS
+#error "SCAN_MODE_EXTI only scans on key edges, encoder events would wait for a key"
+#endif
+
+// Encoder register, little endian
+typedef struct __attribute__((packed)) {
+    int32_t steps;              // Counter, every edge of A and B
+    int32_t detents;            // steps / ENCODER_STEPS_PER_DETENT
+} EncoderPosition;
+
+// Function prototypes
+void EncoderInit(void);
+int32_t EncoderTake(void);
+void EncoderSnapshot(EncoderPosition *position);
+
+#endif /* ENCODER_H */
@@ -0,0 +1,76 @@
+/**
+ * @file event_pack.h
+ * @brief Compact variable-length key event encoding (REPORT_TYPE_PACKED).
+ *
+ * A KeyEvent is 6 bytes on the wire, most of it a timestamp the master
+ * already nearly knows. A packed frame is a status byte, then the events,
+ * oldest first:
+ *
+ *   status  bit 7 EVENT_PACK_ABSOLUTE, bit 6 EVENT_PACK_BACKLOG (queue past
+ *           its high water, key_events.h), bits 5..0 event count
+ *   key     bit 7 = pressed, bits 6..0 key index; EVENT_PACK_KEY_ENCODER
+ *           is followed by one int8_t byte of detents, EVENT_PACK_KEY_RESYNC
+ *           by the events lost and the 4 bytes of held keys (little endian)
+ *           and no time; the record is the last of its frame and the next
+ *           frame is absolute
+ *   time    ticks since the previous event as a varint: 7 bits per byte,
+ *           least significant first, bit 7 set while more bytes follow
+ *
+ * A tick is 2^EVENT_PACK_TICK_SHIFT microseconds of the event timestamp,
+ * counted modulo 2^EVENT_PACK_TICK_BITS. Deltas are taken between the
+ * ticks of the absolute timestamps, so rounding never adds up over a
+ * stream. The defaults put an event within 32 ms of the previous one into
+ * 2 bytes, so a whole roll fits in one short transfer.
+ *
+ * The first delta of a frame refers to the last event dequeued before it.
+ * With EVENT_PACK_ABSOLUTE set the first event carries its full tick count
+ * instead: after boot, after events were taken through another register,
+ * and after the master wrote a byte behind the register pointer to resync.
+ */
+
+#ifndef EVENT_PACK_H
+#define EVENT_PACK_H
+
+#include "key_events.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Timestamp resolution of packed events, 2^n microseconds
+#ifndef EVENT_PACK_TICK_SHIFT
+#define EVENT_PACK_TICK_SHIFT 8
+#endif
+
+#if EVENT_PACK_TICK_SHIFT < 0 || EVENT_PACK_TICK_SHIFT > 16
+#error "EVENT_PACK_TICK_SHIFT must be 0 to 16"
+#endif
+
+// Width of a tick count, deltas wrap with it
+#define EVENT_PACK_TICK_BITS (32 - EVENT_PACK_TICK_SHIFT)
+#define EVENT_PACK_TICK_MASK (0xFFFFFFFFu >> EVENT_PACK_TICK_SHIFT)
+
+#define EVENT_PACK_ABSOLUTE    0x80   // Status: first time is a full tick count
+#define EVENT_PACK_BACKLOG     0x40   // Status: KeyEventBacklog()
+#define EVENT_PACK_COUNT_MASK  0x3F
+#define EVENT_PACK_PRESSED     0x80   // Key byte: press
+#define EVENT_PACK_KEY_MASK    0x7F
+#define EVENT_PACK_KEY_ENCODER (KEY_EVENT_ENCODER & EVENT_PACK_KEY_MASK)
+#define EVENT_PACK_KEY_RESYNC  (KEY_EVENT_RESYNC & EVENT_PACK_KEY_MASK)
+
+// Longest packed event: key, detents, varint of a full tick count, or the
+// 6 bytes of a resync record
+#define EVENT_PACK_TIMED_MAX (2u + (EVENT_PACK_TICK_BITS + 6u) / 7u)
+#define EVENT_PACK_EVENT_MAX (EVENT_PACK_TIMED_MAX > 6u ? EVENT_PACK_TIMED_MAX : 6u)
+
+/**
+ * Tick count of a timestamp
+ */
+static inline uint32_t EventPackTick(uint32_t timestamp)
+{
+    return timestamp >> EVENT_PACK_TICK_SHIFT;
+}
+
+// Function prototypes
+uint32_t EventPackEncode(const KeyEvent *events, uint32_t count, uint32_t base, bool absolute,
+                         uint8_t *frame, uint8_t *ends);
+
+#endif /* EVENT_PACK_H */
@@ -0,0 +1,105 @@
+/**
+ * @file fw_update.h
+ * @brief Firmware update streamed by the master over the split link.
+ *
+ * The master starts an update with a write to RIGHT_KEYBOARD_REG_UPDATE:
+ *
+ *   FW_UPDATE_CMD_ENTER, FW_UPDATE_MAGIC, image length, image CRC-32
+ *   (all 32-bit little endian, length a multiple of 4)
+ *
+ * The main loop then leaves normal operation for good: interrupts are
+ * masked and a polled loop in SRAM takes over the link peripheral, so it
+ * keeps running while flash is busy. From here on every write still starts
+ * with the register byte, followed by a command:
+ *
+ *   FW_UPDATE_CMD_DATA, offset, up to FW_UPDATE_CHUNK bytes (multiple of 4)
+ *   FW_UPDATE_CMD_FINISH
+ *   FW_UPDATE_CMD_ABORT    reset without verifying
+ *
+ * and every read returns FwUpdateStatus. Chunks must arrive in order; one
+ * at another offset than FwUpdateStatus.accepted, or while both page
+ * buffers are still being programmed, is dropped, so the master reads the
+ * status after each chunk and resends from there.
+ *
+ * Reception and flash run side by side: chunks fill one FW_UPDATE_PAGE
+ * buffer while the other is programmed word by word, and whenever flash
+ * has nothing to program the next sector of the image is erased ahead.
+ * FINISH checks the CRC-32 (zlib) of the image in flash. The first word
+ * (initial stack pointer) is held back until then, so a bootloader that
+ * checks it never starts a torn image; on a match it is programmed and
+ * the core resets into the new firmware, otherwise the status reports
+ * FW_UPDATE_FAILED and the master can start over with ENTER.
+ *
+ * Over I2C the link speed bounds an update (368 KB in about 10 s at
+ * 400 kHz); the UART link framing (link.h) is kept, with requests up to
+ * 255 bytes in update mode. The SPI link is not supported.
+ */
+
+#ifndef FW_UPDATE_H
+#define FW_UPDATE_H
+
+#include "right_side_keyboard.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Accept firmware updates over the link (0 = compiled out)
+#ifndef FW_UPDATE_ENABLE
+#define FW_UPDATE_ENABLE 0
+#endif
+
+#if FW_UPDATE_ENABLE && LINK_TRANSPORT == LINK_TRANSPORT_SPI
+#error "FW_UPDATE_ENABLE supports the I2C and UART links only"
+#endif
+
+// Application area, from the vector table to the config store sector
+#define FW_UPDATE_BASE 0x08004000u
+#define FW_UPDATE_MAX  (368u * 1024u)
+
+// Page buffer size, two of them in SRAM
+#ifndef FW_UPDATE_PAGE
+#define FW_UPDATE_PAGE 1024u
+#endif
+
+// Largest chunk in one write
+#ifndef FW_UPDATE_CHUNK
+#define FW_UPDATE_CHUNK 128u
+#endif
+
+#if FW_UPDATE_PAGE % FW_UPDATE_CHUNK != 0 || FW_UPDATE_CHUNK % 4 != 0 || FW_UPDATE_CHUNK > 240
+#error "FW_UPDATE_CHUNK must be a multiple of 4 up to 240 that divides FW_UPDATE_PAGE"
+#endif
+
+#define FW_UPDATE_MAGIC 0x5055594Eu     // "NYUP"
+
+#define FW_UPDATE_CMD_ENTER  0x01
+#define FW_UPDATE_CMD_DATA   0x02
+#define FW_UPDATE_CMD_FINISH 0x03
+#define FW_UPDATE_CMD_ABORT  0x04
+
+typedef enum {
+    FW_UPDATE_IDLE,                     // Normal operation
+    FW_UPDATE_RECEIVING,
+    FW_UPDATE_VERIFYING,
+    FW_UPDATE_FAILED
+} FwUpdateState;
+
+// Why an update failed
+#define FW_UPDATE_ERROR_NONE  0x00
+#define FW_UPDATE_ERROR_FLASH 0x01      // Erase or program error in FLASH_SR
+#define FW_UPDATE_ERROR_CRC   0x02      // Image in flash does not match
+#define FW_UPDATE_ERROR_SHORT 0x03      // FINISH before the whole image arrived
+
+// Update status, little endian
+typedef struct __attribute__((packed)) {
+    uint8_t  state;                     // FwUpdateState
+    uint8_t  error;                     // FW_UPDATE_ERROR_*
+    uint32_t accepted;                  // Offset of the next chunk
+    uint32_t written;                   // Bytes programmed so far
+} FwUpdateStatus;
+
+// Function prototypes
+bool FwUpdateRequest(const uint8_t *data, uint32_t len);
+void FwUpdateService(void);
+void FwUpdateSnapshot(FwUpdateStatus *status);
+
+#endif /* FW_UPDATE_H */
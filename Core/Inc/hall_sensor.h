@@ -0,0 +1,176 @@
+/**
+ * @file hall_sensor.h
+ * @brief Analog Hall-effect key sensing for KEY_WIRING_HALL.
+ *
+ * Every key is a linear Hall sensor whose output moves with the magnet in
+ * the switch. HALL_CHANNELS ADC1 inputs each sit behind a HALL_MUX_WAYS:1
+ * analog mux (74HC4051 style, 1 = no mux) whose select lines are
+ * consecutive pins of HALL_MUX_PORT.
+ *
+ * TIM3 paces the sampling, the CPU never touches a sample on its way in:
+ *   - update event: DMA1 stream 2 (channel 5) writes the next mux select
+ *     to HALL_MUX_PORT->BSRR,
+ *   - CC1, half a period later: triggers one ADC1 scan sequence over the
+ *     channels once the mux output settled,
+ *   - DMA2 stream 4 (channel 0) moves the conversions into a ring of
+ *     frames, one frame = every mux way of every channel.
+ * Only the half/full-transfer interrupt of stream 4 runs, every
+ * HALL_RING_FRAMES / 2 frames, and turns each frame into a key word for
+ * the same debounce, event and report pipeline as the digital wiring.
+ *
+ * Key index = way * HALL_CHANNELS + channel, the order of a frame.
+ *
+ * Per key, in fixed point:
+ *   - rest level: the first frame, then it follows the released key
+ *     slowly (temperature drift) and jumps to any reading on the far side
+ *     of it, so a key held at power-up recovers on its first release,
+ *   - bottom-out: the largest deflection seen, at least HALL_MIN_TRAVEL
+ *     counts; a Q16 reciprocal is recomputed only when it grows,
+ *   - travel: deflection / bottom-out as Q8 (255 = bottomed out),
+ *   - pressed at the actuation point, released below the release point.
+ *
+ * With HALL_RAPID_TRIGGER a key that has been pressed once stays in the
+ * rapid-trigger zone until it falls below its release point. In there it
+ * releases as soon as it rose past its highest travel and came back by the
+ * release delta, and presses again as soon as it went past its lowest
+ * travel and came back down by the press delta, wherever that happens. A
+ * tap that only lifts the key a little re-presses within one frame, which
+ * is why DEBOUNCE_TIME_MS defaults to 0 with it. Deltas of 0 keep a key on
+ * the fixed points.
+ *
+ * RIGHT_KEYBOARD_REG_HALL reads the calibration and takes per-key points:
+ * [key, actuation, release] and optionally [press delta, release delta].
+ *
+ * Conversions have to fit half a mux step: HALL_CHANNELS x (56 + 12) ADC
+ * clocks at PCLK2 / 4.
+ */
+
+#ifndef HALL_SENSOR_H
+#define HALL_SENSOR_H
+
+#include "stm32f4xx_hal.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define HALL_PORT_ID_A 0
+#define HALL_PORT_ID_B 1
+
+// ADC inputs, X(channel index, ADC channel, port letter, pin number)
+#ifndef HALL_CHANNEL_MAP
+#define HALL_CHANNEL_MAP(X) \
+    X(0, 0, A, 0) X(1, 1, A, 1) X(2, 2, A, 2)
+#endif
+
+// Mux ways per input (1, 2, 4 or 8) and its select lines
+#ifndef HALL_MUX_WAYS
+#define HALL_MUX_WAYS 8
+#endif
+
+#ifndef HALL_MUX_PORT
+#define HALL_MUX_PORT      GPIOB
+#define HALL_MUX_FIRST_PIN 12
+#endif
+
+// Mux steps per second, one frame takes HALL_MUX_WAYS steps
+#ifndef HALL_STEP_RATE_HZ
+#define HALL_STEP_RATE_HZ 32000
+#endif
+
+// Frames in the DMA ring, two halves
+#ifndef HALL_RING_FRAMES
+#define HALL_RING_FRAMES 8
+#endif
+
+// Sensor output rises (1) or falls (0) as the magnet comes closer
+#ifndef HALL_POLARITY_RISING
+#define HALL_POLARITY_RISING 1
+#endif
+
+// Default actuation and release points, Q8 of the full travel
+#ifndef HALL_ACTUATION_Q8
+#define HALL_ACTUATION_Q8 77
+#endif
+
+#ifndef HALL_RELEASE_Q8
+#define HALL_RELEASE_Q8 51
+#endif
+
+// Rapid trigger, see above (0 = compiled out)
+#ifndef HALL_RAPID_TRIGGER
+#define HALL_RAPID_TRIGGER 0
+#endif
+
+// Default travel deltas in the rapid-trigger zone, Q8 of the full travel
+#ifndef HALL_RT_PRESS_Q8
+#define HALL_RT_PRESS_Q8 26
+#endif
+
+#ifndef HALL_RT_RELEASE_Q8
+#define HALL_RT_RELEASE_Q8 26
+#endif
+
+// Smallest bottom-out deflection in ADC counts, so noise on a key that was
+// never pressed does not scale up to a full press
+#ifndef HALL_MIN_TRAVEL
+#define HALL_MIN_TRAVEL 200
+#endif
+
+// Rest level filter of a released key, 1/2^n of the error per frame
+#ifndef HALL_REST_SHIFT
+#define HALL_REST_SHIFT 8
+#endif
+
+#define HALL_CHANNEL_COUNT_TERM(idx, channel, port, pin) + 1
+#define HALL_CHANNELS (0 HALL_CHANNEL_MAP(HALL_CHANNEL_COUNT_TERM))
+#define HALL_KEYS     (HALL_CHANNELS * HALL_MUX_WAYS)
+
+// Pins the inputs use, per port
+#define HALL_PINS_A_TERM(idx, channel, port, pin) | (HALL_PORT_ID_##port == HALL_PORT_ID_A ? (1u << (pin)) : 0u)
+#define HALL_PINS_B_TERM(idx, channel, port, pin) | (HALL_PORT_ID_##port == HALL_PORT_ID_B ? (1u << (pin)) : 0u)
+#define HALL_PINS_A (0u HALL_CHANNEL_MAP(HALL_PINS_A_TERM))
+#define HALL_PINS_B (0u HALL_CHANNEL_MAP(HALL_PINS_B_TERM))
+
+// Time between two frames in microseconds
+#define HALL_FRAME_US ((HALL_MUX_WAYS * 1000000u) / HALL_STEP_RATE_HZ)
+
+#if HALL_MUX_WAYS != 1 && HALL_MUX_WAYS != 2 && HALL_MUX_WAYS != 4 && HALL_MUX_WAYS != 8
+#error "HALL_MUX_WAYS must be 1, 2, 4 or 8"
+#endif
+
+#if HALL_CHANNELS < 1 || HALL_CHANNELS > 16
+#error "HALL_CHANNEL_MAP must list 1 to 16 ADC inputs"
+#endif
+
+#if (HALL_RING_FRAMES % 2) != 0
+#error "HALL_RING_FRAMES must be even"
+#endif
+
+#if HALL_RELEASE_Q8 >= HALL_ACTUATION_Q8 || HALL_ACTUATION_Q8 > 255
+#error "HALL_RELEASE_Q8 must be below HALL_ACTUATION_Q8, at most 255"
+#endif
+
+#if HALL_RAPID_TRIGGER && (HALL_RT_PRESS_Q8 < 1 || HALL_RT_PRESS_Q8 > 255 || HALL_RT_RELEASE_Q8 < 1 || HALL_RT_RELEASE_Q8 > 255)
+#error "HALL_RT_PRESS_Q8 and HALL_RT_RELEASE_Q8 must be 1 to 255"
+#endif
+
+// Calibration of one key, little endian
+typedef struct __attribute__((packed)) {
+    uint16_t rest;              // ADC counts
+    uint16_t bottom;            // Largest deflection from rest, ADC counts
+    uint8_t  travel;            // Last reading, Q8 of bottom
+    uint8_t  actuation;         // Q8 press point
+    uint8_t  release;           // Q8 release point
+    uint8_t  rt_press;          // Q8 rapid-trigger press delta, 0 = off
+    uint8_t  rt_release;        // Q8 rapid-trigger release delta, 0 = off
+} HallKeyState;
+
+// Function prototypes
+bool HallInit(void);
+bool HallStart(void);
+uint32_t HallKeys(void);
+void HallSnapshot(HallKeyState *keys);
+bool HallSetPoints(uint8_t key, uint8_t actuation, uint8_t release);
+bool HallSetRapidTrigger(uint8_t key, uint8_t press, uint8_t release);
+void HallIRQHandler(void);
+
+#endif /* HALL_SENSOR_H */
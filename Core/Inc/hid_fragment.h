@@ -0,0 +1,88 @@
+/**
+ * @file hid_fragment.h
+ * @brief HID report fragment kept ready for the master to splice.
+ *
+ * With HID_FRAGMENT_ENABLE the right half keeps its part of the master's
+ * USB keyboard report up to date itself, so the master copies
+ * RIGHT_KEYBOARD_REG_HID into its report buffer instead of turning key bits
+ * into report entries every frame. The fragment follows the published report
+ * (so the rollover policy applies) and the codes the keymap resolved on
+ * press. It is edited per debounced change, only the keys that changed are
+ * touched.
+ *
+ * HID_FRAGMENT_BOOT: HID boot keyboard report (KeymapReport layout). A code
+ * keeps its slot while held and a new one takes the first free slot, so a
+ * release never moves the other codes. Once more codes are held than there
+ * are slots, every slot reads ErrorRollOver until enough are released.
+ *
+ * HID_FRAGMENT_NKRO: modifier byte, then a usage bitmap, usage n in bit
+ * n % 8 of byte n / 8, for usages below 8 * HID_FRAGMENT_NKRO_BYTES. The
+ * master ORs it into its own bitmap report.
+ *
+ * Two keys resolving to the same code show it once, until both are
+ * released.
+ */
+
+#ifndef HID_FRAGMENT_H
+#define HID_FRAGMENT_H
+
+#include "keymap.h"
+#include <stdint.h>
+
+// Keep the HID fragment up to date (0 = compiled out)
+#ifndef HID_FRAGMENT_ENABLE
+#define HID_FRAGMENT_ENABLE (REPORT_TYPE == REPORT_TYPE_HID || USB_HID_ENABLE)
+#endif
+
+#if HID_FRAGMENT_ENABLE && !KEYMAP_ENABLE
+#error "HID_FRAGMENT_ENABLE splices keymap codes and needs KEYMAP_ENABLE"
+#endif
+
+#if REPORT_TYPE == REPORT_TYPE_HID && !HID_FRAGMENT_ENABLE
+#error "REPORT_TYPE_HID needs HID_FRAGMENT_ENABLE"
+#endif
+
+#if USB_HID_ENABLE && !HID_FRAGMENT_ENABLE
+#error "USB_HID_ENABLE sends the HID fragment and needs HID_FRAGMENT_ENABLE"
+#endif
+
+// Fragment layouts
+#define HID_FRAGMENT_BOOT 0
+#define HID_FRAGMENT_NKRO 1
+
+// Layout of the master's USB keyboard report, or of the own one in the
+// USB role (usb_hid.h)
+#ifndef HID_FRAGMENT_FORMAT
+#if USB_HID_ENABLE
+#define HID_FRAGMENT_FORMAT HID_FRAGMENT_NKRO
+#else
+#define HID_FRAGMENT_FORMAT HID_FRAGMENT_BOOT
+#endif
+#endif
+
+// Usage bitmap bytes of the NKRO layout, usages 0x00-0x7F by default
+#ifndef HID_FRAGMENT_NKRO_BYTES
+#define HID_FRAGMENT_NKRO_BYTES 16
+#endif
+
+#if HID_FRAGMENT_NKRO_BYTES < 1 || HID_FRAGMENT_NKRO_BYTES > 28
+#error "HID_FRAGMENT_NKRO_BYTES must be between 1 and 28, usages stop at 0xDF"
+#endif
+
+// HID register
+#if HID_FRAGMENT_FORMAT == HID_FRAGMENT_BOOT
+typedef KeymapReport HidFragment;
+#elif HID_FRAGMENT_FORMAT == HID_FRAGMENT_NKRO
+typedef struct __attribute__((packed)) {
+    uint8_t modifiers;                          // Bit n = usage 0xE0 + n
+    uint8_t usages[HID_FRAGMENT_NKRO_BYTES];    // Bit n % 8 of byte n / 8 = usage n
+} HidFragment;
+#else
+#error "Unknown HID_FRAGMENT_FORMAT"
+#endif
+
+// Function prototypes
+void HidFragmentUpdate(uint32_t pressed);
+void HidFragmentSnapshot(HidFragment *fragment);
+
+#endif /* HID_FRAGMENT_H */
@@ -0,0 +1,57 @@
+/**
+ * @file hot_path.h
+ * @brief Placement of the latency-critical code in SRAM.
+ *
+ * Functions marked HOT_PATH land in .RamFunc, which the linker script keeps
+ * inside .data, so the startup code copies them to SRAM together with the
+ * initialised data. They then run without flash wait states or ART cache
+ * misses, at the cost of fetching over the S-bus. At 16 MHz with 0 wait
+ * states flash is just as fast, so this only pays off with the PLL
+ * profiles.
+ *
+ * Calls from SRAM back into flash go through linker veneers, so the whole
+ * scan -> debounce -> publish chain and the register driver ISRs are
+ * marked rather than single functions. The HAL I2C driver stays in flash.
+ *
+ * FLASH_HOT_PATH keeps the same functions in flash but groups them in
+ * .text.hot at the start of .text, so they share ART cache lines and
+ * prefetch runs instead of sitting between HAL code. The Production build
+ * type turns it on together with LTO; to compare it with Release, build
+ * both with -DPROFILE_ENABLE=1 and read the cycle statistics of the same
+ * traffic from the profile registers (profile.h).
+ */
+
+#ifndef HOT_PATH_H
+#define HOT_PATH_H
+
+// Run the scan kernel, debounce, event queue and register-driver I2C ISRs
+// from SRAM
+#ifndef RAM_HOT_PATH
+#define RAM_HOT_PATH 0
+#endif
+
+// Copy the vector table to SRAM (.ram_vector) and point VTOR at it, so
+// exception entry does not fetch the handler address from flash either
+#ifndef RAM_VECTOR_TABLE
+#define RAM_VECTOR_TABLE 0
+#endif
+
+// Group the same functions in flash in .text.hot (ignored with RAM_HOT_PATH)
+#ifndef FLASH_HOT_PATH
+#define FLASH_HOT_PATH 0
+#endif
+
+// Same section as the HAL's __RAM_FUNC, spelled out so HAL-free modules
+// (debounce.c) can use it
+#if RAM_HOT_PATH
+#define HOT_PATH __attribute__((section(".RamFunc")))
+#elif FLASH_HOT_PATH
+#define HOT_PATH __attribute__((section(".text.hot")))
+#else
+#define HOT_PATH
+#endif
+
+// Function prototypes
+void HotPathRelocateVectors(void);
+
+#endif /* HOT_PATH_H */
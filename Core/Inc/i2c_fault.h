@@ -0,0 +1,158 @@
+/**
+ * @file i2c_fault.h
+ * @brief I2C bus fault injection and recovery-time measurement.
+ *
+ * A test build that breaks the link on purpose and times how long the
+ * error path (RightKeyboardLinkError(), RightKeyboardLinkFault() and the
+ * I2CRecover() reset in RightKeyboardI2CService()) takes to bring it back.
+ * Two spare open-drain outputs are wired to SDA and SCL of the bus; they
+ * float while idle and only pull a line low. Fault kinds:
+ *   I2C_FAULT_STUCK_SDA   SDA held low for I2C_FAULT_STUCK_MS
+ *   I2C_FAULT_STUCK_SCL   SCL held low for I2C_FAULT_STUCK_MS
+ *   I2C_FAULT_COLLISION   SDA pulled low for I2C_FAULT_PULSE_US while this
+ *                         slave transmits; ARLO is master-only on the F4,
+ *                         so the slave sees a corrupted bit, or BERR when
+ *                         it lands on a START/STOP, and the master sees
+ *                         the data (REPORT_INTEGRITY) go bad
+ *   I2C_FAULT_GLITCH      a START and STOP on SDA while SCL is high in
+ *                         the middle of a transfer: misplaced conditions,
+ *                         the transfer ends early
+ *   I2C_FAULT_TRUNCATE    reads stopped early by a cooperating master
+ *   I2C_FAULT_NACK_STORM  bursts of early NACKs from a cooperating master
+ * The line kinds run every I2C_FAULT_PERIOD_MS in turn, or one at a time
+ * when the master writes [RIGHT_KEYBOARD_REG_FAULT, kind]. The master
+ * kinds only open a measurement window: the master writes the kind, then
+ * misbehaves, then goes back to normal traffic. Writing
+ * I2C_FAULT_CMD_CLEAR resets the statistics.
+ *
+ * Per fault, on the TIM5 microsecond base:
+ *   - detection: fault start to the first link error or reset,
+ *   - recovery: fault end (lines released, or the last error or reset
+ *     after that) to the first transfer that completes cleanly afterwards;
+ *     a master kind needs at least one error before it can close,
+ *   - over budget: recovery longer than I2C_FAULT_BUDGET_US, unrecovered:
+ *     no clean transfer within I2C_FAULT_TIMEOUT_MS,
+ *   - then the snapshot check: the published report matches the debounced
+ *     keys, the event queue is within bounds and I2C1 is enabled,
+ *     listening (ACK) on its own address again.
+ * RIGHT_KEYBOARD_REG_FAULT reads the I2CFaultReport; the caps carry
+ * RIGHT_KEYBOARD_CAP2_FAULT in builds that inject.
+ */
+
+#ifndef I2C_FAULT_H
+#define I2C_FAULT_H
+
+#include "right_side_keyboard.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Fault injection test mode (0 = compiled out)
+#ifndef I2C_FAULT_ENABLE
+#define I2C_FAULT_ENABLE 0
+#endif
+
+// Open-drain outputs wired to the bus lines; not keys, SWD, SWO or I2C
+#ifndef I2C_FAULT_SDA_PORT
+#define I2C_FAULT_SDA_PORT GPIOC
+#define I2C_FAULT_SDA_PIN  14
+#endif
+
+#ifndef I2C_FAULT_SCL_PORT
+#define I2C_FAULT_SCL_PORT GPIOC
+#define I2C_FAULT_SCL_PIN  15
+#endif
+
+// Time between two automatic faults, 0 = only on master request
+#ifndef I2C_FAULT_PERIOD_MS
+#define I2C_FAULT_PERIOD_MS 1000u
+#endif
+
+// Line kinds the automatic injection takes in turn, bit n = kind n
+#ifndef I2C_FAULT_AUTO_KINDS
+#define I2C_FAULT_AUTO_KINDS 0x0Fu
+#endif
+
+// How long a stuck line is held, past the stuck-bus detection
+#ifndef I2C_FAULT_STUCK_MS
+#define I2C_FAULT_STUCK_MS (3u * I2C_STUCK_TIMEOUT_MS)
+#endif
+
+// Collision pulse, about one bit at 100 kHz
+#ifndef I2C_FAULT_PULSE_US
+#define I2C_FAULT_PULSE_US 10u
+#endif
+
+// Longest wait for a transfer to collide with or glitch
+#ifndef I2C_FAULT_WAIT_US
+#define I2C_FAULT_WAIT_US 2000u
+#endif
+
+// Downtime budget, fault end to the first clean transfer
+#ifndef I2C_FAULT_BUDGET_US
+#define I2C_FAULT_BUDGET_US 20000u
+#endif
+
+// A fault without a clean transfer for this long counts as unrecovered
+#ifndef I2C_FAULT_TIMEOUT_MS
+#define I2C_FAULT_TIMEOUT_MS 1000u
+#endif
+
+// Error-free time after the first clean transfer that closes a fault,
+// so a NACK storm with clean reads in between is measured from its end
+#ifndef I2C_FAULT_QUIET_MS
+#define I2C_FAULT_QUIET_MS 100u
+#endif
+
+#if I2C_FAULT_ENABLE && LINK_TRANSPORT != LINK_TRANSPORT_I2C
+#error "I2C_FAULT_ENABLE tests the I2C link"
+#endif
+
+#define I2C_FAULT_STUCK_SDA  0
+#define I2C_FAULT_STUCK_SCL  1
+#define I2C_FAULT_COLLISION  2
+#define I2C_FAULT_GLITCH     3
+#define I2C_FAULT_TRUNCATE   4
+#define I2C_FAULT_NACK_STORM 5
+#define I2C_FAULT_KINDS      6
+
+#define I2C_FAULT_LINE_KINDS 0x0Fu      // Kinds the outputs inject
+
+#if (I2C_FAULT_AUTO_KINDS & ~I2C_FAULT_LINE_KINDS) != 0
+#error "I2C_FAULT_AUTO_KINDS can only pick the line kinds, the master injects the others"
+#endif
+
+// Command bytes written after RIGHT_KEYBOARD_REG_FAULT besides a kind
+#define I2C_FAULT_CMD_CLEAR 0xFF
+
+// No fault in progress
+#define I2C_FAULT_NONE 0xFF
+
+// Statistics of one kind, little endian
+typedef struct __attribute__((packed)) {
+    uint16_t injected;          // Faults started
+    uint16_t recovered;         // Clean transfer within I2C_FAULT_TIMEOUT_MS
+    uint16_t over_budget;       // Recovered, but later than I2C_FAULT_BUDGET_US
+    uint16_t inconsistent;      // Snapshot check failed after recovery
+    uint32_t detect_us_max;     // Fault start to the first error or reset
+    uint32_t recover_us_min;    // Fault end to the first clean transfer
+    uint32_t recover_us_mean;
+    uint32_t recover_us_max;
+} I2CFaultKindStats;
+
+// Fault register, little endian
+typedef struct __attribute__((packed)) {
+    uint8_t  enabled;           // I2C_FAULT_ENABLE
+    uint8_t  active;            // Kind in progress, I2C_FAULT_NONE if none
+    uint32_t budget_us;         // I2C_FAULT_BUDGET_US
+    I2CFaultKindStats kind[I2C_FAULT_KINDS];
+} I2CFaultReport;
+
+// Function prototypes
+void I2CFaultInit(void);
+void I2CFaultService(void);
+void I2CFaultCommand(uint8_t command);
+void I2CFaultLinkEvent(void);
+void I2CFaultTransferDone(void);
+void I2CFaultSnapshot(I2CFaultReport *report);
+
+#endif /* I2C_FAULT_H */
@@ -0,0 +1,34 @@
+/**
+ * @file i2c_hal_link.h
+ * @brief HAL I2C1 slave drivers, interrupt or DMA transmit.
+ *
+ * The drivers behind I2C_DRIVER_HAL and I2C_DRIVER_HAL_DMA. Listen mode
+ * arms a receive or transmit from HAL_I2C_AddrCallback() and ends after
+ * every transaction, so it is armed again from the listen-complete
+ * callback and, should that be missed, from I2CHalLinkService(). Frames
+ * come from and go back to the register map through link.h like for every
+ * other transport; reads go out with HAL_I2C_Slave_Seq_Transmit_IT, or
+ * _DMA on DMA1 stream 6 with I2C_DRIVER_HAL_DMA.
+ */
+
+#ifndef I2C_HAL_LINK_H
+#define I2C_HAL_LINK_H
+
+#include "stm32f4xx_hal.h"
+#include "link.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Master write buffer: register pointer plus room for register data, the
+// longest write is the 11-byte debounce profile
+#ifndef I2C_HAL_LINK_RX_LEN
+#define I2C_HAL_LINK_RX_LEN 16
+#endif
+
+// Function prototypes
+bool I2CHalLinkStart(void);
+void I2CHalLinkReset(void);
+void I2CHalLinkService(void);
+uint32_t I2CHalLinkRearms(void);
+
+#endif /* I2C_HAL_LINK_H */
@@ -0,0 +1,56 @@
+/**
+ * @file i2c_slave.h
+ * @brief Register-level I2C1 slave driver.
+ *
+ * Works directly on I2C1 SR1/SR2/DR from the event and error interrupts and
+ * is always ready to answer: every read is served from the frame returned by
+ * RightKeyboardTxBegin(), so nothing has to be re-armed between transactions.
+ * Frames handed out but never read are returned with RightKeyboardTxEnd(0).
+ * The peripheral itself (timing, own address, pins) is still set up once by
+ * MX_I2C1_Init() through the HAL.
+ */
+
+#ifndef I2C_SLAVE_H
+#define I2C_SLAVE_H
+
+#include "stm32f4xx_hal.h"
+#include "link.h"
+#include <stdbool.h>
+
+// Largest master write kept for the application, longer writes are truncated
+#ifndef I2C_SLAVE_RX_LEN
+#define I2C_SLAVE_RX_LEN 16
+#endif
+
+// Byte clocked out when the master reads past the end of the frame
+#define I2C_SLAVE_PAD_BYTE 0xFF
+
+// Stage the next read frame while the bus is idle and park its first byte in
+// DR, so a read starts as soon as ADDR is cleared instead of stretching SCL
+// for the frame lookup. The frame is picked ahead of the address match,
+// I2CSlaveRefresh() re-stages it when the data changes (0 = pick on ADDR).
+#ifndef I2C_SLAVE_PRELOAD
+#define I2C_SLAVE_PRELOAD 0
+#endif
+
+#if I2C_SLAVE_PRELOAD && I2C_DIAG_ADDRESS
+#error "I2C_SLAVE_PRELOAD stages one frame for both addresses, it can't be used with I2C_DIAG_ADDRESS"
+#endif
+
+// Measure how long SCL is stretched at the start of a read, from the address
+// match interrupt to the first byte being available, with the DWT cycle
+// counter (0 = not measured)
+#ifndef I2C_SLAVE_STRETCH_STATS
+#define I2C_SLAVE_STRETCH_STATS 0
+#endif
+
+// Function prototypes
+void I2CSlaveStart(void);
+void I2CSlaveStop(void);
+void I2CSlaveReset(void);
+void I2CSlaveEventIRQHandler(void);
+void I2CSlaveErrorIRQHandler(void);
+void I2CSlaveRefresh(void);
+void I2CSlaveStretchStats(uint32_t *last_cycles, uint32_t *max_cycles);
+
+#endif /* I2C_SLAVE_H */
@@ -0,0 +1,95 @@
+/**
+ * @file irq_plan.h
+ * @brief Interrupt priority plan and per-source handler timing.
+ *
+ * NVIC_PRIORITYGROUP_4: 16 preemption levels, no subpriority, lower number
+ * preempts higher. From most to least urgent:
+ *
+ *   0  I2C1 event/error, I2C1 TX DMA  byte timing while SCL is stretched
+ *      or USART1, its DMA streams    (LINK_TRANSPORT_UART instead)
+ *      or SPI1 NSS (EXTI15_10)        (LINK_TRANSPORT_SPI instead)
+ *      OTG FS                         USB keyboard role (usb_hid.h)
+ *   1  SysTick                        a few cycles, keeps HAL_GetTick() exact
+ *   2  DMA sampler (TIM1/DMA2)        must finish within half a sample ring
+ *   3  EXTI keys, RTC wakeup, TIM5    only wake the main loop
+ *      scheduler kick (SPI5 vector)   RTOS build, the kernel's highest level
+ *
+ * The RTOS build (sched.h) runs SysTick at the lowest level instead and
+ * masks everything from level 3 down in its critical sections.
+ *
+ * Scans that run from the I2C interrupt (SCAN_ON_ADDRESS_MATCH) hold off
+ * SysTick for one scan, which is far below the 1 ms tick, and debounce
+ * timing comes from TIM5 (timebase.h) anyway.
+ *
+ * With IRQ_PLAN_STATS the handlers in stm32f4xx_it.c record their longest
+ * run time in DWT cycles, and SysTick also records its entry latency from
+ * the reload. IrqPlanWorstLatency() turns the run times into a bound for
+ * any source: the longest handler at the same level plus one run of every
+ * more urgent one.
+ */
+
+#ifndef IRQ_PLAN_H
+#define IRQ_PLAN_H
+
+#include "stm32f4xx_hal.h"
+
+// Preemption priorities, see the table above
+#ifndef IRQ_PRIO_I2C
+#define IRQ_PRIO_I2C     0
+#endif
+#ifndef IRQ_PRIO_SYSTICK
+#define IRQ_PRIO_SYSTICK 1
+#endif
+#ifndef IRQ_PRIO_SAMPLER
+#define IRQ_PRIO_SAMPLER 2
+#endif
+#ifndef IRQ_PRIO_WAKE
+#define IRQ_PRIO_WAKE    3
+#endif
+
+#if IRQ_PRIO_I2C > IRQ_PRIO_SAMPLER || IRQ_PRIO_I2C > IRQ_PRIO_WAKE
+#error "The I2C interrupts must not be preempted by scan work"
+#endif
+
+#if IRQ_PRIO_SYSTICK > IRQ_PRIO_SAMPLER
+#error "SysTick must preempt the sampler or HAL_GetTick() drifts during long batches"
+#endif
+
+// Record handler run times in DWT cycles (0 = no instrumentation)
+#ifndef IRQ_PLAN_STATS
+#define IRQ_PLAN_STATS 0
+#endif
+
+typedef enum {
+    IRQ_SOURCE_I2C_EV,
+    IRQ_SOURCE_I2C_ER,
+    IRQ_SOURCE_I2C_DMA,
+    IRQ_SOURCE_UART,
+    IRQ_SOURCE_UART_DMA,
+    IRQ_SOURCE_SPI_NSS,
+    IRQ_SOURCE_USB,
+    IRQ_SOURCE_SYSTICK,
+    IRQ_SOURCE_SAMPLER,
+    IRQ_SOURCE_EXTI,
+    IRQ_SOURCE_RTC,
+    IRQ_SOURCE_TIMEBASE,
+    IRQ_SOURCE_SCHED_KICK,
+    IRQ_SOURCE_COUNT
+} IrqSource;
+
+#if IRQ_PLAN_STATS
+#define IRQ_PLAN_ENTER()    uint32_t irq_plan_entry = DWT->CYCCNT
+#define IRQ_PLAN_EXIT(src)  IrqPlanRecord((src), DWT->CYCCNT - irq_plan_entry)
+#else
+#define IRQ_PLAN_ENTER()    do { } while (0)
+#define IRQ_PLAN_EXIT(src)  do { } while (0)
+#endif
+
+// Function prototypes
+void IrqPlanInit(void);
+void IrqPlanRecord(IrqSource source, uint32_t cycles);
+void IrqPlanRecordTickLatency(void);
+uint32_t IrqPlanMaxCycles(IrqSource source);
+uint32_t IrqPlanWorstLatency(IrqSource source);
+
+#endif /* IRQ_PLAN_H */
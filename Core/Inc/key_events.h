@@ -0,0 +1,97 @@
+/**
+ * @file key_events.h
+ * @brief Lock-free single-producer/single-consumer queue of key events.
+ *
+ * The scanner pushes one event per accepted edge, the transmitter drains
+ * them. Head is only written by the producer and tail only by the consumer,
+ * so no critical sections are needed on a single core.
+ *
+ * Every event gets a sequence number, its position in the stream since
+ * boot (16-bit on the wire, wraps). Delivered events stay in the ring for
+ * KEY_EVENT_HISTORY_LEN more events, so a master that lost a read can ask
+ * for everything since the last number it saw (KeyEventReplay()) instead
+ * of resyncing from the bitmap. The producer only ever writes the slot
+ * QUEUE_LEN ahead of the tail, so the history behind the tail is stable
+ * while the consumer copies it.
+ *
+ * Backpressure: past KEY_EVENT_HIGH_WATER queued events KeyEventBacklog()
+ * is set, and the frames that carry events flag it so the master can
+ * poll faster. If the queue still fills up, the stream is broken. The
+ * producer stops queueing and keeps the debounced state instead
+ * (KeyEventSync()). The next read then coalesces the whole backlog into
+ * one resync record: key KEY_EVENT_RESYNC, pressed = events lost (capped
+ * at 255), timestamp = the pressed keys (bit n = key n held). The master
+ * takes that as its key state and throws away any partial history. Events
+ * queue again once the record is delivered, so the ring never has to
+ * grow and any polling rate ends up with the right state. A change while
+ * the record is in flight queues another one.
+ */
+
+#ifndef KEY_EVENTS_H
+#define KEY_EVENTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Queue depth, must be a power of two
+#ifndef KEY_EVENT_QUEUE_LEN
+#define KEY_EVENT_QUEUE_LEN 32
+#endif
+
+#if (KEY_EVENT_QUEUE_LEN & (KEY_EVENT_QUEUE_LEN - 1)) != 0 || KEY_EVENT_QUEUE_LEN > 256
+#error "KEY_EVENT_QUEUE_LEN must be a power of two no larger than 256"
+#endif
+
+// Delivered events kept for replay (0 = no history)
+#ifndef KEY_EVENT_HISTORY_LEN
+#define KEY_EVENT_HISTORY_LEN KEY_EVENT_QUEUE_LEN
+#endif
+
+// Queued events from which KeyEventBacklog() asks the master to read faster
+#ifndef KEY_EVENT_HIGH_WATER
+#define KEY_EVENT_HIGH_WATER (KEY_EVENT_QUEUE_LEN * 3u / 4u)
+#endif
+
+#if KEY_EVENT_HIGH_WATER < 1 || KEY_EVENT_HIGH_WATER > KEY_EVENT_QUEUE_LEN
+#error "KEY_EVENT_HIGH_WATER must be 1 to KEY_EVENT_QUEUE_LEN"
+#endif
+
+// Slots of the ring, queue plus history
+#define KEY_EVENT_RING_LEN (KEY_EVENT_QUEUE_LEN + KEY_EVENT_HISTORY_LEN)
+
+#if (KEY_EVENT_RING_LEN & (KEY_EVENT_RING_LEN - 1)) != 0 || KEY_EVENT_RING_LEN > 1024
+#error "KEY_EVENT_QUEUE_LEN + KEY_EVENT_HISTORY_LEN must be a power of two no larger than 1024"
+#endif
+
+// Key index sent when the queue is empty
+#define KEY_EVENT_NONE 0xFF
+
+// Key index of an encoder turn, pressed holds the signed detents (encoder.h)
+#define KEY_EVENT_ENCODER 0xFE
+
+// Key index of a resync record, see above
+#define KEY_EVENT_RESYNC 0xFD
+
+// One key transition, also the on-wire format (6 bytes, little endian)
+typedef struct __attribute__((packed)) {
+    uint8_t  key;           // Key index, KEY_EVENT_NONE if no event
+    uint8_t  pressed;       // 1 = press, 0 = release; int8_t detents for KEY_EVENT_ENCODER
+    uint32_t timestamp;     // Time of the accepted edge in microseconds, wraps every ~71.6 min
+                            // (read in master time with TIME_SYNC_ENABLE, time_sync.h)
+} KeyEvent;
+
+// Function prototypes
+bool KeyEventPush(uint8_t key, bool pressed, uint32_t timestamp);
+bool KeyEventPushTurn(int8_t detents, uint32_t timestamp);
+bool KeyEventPeek(KeyEvent *event);
+void KeyEventDrop(void);
+uint32_t KeyEventPeekBatch(KeyEvent *batch, uint32_t max);
+void KeyEventDropBatch(uint32_t count);
+uint32_t KeyEventReplay(uint16_t since, KeyEvent *batch, uint32_t max, uint16_t *first, uint16_t *next);
+bool KeyEventAcknowledge(uint16_t next);
+void KeyEventSync(uint32_t pressed);
+uint32_t KeyEventCount(void);
+bool KeyEventBacklog(void);
+uint32_t KeyEventDropped(void);
+
+#endif /* KEY_EVENTS_H */
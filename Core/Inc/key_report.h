@@ -0,0 +1,40 @@
+/**
+ * @file key_report.h
+ * @brief Report building from the debounced key word.
+ *
+ * HAL-free like debounce.h: the rollover limit and the bitmap packing only
+ * see key words. The press-order rollover keeps a small queue of the held
+ * keys, oldest first, updated only when the debounced word changes; picking
+ * the reported keys then costs at most one step per reported key.
+ */
+
+#ifndef KEY_REPORT_H
+#define KEY_REPORT_H
+
+#include <stdint.h>
+
+// Which pressed keys the report keeps once more than the limit are held
+typedef enum {
+    KEY_ROLLOVER_INDEX,     // Lowest key indices
+    KEY_ROLLOVER_FIRST,     // First pressed, later presses wait for a free slot
+    KEY_ROLLOVER_LAST,      // Last pressed, the oldest drop out
+    KEY_ROLLOVER_ALL,       // Every pressed key, the limit is ignored
+    KEY_ROLLOVER_POLICIES
+} KeyRolloverPolicy;
+
+// Held keys in press order
+typedef struct {
+    uint32_t pressed;       // Keys in the queue
+    uint8_t  count;         // Queue length
+    uint8_t  order[32];     // Key indices, oldest press first
+} KeyPressOrder;
+
+// Function prototypes
+uint32_t KeyReportRollover(uint32_t pressed, uint8_t max_keys);
+uint32_t KeyReportWord(uint32_t pressed, uint32_t bytes);
+void KeyPressOrderInit(KeyPressOrder *order);
+void KeyPressOrderUpdate(KeyPressOrder *order, uint32_t pressed);
+uint32_t KeyPressOrderSelect(const KeyPressOrder *order, KeyRolloverPolicy policy,
+                             uint32_t pressed, uint8_t max_keys);
+
+#endif /* KEY_REPORT_H */
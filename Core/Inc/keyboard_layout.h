@@ -0,0 +1,91 @@
+/**
+ * @file keyboard_layout.h
+ * @brief Pin map of the right side keyboard and the tables derived from it.
+ *
+ * KEY_MAP is the single source of truth for which pin each key index is
+ * wired to. The per-port masks, the MODER/PUPDR fields, the EXTI line
+ * routing and the KEY_GATHER() kernel that packs the two IDR snapshots into
+ * the 24-bit key word are all derived from it or checked against it at
+ * compile time, so editing the map without updating the gather fails the
+ * build and nothing is looked up at run time.
+ *
+ * Another direct-wired board defines KEY_MAP and KEY_GATHER together, up
+ * to 32 keys; NUM_KEYS follows the map.
+ */
+
+#ifndef KEYBOARD_LAYOUT_H
+#define KEYBOARD_LAYOUT_H
+
+#include <stdint.h>
+
+#define KEY_PORT_ID_A 0
+#define KEY_PORT_ID_B 1
+
+// X(key index, port letter, pin number)
+#ifndef KEY_MAP
+#define KEY_MAP(X) \
+    X(0,  A, 0)  X(1,  A, 1)  X(2,  A, 2)  X(3,  A, 3)  \
+    X(4,  A, 4)  X(5,  A, 5)  X(6,  A, 6)  X(7,  A, 7)  \
+    X(8,  A, 8)  X(9,  A, 9)  X(10, A, 10) X(11, A, 11) \
+    X(12, B, 0)  X(13, B, 1)  X(14, B, 2)  X(15, B, 15) \
+    X(16, B, 4)  X(17, B, 5)  X(18, B, 8)  X(19, B, 9)  \
+    X(20, B, 10) X(21, B, 12) X(22, B, 13) X(23, B, 14)
+#endif
+
+#define KEY_MAP_COUNT_TERM(idx, port, pin) + 1
+#define KEY_MAP_COUNT (0 KEY_MAP(KEY_MAP_COUNT_TERM))
+
+// Per-port masks of the IDR bits that carry a key
+#define KEY_MASK_A_TERM(idx, port, pin) | (KEY_PORT_ID_##port == KEY_PORT_ID_A ? (1u << (pin)) : 0u)
+#define KEY_MASK_B_TERM(idx, port, pin) | (KEY_PORT_ID_##port == KEY_PORT_ID_B ? (1u << (pin)) : 0u)
+#define KEY_MASK_A (0u KEY_MAP(KEY_MASK_A_TERM))
+#define KEY_MASK_B (0u KEY_MAP(KEY_MASK_B_TERM))
+
+// Per-port masks of the two-bit MODER/PUPDR fields that belong to a key
+#define KEY_FIELD2_A_TERM(idx, port, pin) | (KEY_PORT_ID_##port == KEY_PORT_ID_A ? (3u << (2 * (pin))) : 0u)
+#define KEY_FIELD2_B_TERM(idx, port, pin) | (KEY_PORT_ID_##port == KEY_PORT_ID_B ? (3u << (2 * (pin))) : 0u)
+#define KEY_FIELD2_A (0u KEY_MAP(KEY_FIELD2_A_TERM))
+#define KEY_FIELD2_B (0u KEY_MAP(KEY_FIELD2_B_TERM))
+
+// EXTI routing: port A owns every line it has a key on, port B the rest;
+// port B keys on a line owned by port A have no edge interrupt and are polled
+#define KEY_EXTI_LINES   (KEY_MASK_A | KEY_MASK_B)
+#define KEY_EXTI_LINES_B (KEY_MASK_B & ~KEY_MASK_A)
+#define KEY_POLLED_B     (KEY_MASK_B & KEY_MASK_A)
+
+// SYSCFG->EXTICR[reg] bits of the key lines: field mask, and the port
+// selection (1 = GPIOB, 0 = GPIOA)
+#define KEY_EXTICR_BIT(lines, reg, n) ((((lines) >> (4u * (reg) + (n))) & 1u) << (4u * (n)))
+#define KEY_EXTICR_BITS(lines, reg) \
+    (KEY_EXTICR_BIT(lines, reg, 0) | KEY_EXTICR_BIT(lines, reg, 1) | \
+     KEY_EXTICR_BIT(lines, reg, 2) | KEY_EXTICR_BIT(lines, reg, 3))
+#define KEY_EXTICR_MASK(reg)  (KEY_EXTICR_BITS(KEY_EXTI_LINES, reg) * 0xFu)
+#define KEY_EXTICR_VALUE(reg) KEY_EXTICR_BITS(KEY_EXTI_LINES_B, reg)
+
+// Packed key word from two IDR snapshots, bit n = key n (1 = released)
+// Each term moves one run of pins that share the same pin-to-key offset:
+//   PA0-PA11 -> 0-11, PB15 -> 15, PB0-PB2/PB4-PB5 -> 12-14/16-17,
+//   PB8-PB10 -> 18-20, PB12-PB14 -> 21-23
+#ifndef KEY_GATHER
+#define KEY_GATHER(a, b) \
+    (((uint32_t)(a) & 0x0FFFu) | \
+     ((uint32_t)(b) & 0x8000u) | \
+     (((uint32_t)(b) & 0x0037u) << 12) | \
+     (((uint32_t)(b) & 0x0700u) << 10) | \
+     (((uint32_t)(b) & 0x7000u) << 9))
+#endif
+
+// Compile-time checks of the gather against the pin map
+#define KEY_GATHER_CHECK(idx, port, pin) \
+    _Static_assert(KEY_GATHER(KEY_PORT_ID_##port == KEY_PORT_ID_A ? (1u << (pin)) : 0u, \
+                              KEY_PORT_ID_##port == KEY_PORT_ID_B ? (1u << (pin)) : 0u) == (1u << (idx)), \
+                   "KEY_GATHER does not route pin " #port #pin " to key " #idx);
+KEY_MAP(KEY_GATHER_CHECK)
+
+_Static_assert(__builtin_popcount(KEY_MASK_A) + __builtin_popcount(KEY_MASK_B) == KEY_MAP_COUNT,
+               "KEY_MAP wires two keys to the same pin");
+_Static_assert((KEY_MASK_A & 0x6000u) == 0, "PA13/PA14 are reserved for SWD");
+_Static_assert(KEY_GATHER(0xFFFFu, 0xFFFFu) == ((1u << KEY_MAP_COUNT) - 1u),
+               "KEY_GATHER picks up pins that are not in KEY_MAP");
+
+#endif /* KEYBOARD_LAYOUT_H */
@@ -0,0 +1,81 @@
+/**
+ * @file keyboard_matrix.h
+ * @brief Row/column matrix wiring for KEY_WIRING_MATRIX.
+ *
+ * Rows are inputs with pull-up on consecutive MATRIX_ROW_PORT pins, columns
+ * are open-drain outputs on MATRIX_COL_PORT. One column at a time is pulled
+ * low and the rows read back, a low row means the key at that crossing is
+ * pressed. Released columns float, so two keys on one row never short two
+ * driven outputs; blocking ghost keys on chords still needs a diode per key.
+ *
+ * Key index = column * MATRIX_ROWS + row, so the packed key word and every
+ * layer above it (debounce, events, reports) work as for direct wiring.
+ */
+
+#ifndef KEYBOARD_MATRIX_H
+#define KEYBOARD_MATRIX_H
+
+#include "stm32f4xx_hal.h"
+
+// Rows, MATRIX_ROWS consecutive pins from MATRIX_ROW_FIRST_PIN
+#ifndef MATRIX_ROWS
+#define MATRIX_ROWS 5
+#endif
+
+#ifndef MATRIX_ROW_PORT
+#define MATRIX_ROW_PORT      GPIOA
+#define MATRIX_ROW_FIRST_PIN 0
+#endif
+
+// Columns, X(column index, pin number) on MATRIX_COL_PORT
+#ifndef MATRIX_COL_MAP
+#define MATRIX_COL_PORT GPIOB
+#define MATRIX_COL_MAP(X) \
+    X(0, 0) X(1, 1) X(2, 2) X(3, 4) X(4, 5) X(5, 8)
+#if BOARD_I2C_SCL_PIN == 8
+#error "The default MATRIX_COL_MAP drives PB8, move the link to PB6/PB7 or give a map"
+#endif
+#endif
+
+// Time a strobed column gets to pull the rows down before they are read by
+// the CPU scan, in microseconds
+#ifndef MATRIX_SETTLE_US
+#define MATRIX_SETTLE_US 2
+#endif
+
+#define MATRIX_COL_COUNT_TERM(col, pin) + 1
+#define MATRIX_COLS (0 MATRIX_COL_MAP(MATRIX_COL_COUNT_TERM))
+
+#define MATRIX_COL_MASK_TERM(col, pin) | (1u << (pin))
+#define MATRIX_COL_MASK (0u MATRIX_COL_MAP(MATRIX_COL_MASK_TERM))
+
+#define MATRIX_ROW_MASK (((1u << MATRIX_ROWS) - 1u) << MATRIX_ROW_FIRST_PIN)
+
+#if MATRIX_ROW_FIRST_PIN + MATRIX_ROWS > 16
+#error "Matrix rows run past the end of MATRIX_ROW_PORT"
+#endif
+
+// BSRR words of one strobe sequence, column 0 first, set up by MatrixInit()
+extern uint32_t matrix_strobe[MATRIX_COLS];
+
+// Function prototypes
+void MatrixInit(void);
+uint32_t MatrixScan(void);
+
+/**
+ * Pack one row reading per column into the key word
+ *
+ * @param rows MATRIX_ROW_PORT->IDR, one sample per column, column 0 first
+ * @return Key word, bit (column * MATRIX_ROWS + row) = key (1 = released)
+ */
+static inline uint32_t MatrixGather(const uint16_t *rows)
+{
+    uint32_t keys = 0;
+
+    for (uint32_t c = 0; c < MATRIX_COLS; ++c) {
+        keys |= (((uint32_t)rows[c] & MATRIX_ROW_MASK) >> MATRIX_ROW_FIRST_PIN) << (c * MATRIX_ROWS);
+    }
+    return keys;
+}
+
+#endif /* KEYBOARD_MATRIX_H */
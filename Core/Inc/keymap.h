@@ -0,0 +1,71 @@
+/**
+ * @file keymap.h
+ * @brief On-device keymap: key indices to HID usage codes through layers.
+ *
+ * With KEYMAP_ENABLE the right half resolves its own keys, so the master
+ * only merges two boot-style reports instead of looking every key up. The
+ * table is const and stays in flash, KEYMAP_LAYERS layers of NUM_KEYS
+ * codes. The master writes the active layers to RIGHT_KEYBOARD_REG_LAYERS;
+ * a key is resolved when it is pressed, through the highest active layer
+ * that has a code for it, and keeps that code until it is released, so a
+ * layer change while a key is held never leaves the master with a stuck
+ * code.
+ *
+ * RIGHT_KEYBOARD_REG_CODES serves the keys of the published report (so the
+ * rollover policy applies) as a HID boot keyboard report: modifier byte,
+ * reserved byte, KEYMAP_REPORT_CODES usage codes.
+ */
+
+#ifndef KEYMAP_H
+#define KEYMAP_H
+
+#include "right_side_keyboard.h"
+#include <stdint.h>
+
+// Resolve keys on this half (0 = compiled out, the master maps raw bits)
+#ifndef KEYMAP_ENABLE
+#define KEYMAP_ENABLE (REPORT_TYPE == REPORT_TYPE_KEYCODES || REPORT_TYPE == REPORT_TYPE_HID || \
+                       USB_HID_ENABLE)
+#endif
+
+#if REPORT_TYPE == REPORT_TYPE_KEYCODES && !KEYMAP_ENABLE
+#error "REPORT_TYPE_KEYCODES needs KEYMAP_ENABLE"
+#endif
+
+// Layers in the table, layer 0 is the base layer and always active
+#ifndef KEYMAP_LAYERS
+#define KEYMAP_LAYERS 4
+#endif
+
+#if KEYMAP_LAYERS < 1 || KEYMAP_LAYERS > 8
+#error "KEYMAP_LAYERS must be between 1 and 8, the layer mask is one byte"
+#endif
+
+// Usage codes in one report, as in the HID boot keyboard report
+#define KEYMAP_REPORT_CODES 6
+
+// Table entries besides usage codes
+#define KEYMAP_NONE        0x00    // No code, the key does nothing
+#define KEYMAP_TRANSPARENT 0x01    // Use the next lower active layer
+
+// HID usage codes with a meaning of their own in the report
+#define KEYMAP_ERROR_ROLLOVER 0x01  // Sent in every slot when too many keys are held
+#define KEYMAP_MODIFIER_FIRST 0xE0  // Left Control, bit 0 of the modifier byte
+#define KEYMAP_MODIFIER_LAST  0xE7  // Right GUI, bit 7 of the modifier byte
+
+// Codes register, HID boot keyboard report layout
+typedef struct __attribute__((packed)) {
+    uint8_t modifiers;                      // Bit n = usage 0xE0 + n
+    uint8_t reserved;
+    uint8_t codes[KEYMAP_REPORT_CODES];     // Lowest key index first, 0 = empty slot
+} KeymapReport;
+
+// Function prototypes
+uint8_t KeymapLookup(uint32_t key, uint8_t layers);
+uint8_t KeymapCode(uint32_t key);
+void KeymapPress(uint32_t pressed_keys, uint8_t layers);
+void KeymapSetLayers(uint8_t layers);
+uint8_t KeymapLayers(void);
+void KeymapReportBuild(uint32_t pressed, KeymapReport *report);
+
+#endif /* KEYMAP_H */
@@ -0,0 +1,56 @@
+/**
+ * @file latency_stats.h
+ * @brief Key edge to I2C transmit latency statistics.
+ *
+ * One key change at a time is followed through the pipeline, timestamped
+ * on the TIM5 time base:
+ *   edge     first sample that shows the new raw level
+ *   accept   debounce accepted the change
+ *   publish  the snapshot carrying it is in the ready slot
+ *   transmit address match of the next report read
+ * Changes that arrive while one is in flight are not timed. Each stage and
+ * the total go into a log-scale histogram (two buckets per octave, 1 us to
+ * 65 ms), from which p50/p99 are read as bucket upper bounds, and max is
+ * tracked exactly. The master reads them from RIGHT_KEYBOARD_REG_LATENCY.
+ */
+
+#ifndef LATENCY_STATS_H
+#define LATENCY_STATS_H
+
+#include "stm32f4xx_hal.h"
+
+// Time key changes through to the bus (0 = compiled out)
+#ifndef LATENCY_STATS
+#define LATENCY_STATS 0
+#endif
+
+typedef enum {
+    LATENCY_EDGE_TO_ACCEPT,
+    LATENCY_ACCEPT_TO_PUBLISH,
+    LATENCY_PUBLISH_TO_TRANSMIT,
+    LATENCY_EDGE_TO_TRANSMIT,
+    LATENCY_STAGES
+} LatencyStage;
+
+// Percentiles of one stage in microseconds
+typedef struct __attribute__((packed)) {
+    uint32_t p50_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+} LatencyPercentiles;
+
+// Latency register, little endian
+typedef struct __attribute__((packed)) {
+    uint32_t samples;                           // Changes timed since boot
+    LatencyPercentiles stage[LATENCY_STAGES];   // Indexed by LatencyStage
+} LatencyReport;
+
+// Function prototypes
+void LatencyEdge(uint32_t now);
+void LatencyAccept(uint32_t now);
+void LatencyPublish(uint32_t now);
+void LatencyCancel(void);
+void LatencyTransmit(uint32_t now);
+void LatencySnapshot(LatencyReport *report);
+
+#endif /* LATENCY_STATS_H */
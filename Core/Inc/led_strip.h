@@ -0,0 +1,69 @@
+/**
+ * @file led_strip.h
+ * @brief WS2812-style per-key RGB LEDs, waveform from TIM3 PWM and DMA.
+ *
+ * The data line is TIM3 CH2 on PA7 (AF2, push-pull), one 800 kHz PWM
+ * period per bit: a short high time for 0, a long one for 1. DMA1 stream 2
+ * (channel 5, TIM3_UP) loads the next duty cycle into the preloaded CCR2 at
+ * every update event, so the whole frame goes out without the CPU and
+ * without an interrupt; the last slot is 0 and keeps the line low.
+ *
+ * The colours live in a compact RGB frame, 3 bytes per LED. LedStripService()
+ * runs in the main loop, between scans: once the previous frame is out and
+ * the reset time has passed, a changed frame is encoded into the duty
+ * cycle buffer (two table copies per byte) and the stream restarted. The
+ * scan and the link interrupts never wait for it.
+ *
+ * RIGHT_KEYBOARD_REG_LEDS reads the frame; a write is [first LED, r, g, b,
+ * ...], first LED 0xFF sets every LED to one colour.
+ *
+ * PA7 is a key in the direct wiring and MOSI of the SPI link, and TIM3
+ * samples the Hall sensors, so this needs KEY_WIRING_MATRIX. TIM3 has to
+ * keep its clock: no CLOCK_PROFILE_GOVERNOR.
+ */
+
+#ifndef LED_STRIP_H
+#define LED_STRIP_H
+
+#include "right_side_keyboard.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Per-key RGB LEDs (0 = compiled out)
+#ifndef LED_STRIP_ENABLE
+#define LED_STRIP_ENABLE 0
+#endif
+
+// LEDs on the chain
+#ifndef LED_COUNT
+#define LED_COUNT NUM_KEYS
+#endif
+
+// Low time that latches a frame, in microseconds (280 for WS2812B-V5)
+#ifndef LED_RESET_US
+#define LED_RESET_US 300u
+#endif
+
+#if LED_COUNT < 1 || LED_COUNT > 64
+#error "LED_COUNT must be 1 to 64"
+#endif
+
+#if LED_STRIP_ENABLE && KEY_WIRING != KEY_WIRING_MATRIX
+#error "LED_STRIP_ENABLE needs KEY_WIRING_MATRIX, PA7 and TIM3 are taken otherwise"
+#endif
+
+#if LED_STRIP_ENABLE && LINK_TRANSPORT == LINK_TRANSPORT_SPI
+#error "LED_STRIP_ENABLE uses PA7, the SPI link's MOSI"
+#endif
+
+#if LED_STRIP_ENABLE && CLOCK_PROFILE == CLOCK_PROFILE_GOVERNOR
+#error "CLOCK_PROFILE_GOVERNOR changes the TIM3 clock under the LED waveform"
+#endif
+
+// Function prototypes
+void LedStripInit(void);
+void LedStripService(void);
+bool LedStripWrite(const uint8_t *data, uint32_t len);
+void LedStripSnapshot(uint8_t *rgb);
+
+#endif /* LED_STRIP_H */
@@ -0,0 +1,91 @@
+/**
+ * @file link.h
+ * @brief Interface between the register map and the link to the left half.
+ *
+ * A transport only moves bytes: it asks the register map for the frame of
+ * the next read with RightKeyboardTxBegin(), reports how much of it reached
+ * the master with RightKeyboardTxEnd() and hands master writes (register
+ * pointer plus data) to RightKeyboardRxEnd(). A transport that sends
+ * without being asked checks RightKeyboardPushPending() after each frame.
+ * Framing, queues, data-ready and integrity all stay in
+ * right_side_keyboard.c, so every transport carries the same register
+ * protocol. With I2C_DIAG_ADDRESS the I2C drivers fetch reads on the
+ * report address with RightKeyboardReportBegin() and drop writes to it.
+ *
+ * Transports: the register-level and HAL I2C drivers (i2c_slave.h,
+ * i2c_hal_link.h), the UART link (uart_link.h) and the SPI link
+ * (spi_link.h), selected at compile time through transport.h.
+ *
+ * The links without addressing, UART and SPI, share one byte framing
+ * (link.c). Master to slave, the bytes of an I2C register write:
+ *
+ *   LINK_SYNC_REQUEST, length (1..LINK_REQUEST_LEN), register pointer,
+ *   data..., CRC-8 (crc8.h) over length, pointer and data
+ *
+ * Slave to master, the frame an I2C read of that register would return:
+ *
+ *   LINK_SYNC_REPLY, register, length (2 bytes, little endian),
+ *   frame..., CRC-8 over register, length and frame
+ *
+ * Frames longer than LINK_REPLY_LEN are cut, which counts as a short read.
+ */
+
+#ifndef LINK_H
+#define LINK_H
+
+#include "right_side_keyboard.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Error classes for RightKeyboardLinkError(), the HAL I2C error bits so the
+// I2C drivers pass theirs through unchanged
+#define LINK_ERROR_BUS     HAL_I2C_ERROR_BERR  // Misplaced START/STOP, UART framing or noise
+#define LINK_ERROR_ARLO    HAL_I2C_ERROR_ARLO  // Arbitration lost (I2C only)
+#define LINK_ERROR_FRAME   HAL_I2C_ERROR_AF    // Early NACK or STOP, request with a bad length or CRC
+#define LINK_ERROR_OVERRUN HAL_I2C_ERROR_OVR   // Byte lost in the peripheral
+
+// Largest request, pointer plus data, as for an I2C write
+#ifndef LINK_REQUEST_LEN
+#define LINK_REQUEST_LEN 16
+#endif
+
+// Largest frame sent in one reply
+#ifndef LINK_REPLY_LEN
+#define LINK_REPLY_LEN 256
+#endif
+
+// First byte of every request and reply
+#define LINK_SYNC_REQUEST 0xA5
+#define LINK_SYNC_REPLY   0x5A
+
+// Reply bytes around the frame: sync, register and length in front, CRC behind
+#define LINK_REPLY_HEADER 4u
+#define LINK_REPLY_EXTRA  (LINK_REPLY_HEADER + 1u)
+
+// Request parser of one link, a zeroed one waits for a sync byte
+typedef struct {
+    uint8_t state;
+    uint8_t len;                        // Length of the request being parsed
+    uint8_t count;                      // Bytes of it received so far
+    uint8_t frame[LINK_REQUEST_LEN];    // Pointer and data of the last request
+} LinkParser;
+
+// Function prototypes
+void LinkParserReset(LinkParser *parser);
+bool LinkParse(LinkParser *parser, uint8_t byte);
+bool LinkParserIdle(const LinkParser *parser);
+uint32_t LinkReplyBuild(uint8_t *buf, uint8_t reg, const uint8_t *frame, uint32_t len);
+
+// Provided by the application, called from the transport interrupts
+uint32_t RightKeyboardTxBegin(const uint8_t **frame);
+uint32_t RightKeyboardReportBegin(const uint8_t **frame);
+void RightKeyboardTxEnd(uint32_t bytes_sent);
+void RightKeyboardRxEnd(const uint8_t *data, uint32_t len);
+void RightKeyboardGeneralCall(const uint8_t *data, uint32_t len);
+void RightKeyboardLinkError(uint32_t errors);
+void RightKeyboardLinkFault(void);
+bool RightKeyboardPushPending(void);
+const volatile uint32_t *RightKeyboardPublishedWord(void);
+uint8_t RightKeyboardDefaultRegister(void);
+
+#endif /* LINK_H */
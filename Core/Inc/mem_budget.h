@@ -0,0 +1,36 @@
+/**
+ * @file mem_budget.h
+ * @brief Static RAM budget: named sections for the large buffers.
+ *
+ * The firmware is heap-free, _sbrk() refuses every request and the linker
+ * scripts reserve no heap. All RAM is .data, .bss and the MSP stack
+ * reserve (_Min_Stack_Size), and the link fails with "region RAM
+ * overflowed" if they don't fit, so buffers can be grown until the budget
+ * is used up without ever reaching into the stack.
+ *
+ * Buffers marked MEM_BSS(region) go to their own output section,
+ * .bss_<region>, inside the zeroed .bss range:
+ *
+ *   events   key event ring (key_events.c)
+ *   capture  raw sample capture ring (raw_capture.c)
+ *   dma      DMA sampler rings (dma_sampler.c, hall_sensor.c), UART and
+ *            SPI link buffers (uart_link.c, spi_link.c), LED waveform
+ *            (led_strip.c)
+ *   stats    chatter, latency and profiling tables
+ *   rtos     task stacks of the RTOS build (sched.c)
+ *
+ * The post-build step prints every output section with its size
+ * (arm-none-eabi-size -A), so each build shows what the regions cost next
+ * to the plain .bss and the stack reserve; the map file has the per-symbol
+ * breakdown. Only zero-initialised objects may be placed in a region.
+ * .noinit (retained.h) sits after .bss and is left alone by the startup.
+ */
+
+#ifndef MEM_BUDGET_H
+#define MEM_BUDGET_H
+
+// ".bss." prefix makes GCC emit the section as NOBITS like plain .bss, the
+// dot after "mem" keeps it apart from -fdata-sections names
+#define MEM_BSS(region) __attribute__((section(".bss.mem." #region)))
+
+#endif /* MEM_BUDGET_H */
@@ -0,0 +1,53 @@
+/**
+ * @file periph.h
+ * @brief Inline register access for the paths that run on every pass.
+ *
+ * The HAL sets the peripherals up once; what runs per scan, per edge
+ * interrupt or per main loop pass uses these instead, so it costs a load or
+ * a store rather than a call with parameter checks and handle bookkeeping.
+ * The bus transport itself is the register-level driver (i2c_slave.c) by
+ * default, the HAL I2C drivers remain selectable with I2C_DRIVER.
+ */
+
+#ifndef PERIPH_H
+#define PERIPH_H
+
+#include "stm32f4xx_hal.h"
+#include <stdbool.h>
+
+/**
+ * Get the HAL millisecond tick without the HAL_GetTick() call
+ */
+static inline uint32_t PeriphTickMs(void)
+{
+    return uwTick;
+}
+
+/**
+ * Clear the pending EXTI lines among the given ones
+ *
+ * @param lines EXTI line mask the calling handler owns
+ * @return Lines that were pending
+ */
+static inline uint32_t PeriphExtiTake(uint32_t lines)
+{
+    uint32_t pending = EXTI->PR & lines;
+    EXTI->PR = pending;
+    return pending;
+}
+
+/**
+ * Mask or unmask both I2C1 interrupts at the NVIC
+ */
+static inline void PeriphI2CIrqEnable(bool enable)
+{
+    if (enable) {
+        NVIC_EnableIRQ(I2C1_ER_IRQn);
+        NVIC_EnableIRQ(I2C1_EV_IRQn);
+    } else {
+        NVIC_DisableIRQ(I2C1_EV_IRQn);
+        NVIC_DisableIRQ(I2C1_ER_IRQn);
+    }
+}
+
+#endif /* PERIPH_H */
@@ -0,0 +1,61 @@
+/**
+ * @file profile.h
+ * @brief DWT cycle-count profiling of the scan and I2C hot paths.
+ *
+ * With PROFILE_ENABLE every instrumented section records its run time in
+ * core cycles: minimum, maximum, mean and a histogram with power-of-two
+ * buckets. The statistics live in profile_stats[] for the debugger and are
+ * served on RIGHT_KEYBOARD_REG_PROFILE + slot. Without PROFILE_ENABLE the
+ * macros compile to nothing.
+ *
+ * Cycles include any interrupt that preempts the section, the histogram
+ * shows those as a separate tail.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "stm32f4xx_hal.h"
+
+// Record per-section cycle statistics (0 = compiled out)
+#ifndef PROFILE_ENABLE
+#define PROFILE_ENABLE 0
+#endif
+
+// Histogram: bucket 0 counts runs below 2^PROFILE_HIST_SHIFT cycles, each
+// further bucket doubles, the last one takes everything above
+#define PROFILE_HIST_BUCKETS 8
+#define PROFILE_HIST_SHIFT   6
+
+typedef enum {
+    PROFILE_SCAN,       // RightKeyboardScan6KRO()
+    PROFILE_DEBOUNCE,   // One debounce and publish step
+    PROFILE_I2C_EV,     // I2C1 event interrupt
+    PROFILE_I2C_ER,     // I2C1 error interrupt
+    PROFILE_SLOTS
+} ProfileSlot;
+
+// Statistics of one section, little endian, as read from the register map
+typedef struct __attribute__((packed)) {
+    uint32_t count;     // Runs recorded, saturates
+    uint32_t min;       // Cycles
+    uint32_t max;
+    uint32_t mean;      // Computed when the snapshot is taken
+    uint16_t hist[PROFILE_HIST_BUCKETS];    // Runs per bucket, saturate
+} ProfileStats;
+
+#if PROFILE_ENABLE
+#define PROFILE_BEGIN(slot)  uint32_t profile_start_##slot = DWT->CYCCNT
+#define PROFILE_END(slot)    ProfileRecord((slot), DWT->CYCCNT - profile_start_##slot)
+#else
+#define PROFILE_BEGIN(slot)  do { } while (0)
+#define PROFILE_END(slot)    do { } while (0)
+#endif
+
+// Function prototypes
+void ProfileInit(void);
+void ProfileRecord(ProfileSlot slot, uint32_t cycles);
+void ProfileSnapshot(ProfileSlot slot, ProfileStats *stats);
+void ProfileReset(void);
+
+#endif /* PROFILE_H */
@@ -0,0 +1,79 @@
+/**
+ * @file pulsed_pullup.h
+ * @brief Key pull-ups switched on only around each sample.
+ *
+ * With the pull-ups on all the time every held key sinks about 80 uA
+ * (3.3 V into ~40 kOhm) to ground for as long as it is held. In this mode
+ * the key pins sit on their pull-downs between samples, where neither a
+ * held nor a released key draws current and no input floats. A sample
+ * switches the pull-ups on, waits the settle time, reads both IDRs and
+ * switches back, with interrupts masked so a scan from the I2C interrupt
+ * cannot land between the two halves of a pulse.
+ *
+ * The settle time is measured at init unless PULSED_PULLUP_SETTLE_NS sets
+ * it: the lines are discharged, the pull-ups switched on and the slowest
+ * released line timed on the cycle counter until it reads high. A key held
+ * at boot takes no part in the measurement. The result is scaled by
+ * PULSED_PULLUP_MARGIN and kept at PULSED_PULLUP_MIN_NS or more, and
+ * follows core clock changes (clock_governor.h).
+ *
+ * The poll scan is the only one the CPU samples itself: the DMA sampler
+ * copies the IDRs with no CPU in between, and the EXTI and edge capture
+ * modes need the pull-ups to see edges at all. Deep idle is ruled out for
+ * the same reason: STOP waits for key edges and compares the raw IDRs on
+ * every RTC wake-up.
+ */
+
+#ifndef PULSED_PULLUP_H
+#define PULSED_PULLUP_H
+
+#include "right_side_keyboard.h"
+#include "edge_capture.h"
+#include <stdint.h>
+
+// Pulsed pull-ups on the key pins (0 = pull-ups always on)
+#ifndef PULSED_PULLUP_ENABLE
+#define PULSED_PULLUP_ENABLE 0
+#endif
+
+// Settle time from pull-up on to the sample in ns (0 = measure at init)
+#ifndef PULSED_PULLUP_SETTLE_NS
+#define PULSED_PULLUP_SETTLE_NS 0u
+#endif
+
+// Measured settle time multiplier, and the floor of the result
+#ifndef PULSED_PULLUP_MARGIN
+#define PULSED_PULLUP_MARGIN 2u
+#endif
+
+#ifndef PULSED_PULLUP_MIN_NS
+#define PULSED_PULLUP_MIN_NS 500u
+#endif
+
+// How long the measurement waits for the lines to rise; a line still low
+// by then counts as held
+#ifndef PULSED_PULLUP_MEASURE_US
+#define PULSED_PULLUP_MEASURE_US 50u
+#endif
+
+#if PULSED_PULLUP_ENABLE && (SCAN_MODE != SCAN_MODE_POLL || KEY_WIRING != KEY_WIRING_DIRECT)
+#error "PULSED_PULLUP_ENABLE needs SCAN_MODE_POLL with KEY_WIRING_DIRECT, the CPU pulses around its own samples"
+#endif
+
+#if PULSED_PULLUP_ENABLE && EDGE_CAPTURE_ENABLE
+#error "PULSED_PULLUP_ENABLE leaves the key pins on their pull-downs, edge capture would see no edges"
+#endif
+
+#if PULSED_PULLUP_ENABLE && DEEP_IDLE_ENABLE
+#error "PULSED_PULLUP_ENABLE leaves the key pins on their pull-downs, deep idle would see no key in STOP"
+#endif
+
+#if PULSED_PULLUP_MARGIN < 1u || PULSED_PULLUP_MEASURE_US > 1000u
+#error "PULSED_PULLUP_MARGIN must be at least 1, PULSED_PULLUP_MEASURE_US at most 1000"
+#endif
+
+// Function prototypes
+void PulsedPullupInit(void);
+uint32_t PulsedPullupSample(void);
+
+#endif /* PULSED_PULLUP_H */
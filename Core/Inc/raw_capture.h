@@ -0,0 +1,85 @@
+/**
+ * @file raw_capture.h
+ * @brief Triggered capture of raw key samples for offline debounce tuning.
+ *
+ * With RAW_CAPTURE every raw key word that reaches the debounce (every CPU
+ * scan, every DMA sample) is written to a RAM ring together with its
+ * timestamp. An edge on one of the RAW_CAPTURE_TRIGGER_MASK keys triggers
+ * the capture: RAW_CAPTURE_PRETRIGGER samples before the edge are kept and
+ * the ring is filled up after it, then it freezes until re-armed.
+ *
+ * Dump format, shared by both paths: RawSample records, oldest first, key
+ * word as packed by KEY_GATHER()/MatrixGather() (bit n = key n,
+ * 1 = released), time on the TIM5 microsecond base. A replay harness feeds
+ * sample.keys at sample.time_us into the debounce under test.
+ *   SWD: raw_capture_state == RAW_CAPTURE_DONE, raw_capture_count records
+ *        starting at raw_capture[raw_capture_first], wrapping at
+ *        RAW_CAPTURE_SAMPLES; the trigger is record raw_capture_trigger
+ *   I2C: RIGHT_KEYBOARD_REG_CAPTURE returns RawCaptureChunk frames, the
+ *        cursor moves on after every complete read. Writing one command
+ *        byte after the register pointer arms the capture again or
+ *        rewinds the cursor.
+ */
+
+#ifndef RAW_CAPTURE_H
+#define RAW_CAPTURE_H
+
+#include "stm32f4xx_hal.h"
+
+// Record raw samples around a trigger edge (0 = compiled out)
+#ifndef RAW_CAPTURE
+#define RAW_CAPTURE 0
+#endif
+
+// Ring size in samples, 8 bytes each
+#ifndef RAW_CAPTURE_SAMPLES
+#define RAW_CAPTURE_SAMPLES 512u
+#endif
+
+// Samples kept from before the trigger edge
+#ifndef RAW_CAPTURE_PRETRIGGER
+#define RAW_CAPTURE_PRETRIGGER 64u
+#endif
+
+// Keys whose raw edges trigger the capture
+#ifndef RAW_CAPTURE_TRIGGER_MASK
+#define RAW_CAPTURE_TRIGGER_MASK 0xFFFFFFFFu
+#endif
+
+// Samples per register read
+#define RAW_CAPTURE_CHUNK 8u
+
+// Command bytes written after RIGHT_KEYBOARD_REG_CAPTURE
+#define RAW_CAPTURE_CMD_ARM    0x01    // Drop the capture and wait for a new trigger
+#define RAW_CAPTURE_CMD_REWIND 0x02    // Restart the dump at the oldest sample
+
+typedef enum {
+    RAW_CAPTURE_IDLE,       // Compiled out
+    RAW_CAPTURE_ARMED,      // Recording, waiting for a trigger edge
+    RAW_CAPTURE_TRIGGERED,  // Filling the ring after the edge
+    RAW_CAPTURE_DONE        // Frozen, ready to dump
+} RawCaptureState;
+
+typedef struct __attribute__((packed)) {
+    uint32_t time_us;       // TIM5 time of the sample
+    uint32_t keys;          // Raw key word (1 = released)
+} RawSample;
+
+// Capture register, little endian
+typedef struct __attribute__((packed)) {
+    uint8_t   state;        // RawCaptureState
+    uint8_t   samples;      // Valid entries in sample[], 0 unless RAW_CAPTURE_DONE
+    uint16_t  total;        // Samples in the capture
+    uint16_t  trigger;      // Index of the trigger sample
+    uint16_t  index;        // Index of sample[0]
+    RawSample sample[RAW_CAPTURE_CHUNK];
+} RawCaptureChunk;
+
+// Function prototypes
+void RawCaptureSample(uint32_t keys, uint32_t now);
+void RawCaptureCommand(uint8_t command);
+uint32_t RawCaptureChunkRead(RawCaptureChunk *chunk);
+void RawCaptureChunkDone(void);
+uint32_t RawCaptureCopy(RawSample *out, uint32_t max);
+
+#endif /* RAW_CAPTURE_H */
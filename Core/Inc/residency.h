@@ -0,0 +1,77 @@
+/**
+ * @file residency.h
+ * @brief Power-state residency and duty-cycle accounting.
+ *
+ * Always-on counters, in microseconds since TimebaseInit():
+ *   - total: TIM5 time plus STOP, wall-clock since boot
+ *   - sleep: the core in WFI, main loop idle or the RTOS tickless idle;
+ *     counted with interrupts masked, so the handlers of the wake-up are
+ *     not part of it
+ *   - stop:  STOP (DEEP_IDLE_ENABLE), where TIM5 does not run; counted
+ *     by deep_idle.c off the RTC sub-second counter and scaled with the
+ *     LSI rate it measures against TIM5 while awake
+ *   - run:   total - sleep - stop
+ * and the parts of the run time:
+ *   - scan:  RightKeyboardScan6KRO() and the sampler's batches, sampling,
+ *     debounce and publish
+ *   - link:  the link interrupts (I2C1, its TX DMA, USART1 and its DMA,
+ *     SPI NSS), including a scan on address match
+ * other work is run - scan - link. Spans nest: a link interrupt in the
+ * middle of a scan only counts as link.
+ *
+ * The cost is two TIM5 reads and a few masked instructions per span.
+ * RIGHT_KEYBOARD_REG_RESIDENCY reads a ResidencyReport; the fields are
+ * 64-bit and do not wrap, duty cycles over a window are the differences
+ * of two reads. RIGHT_KEYBOARD_CAP2_RESIDENCY in the caps says the build
+ * counts.
+ */
+
+#ifndef RESIDENCY_H
+#define RESIDENCY_H
+
+#include <stdint.h>
+
+// Residency accounting (0 = compiled out, the register reads zeros)
+#ifndef RESIDENCY_STATS
+#define RESIDENCY_STATS 1
+#endif
+
+// Run time split, see above
+typedef enum {
+    RESIDENCY_SCAN,
+    RESIDENCY_LINK,
+    RESIDENCY_WORK_KINDS
+} ResidencyWork;
+
+// Start of an open span
+typedef struct {
+    uint32_t start_us;
+    uint32_t nested_us;         // Spans closed before this one, see ResidencyEnter()
+} ResidencyMark;
+
+// Residency register, little endian
+typedef struct __attribute__((packed)) {
+    uint64_t total_us;          // Since boot, TIM5 plus STOP
+    uint64_t run_us;            // Core running
+    uint64_t sleep_us;          // WFI
+    uint64_t stop_us;           // STOP (DEEP_IDLE_ENABLE)
+    uint64_t scan_us;           // Part of run: scans
+    uint64_t link_us;           // Part of run: link interrupts
+} ResidencyReport;
+
+#if RESIDENCY_STATS
+#define RESIDENCY_ENTER()       ResidencyMark residency_mark; ResidencyEnter(&residency_mark)
+#define RESIDENCY_EXIT(work)    ResidencyExit((work), &residency_mark)
+#else
+#define RESIDENCY_ENTER()       do { } while (0)
+#define RESIDENCY_EXIT(work)    do { } while (0)
+#endif
+
+// Function prototypes
+void ResidencyEnter(ResidencyMark *mark);
+void ResidencyExit(ResidencyWork work, const ResidencyMark *mark);
+void ResidencySleep(uint32_t start_us, uint32_t end_us);
+void ResidencyStop(uint32_t stop_us);
+void ResidencySnapshot(ResidencyReport *report);
+
+#endif /* RESIDENCY_H */
@@ -0,0 +1,86 @@
+/**
+ * @file retained.h
+ * @brief Diagnostics kept in .noinit RAM across warm resets.
+ *
+ * With RETAINED_DIAG one record lives in the .noinit section, which the
+ * startup code neither copies nor zeroes. It holds a magic word (derived
+ * from the record size, so a firmware with another layout starts over) and
+ * a CRC-8 over the payload. RetainedInit() checks both at boot: a power-on
+ * or a corrupted record starts from zero, a warm reset (Error_Handler(),
+ * fault, watchdog, NRST, debugger) keeps counting.
+ *
+ * While running, RetainedService() copies the latency statistics and the
+ * I2C error counters into the record every RETAINED_SAVE_MS. Error_Handler()
+ * and the fault handlers (NMI, HardFault, MemManage, BusFault, UsageFault)
+ * store the caller or the stacked fault frame.
+ *
+ * Recovery policy, with or without the record: with FAULT_RESET those
+ * paths reset the core instead of spinning, so a unit in the field is back
+ * in about a millisecond (clock setup and a 10 us pull-up settle, the boot
+ * path has nothing slower) with the cause kept; the watchdog (watchdog.h)
+ * covers hangs that never reach a handler. With a debugger attached they
+ * stop at a breakpoint instead, so the fault can still be inspected.
+ *
+ * The master reads the record as it was at boot, before this run saved
+ * anything, from RIGHT_KEYBOARD_REG_RETAINED.
+ */
+
+#ifndef RETAINED_H
+#define RETAINED_H
+
+#include "stm32f4xx_hal.h"
+#include "right_side_keyboard.h"
+#include "latency_stats.h"
+
+// Keep diagnostics across warm resets (0 = compiled out)
+#ifndef RETAINED_DIAG
+#define RETAINED_DIAG 0
+#endif
+
+// Interval between copies of the running statistics into the record
+#ifndef RETAINED_SAVE_MS
+#define RETAINED_SAVE_MS 1000u
+#endif
+
+// Reset after Error_Handler() or a fault instead of spinning (0 = spin)
+#ifndef FAULT_RESET
+#define FAULT_RESET 1
+#endif
+
+// The fault handlers branch to RetainedFaultEntry()
+#define RETAINED_FAULT_HOOK (RETAINED_DIAG || FAULT_RESET)
+
+// Fault context stacked by the core on exception entry, plus the fault
+// status registers
+typedef struct __attribute__((packed)) {
+    uint32_t exception;         // IPSR: 2 NMI, 3 HardFault, 4 MemManage, 5 BusFault, 6 UsageFault
+    uint32_t pc;
+    uint32_t lr;
+    uint32_t psr;
+    uint32_t cfsr;
+    uint32_t hfsr;
+    uint32_t mmfar;
+    uint32_t bfar;
+} RetainedFault;
+
+// Retained register, little endian
+typedef struct __attribute__((packed)) {
+    uint32_t boots;             // Resets since the record was started, 1 after power-on
+    uint32_t reset_flags;       // RCC->CSR of this boot, reset cause in bits 31-24
+    uint32_t errors;            // Error_Handler() calls
+    uint32_t error_caller;      // Return address of the last Error_Handler() call
+    uint32_t faults;            // Fault handler entries
+    RetainedFault fault;        // Last fault
+    uint32_t saved_tick_ms;     // HAL tick of the last save before the reset
+    LatencyReport latency;      // As of the last save
+    RightKeyboardI2CHealth i2c_health;  // As of the last save
+} RetainedReport;
+
+// Function prototypes
+void RetainedInit(void);
+void RetainedService(void);
+void RetainedError(uint32_t caller);
+void RetainedFaultEntry(void);
+void RetainedSnapshot(RetainedReport *report);
+
+#endif /* RETAINED_H */
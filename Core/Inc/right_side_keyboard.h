@@ -7,29 +7,841 @@
 #define RIGHT_SIDE_KEYBOARD_H
 
 #include "stm32f4xx_hal.h"
+#include "board.h"
 #include <stdbool.h>
 
+// Key wiring
+// KEY_WIRING_DIRECT: one pin per key, KEY_MAP in keyboard_layout.h
+// KEY_WIRING_MATRIX: rows and columns, keyboard_matrix.h; columns are strobed
+//                    by the CPU (SCAN_MODE_POLL) or by TIM1/DMA2 while a
+//                    second stream captures the rows (SCAN_MODE_DMA)
+// KEY_WIRING_HALL:   analog Hall-effect sensors on ADC1 inputs behind analog
+//                    muxes, hall_sensor.h; sampled by TIM3/DMA (SCAN_MODE_DMA)
+#define KEY_WIRING_DIRECT 0
+#define KEY_WIRING_MATRIX 1
+#define KEY_WIRING_HALL   2
+
+#ifndef KEY_WIRING
+#define KEY_WIRING KEY_WIRING_DIRECT
+#endif
+
+// Number of keys on the right side
+#if KEY_WIRING == KEY_WIRING_MATRIX
+#include "keyboard_matrix.h"
+#define NUM_KEYS (MATRIX_ROWS * MATRIX_COLS)
+#elif KEY_WIRING == KEY_WIRING_HALL
+#include "hall_sensor.h"
+#define NUM_KEYS HALL_KEYS
+#else
+#include "keyboard_layout.h"
+#define NUM_KEYS KEY_MAP_COUNT
+_Static_assert((KEY_MASK_B & BOARD_I2C_PINS) == 0, "KEY_MAP uses the I2C1 pins of the link");
+#endif
+
+// Every layer works on one packed 32-bit key word
+#if NUM_KEYS > 32
+#error "At most 32 keys fit the packed key word"
+#endif
+
+// Bytes of the key bitmap, one bit per key
+#define RIGHT_KEYBOARD_REPORT_BYTES ((NUM_KEYS + 7) / 8)
+
+// Key bits of the report word, whole bytes
+#define RIGHT_KEYBOARD_REPORT_KEY_MASK (0xFFFFFFFFu >> (32 - 8 * RIGHT_KEYBOARD_REPORT_BYTES))
+
+// Flags in the report word above the key bytes, never sent (up to 24 keys)
+#if RIGHT_KEYBOARD_REPORT_BYTES < 4
+#define RIGHT_KEYBOARD_REPORT_SEQ_SHIFT 24
+#define RIGHT_KEYBOARD_REPORT_SEQ_MASK  0x0F000000u  // Bumped on every publish
+#endif
+
 // Define the keyboard state structure
-// This will be sent over I2C to the left side
-typedef struct {
-    // Each bit represents a key state (0 = pressed, 1 = not pressed)
-    // For 16 keys, we need 2 bytes
-    uint8_t key_states[3];
+// This will be sent over I2C to the left side. The report is one 32-bit
+// word so it is published and read with a single store and load; only the
+// first RIGHT_KEYBOARD_REPORT_BYTES bytes go on the wire, the same bytes
+// as the plain bitmap.
+typedef union {
+    uint32_t word;
+    // Each bit represents a key state (0 = pressed, 1 = not pressed),
+    // key n in bit n % 8 of byte n / 8
+    uint8_t  key_states[RIGHT_KEYBOARD_REPORT_BYTES];
 } RightKeyboardState;
 
 // I2C slave address for this keyboard half
+#ifndef RIGHT_KEYBOARD_I2C_ADDRESS
 #define RIGHT_KEYBOARD_I2C_ADDRESS 0x42
+#endif
 
-// Number of keys on the right side
-#define NUM_KEYS 24
+#if RIGHT_KEYBOARD_I2C_ADDRESS < 0x08 || RIGHT_KEYBOARD_I2C_ADDRESS > 0x77
+#error "RIGHT_KEYBOARD_I2C_ADDRESS must be a 7-bit address outside the reserved ranges"
+#endif
+
+// Diagnostics address, the second own address of I2C1 (OAR2). With it set
+// the report address above only serves reads of the default register and
+// ignores writes, so the hot path never sees a register pointer; pointer
+// writes and every other register go through this address
+// (0 = one address for everything)
+#ifndef I2C_DIAG_ADDRESS
+#define I2C_DIAG_ADDRESS 0
+#endif
+
+#if I2C_DIAG_ADDRESS == RIGHT_KEYBOARD_I2C_ADDRESS || I2C_DIAG_ADDRESS > 0x7F
+#error "I2C_DIAG_ADDRESS must be a free 7-bit address"
+#endif
+
+// Maximum number of pressed keys in the report published to the left half
+// (0 means no limit), ignored by REPORT_TYPE_NKRO
+#ifndef REPORT_MAX_KEYS
+#define REPORT_MAX_KEYS 6
+#endif
+
+// Which keys the report keeps once more than REPORT_MAX_KEYS are held, a
+// KeyRolloverPolicy (key_report.h): KEY_ROLLOVER_FIRST keeps the first
+// pressed, KEY_ROLLOVER_LAST the last pressed, KEY_ROLLOVER_INDEX the lowest
+// key indices, KEY_ROLLOVER_ALL every key. The master can change the policy
+// and the limit at run time through RIGHT_KEYBOARD_REG_ROLLOVER.
+#ifndef REPORT_ROLLOVER
+#define REPORT_ROLLOVER KEY_ROLLOVER_FIRST
+#endif
+
+// Report type sent to the left half
+// REPORT_TYPE_BITMAP: level bitmap (RightKeyboardState, 3 bytes for 24 keys)
+//                     with the REPORT_MAX_KEYS rollover limit
+// REPORT_TYPE_EVENTS: oldest queued key event per read (KeyEvent), so the
+//                     master can rebuild exact press order and timing
+// REPORT_TYPE_DELTA:  status byte first, the master stops after it while
+//                     nothing changed (RightKeyboardDelta)
+// REPORT_TYPE_EVENT_BATCH: count byte, then every queued event that fits,
+//                     so a chord or roll drains in one read
+// REPORT_TYPE_NKRO:   the bitmap with every debounced key, no rollover
+//                     stage, RIGHT_KEYBOARD_REPORT_BYTES long; the master
+//                     applies its own rollover
+// REPORT_TYPE_KEYCODES: HID usage codes resolved through the on-device
+//                     keymap (KeymapReport, keymap.h), modifiers count
+//                     towards REPORT_MAX_KEYS
+// REPORT_TYPE_HID:    the master's USB keyboard report fragment
+//                     (HidFragment, hid_fragment.h), boot or NKRO layout,
+//                     kept up to date on this half to be copied as is
+// REPORT_TYPE_PACKED: status byte, then every queued event that fits,
+//                     delta-coded, about 2 bytes each (event_pack.h)
+#define REPORT_TYPE_BITMAP      0
+#define REPORT_TYPE_EVENTS      1
+#define REPORT_TYPE_DELTA       2
+#define REPORT_TYPE_EVENT_BATCH 3
+#define REPORT_TYPE_NKRO        4
+#define REPORT_TYPE_KEYCODES    5
+#define REPORT_TYPE_HID         6
+#define REPORT_TYPE_PACKED      7
+
+#ifndef REPORT_TYPE
+#define REPORT_TYPE REPORT_TYPE_BITMAP
+#endif
+
+// Key limit the published report starts with
+#if REPORT_TYPE == REPORT_TYPE_NKRO
+#define REPORT_KEY_LIMIT 0
+#else
+#define REPORT_KEY_LIMIT REPORT_MAX_KEYS
+#endif
+
+// Key events are only recorded by the report types that send them
+#define REPORT_RECORDS_EVENTS (REPORT_TYPE == REPORT_TYPE_EVENTS || REPORT_TYPE == REPORT_TYPE_EVENT_BATCH || \
+                               REPORT_TYPE == REPORT_TYPE_PACKED)
+
+// I2C register map
+// A master write sets the register pointer (first byte), the next read
+// streams that register, usually as write + repeated start + read in one
+// transaction. The pointer falls back to RIGHT_KEYBOARD_REG_DEFAULT after
+// every read, so a plain read always returns the configured report.
+#define RIGHT_KEYBOARD_REG_KEYS       0x00  // RightKeyboardState bitmap
+#define RIGHT_KEYBOARD_REG_EVENT      0x01  // Oldest KeyEvent, dequeued once fully read
+#define RIGHT_KEYBOARD_REG_COUNTERS   0x02  // RightKeyboardCounters
+#define RIGHT_KEYBOARD_REG_CONFIG     0x03  // RightKeyboardConfig
+#define RIGHT_KEYBOARD_REG_DELTA      0x04  // RightKeyboardDelta, acknowledged once fully read
+#define RIGHT_KEYBOARD_REG_EVENTS     0x05  // Count byte + up to REPORT_EVENT_BATCH KeyEvents
+#define RIGHT_KEYBOARD_REG_SCAN_RATE  0x06  // RightKeyboardScanRate
+#define RIGHT_KEYBOARD_REG_LATENCY    0x07  // LatencyReport, latency_stats.h
+#define RIGHT_KEYBOARD_REG_CHATTER    0x08  // ChatterKeyStats[NUM_KEYS], chatter_stats.h
+#define RIGHT_KEYBOARD_REG_I2C_HEALTH 0x09  // RightKeyboardI2CHealth
+#define RIGHT_KEYBOARD_REG_BENCH      0x0A  // BenchReport, bench.h
+#define RIGHT_KEYBOARD_REG_CAPTURE    0x0B  // RawCaptureChunk, raw_capture.h; writable
+#define RIGHT_KEYBOARD_REG_JITTER     0x0C  // ScanJitterReport, scan_jitter.h
+#define RIGHT_KEYBOARD_REG_RETAINED   0x0D  // RetainedReport of this boot, retained.h
+#define RIGHT_KEYBOARD_REG_DEBOUNCE   0x0E  // RightKeyboardDebounceProfile[DEBOUNCE_PROFILES]; writable
+#define RIGHT_KEYBOARD_REG_WINDOWS    0x0F  // uint16_t[NUM_KEYS] lockout window per key in us
+#define RIGHT_KEYBOARD_REG_PROFILE    0x10  // ProfileStats of slot (register - 0x10), profile.h
+#define RIGHT_KEYBOARD_REG_ROLLOVER   0x20  // RightKeyboardRollover; writable
+#define RIGHT_KEYBOARD_REG_LAYERS     0x21  // Active keymap layers, one byte, bit n = layer n; writable
+#define RIGHT_KEYBOARD_REG_CODES      0x22  // KeymapReport of the published keys, keymap.h
+#define RIGHT_KEYBOARD_REG_ACTIONS    0x23  // Oldest TapHoldAction, dequeued once fully read, tap_hold.h
+#define RIGHT_KEYBOARD_REG_HID        0x24  // HidFragment of the published keys, hid_fragment.h
+#define RIGHT_KEYBOARD_REG_TIME       0x25  // TimeSyncReport, time_sync.h; writable
+#define RIGHT_KEYBOARD_REG_SETTINGS   0x26  // RightKeyboardSettings, live tuning; writable
+#define RIGHT_KEYBOARD_REG_UPDATE     0x27  // FwUpdateStatus, fw_update.h; writable
+#define RIGHT_KEYBOARD_REG_CAPS       0x28  // RightKeyboardCaps, read once at master startup
+#define RIGHT_KEYBOARD_REG_POWER      0x29  // RightKeyboardPower, host suspend handshake; writable
+#define RIGHT_KEYBOARD_REG_HALL       0x2A  // HallKeyState[NUM_KEYS], hall_sensor.h; writable
+#define RIGHT_KEYBOARD_REG_ENCODER    0x2B  // EncoderPosition, encoder.h
+#define RIGHT_KEYBOARD_REG_LEDS       0x2C  // RGB per LED, led_strip.h; writable
+#define RIGHT_KEYBOARD_REG_TASKS      0x2D  // SchedTaskStats[SCHED_TASKS], sched.h
+#define RIGHT_KEYBOARD_REG_REPLAY     0x2E  // RightKeyboardReplay + up to REPORT_EVENT_BATCH KeyEvents; writable
+#define RIGHT_KEYBOARD_REG_PACKED     0x2F  // Up to REPORT_EVENT_BATCH packed events, event_pack.h; writable
+#define RIGHT_KEYBOARD_REG_FAULT      0x30  // I2CFaultReport, i2c_fault.h; writable
+#define RIGHT_KEYBOARD_REG_RESIDENCY  0x31  // ResidencyReport, residency.h
+#define RIGHT_KEYBOARD_REG_LAST       RIGHT_KEYBOARD_REG_RESIDENCY
+
+// Version of the register map and frame layouts in RightKeyboardCaps,
+// bumped on every change an older master would misread. Registers added
+// at the end with their feature bit do not bump it.
+#define RIGHT_KEYBOARD_PROTOCOL_VERSION 1
+
+#if REPORT_TYPE == REPORT_TYPE_EVENTS
+#define RIGHT_KEYBOARD_REG_DEFAULT RIGHT_KEYBOARD_REG_EVENT
+#elif REPORT_TYPE == REPORT_TYPE_DELTA
+#define RIGHT_KEYBOARD_REG_DEFAULT RIGHT_KEYBOARD_REG_DELTA
+#elif REPORT_TYPE == REPORT_TYPE_EVENT_BATCH
+#define RIGHT_KEYBOARD_REG_DEFAULT RIGHT_KEYBOARD_REG_EVENTS
+#elif REPORT_TYPE == REPORT_TYPE_KEYCODES
+#define RIGHT_KEYBOARD_REG_DEFAULT RIGHT_KEYBOARD_REG_CODES
+#elif REPORT_TYPE == REPORT_TYPE_HID
+#define RIGHT_KEYBOARD_REG_DEFAULT RIGHT_KEYBOARD_REG_HID
+#elif REPORT_TYPE == REPORT_TYPE_PACKED
+#define RIGHT_KEYBOARD_REG_DEFAULT RIGHT_KEYBOARD_REG_PACKED
+#else
+#define RIGHT_KEYBOARD_REG_DEFAULT RIGHT_KEYBOARD_REG_KEYS
+#endif
+
+// Most events packed into one read of RIGHT_KEYBOARD_REG_EVENTS (and the
+// replay and packed registers). Every event the master read completely is
+// dequeued, a short read keeps the rest.
+#ifndef REPORT_EVENT_BATCH
+#define REPORT_EVENT_BATCH 8
+#endif
+
+// Count byte of the event batch and replay frames: the event queue is past
+// its high water or has overflowed (KeyEventBacklog(), key_events.h); the
+// count is in the low bits
+#define RIGHT_KEYBOARD_EVENTS_BACKLOG    0x80
+#define RIGHT_KEYBOARD_EVENTS_COUNT_MASK 0x7F
+
+// Report integrity: every frame read from the register map starts with a
+// RightKeyboardReportHeader, so the master can trust a single read and only
+// resync when the sequence skips (0 = bare payload)
+#ifndef REPORT_INTEGRITY
+#define REPORT_INTEGRITY 0
+#endif
+
+// Scan at address match: a read of the key, event or delta register first runs
+// a scan from the I2C address interrupt, so the first data byte reflects the
+// pins a few microseconds earlier instead of the last main loop scan
+// (0 = serve the last published snapshot)
+#ifndef SCAN_ON_ADDRESS_MATCH
+#define SCAN_ON_ADDRESS_MATCH 0
+#endif
+
+// Chord coalescing window in microseconds: the first accepted edge opens
+// it, edges accepted until it closes go out with it as one snapshot under
+// one report sequence number, with one data-ready edge. Every report waits
+// out the window, rounded up to the next scan; the event queue keeps each
+// edge with its own time (0 = publish every change at once)
+#ifndef CHORD_WINDOW_US
+#define CHORD_WINDOW_US 0u
+#endif
+
+// Data-ready line to the left half: open drain, active low, needs the
+// master's pull-up. Asserted when the debounced state or the event queue
+// changes, released once the master fully read a report that covers every
+// change (0 = master polls)
+#ifndef DATA_READY_ENABLE
+#define DATA_READY_ENABLE 0
+#endif
+
+#ifndef DATA_READY_PORT
+#define DATA_READY_PORT GPIOA
+#define DATA_READY_PIN  GPIO_PIN_15
+#endif
+
+// Boot debug pin: driven low first thing after reset and high once the
+// first report is scanned and the slave listens, so a scope on NRST and
+// this pin shows the boot-to-ready time (0 = pin unused)
+#ifndef BOOT_READY_PIN_ENABLE
+#define BOOT_READY_PIN_ENABLE 0
+#endif
+
+#ifndef BOOT_READY_PORT
+#define BOOT_READY_PORT GPIOC
+#define BOOT_READY_PIN  GPIO_PIN_13
+#endif
+
+// Time the internal pull-ups get to charge the key lines before the first
+// sample, in microseconds (~40 kOhm into a few tens of pF)
+#ifndef KEY_PULLUP_SETTLE_US
+#define KEY_PULLUP_SETTLE_US 10
+#endif
+
+// Bus-stuck detection: SCL or SDA held low, or BUSY set, with no transfer
+// to this slave for this long resets I2C1. Must exceed the longest frame
+// (about 5 ms for a full event batch at 100 kHz).
+#ifndef I2C_STUCK_TIMEOUT_MS
+#define I2C_STUCK_TIMEOUT_MS 10
+#endif
+
+// General-call sample strobe: with GeneralCallMode enabled the master can
+// write RIGHT_KEYBOARD_GC_SAMPLE to address 0x00 and both halves latch their
+// state at the same instant. The next key or delta read returns the latched
+// snapshot instead of the live one (0 = general call ignored).
+#ifndef I2C_GENERAL_CALL_SAMPLE
+#define I2C_GENERAL_CALL_SAMPLE 0
+#endif
+
+#if I2C_GENERAL_CALL_SAMPLE
+#define I2C_GENERAL_CALL_MODE I2C_GENERALCALL_ENABLE
+#else
+#define I2C_GENERAL_CALL_MODE I2C_GENERALCALL_DISABLE
+#endif
+
+// General-call command byte of the sample strobe (even, so not a hardware
+// general call, and not one of the codes the I2C spec reserves)
+#define RIGHT_KEYBOARD_GC_SAMPLE 0x5A
+
+// Byte returned for a read of an unknown register
+#define RIGHT_KEYBOARD_REG_INVALID 0xFF
+
+// Frame header with REPORT_INTEGRITY
+typedef struct __attribute__((packed)) {
+    uint8_t sequence;           // Bumped on every read served
+    uint8_t crc;                // CRC-8 (crc8.h) over sequence and payload
+} RightKeyboardReportHeader;
+
+// Delta register: keys changed since the last fully read delta
+// The sequence counts acknowledged deltas, a master whose own count differs
+// (slave reset, missed read) resyncs from RIGHT_KEYBOARD_REG_KEYS.
+#define RIGHT_KEYBOARD_DELTA_CHANGED  0x80
+#define RIGHT_KEYBOARD_DELTA_SEQ_MASK 0x7F
+
+typedef struct __attribute__((packed)) {
+    uint8_t status;             // RIGHT_KEYBOARD_DELTA_CHANGED | sequence
+    uint8_t changed[RIGHT_KEYBOARD_REPORT_BYTES]; // 1 = key flipped, XOR into the last bitmap
+} RightKeyboardDelta;
+
+// Counters register, little endian
+typedef struct __attribute__((packed)) {
+    uint32_t scan_count;        // Debounce passes since boot
+    uint32_t events_dropped;    // Events lost to a full queue
+    uint8_t  events_queued;     // Events waiting to be read
+    uint16_t i2c_recoveries;    // I2C1 resets after a stuck bus or bus error
+    uint16_t i2c_recovery_ms;   // Downtime of the last one, fault seen to listening
+    uint16_t i2c_stretch_max_cycles; // Longest SCL stretch at a read start (I2C_SLAVE_STRETCH_STATS)
+    uint16_t deep_idle_entries; // STOP entries (DEEP_IDLE_ENABLE)
+    uint16_t deep_idle_wake_us; // Last STOP exit to clocks restored, upper bound
+    uint16_t stack_free_bytes;  // Stack reserve never touched since boot (STACK_MONITOR)
+    uint8_t  hse_failures;      // HSE crystal failures, running on HSI since (CLOCK_CSS_ENABLE)
+} RightKeyboardCounters;
+
+// I2C health register, little endian. Always counted, all fields wrap; the
+// master takes differences between two reads and divides by the tick_ms
+// difference for rates. AF counts a write stopped early or a read NACKed
+// before the end of its frame, not the NACK that normally ends a read.
+typedef struct __attribute__((packed)) {
+    uint32_t tick_ms;           // HAL tick when the snapshot was taken
+    uint32_t reads;             // Reads that returned at least one byte
+    uint32_t writes;            // Register pointer and general-call writes
+    uint32_t bytes_sent;        // Frame bytes that reached the master
+    uint32_t bytes_received;    // Bytes written by the master
+    uint16_t berr;              // Misplaced START or STOP
+    uint16_t arlo;              // Arbitration lost
+    uint16_t af;                // Early NACK or STOP
+    uint16_t ovr;               // Overrun or underrun
+    uint16_t recoveries;        // I2C1 resets, as in RightKeyboardCounters
+    uint32_t listen_rearms;     // Listen mode restarts (HAL drivers)
+} RightKeyboardI2CHealth;
+
+// Scan rate register, little endian. The master can poll changes to spot
+// a rate step, the time between scans bounds the report latency.
+typedef struct __attribute__((packed)) {
+    uint32_t interval_us;       // Time between scans now (0 = edge driven, SCAN_MODE_EXTI)
+    uint8_t  level;             // ScanRateLevel (scan_rate.h)
+    uint8_t  changes;           // Level changes since boot, wraps
+} RightKeyboardScanRate;
+
+// Debounce register entry, little endian. Writing the register takes
+// profile index, then one entry: 11 bytes with the pointer.
+typedef struct __attribute__((packed)) {
+    uint32_t keys;              // Keys in the profile
+    uint8_t  flags;             // RIGHT_KEYBOARD_DEBOUNCE_* policy bits
+    uint16_t press_us;          // Press window
+    uint16_t release_us;        // Release window
+} RightKeyboardDebounceProfile;
+
+#define RIGHT_KEYBOARD_DEBOUNCE_PRESS_DEFERRED   0x01    // Clear = eager press
+#define RIGHT_KEYBOARD_DEBOUNCE_RELEASE_DEFERRED 0x02    // Clear = eager release
+
+// Replay register: events by sequence number, key_events.h. Writing it
+// takes the 16-bit number of the first event wanted, 3 bytes with the
+// pointer; the read returns this header and the events from there on,
+// delivered or still queued, oldest first. first != the number asked for
+// means events older than the history were lost, resync from
+// RIGHT_KEYBOARD_REG_KEYS. Every event read completely is dequeued as
+// from RIGHT_KEYBOARD_REG_EVENTS, and a pointer write without a number
+// continues behind the last event read. After a queue overflow the frame
+// holds the KEY_EVENT_RESYNC record alone, with first = next.
+typedef struct __attribute__((packed)) {
+    uint16_t first;             // Sequence number of the first event in the frame
+    uint16_t next;              // Sequence number the next recorded event gets
+    uint8_t  count;             // Events in the frame | RIGHT_KEYBOARD_EVENTS_BACKLOG
+} RightKeyboardReplay;
+
+// Rollover register. Writing it takes policy, then the key limit: 3 bytes
+// with the pointer; an unknown policy leaves both unchanged. Read-only
+// with REPORT_TYPE_NKRO.
+typedef struct __attribute__((packed)) {
+    uint8_t policy;             // KeyRolloverPolicy, key_report.h
+    uint8_t max_keys;           // Keys kept in the report (0 = no limit)
+    uint8_t held;               // Keys held right now
+} RightKeyboardRollover;
+
+// Settings register, little endian: the run-time tunables in one block.
+// Writing it takes a whole block up to the counters, 10 bytes with the
+// pointer; the master reads, edits and writes back. The block is checked
+// as a whole (unknown register or policy, intervals out of order, a zero
+// lockout) and either staged or rejected, the next scan then applies
+// every field at once before it debounces. Fields an engine or scan mode
+// lacks read as 0 and must be written as read.
+typedef struct __attribute__((packed)) {
+    uint8_t  default_register;  // Read without a pointer write, one of the report registers
+    uint8_t  rollover_policy;   // As the rollover register (fixed with REPORT_TYPE_NKRO)
+    uint8_t  rollover_max_keys;
+    uint16_t scan_fast_us;      // SCAN_MODE_POLL interval while keys move (SCAN_RATE_FAST_US)
+    uint16_t scan_slow_us;      // and once idle (SCAN_POLL_INTERVAL_MS), SCAN_RATE_MEDIUM_US between
+    uint16_t lockout_us;        // DEBOUNCE_LOCKOUT window
+    uint8_t  applied;           // Blocks applied since boot, wraps; ignored on write
+    uint8_t  rejected;          // Blocks rejected since boot, wraps; ignored on write
+} RightKeyboardSettings;
+
+// Power register: the master writes one RIGHT_KEYBOARD_POWER_* byte when
+// the host suspends or resumes. A key press in a low-power state returns to
+// RIGHT_KEYBOARD_POWER_ACTIVE by itself and raises the data-ready line
+// (DATA_READY_ENABLE), which doubles as the master's wake-up source.
+// States this build can't enter are rejected and leave the state as is.
+#define RIGHT_KEYBOARD_POWER_ACTIVE 0   // Normal scanning
+#define RIGHT_KEYBOARD_POWER_SLOW   1   // SCAN_MODE_POLL: slow interval whenever the keys are settled
+#define RIGHT_KEYBOARD_POWER_STOP   2   // DEEP_IDLE_ENABLE: STOP right away, not after DEEP_IDLE_AFTER_MS
+#define RIGHT_KEYBOARD_POWER_STATES 3
+
+typedef struct __attribute__((packed)) {
+    uint8_t state;              // RIGHT_KEYBOARD_POWER_*
+    uint8_t supported;          // Bit n set: state n can be written
+    uint8_t resumes;            // Low-power states left on a key press, wraps
+    uint8_t rejected;           // Writes of an unsupported state, wraps
+} RightKeyboardPower;
+
+// Config register, read-only build settings
+typedef struct __attribute__((packed)) {
+    uint8_t num_keys;
+    uint8_t report_max_keys;
+    uint8_t debounce_time_ms;
+    uint8_t report_type;
+    uint8_t scan_mode;
+    uint8_t report_bytes;       // Bytes of the key bitmap, RIGHT_KEYBOARD_REPORT_BYTES
+    uint8_t hid_format;         // HID_FRAGMENT_FORMAT, hid_fragment.h
+    uint8_t hid_bytes;          // Length of RIGHT_KEYBOARD_REG_HID, 0 if compiled out
+    uint8_t board;              // BOARD, board.h
+} RightKeyboardConfig;
+
+// Capability register, read-only: what this build serves, so the master
+// picks the cheapest report both halves support (its default register goes
+// into the settings block) instead of probing registers
+typedef struct __attribute__((packed)) {
+    uint8_t  protocol_version;  // RIGHT_KEYBOARD_PROTOCOL_VERSION
+    uint8_t  num_keys;
+    uint8_t  report_type;       // REPORT_TYPE of this build
+    uint8_t  report_types;      // Bit n set: REPORT_TYPE n can be read (and set as default register)
+    uint8_t  transport;         // LINK_TRANSPORT
+    uint8_t  last_register;     // RIGHT_KEYBOARD_REG_LAST
+    uint16_t event_queue_len;   // Events held before the oldest is dropped, 0 if none are recorded
+    uint8_t  event_batch;       // Most events in one read of RIGHT_KEYBOARD_REG_EVENTS
+    uint8_t  debounce_algorithm;
+    uint16_t timestamp_ns;      // Tick of every timestamp (TIM5, timebase.h)
+    uint16_t features;          // RIGHT_KEYBOARD_CAP_*
+    uint16_t features2;         // RIGHT_KEYBOARD_CAP2_*, once features ran out of bits
+} RightKeyboardCaps;
+
+// Feature bits of RightKeyboardCaps
+#define RIGHT_KEYBOARD_CAP_INTEGRITY    0x0001u  // Frames start with RightKeyboardReportHeader
+#define RIGHT_KEYBOARD_CAP_TIME_SYNC    0x0002u  // Timestamps in master time, RIGHT_KEYBOARD_REG_TIME
+#define RIGHT_KEYBOARD_CAP_CONFIG_STORE 0x0004u  // Settings and debounce writes survive a reset
+#define RIGHT_KEYBOARD_CAP_FW_UPDATE    0x0008u  // RIGHT_KEYBOARD_REG_UPDATE
+#define RIGHT_KEYBOARD_CAP_DATA_READY   0x0010u  // Data-ready line
+#define RIGHT_KEYBOARD_CAP_GENERAL_CALL 0x0020u  // General-call sample strobe
+#define RIGHT_KEYBOARD_CAP_TAP_HOLD     0x0040u  // RIGHT_KEYBOARD_REG_ACTIONS
+#define RIGHT_KEYBOARD_CAP_DEBOUNCE     0x0080u  // RIGHT_KEYBOARD_REG_DEBOUNCE takes writes
+#define RIGHT_KEYBOARD_CAP_ADDR_SCAN    0x0100u  // SCAN_ON_ADDRESS_MATCH
+#define RIGHT_KEYBOARD_CAP_USB_HID      0x0200u  // USB keyboard role built in
+#define RIGHT_KEYBOARD_CAP_DIAG_ADDRESS 0x0400u  // Register map on I2C_DIAG_ADDRESS, reports only on the main one
+#define RIGHT_KEYBOARD_CAP_RAPID_TRIGGER 0x0800u // Hall keys take rapid-trigger deltas, RIGHT_KEYBOARD_REG_HALL
+#define RIGHT_KEYBOARD_CAP_ENCODER      0x1000u  // RIGHT_KEYBOARD_REG_ENCODER, KEY_EVENT_ENCODER events
+#define RIGHT_KEYBOARD_CAP_LEDS         0x2000u  // RIGHT_KEYBOARD_REG_LEDS
+#define RIGHT_KEYBOARD_CAP_REPLAY       0x4000u  // RIGHT_KEYBOARD_REG_REPLAY keeps delivered events
+#define RIGHT_KEYBOARD_CAP_EDGE_CAPTURE 0x8000u  // Event times of EDGE_CAPTURE_PINS keys are TIM5 captures
+
+// Feature bits of RightKeyboardCaps.features2
+#define RIGHT_KEYBOARD_CAP2_RESIDENCY   0x0001u  // RIGHT_KEYBOARD_REG_RESIDENCY counts, RESIDENCY_STATS
+#define RIGHT_KEYBOARD_CAP2_FAULT       0x0002u  // RIGHT_KEYBOARD_REG_FAULT injects faults, I2C_FAULT_ENABLE
+
+// I2C slave driver
+// I2C_DRIVER_HAL:      HAL listen mode, each read armed from HAL_I2C_AddrCallback
+// I2C_DRIVER_REGISTER: lean SR1/SR2/DR driver in i2c_slave.c, always ready,
+//                      the default: no HAL call after MX_I2C1_Init()
+// I2C_DRIVER_HAL_DMA:  as I2C_DRIVER_HAL, reads go out on DMA1 stream 6, one
+//                      interrupt per transfer instead of one per byte
+#define I2C_DRIVER_HAL      0
+#define I2C_DRIVER_REGISTER 1
+#define I2C_DRIVER_HAL_DMA  2
 
-// Debounce time in milliseconds
+#ifndef I2C_DRIVER
+#define I2C_DRIVER I2C_DRIVER_REGISTER
+#endif
+
+// Transport to the left half (link.h)
+// LINK_TRANSPORT_I2C:  I2C1 slave on PB6/PB7 (or PB8/PB9, board.h), driver
+//                      chosen by I2C_DRIVER
+// LINK_TRANSPORT_UART: USART1 full duplex on PB6/PB7 with DMA both ways, the
+//                      same register map in CRC-checked frames (uart_link.h)
+// LINK_TRANSPORT_SPI:  SPI1 slave on PA5-PA7/PA15, key bitmap streamed by
+//                      DMA, register requests framed as for the UART
+//                      (spi_link.h)
+#define LINK_TRANSPORT_I2C  0
+#define LINK_TRANSPORT_UART 1
+#define LINK_TRANSPORT_SPI  2
+
+#ifndef LINK_TRANSPORT
+#define LINK_TRANSPORT LINK_TRANSPORT_I2C
+#endif
+
+#if LINK_TRANSPORT != LINK_TRANSPORT_I2C
+#if I2C_DRIVER != I2C_DRIVER_REGISTER
+#error "I2C_DRIVER only applies to LINK_TRANSPORT_I2C, leave it at I2C_DRIVER_REGISTER"
+#endif
+#if I2C_GENERAL_CALL_SAMPLE
+#error "The general-call strobe needs LINK_TRANSPORT_I2C"
+#endif
+#if I2C_DIAG_ADDRESS
+#error "I2C_DIAG_ADDRESS needs LINK_TRANSPORT_I2C"
+#endif
+#endif
+
+#if LINK_TRANSPORT == LINK_TRANSPORT_UART && BOARD_I2C_SCL_PIN != 6
+#error "LINK_TRANSPORT_UART needs the link on PB6/PB7, USART1 has no PB8/PB9 mapping"
+#endif
+
+#if LINK_TRANSPORT == LINK_TRANSPORT_SPI && KEY_WIRING != KEY_WIRING_MATRIX
+#error "LINK_TRANSPORT_SPI needs KEY_WIRING_MATRIX, direct wiring uses PA5-PA7 and PA15"
+#endif
+
+// USB HID keyboard role on OTG FS (usb_hid.h), 0 = link role only
+#ifndef USB_HID_ENABLE
+#define USB_HID_ENABLE 0
+#endif
+
+// How the USB role is chosen at boot
+// USB_HID_ROLE_AUTO:   USB keyboard while VBUS is present on PA9, split
+//                      link to the left half otherwise
+// USB_HID_ROLE_ALWAYS: always the USB keyboard, for boards without VBUS on PA9
+#define USB_HID_ROLE_AUTO   0
+#define USB_HID_ROLE_ALWAYS 1
+
+#ifndef USB_HID_ROLE
+#define USB_HID_ROLE USB_HID_ROLE_AUTO
+#endif
+
+// I2C link speed profile, the default clock profile follows it
+// I2C_LINK_STANDARD: 100 kHz, 2:1 duty, HSI 16 MHz straight to SYSCLK
+// I2C_LINK_FAST:     400 kHz, 16/9 duty, PLL from HSI to 40 MHz so PCLK1 is
+//                     an exact multiple of 25 x 400 kHz (CCR = 4)
+// The STM32F411 I2C peripheral is specified up to 400 kHz, Fast-mode Plus
+// needs the FMPI2C block that this part does not have.
+#define I2C_LINK_STANDARD 0
+#define I2C_LINK_FAST      1
+
+#ifndef I2C_LINK_PROFILE
+#define I2C_LINK_PROFILE I2C_LINK_STANDARD
+#endif
+
+#if I2C_LINK_PROFILE == I2C_LINK_FAST
+#define I2C_CLOCK_SPEED    400000
+#define I2C_DUTY_CYCLE     I2C_DUTYCYCLE_16_9
+#else
+#define I2C_CLOCK_SPEED    100000
+#define I2C_DUTY_CYCLE     I2C_DUTYCYCLE_2
+#endif
+
+// System clock profile, SystemClock_Config() follows it
+// CLOCK_PROFILE_HSI:     SYSCLK = HSI 16 MHz, no PLL, 0 flash wait states
+// CLOCK_PROFILE_PLL_40:  PLL to 40 MHz, APB1 40 MHz, 1 wait state
+// CLOCK_PROFILE_PLL_100: PLL to 100 MHz, APB1 50 MHz, 3 wait states; both
+//                        I2C rates still divide exactly (CCR 250 / 5)
+// CLOCK_PROFILE_GOVERNOR: switched at run time by clock_governor.c, HSI 16 MHz
+//                        while idle and PLL 64 MHz while keys or I2C are
+//                        active (regulator scale 3, 1 wait state when boosted)
+// CLOCK_PROFILE_PLL_96:  PLL to 96 MHz with the 48 MHz USB clock on Q, APB1
+//                        48 MHz, 3 wait states; 100 kHz I2C divides exactly
+// The PLL runs from HSI or, with CLOCK_PLL_SOURCE_HSE, from the HSE crystal
+// (HSE_VALUE, whole MHz), which falls back to HSI if it fails (clock_css.h).
+// HAL_Init() already enables prefetch and both caches, which hide most of
+// the wait states on the hot loops.
+#define CLOCK_PROFILE_HSI      0
+#define CLOCK_PROFILE_PLL_40   1
+#define CLOCK_PROFILE_PLL_100  2
+#define CLOCK_PROFILE_GOVERNOR 3
+#define CLOCK_PROFILE_PLL_96   4
+
+#ifndef CLOCK_PROFILE
+#if USB_HID_ENABLE
+#define CLOCK_PROFILE CLOCK_PROFILE_PLL_96
+#elif I2C_LINK_PROFILE == I2C_LINK_FAST
+#define CLOCK_PROFILE CLOCK_PROFILE_PLL_40
+#else
+#define CLOCK_PROFILE CLOCK_PROFILE_HSI
+#endif
+#endif
+
+#define CLOCK_PLL_SOURCE_HSI 0
+#define CLOCK_PLL_SOURCE_HSE 1
+
+#ifndef CLOCK_PLL_SOURCE
+#if USB_HID_ENABLE
+#define CLOCK_PLL_SOURCE CLOCK_PLL_SOURCE_HSE
+#else
+#define CLOCK_PLL_SOURCE CLOCK_PLL_SOURCE_HSI
+#endif
+#endif
+
+#if USB_HID_ENABLE && (CLOCK_PROFILE != CLOCK_PROFILE_PLL_96 || CLOCK_PLL_SOURCE != CLOCK_PLL_SOURCE_HSE)
+#error "USB_HID_ENABLE needs CLOCK_PROFILE_PLL_96 on the HSE crystal, HSI is too coarse for full speed"
+#endif
+
+#if CLOCK_PLL_SOURCE == CLOCK_PLL_SOURCE_HSE && CLOCK_PROFILE == CLOCK_PROFILE_HSI
+#error "CLOCK_PLL_SOURCE_HSE needs a PLL clock profile, CLOCK_PROFILE_HSI runs from HSI alone"
+#endif
+
+#if CLOCK_PROFILE == CLOCK_PROFILE_PLL_96 && I2C_LINK_PROFILE == I2C_LINK_FAST
+#error "CLOCK_PROFILE_PLL_96 leaves PCLK1 at 48 MHz, not a multiple of 25 x 400 kHz"
+#endif
+
+// Time without key changes or I2C transfers before the governor drops back
+// to HSI, in milliseconds
+#ifndef CLOCK_GOVERNOR_IDLE_MS
+#define CLOCK_GOVERNOR_IDLE_MS 500
+#endif
+
+#if CLOCK_PROFILE == CLOCK_PROFILE_GOVERNOR && I2C_LINK_PROFILE == I2C_LINK_FAST
+#error "CLOCK_PROFILE_GOVERNOR keeps PCLK1 at 8 MHz, too slow for 400 kHz with 16/9 duty"
+#endif
+
+#if CLOCK_PROFILE == CLOCK_PROFILE_GOVERNOR && LINK_TRANSPORT == LINK_TRANSPORT_UART
+#error "CLOCK_PROFILE_GOVERNOR changes PCLK2 at run time, the UART baud rate would follow it"
+#endif
+
+// Debounce time in milliseconds; Hall sensors do not bounce and a lockout
+// would hold back rapid-trigger re-presses, see hall_sensor.h
+#ifndef DEBOUNCE_TIME_MS
+#if KEY_WIRING == KEY_WIRING_HALL && HALL_RAPID_TRIGGER
+#define DEBOUNCE_TIME_MS 0
+#else
 #define DEBOUNCE_TIME_MS 5
+#endif
+#endif
+
+// Debounce algorithm selection
+// DEBOUNCE_LOCKOUT:          accept an edge instantly, then ignore the key for
+//                            DEBOUNCE_TIME_MS (per-key timestamps)
+// DEBOUNCE_VERTICAL_COUNTER: 2-bit vertical counters clocked once per scan,
+//                            a key flips after 4 consecutive scans at the new
+//                            level (all keys in parallel), so the window is 4
+//                            scan periods; fixed-rate scanning only like
+//                            DEBOUNCE_SAMPLE_COUNT below
+// DEBOUNCE_ASYMMETRIC:       separate policy and window for press and
+//                            release, see the settings below
+// DEBOUNCE_ADAPTIVE:         as DEBOUNCE_LOCKOUT, each key's window follows
+//                            its observed bounce, see the settings below
+// DEBOUNCE_SAMPLE_COUNT:     a key flips after a number of consecutive
+//                            samples at the new level, no time source read;
+//                            fixed-rate scanning only (SCAN_MODE_DMA, or
+//                            SCAN_MODE_POLL without SCAN_RATE_ADAPTIVE)
+// DEBOUNCE_INTEGRATOR:       a saturating counter per key integrates the
+//                            samples, a key flips when its counter reaches
+//                            the far end; four keys per Cortex-M4 SIMD step,
+//                            fixed-rate scanning only like the above
+#define DEBOUNCE_LOCKOUT          0
+#define DEBOUNCE_VERTICAL_COUNTER 1
+#define DEBOUNCE_ASYMMETRIC       2
+#define DEBOUNCE_ADAPTIVE         3
+#define DEBOUNCE_SAMPLE_COUNT     4
+#define DEBOUNCE_INTEGRATOR       5
+
+#ifndef DEBOUNCE_ALGORITHM
+#define DEBOUNCE_ALGORITHM DEBOUNCE_LOCKOUT
+#endif
+
+// Engines that count scans instead of reading the time base
+#define DEBOUNCE_COUNTS_SAMPLES (DEBOUNCE_ALGORITHM == DEBOUNCE_VERTICAL_COUNTER || \
+                                 DEBOUNCE_ALGORITHM == DEBOUNCE_SAMPLE_COUNT || \
+                                 DEBOUNCE_ALGORITHM == DEBOUNCE_INTEGRATOR)
+
+// DEBOUNCE_ASYMMETRIC policy per direction
+// DEBOUNCE_EAGER:    take the edge at once, then ignore the key for the window
+// DEBOUNCE_DEFERRED: take the edge once the new level has held for the
+//                    whole window, a sample at the old level cancels it
+// The default, eager press and deferred release, reports a press on the
+// first sample and keeps release bounce in fast rolls from coming back as
+// a second press.
+#define DEBOUNCE_EAGER    0
+#define DEBOUNCE_DEFERRED 1
+
+#ifndef DEBOUNCE_PRESS_POLICY
+#define DEBOUNCE_PRESS_POLICY DEBOUNCE_EAGER
+#endif
+
+#ifndef DEBOUNCE_RELEASE_POLICY
+#define DEBOUNCE_RELEASE_POLICY DEBOUNCE_DEFERRED
+#endif
+
+// DEBOUNCE_ASYMMETRIC windows in milliseconds, at most 65
+#ifndef DEBOUNCE_PRESS_MS
+#define DEBOUNCE_PRESS_MS DEBOUNCE_TIME_MS
+#endif
+
+#ifndef DEBOUNCE_RELEASE_MS
+#define DEBOUNCE_RELEASE_MS DEBOUNCE_TIME_MS
+#endif
+
+// DEBOUNCE_ASYMMETRIC per-key profiles, applied in order at init on top of
+// profile 0 = every key with the settings above. Up to DEBOUNCE_PROFILES
+// (debounce.h) profiles, a key listed twice ends up in the later one.
+// Eager/eager is the lockout behaviour, deferred/deferred waits out every
+// edge. The master can rewrite a profile through RIGHT_KEYBOARD_REG_DEBOUNCE.
+// X(profile, key mask, press policy, press us, release policy, release us)
+#ifndef DEBOUNCE_PROFILE_TABLE
+#define DEBOUNCE_PROFILE_TABLE(X)
+#endif
+
+// DEBOUNCE_ADAPTIVE bounds in microseconds: the window stays margin above
+// the key's bounce estimate and within min..max. Two accepted edges of a
+// key less than max apart are taken for bounce, so max must stay below the
+// shortest real tap. Every key starts from DEBOUNCE_TIME_MS.
+#ifndef DEBOUNCE_ADAPTIVE_MIN_US
+#define DEBOUNCE_ADAPTIVE_MIN_US 1000u
+#endif
+
+#ifndef DEBOUNCE_ADAPTIVE_MAX_US
+#define DEBOUNCE_ADAPTIVE_MAX_US 20000u
+#endif
+
+#ifndef DEBOUNCE_ADAPTIVE_MARGIN_US
+#define DEBOUNCE_ADAPTIVE_MARGIN_US 1000u
+#endif
+
+// DEBOUNCE_SAMPLE_COUNT: DEBOUNCE_PRESS_SAMPLES and DEBOUNCE_RELEASE_SAMPLES,
+// 1..63, default to the DEBOUNCE_PRESS_MS/DEBOUNCE_RELEASE_MS windows
+// rounded up to whole scan periods (right_side_keyboard.c). Setting them
+// directly gives windows below a millisecond.
+
+// DEBOUNCE_INTEGRATOR: DEBOUNCE_INTEGRATOR_SAMPLES, the counter range,
+// 1..255, defaults to DEBOUNCE_TIME_MS the same way: a clean edge takes
+// that many samples, each sample at the old level in between one more.
+
+#if DEBOUNCE_ADAPTIVE_MIN_US > DEBOUNCE_ADAPTIVE_MAX_US || DEBOUNCE_ADAPTIVE_MAX_US > 65535u
+#error "DEBOUNCE_ADAPTIVE_MIN_US..DEBOUNCE_ADAPTIVE_MAX_US must be an ordered range of at most 65535 us"
+#endif
+
+// Scan engine selection
+// SCAN_MODE_POLL: pins are read by the CPU each time a scan is requested
+// SCAN_MODE_DMA:  TIM1 triggers DMA2 to copy GPIOA/GPIOB IDR into a RAM ring
+//                 at DMA_SAMPLE_RATE_HZ, samples are processed per half-buffer
+// SCAN_MODE_EXTI: key edges raise EXTI interrupts, a burst of scans runs until
+//                 every key is stable and the CPU sleeps in between
+#define SCAN_MODE_POLL 0
+#define SCAN_MODE_DMA  1
+#define SCAN_MODE_EXTI 2
+
+#ifndef SCAN_MODE
+#define SCAN_MODE SCAN_MODE_POLL
+#endif
+
+// SCAN_MODE_POLL: time between scans in milliseconds, the main loop sleeps
+// in WFI in between and wakes on SysTick, I2C and DMA interrupts. With
+// SCAN_RATE_ADAPTIVE (scan_rate.h) this is the slowest, idle rate.
+#ifndef SCAN_POLL_INTERVAL_MS
+#define SCAN_POLL_INTERVAL_MS 10
+#endif
+
+// Deep idle (deep_idle.c): STOP mode after DEEP_IDLE_AFTER_MS without key
+// changes or I2C transfers, SCAN_MODE_EXTI only. Keys with their own EXTI
+// line and a START on SDA wake the core, the other keys are polled every
+// DEEP_IDLE_POLL_MS by the RTC wakeup timer. The transfer that wakes us is
+// NACKed; the core then stays up DEEP_IDLE_GRACE_MS for the master's retry.
+#ifndef DEEP_IDLE_ENABLE
+#define DEEP_IDLE_ENABLE 0
+#endif
+
+#ifndef DEEP_IDLE_AFTER_MS
+#define DEEP_IDLE_AFTER_MS 30000
+#endif
+
+#ifndef DEEP_IDLE_POLL_MS
+#define DEEP_IDLE_POLL_MS 20
+#endif
+
+#ifndef DEEP_IDLE_GRACE_MS
+#define DEEP_IDLE_GRACE_MS 100
+#endif
+
+#if KEY_WIRING == KEY_WIRING_MATRIX && SCAN_MODE == SCAN_MODE_EXTI
+#error "KEY_WIRING_MATRIX needs SCAN_MODE_POLL or SCAN_MODE_DMA"
+#endif
+
+#if KEY_WIRING == KEY_WIRING_MATRIX && SCAN_ON_ADDRESS_MATCH
+#error "SCAN_ON_ADDRESS_MATCH would strobe the columns under a running matrix scan"
+#endif
+
+#if KEY_WIRING == KEY_WIRING_HALL && SCAN_MODE != SCAN_MODE_DMA
+#error "KEY_WIRING_HALL needs SCAN_MODE_DMA, TIM3 and DMA sample the sensors"
+#endif
+
+#if KEY_WIRING == KEY_WIRING_HALL && (SCAN_ON_ADDRESS_MATCH || I2C_GENERAL_CALL_SAMPLE)
+#error "KEY_WIRING_HALL has no pin state to read at an address match, only the last frame"
+#endif
+
+#if DEEP_IDLE_ENABLE && BOARD_I2C_SDA_PIN != 7
+#error "DEEP_IDLE_ENABLE wakes on SDA through EXTI line 7, I2C1 must be on PB6/PB7"
+#endif
+
+#if DEEP_IDLE_ENABLE && USB_HID_ENABLE
+#error "DEEP_IDLE_ENABLE stops the PLL, the USB role needs it running"
+#endif
+
+#if DEEP_IDLE_ENABLE && SCAN_MODE != SCAN_MODE_EXTI
+#error "DEEP_IDLE_ENABLE needs SCAN_MODE_EXTI for the key wake-up lines"
+#endif
+
+#if DEEP_IDLE_POLL_MS < 1 || DEEP_IDLE_POLL_MS > 30000
+#error "DEEP_IDLE_POLL_MS must be between 1 and 30000"
+#endif
 
 // Function prototypes
 bool RightKeyboardInit(void);
 void RightKeyboardScan(RightKeyboardState *state);
 void RightKeyboardScan6KRO(RightKeyboardState *state, uint8_t max_keys);
-void RightKeyboardI2CTransmit(void);
+void RightKeyboardI2CService(void);
+void RightKeyboardI2CHealthSnapshot(RightKeyboardI2CHealth *health);
+void RightKeyboardKeyEdge(void);
+void RightKeyboardProcessSamples(const uint16_t *idr_a, const uint16_t *idr_b, uint32_t count);
+void RightKeyboardProcessMatrix(const uint16_t *rows, uint32_t frames);
+void RightKeyboardProcessHall(const uint32_t *keys, uint32_t frames);
+bool RightKeyboardScanPending(void);
+uint32_t RightKeyboardActivity(void);
+uint8_t RightKeyboardPowerState(void);
+void RightKeyboardScanRequest(void);
+bool RightKeyboardSnapshotConsistent(void);
 
 #endif /* RIGHT_SIDE_KEYBOARD_H */
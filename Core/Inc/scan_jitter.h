@@ -0,0 +1,54 @@
+/**
+ * @file scan_jitter.h
+ * @brief Scan interval jitter and missed-deadline statistics.
+ *
+ * With SCAN_JITTER_STATS the fixed-rate scan paths report the time of
+ * every scheduled scan together with the interval they asked for:
+ *   SCAN_MODE_POLL  each main loop scan, against the interval scheduled by
+ *                   the previous one (scan_rate.c)
+ *   SCAN_MODE_DMA   each half-ring interrupt, against the time its samples
+ *                   span; the samples themselves are always on the timer grid
+ * The deviation of the measured interval from the requested one goes into
+ * a histogram with power-of-two buckets, and an interval longer than
+ * requested by more than SCAN_JITTER_LATE_US counts as a missed deadline.
+ * Extra scans from the I2C interrupt (SCAN_ON_ADDRESS_MATCH, general call)
+ * are not scheduled and not counted. The master reads the statistics from
+ * RIGHT_KEYBOARD_REG_JITTER.
+ */
+
+#ifndef SCAN_JITTER_H
+#define SCAN_JITTER_H
+
+#include "stm32f4xx_hal.h"
+
+// Measure the scan intervals (0 = compiled out)
+#ifndef SCAN_JITTER_STATS
+#define SCAN_JITTER_STATS 0
+#endif
+
+// Lateness past the requested interval that counts as a missed deadline
+#ifndef SCAN_JITTER_LATE_US
+#define SCAN_JITTER_LATE_US 100u
+#endif
+
+// Histogram: bucket 0 counts deviations below 2^SCAN_JITTER_HIST_SHIFT us,
+// each further bucket doubles, the last one takes everything above
+#define SCAN_JITTER_HIST_BUCKETS 8
+#define SCAN_JITTER_HIST_SHIFT   2
+
+// Jitter register, little endian, intervals in microseconds
+typedef struct __attribute__((packed)) {
+    uint32_t scans;             // Intervals measured
+    uint32_t missed;            // Intervals over the request by SCAN_JITTER_LATE_US
+    uint32_t requested_us;      // Interval requested for the last one
+    uint32_t min_us;
+    uint32_t max_us;
+    uint32_t mean_us;           // Computed when the snapshot is taken
+    uint16_t hist[SCAN_JITTER_HIST_BUCKETS];    // |measured - requested|, saturate
+} ScanJitterReport;
+
+// Function prototypes
+void ScanJitterRecord(uint32_t now, uint32_t requested_us);
+void ScanJitterSnapshot(ScanJitterReport *report);
+
+#endif /* SCAN_JITTER_H */
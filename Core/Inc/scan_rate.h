@@ -0,0 +1,66 @@
+/**
+ * @file scan_rate.h
+ * @brief Adaptive scan interval for SCAN_MODE_POLL.
+ *
+ * While any key is bouncing or inside its debounce window the main loop
+ * scans every SCAN_RATE_FAST_US. Once every key is stable the interval
+ * steps down to SCAN_RATE_MEDIUM_US after SCAN_RATE_MEDIUM_AFTER_MS and to
+ * SCAN_POLL_INTERVAL_MS after SCAN_RATE_SLOW_AFTER_MS. Scans between the
+ * HAL ticks are woken by a TIM5 compare (TimebaseWakeAt()). The master sees
+ * the current level in RIGHT_KEYBOARD_REG_SCAN_RATE.
+ */
+
+#ifndef SCAN_RATE_H
+#define SCAN_RATE_H
+
+#include "stm32f4xx_hal.h"
+#include <stdbool.h>
+
+// Step the poll interval with key activity (0 = fixed SCAN_POLL_INTERVAL_MS)
+#ifndef SCAN_RATE_ADAPTIVE
+#define SCAN_RATE_ADAPTIVE 0
+#endif
+
+// Interval while keys are moving, in microseconds (250 = 4 kHz)
+#ifndef SCAN_RATE_FAST_US
+#define SCAN_RATE_FAST_US 250
+#endif
+
+// Interval for the first idle step, in microseconds
+#ifndef SCAN_RATE_MEDIUM_US
+#define SCAN_RATE_MEDIUM_US 1000
+#endif
+
+// Time with every key stable before each step down, in milliseconds
+#ifndef SCAN_RATE_MEDIUM_AFTER_MS
+#define SCAN_RATE_MEDIUM_AFTER_MS 50
+#endif
+
+#ifndef SCAN_RATE_SLOW_AFTER_MS
+#define SCAN_RATE_SLOW_AFTER_MS 1000
+#endif
+
+#if SCAN_RATE_ADAPTIVE && (SCAN_RATE_FAST_US < 50 || SCAN_RATE_FAST_US > SCAN_RATE_MEDIUM_US)
+#error "SCAN_RATE_FAST_US must be 50 us or more and not above SCAN_RATE_MEDIUM_US"
+#endif
+
+#if SCAN_RATE_ADAPTIVE && SCAN_RATE_MEDIUM_AFTER_MS > SCAN_RATE_SLOW_AFTER_MS
+#error "SCAN_RATE_MEDIUM_AFTER_MS must not be above SCAN_RATE_SLOW_AFTER_MS"
+#endif
+
+typedef enum {
+    SCAN_RATE_FAST,
+    SCAN_RATE_MEDIUM,
+    SCAN_RATE_SLOW
+} ScanRateLevel;
+
+// Function prototypes
+void ScanRateInit(uint32_t now);
+uint32_t ScanRateUpdate(bool settled, uint32_t now);
+ScanRateLevel ScanRateCurrent(void);
+uint32_t ScanRateInterval(void);
+uint8_t ScanRateChanges(void);
+void ScanRateSetIntervals(uint32_t fast_us, uint32_t slow_us);
+void ScanRateIntervals(uint32_t *fast_us, uint32_t *slow_us);
+
+#endif /* SCAN_RATE_H */
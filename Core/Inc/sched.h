@@ -0,0 +1,103 @@
+/**
+ * @file sched.h
+ * @brief Cooperative main-loop scheduler with deadlines and run-time stats.
+ *
+ * Every thread-context job of the firmware is one entry of a static task
+ * table, highest priority first (main.c). A task is ready when
+ *   - its period elapsed (period_us, released on a fixed grid),
+ *   - SchedSignal() flagged it, from any context, or
+ *   - its ready() check says so, polled on every pass.
+ * Each pass runs only the most urgent ready task and then starts over, so
+ * the input path (task 0, the scan) never waits behind more than one
+ * lower-priority task. Tasks run to completion and must stay short.
+ *
+ * With nothing ready the idle hook runs, then the core sleeps in WFI until
+ * the next interrupt. Periods can't be shorter than the 1 ms SysTick that
+ * wakes the loop; fast, exact timing belongs to TIM5 compares and the
+ * interrupts.
+ *
+ * Per task the scheduler counts runs, busy time and the longest run, and
+ * every run that started more than deadline_us after its release (period
+ * slot or signal) as a miss; RIGHT_KEYBOARD_REG_TASKS reads them.
+ *
+ * RTOS_ENABLE runs the same table on FreeRTOS instead (cmake -DRTOS=ON,
+ * kernel sources in Middlewares/Third_Party/FreeRTOS, not part of the
+ * tree), for comparing the two on identical work:
+ *   - every entry becomes a task with a static TCB and stack, FreeRTOS
+ *     priority in table order, so the scan preempts everything below it,
+ *   - a task blocks on its notification until its next period slot, or
+ *     SCHED_RTOS_READY_TICKS while it has a ready() check,
+ *   - SchedSignal() notifies the task; from an interrupt above
+ *     configMAX_SYSCALL_INTERRUPT_PRIORITY (the link) it pends the kick
+ *     interrupt (SPI5 vector, unused) which notifies at a legal level,
+ *   - key edges and TIM5 wake-ups signal the scan task,
+ *   - the idle task sleeps tickless (configUSE_TICKLESS_IDLE), TIM5
+ *     carries the HAL tick across the stopped SysTick.
+ * Busy time then includes preemption by higher tasks. Deep idle and the
+ * clock governor are bare-metal only.
+ */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Run the task table on FreeRTOS (0 = cooperative loop); set by the RTOS
+// CMake option
+#ifndef RTOS_ENABLE
+#define RTOS_ENABLE 0
+#endif
+
+// RTOS build: stack of every task in 32-bit words
+#ifndef SCHED_RTOS_STACK_WORDS
+#define SCHED_RTOS_STACK_WORDS 256
+#endif
+
+// RTOS build: ticks between two ready() checks of a task with one
+#ifndef SCHED_RTOS_READY_TICKS
+#define SCHED_RTOS_READY_TICKS 1
+#endif
+
+// Task table order = priority, see main.c
+typedef enum {
+    SCHED_TASK_SCAN,            // Key scan while one is due (POLL/EXTI)
+    SCHED_TASK_FW_UPDATE,       // Firmware update, signaled by the master's request
+    SCHED_TASK_LINK,            // I2C bus recovery, transport service
+    SCHED_TASK_LEDS,            // Next LED frame
+    SCHED_TASK_CLOCK,           // Clock governor
+    SCHED_TASK_CONFIG,          // Settings to flash once quiet
+    SCHED_TASK_RETAINED,        // Retained statistics
+    SCHED_TASK_FAULT,           // I2C fault injection, i2c_fault.h
+    SCHED_TASK_BENCH,           // Debounce engine benchmark, debounce_bench.h
+    SCHED_TASK_WATCHDOG,        // Last, so a starved loop does not feed it
+    SCHED_TASKS
+} SchedTaskId;
+
+_Static_assert(SCHED_TASKS <= 32, "One pending bit per task");
+
+typedef struct {
+    void     (*run)(void);
+    bool     (*ready)(void);    // NULL = period and signals only
+    uint32_t period_us;         // 0 = not periodic
+    uint32_t deadline_us;       // Longest wait after a release, 0 = none
+} SchedTask;
+
+// Accounting of one task, little endian
+typedef struct __attribute__((packed)) {
+    uint32_t runs;
+    uint32_t busy_us;           // Total run time, wraps
+    uint16_t max_us;            // Longest run, saturates
+    uint16_t misses;            // Runs past the deadline, saturates
+} SchedTaskStats;
+
+// Function prototypes
+void SchedInit(const SchedTask *tasks, void (*idle)(void));
+void SchedSignal(SchedTaskId task);
+void SchedRun(void) __attribute__((noreturn));
+void SchedSnapshot(SchedTaskStats *stats);
+void SchedKickIRQHandler(void);
+void SchedRtosPreSleep(void);
+void SchedRtosPostSleep(void);
+
+#endif /* SCHED_H */
@@ -0,0 +1,47 @@
+/**
+ * @file spi_link.h
+ * @brief SPI1 slave link to the left half, DMA in both directions.
+ *
+ * With LINK_TRANSPORT_SPI the master clocks the right half over SPI1 on
+ * AF5: PA5 SCK, PA6 MISO, PA7 MOSI and PA15 NSS, mode 0, MSB first, SCK up
+ * to PCLK2 / 4. These pins only stay free with KEY_WIRING_MATRIX.
+ *
+ * Between requests every transaction returns the key bitmap, the first
+ * RIGHT_KEYBOARD_REPORT_BYTES bytes of the published report, streamed by
+ * DMA straight from the report word. Polling costs the slave no CPU time
+ * per byte, only one interrupt when NSS rises. A transaction that overlaps
+ * a publish may mix bytes of the two reports; masters that need a checked
+ * frame use a request.
+ *
+ * A request is a transaction whose MOSI bytes carry a link.h request. The
+ * next transaction returns its reply on MISO, framed as in link.h, and the
+ * snapshot stream resumes after it. Dummy MOSI bytes must not be
+ * LINK_SYNC_REQUEST, so a master may send its next request while it reads a
+ * reply.
+ *
+ * The slave prepares the next transaction when NSS rises, so the master
+ * leaves a turnaround gap before pulling NSS low again: the NSS interrupt
+ * for a snapshot, plus copying the frame and computing its CRC after a
+ * request. A transaction started earlier returns a stale snapshot or a
+ * reply with a wrong sync byte, which the master drops and reads again.
+ */
+
+#ifndef SPI_LINK_H
+#define SPI_LINK_H
+
+#include "link.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// MOSI bytes taken per transaction, later ones are dropped
+#ifndef SPI_LINK_RX_LEN
+#define SPI_LINK_RX_LEN 32
+#endif
+
+// Function prototypes
+void SpiLinkStart(void);
+void SpiLinkRefresh(void);
+bool SpiLinkBusy(void);
+void SpiLinkNssIRQHandler(void);
+
+#endif /* SPI_LINK_H */
@@ -0,0 +1,35 @@
+/**
+ * @file stack_monitor.h
+ * @brief Stack high-water mark from a painted stack reserve.
+ *
+ * With STACK_MONITOR the _Min_Stack_Size bytes below _estack that the
+ * linker reserves for the MSP are filled with STACK_PAINT_WORD early in
+ * main(), below the live stack pointer. The first word from the bottom that
+ * no longer holds the pattern marks the deepest point the stack reached,
+ * including nested interrupts (I2C at priority 0 preempting a scan, the
+ * scanner called from the I2C callbacks). The static .su files only cover
+ * single frames.
+ *
+ * The free bytes are served in RightKeyboardCounters.stack_free_bytes. A
+ * value of 0 means the stack reached the bottom of the reserve and may have
+ * run into the heap or .bss, the reserve must not be shrunk then.
+ */
+
+#ifndef STACK_MONITOR_H
+#define STACK_MONITOR_H
+
+#include "stm32f4xx_hal.h"
+
+// Paint the stack reserve and track its high-water mark (0 = compiled out)
+#ifndef STACK_MONITOR
+#define STACK_MONITOR 0
+#endif
+
+#define STACK_PAINT_WORD 0xA5A5A5A5u
+
+// Function prototypes
+void StackPaint(void);
+uint32_t StackFreeBytes(void);
+uint32_t StackUsedBytes(void);
+
+#endif /* STACK_MONITOR_H */
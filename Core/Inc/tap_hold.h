@@ -0,0 +1,92 @@
+/**
+ * @file tap_hold.h
+ * @brief Local tap-hold and combo decisions on the keymap codes.
+ *
+ * With TAP_HOLD_ENABLE every accepted edge goes through this stage, and the
+ * master reads the outcome as resolved actions (usage code, press or
+ * release, time) from RIGHT_KEYBOARD_REG_ACTIONS, one per read like the
+ * event register. All decisions use the scan's microsecond timestamps, so
+ * the master's poll interval no longer adds to the tap or combo timing.
+ *
+ * Tap-hold keys (TAP_HOLD_TABLE): released within TAP_HOLD_TERM_US of the
+ * press they send their tap code as a press and a release, held longer
+ * they send their hold code until released. Combos (TAP_HOLD_COMBO_TABLE):
+ * all keys of the combo pressed within TAP_HOLD_COMBO_TERM_US of the first
+ * send the combo code instead, until the first of them is released. Other
+ * keys send their keymap code.
+ *
+ * While a decision is open every later edge is held back and replayed once
+ * it is made, so the actions keep the order in which keys went down. Action
+ * times never go backwards: a replayed edge carries the time of the
+ * decision if that is later than its own.
+ */
+
+#ifndef TAP_HOLD_H
+#define TAP_HOLD_H
+
+#include "keymap.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Decide tap-hold and combos on this half (0 = compiled out)
+#ifndef TAP_HOLD_ENABLE
+#define TAP_HOLD_ENABLE 0
+#endif
+
+#if TAP_HOLD_ENABLE && !KEYMAP_ENABLE
+#error "TAP_HOLD_ENABLE works on keymap codes and needs KEYMAP_ENABLE"
+#endif
+
+// Longest press that still counts as a tap, in microseconds
+#ifndef TAP_HOLD_TERM_US
+#define TAP_HOLD_TERM_US 200000u
+#endif
+
+// Longest time from the first to the last key of a combo, in microseconds
+#ifndef TAP_HOLD_COMBO_TERM_US
+#define TAP_HOLD_COMBO_TERM_US 30000u
+#endif
+
+// Edges held back while a decision is open; one more forces the decision
+#ifndef TAP_HOLD_BUFFER_LEN
+#define TAP_HOLD_BUFFER_LEN 8
+#endif
+
+// Action queue depth, must be a power of two
+#ifndef TAP_HOLD_QUEUE_LEN
+#define TAP_HOLD_QUEUE_LEN 32
+#endif
+
+#if (TAP_HOLD_QUEUE_LEN & (TAP_HOLD_QUEUE_LEN - 1)) != 0 || TAP_HOLD_QUEUE_LEN > 256
+#error "TAP_HOLD_QUEUE_LEN must be a power of two no larger than 256"
+#endif
+
+// Tap-hold keys, X(key index, tap code, hold code). By default the right
+// shift position sends Enter on a tap.
+#ifndef TAP_HOLD_TABLE
+#define TAP_HOLD_TABLE(X) \
+    X(23, 0x28, 0xE5)
+#endif
+
+// Combos, X(key mask, code). By default J + K sends Escape.
+#ifndef TAP_HOLD_COMBO_TABLE
+#define TAP_HOLD_COMBO_TABLE(X) \
+    X((1u << 13) | (1u << 14), 0x29)
+#endif
+
+// One resolved action, also the on-wire format (6 bytes, little endian)
+typedef struct __attribute__((packed)) {
+    uint8_t  code;          // HID usage code, KEYMAP_NONE if no action
+    uint8_t  pressed;       // 1 = press, 0 = release
+    uint32_t timestamp;     // Time of the action in microseconds (master time with TIME_SYNC_ENABLE)
+} TapHoldAction;
+
+// Function prototypes
+bool TapHoldInput(uint32_t changed, uint32_t pressed, uint32_t now);
+bool TapHoldService(uint32_t now);
+bool TapHoldBusy(void);
+bool TapHoldActionPeek(TapHoldAction *action);
+void TapHoldActionDrop(void);
+uint32_t TapHoldActionCount(void);
+
+#endif /* TAP_HOLD_H */
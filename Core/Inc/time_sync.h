@@ -0,0 +1,83 @@
+/**
+ * @file time_sync.h
+ * @brief Right-half time base mapped onto the master's clock.
+ *
+ * The master writes its own microsecond time to RIGHT_KEYBOARD_REG_TIME
+ * now and then (every second or so is plenty). Each write is paired with
+ * the TIM5 time at which it completed; the pairs steer an offset and a
+ * rate correction, so a local time converts to master time as
+ *
+ *   master = ref_master + (local - ref_local) * (1 + drift / 2^32)
+ *
+ * Every error between a write and the prediction moves the reference by
+ * 1 / 2^TIME_SYNC_OFFSET_SHIFT of the error and the rate by
+ * 1 / 2^TIME_SYNC_DRIFT_SHIFT of the error over the interval, which
+ * filters the jitter of the write itself. An error beyond TIME_SYNC_STEP_US
+ * (master reset, long gap) snaps the reference instead.
+ *
+ * With the estimate locked, the event, event batch and action registers
+ * carry master time, so the master can merge both halves in order. Before
+ * the first write the conversion is the identity, as without the option.
+ * The fixed time a write spends on the bus shows up as a constant offset;
+ * TIME_SYNC_LINK_DELAY_US takes it out.
+ */
+
+#ifndef TIME_SYNC_H
+#define TIME_SYNC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Accept master time writes and report timestamps in master time
+// (0 = compiled out, timestamps stay on the local time base)
+#ifndef TIME_SYNC_ENABLE
+#define TIME_SYNC_ENABLE 0
+#endif
+
+// Time from the master taking its timestamp to the end of the write, in us
+#ifndef TIME_SYNC_LINK_DELAY_US
+#define TIME_SYNC_LINK_DELAY_US 0
+#endif
+
+// Loop gains as right shifts of the error, larger = smoother and slower
+#ifndef TIME_SYNC_OFFSET_SHIFT
+#define TIME_SYNC_OFFSET_SHIFT 1
+#endif
+#ifndef TIME_SYNC_DRIFT_SHIFT
+#define TIME_SYNC_DRIFT_SHIFT 2
+#endif
+
+// Error that resets the estimate instead of steering it, in us
+#ifndef TIME_SYNC_STEP_US
+#define TIME_SYNC_STEP_US 2000
+#endif
+
+// Rate correction limit in ppm, crystal plus HSI trim on either side
+#ifndef TIME_SYNC_MAX_DRIFT_PPM
+#define TIME_SYNC_MAX_DRIFT_PPM 20000
+#endif
+
+// Writes closer than this only steer the offset, the interval is too
+// short to tell drift from jitter
+#ifndef TIME_SYNC_MIN_INTERVAL_US
+#define TIME_SYNC_MIN_INTERVAL_US 100000
+#endif
+
+// Time register, little endian. Writing it takes the master time: 5 bytes
+// with the pointer.
+typedef struct __attribute__((packed)) {
+    uint32_t local_us;          // TIM5 time of this read
+    uint32_t master_us;         // The same instant in master time
+    int32_t  last_error_us;     // Last write minus its prediction
+    int32_t  drift_ppb;         // Rate correction, master faster is positive
+    uint16_t samples;           // Writes since boot, saturates
+    uint8_t  steps;             // Estimate resets, wraps
+    uint8_t  locked;            // 1 once two writes set offset and rate
+} TimeSyncReport;
+
+// Function prototypes
+void TimeSyncSample(uint32_t master_us, uint32_t local_us);
+uint32_t TimeSyncToMaster(uint32_t local_us);
+void TimeSyncSnapshot(TimeSyncReport *report);
+
+#endif /* TIME_SYNC_H */
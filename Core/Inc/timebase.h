@@ -0,0 +1,41 @@
+/**
+ * @file timebase.h
+ * @brief Free-running microsecond time base on TIM5.
+ *
+ * TIM5 is the 32-bit APB1 timer, prescaled to 1 MHz and never stopped, so
+ * the count wraps every 2^32 us (about 71.6 minutes). Compare times with
+ * TimebaseReached() or an unsigned difference, never with < or >=.
+ *
+ * Channel 1 compare can wake the core from WFI at a given time, for waits
+ * shorter than the 1 ms HAL tick. Channels 2-4 capture key edges with
+ * EDGE_CAPTURE_ENABLE (edge_capture.h).
+ */
+
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+
+#include "stm32f4xx_hal.h"
+#include <stdbool.h>
+
+// Function prototypes
+void TimebaseInit(void);
+void TimebaseWakeAt(uint32_t deadline);
+void TimebaseIRQHandler(void);
+
+/**
+ * Get the current time in microseconds
+ */
+static inline uint32_t TimebaseNowUs(void)
+{
+    return TIM5->CNT;
+}
+
+/**
+ * Check whether a deadline has passed, valid while both are within 2^31 us
+ */
+static inline bool TimebaseReached(uint32_t now, uint32_t deadline)
+{
+    return (int32_t)(now - deadline) >= 0;
+}
+
+#endif /* TIMEBASE_H */
@@ -0,0 +1,77 @@
+/**
+ * @file trace.h
+ * @brief ITM/SWO event trace of the scan, debounce and I2C paths.
+ *
+ * With TRACE_ITM every traced event is one 32-bit write to its own ITM
+ * stimulus port, TRACE_PORT_BASE + TraceEvent:
+ *
+ *   bits 31-24  event argument, see TraceEvent
+ *   bits 23-0   TIM5 time base in microseconds, low 24 bits
+ *
+ * The timestamp wraps every 16.8 s. Before the first record after a wrap a
+ * TRACE_SYNC record carries the full 32-bit time, so the host can rebuild
+ * absolute times from the records in order. A record is dropped rather than
+ * waited for when its port FIFO is full, the core never stalls on SWO;
+ * trace_dropped counts the losses.
+ *
+ * SWO is PB3 (not a key pin). With TRACE_SWO_SETUP the firmware programs
+ * the TPIU for NRZ at TRACE_SWO_HZ itself, so any probe that captures SWO
+ * works without a debugger session; otherwise the debugger's SWV setup is
+ * used as is. The TPIU clock is HCLK, TraceClockUpdate() keeps the baud
+ * rate when the clock governor switches.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "stm32f4xx_hal.h"
+
+// Stream trace records over ITM/SWO (0 = compiled out)
+#ifndef TRACE_ITM
+#define TRACE_ITM 0
+#endif
+
+// First stimulus port used, port 0 is left to printf redirection
+#ifndef TRACE_PORT_BASE
+#define TRACE_PORT_BASE 1
+#endif
+
+// Program the TPIU and PB3 from the firmware (0 = leave it to the debugger)
+#ifndef TRACE_SWO_SETUP
+#define TRACE_SWO_SETUP 1
+#endif
+
+// SWO baud rate with TRACE_SWO_SETUP, an integer divider of every HCLK used
+#ifndef TRACE_SWO_HZ
+#define TRACE_SWO_HZ 2000000u
+#endif
+
+typedef enum {
+    TRACE_SYNC,         // Payload is the full 32-bit time, no argument
+    TRACE_SCAN_BEGIN,   // Scan or sample batch starts, arg = samples (saturates)
+    TRACE_SCAN_END,     // arg = 1 if every key was settled
+    TRACE_KEY_ACCEPT,   // Debounce accepted an edge, arg = key | 0x80 if pressed
+    TRACE_PUBLISH,      // Snapshot with new keys published, arg = change count
+    TRACE_I2C_ADDR,     // Address match, arg = register read or TRACE_I2C_WRITE
+    TRACE_I2C_DONE,     // Read ended, arg = bytes sent (saturates)
+    TRACE_I2C_ERROR,    // Bus error, arg = BERR 1 | ARLO 2 | OVR 8
+    TRACE_EVENTS
+} TraceEvent;
+
+// TRACE_I2C_ADDR argument of a master write
+#define TRACE_I2C_WRITE     0xFFu
+
+#define TRACE_ARG_KEY_PRESSED 0x80u
+
+#if TRACE_ITM
+#define TRACE(event, arg)   TraceEmit((event), (arg))
+#else
+#define TRACE(event, arg)   do { } while (0)
+#endif
+
+// Function prototypes
+void TraceInit(void);
+void TraceClockUpdate(void);
+void TraceEmit(TraceEvent event, uint32_t arg);
+
+#endif /* TRACE_H */
@@ -0,0 +1,129 @@
+/**
+ * @file transport.h
+ * @brief Compile-time selection of the link transport.
+ *
+ * The application talks to the link through these few calls and the
+ * link.h callbacks only, never to a peripheral handle. LINK_TRANSPORT and
+ * I2C_DRIVER pick the backend:
+ *
+ *   I2C, I2C_DRIVER_REGISTER       i2c_slave.h
+ *   I2C, I2C_DRIVER_HAL/_HAL_DMA   i2c_hal_link.h
+ *   UART                           uart_link.h
+ *   SPI                            spi_link.h
+ *
+ * Each call is a forced inline with the other backends preprocessed away,
+ * so the scan pays a direct call into the selected driver, or nothing
+ * where the driver has no work, without any dispatch through pointers.
+ *
+ * In the other direction every backend serves reads with
+ * RightKeyboardTxBegin()/TxEnd() and hands master writes, the register
+ * pointer and configuration registers, to RightKeyboardRxEnd().
+ */
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include "link.h"
+#include <stdbool.h>
+
+#if LINK_TRANSPORT == LINK_TRANSPORT_UART
+#include "uart_link.h"
+#elif LINK_TRANSPORT == LINK_TRANSPORT_SPI
+#include "spi_link.h"
+#elif I2C_DRIVER == I2C_DRIVER_REGISTER
+#include "i2c_slave.h"
+#else
+#include "i2c_hal_link.h"
+#endif
+
+#define TRANSPORT_INLINE static inline __attribute__((always_inline))
+
+/**
+ * Start serving the master, once from RightKeyboardInit()
+ *
+ * @return false if the backend could not be armed
+ */
+TRANSPORT_INLINE bool TransportStart(void)
+{
+#if LINK_TRANSPORT == LINK_TRANSPORT_UART
+    UartLinkStart();
+#elif LINK_TRANSPORT == LINK_TRANSPORT_SPI
+    SpiLinkStart();
+#elif I2C_DRIVER == I2C_DRIVER_REGISTER
+    I2CSlaveStart();
+#else
+    return I2CHalLinkStart();
+#endif
+    return true;
+}
+
+/**
+ * A new report or event was published
+ *
+ * The UART pushes the default register, SPI refetches its snapshot byte
+ * and the register driver re-stages a preloaded frame. The HAL drivers
+ * pick the frame on every address match and need nothing.
+ */
+TRANSPORT_INLINE void TransportPublish(void)
+{
+#if LINK_TRANSPORT == LINK_TRANSPORT_UART
+    UartLinkRefresh();
+#elif LINK_TRANSPORT == LINK_TRANSPORT_SPI
+    SpiLinkRefresh();
+#elif I2C_DRIVER == I2C_DRIVER_REGISTER
+    I2CSlaveRefresh();
+#endif
+}
+
+/**
+ * Check whether a transfer is under way, STOP or a clock switch would cut
+ * it
+ */
+TRANSPORT_INLINE bool TransportBusy(void)
+{
+#if LINK_TRANSPORT == LINK_TRANSPORT_UART
+    return UartLinkBusy();
+#elif LINK_TRANSPORT == LINK_TRANSPORT_SPI
+    return SpiLinkBusy();
+#else
+    return (I2C1->SR2 & I2C_SR2_BUSY) != 0;
+#endif
+}
+
+/**
+ * Thread-context upkeep, once per main loop pass
+ */
+TRANSPORT_INLINE void TransportService(void)
+{
+#if LINK_TRANSPORT == LINK_TRANSPORT_I2C && I2C_DRIVER != I2C_DRIVER_REGISTER
+    I2CHalLinkService();
+#endif
+}
+
+/**
+ * Listen mode restarts for the I2C health counters, HAL drivers only
+ */
+TRANSPORT_INLINE uint32_t TransportListenRearms(void)
+{
+#if LINK_TRANSPORT == LINK_TRANSPORT_I2C && I2C_DRIVER != I2C_DRIVER_REGISTER
+    return I2CHalLinkRearms();
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Reset the bus peripheral after a fault, with the link interrupts masked
+ *
+ * Only the I2C backends keep bus state that can lock up.
+ */
+TRANSPORT_INLINE void TransportReset(void)
+{
+#if LINK_TRANSPORT == LINK_TRANSPORT_I2C && I2C_DRIVER == I2C_DRIVER_REGISTER
+    I2CSlaveReset();
+#elif LINK_TRANSPORT == LINK_TRANSPORT_I2C
+    I2CHalLinkReset();
+#endif
+}
+
+#endif /* TRANSPORT_H */
@@ -0,0 +1,51 @@
+/**
+ * @file uart_link.h
+ * @brief Full-duplex USART1 link to the left half, DMA in both directions.
+ *
+ * With LINK_TRANSPORT_UART the two link wires leave I2C1 for USART1 on the
+ * same pins, PB6 TX and PB7 RX (AF7), 8N1 at UART_LINK_BAUD. Reception runs
+ * on DMA2 stream 2 into a circular ring, transmission on DMA2 stream 7, so
+ * the CPU only sees one interrupt per frame in each direction. Both carry
+ * the register map of right_side_keyboard.h unchanged, REPORT_INTEGRITY
+ * headers included.
+ *
+ * Requests and replies use the framing of link.h. Every request is answered
+ * with the frame of the register it names, as it was when the request was
+ * taken. Only one request may be in flight; one that arrives before the
+ * previous reply started replaces it.
+ *
+ * With UART_LINK_PUSH the default register is also sent unsolicited every
+ * time the published report changes, so the master needs no polling at all.
+ */
+
+#ifndef UART_LINK_H
+#define UART_LINK_H
+
+#include "link.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Line rate in baud, exact at 2 Mbaud for every fixed clock profile
+#ifndef UART_LINK_BAUD
+#define UART_LINK_BAUD 2000000u
+#endif
+
+// Receive ring, DMA half and full marks flush it while a request streams in
+#ifndef UART_LINK_RING_LEN
+#define UART_LINK_RING_LEN 64
+#endif
+
+// Send the default register whenever the report changes (0 = replies only)
+#ifndef UART_LINK_PUSH
+#define UART_LINK_PUSH 1
+#endif
+
+// Function prototypes
+void UartLinkStart(void);
+void UartLinkRefresh(void);
+bool UartLinkBusy(void);
+void UartLinkIRQHandler(void);
+void UartLinkRxDmaIRQHandler(void);
+void UartLinkTxDmaIRQHandler(void);
+
+#endif /* UART_LINK_H */
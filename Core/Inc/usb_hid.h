@@ -0,0 +1,58 @@
+/**
+ * @file usb_hid.h
+ * @brief USB full-speed HID keyboard on OTG FS, the right half on its own.
+ *
+ * With USB_HID_ENABLE the right half can also be the keyboard itself: when
+ * it boots with VBUS on PA9 (USB_HID_ROLE_AUTO) it enumerates as a HID
+ * keyboard on PA11/PA12 instead of starting the link to the left half, and
+ * sends the HID fragment (hid_fragment.h) as its input report. Scan,
+ * debounce and keymap are the same as in the split role; only the rollover
+ * limit is lifted, so the NKRO layout carries every held key.
+ *
+ * The report goes out on interrupt endpoint 1 with a 1 ms interval, queued
+ * as soon as the scan publishes a change, so it leaves with the next frame
+ * the host polls. A boot layout fragment (HID_FRAGMENT_BOOT) also declares
+ * the boot keyboard subclass.
+ *
+ * Full speed needs a 48 MHz clock within 0.25 %: CLOCK_PROFILE_PLL_96 with
+ * the PLL on the HSE crystal. The role is chosen once at boot; unplugging a
+ * bus-powered half resets it anyway.
+ *
+ * The direct wiring has keys on PA9 and PA11, so the USB role needs
+ * KEY_WIRING_MATRIX (rows PA0-PA4) and a keymap for its keys.
+ */
+
+#ifndef USB_HID_H
+#define USB_HID_H
+
+#include "right_side_keyboard.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Device identity, pid.codes test IDs by default
+#ifndef USB_HID_VID
+#define USB_HID_VID 0x1209
+#endif
+#ifndef USB_HID_PID
+#define USB_HID_PID 0x0001
+#endif
+
+#ifndef USB_HID_MANUFACTURER
+#define USB_HID_MANUFACTURER "Nyan Keys"
+#endif
+#ifndef USB_HID_PRODUCT
+#define USB_HID_PRODUCT "Nyan Keys Right"
+#endif
+
+// Bus current drawn, in mA
+#ifndef USB_HID_MAX_POWER_MA
+#define USB_HID_MAX_POWER_MA 100
+#endif
+
+// Function prototypes
+bool UsbHidRoleSelected(void);
+void UsbHidStart(void);
+void UsbHidPublish(void);
+void UsbHidIRQHandler(void);
+
+#endif /* USB_HID_H */
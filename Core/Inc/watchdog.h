@@ -0,0 +1,41 @@
+/**
+ * @file watchdog.h
+ * @brief Independent watchdog as the backstop of the recovery policy.
+ *
+ * Faults and Error_Handler() reset the core themselves (retained.h), the
+ * IWDG catches what never gets there: a loop that spins with interrupts
+ * masked, a peripheral wait that never ends. It runs from LSI, so it keeps
+ * counting in STOP and through clock changes; the main loop refreshes it
+ * on every pass and deep idle on every RTC poll wake-up. LSI is only good
+ * to 17-47 kHz on the F411, so the real timeout is anywhere from about
+ * 0.7x to 1.9x WATCHDOG_TIMEOUT_MS. It is frozen while a debugger halts
+ * the core.
+ *
+ * Once started the IWDG can't be stopped until the next reset. A watchdog
+ * reset shows as IWDGRSTF in RetainedReport.reset_flags.
+ */
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include "stm32f4xx_hal.h"
+
+// Start the independent watchdog at boot (0 = compiled out)
+#ifndef WATCHDOG_ENABLE
+#define WATCHDOG_ENABLE 0
+#endif
+
+// Nominal timeout, 1 to 32000 ms
+#ifndef WATCHDOG_TIMEOUT_MS
+#define WATCHDOG_TIMEOUT_MS 500u
+#endif
+
+#if WATCHDOG_TIMEOUT_MS < 1 || WATCHDOG_TIMEOUT_MS > 32000
+#error "WATCHDOG_TIMEOUT_MS must be between 1 and 32000"
+#endif
+
+// Function prototypes
+void WatchdogInit(void);
+void WatchdogKick(void);
+
+#endif /* WATCHDOG_H */
@@ -0,0 +1,254 @@
+/**
+ * @file bench.c
+ * @brief Hardware-in-the-loop latency benchmark mode.
+ *
+ * The pattern works on bench slots; slot n is key n when injecting and the
+ * n-th BENCH_LOOPBACK_MAP entry with the loopback. The stimulus is written
+ * from SysTick and read from the I2C interrupt, which preempts it, so
+ * SysTick masks interrupts for the few cycles it takes to start one.
+ */
+
+#include "bench.h"
+#include "right_side_keyboard.h"
+#include "timebase.h"
+#include "hot_path.h"
+#include <string.h>
+
+#if BENCH_MODE != BENCH_MODE_OFF
+
+#if DEEP_IDLE_ENABLE
+#error "BENCH_MODE needs SysTick running, disable DEEP_IDLE_ENABLE"
+#endif
+
+#if BENCH_MODE == BENCH_MODE_LOOPBACK
+typedef struct {
+    GPIO_TypeDef *port;
+    uint16_t      pin;
+    uint8_t       key;
+} BenchPin;
+
+#define BENCH_PIN_ENTRY(key, port, pin) { GPIO##port, (uint16_t)(1u << (pin)), (key) },
+static const BenchPin bench_pins[] = { BENCH_LOOPBACK_MAP(BENCH_PIN_ENTRY) };
+#define BENCH_SLOTS (sizeof(bench_pins) / sizeof(bench_pins[0]))
+#else
+#define BENCH_SLOTS BENCH_KEYS
+static volatile uint32_t injected_keys;
+#endif
+
+_Static_assert(BENCH_SLOTS > 0 && BENCH_SLOTS <= NUM_KEYS, "Bench keys must exist");
+
+#define BENCH_SLOTS_ALL ((1u << BENCH_SLOTS) - 1u)
+
+static bool     bench_running;
+static uint32_t bench_mask;     /* key word of all slots */
+static uint32_t step_ms;
+static uint32_t step;
+static uint32_t target_slots;
+static uint32_t applied_slots;
+
+// Change in flight
+static bool     pending;
+static uint32_t expected_keys;
+static uint32_t stimulus_us;
+
+// Readable from the debugger
+BenchReport bench_report;
+static uint64_t bench_sum_us;
+
+static uint32_t BenchSlotsToKeys(uint32_t slots)
+{
+    uint32_t keys = 0;
+    for (uint32_t n = 0; n < BENCH_SLOTS; ++n) {
+        if (slots & (1u << n)) {
+#if BENCH_MODE == BENCH_MODE_LOOPBACK
+            keys |= 1u << bench_pins[n].key;
+#else
+            keys |= 1u << n;
+#endif
+        }
+    }
+    return keys;
+}
+
+/**
+ * Pressed slots of a pattern step once any bounce is over
+ */
+static uint32_t BenchTarget(uint32_t n)
+{
+#if BENCH_PATTERN == BENCH_PATTERN_ROLL
+    uint32_t s = n % (2u * BENCH_SLOTS);
+    if (s < BENCH_SLOTS) {
+        return (2u << s) - 1u;
+    }
+    return BENCH_SLOTS_ALL & ~((2u << (s - BENCH_SLOTS)) - 1u);
+#elif BENCH_PATTERN == BENCH_PATTERN_CHORD
+    return (n & 1u) ? BENCH_SLOTS_ALL : 0u;
+#else
+    return n & 1u;
+#endif
+}
+
+static void BenchDrive(uint32_t slots)
+{
+#if BENCH_MODE == BENCH_MODE_LOOPBACK
+    for (uint32_t n = 0; n < BENCH_SLOTS; ++n) {
+        // Open drain: low presses the key, released leaves the pull-up alone
+        bench_pins[n].port->BSRR = (slots & (1u << n)) ? (uint32_t)bench_pins[n].pin << 16 :
+                                                         bench_pins[n].pin;
+    }
+#else
+    injected_keys = BenchSlotsToKeys(slots);
+    // EXTI mode only scans after an edge
+    RightKeyboardScanRequest();
+#endif
+}
+
+static void BenchStimulus(uint32_t keys)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (pending) {
+        bench_report.missed++;
+    }
+    expected_keys = keys;
+    stimulus_us = TimebaseNowUs();
+    pending = true;
+    bench_report.stimuli++;
+    __set_PRIMASK(primask);
+}
+#endif /* BENCH_MODE != BENCH_MODE_OFF */
+
+/**
+ * Set up the loopback outputs and clear the results
+ *
+ * Called once the keyboard is initialised.
+ */
+void BenchInit(void)
+{
+#if BENCH_MODE != BENCH_MODE_OFF
+#if BENCH_MODE == BENCH_MODE_LOOPBACK
+    for (uint32_t n = 0; n < BENCH_SLOTS; ++n) {
+        GPIO_TypeDef *port = bench_pins[n].port;
+        uint32_t pin = bench_pins[n].pin;
+        uint32_t field = 3u << (2 * __builtin_ctz(pin));
+
+        RCC->AHB1ENR |= 1u << GPIO_GET_INDEX(port);
+        (void)RCC->AHB1ENR;
+        port->BSRR = pin;
+        port->OTYPER |= pin;
+        port->PUPDR &= ~field;
+        port->MODER = (port->MODER & ~field) | (field & 0x55555555u);
+    }
+#endif
+    bench_mask = BenchSlotsToKeys(BENCH_SLOTS_ALL);
+    memset(&bench_report, 0, sizeof(bench_report));
+    bench_report.min_us = UINT32_MAX;
+    bench_report.mode = BENCH_MODE;
+    bench_report.pattern = BENCH_PATTERN;
+    bench_sum_us = 0;
+    bench_running = true;
+#endif
+}
+
+/**
+ * Advance the pattern by one millisecond
+ *
+ * Called from SysTick_Handler().
+ */
+void BenchTick(void)
+{
+#if BENCH_MODE != BENCH_MODE_OFF
+    if (!bench_running) {
+        return;
+    }
+    if (++step_ms >= BENCH_STEP_MS) {
+        step_ms = 0;
+        uint32_t next = BenchTarget(step++);
+        if (next != target_slots) {
+            target_slots = next;
+            BenchStimulus(BenchSlotsToKeys(next));
+        }
+    }
+
+    uint32_t out = target_slots;
+#if BENCH_PATTERN == BENCH_PATTERN_CHATTER
+    // Back to the old level on every odd millisecond of the bounce
+    if (step_ms < BENCH_CHATTER_MS && (step_ms & 1u)) {
+        out ^= 1u;
+    }
+#endif
+    if (out != applied_slots) {
+        applied_slots = out;
+        BenchDrive(out);
+    }
+#endif
+}
+
+/**
+ * Get the keys the bench holds pressed
+ *
+ * @return Key word (1 = pressed), 0 unless BENCH_MODE_INJECT
+ */
+HOT_PATH uint32_t BenchInjectedKeys(void)
+{
+#if BENCH_MODE == BENCH_MODE_INJECT
+    return injected_keys;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Check a report that is about to be sent against the change in flight
+ *
+ * Called from the I2C interrupt on the address match of a key or delta read.
+ *
+ * @param pressed Pressed keys the read carries (1 = pressed)
+ * @param now Time of the address match in microseconds
+ */
+HOT_PATH void BenchObserve(uint32_t pressed, uint32_t now)
+{
+#if BENCH_MODE != BENCH_MODE_OFF
+    if (!pending || (pressed & bench_mask) != expected_keys) {
+        return;
+    }
+    pending = false;
+
+    uint32_t latency = now - stimulus_us;
+    bench_report.observed++;
+    bench_sum_us += latency;
+    if (latency < bench_report.min_us) {
+        bench_report.min_us = latency;
+    }
+    if (latency > bench_report.max_us) {
+        bench_report.max_us = latency;
+    }
+#else
+    (void)pressed;
+    (void)now;
+#endif
+}
+
+/**
+ * Copy the results for a register read
+ *
+ * @param report Filled with the results, all zero without BENCH_MODE
+ */
+void BenchSnapshot(BenchReport *report)
+{
+#if BENCH_MODE != BENCH_MODE_OFF
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    *report = bench_report;
+    uint64_t sum = bench_sum_us;
+    __set_PRIMASK(primask);
+
+    if (report->observed == 0) {
+        report->min_us = 0;
+    } else {
+        report->mean_us = (uint32_t)(sum / report->observed);
+    }
+#else
+    memset(report, 0, sizeof(*report));
+#endif
+}
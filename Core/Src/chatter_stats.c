@@ -0,0 +1,79 @@
+/**
+ * @file chatter_stats.c
+ * @brief Per-key raw versus accepted transition counts and bounce bursts.
+ */
+
+#include "chatter_stats.h"
+#include "right_side_keyboard.h"
+#include "hot_path.h"
+#include "mem_budget.h"
+#include <string.h>
+
+#if CHATTER_STATS
+// Readable from the debugger as well as through the register map
+ChatterKeyStats chatter_table[NUM_KEYS] MEM_BSS(stats);
+
+static uint32_t burst_start_us[NUM_KEYS] MEM_BSS(stats);
+static uint32_t last_edge_us[NUM_KEYS] MEM_BSS(stats);
+static uint32_t in_burst;      /* keys whose burst may still grow */
+#endif
+
+/**
+ * Account for one scan
+ *
+ * Only the keys that moved are visited.
+ *
+ * @param raw_changed Keys whose raw level differs from the previous scan
+ * @param accepted Keys whose debounced level changed in this scan
+ * @param now Sample time in microseconds
+ */
+HOT_PATH void ChatterUpdate(uint32_t raw_changed, uint32_t accepted, uint32_t now)
+{
+#if CHATTER_STATS
+    for (uint32_t keys = raw_changed | accepted; keys; keys &= keys - 1u) {
+        uint32_t key = (uint32_t)__builtin_ctz(keys);
+        uint32_t bit = 1u << key;
+        ChatterKeyStats *entry = &chatter_table[key];
+
+        if ((raw_changed & bit) && entry->raw_edges != UINT16_MAX) {
+            entry->raw_edges++;
+        }
+        if (accepted & bit) {
+            if (entry->accepted != UINT16_MAX) {
+                entry->accepted++;
+            }
+            burst_start_us[key] = now;
+            in_burst |= bit;
+        } else if ((in_burst & bit) && (now - last_edge_us[key]) <= CHATTER_BURST_GAP_US) {
+            uint32_t burst = now - burst_start_us[key];
+            if (burst > entry->burst_max_us) {
+                entry->burst_max_us = burst > UINT16_MAX ? UINT16_MAX : (uint16_t)burst;
+            }
+        } else {
+            in_burst &= ~bit;
+        }
+        last_edge_us[key] = now;
+    }
+#else
+    (void)raw_changed;
+    (void)accepted;
+    (void)now;
+#endif
+}
+
+/**
+ * Copy the table for a register read
+ *
+ * Runs in the I2C interrupt, an entry caught in the middle of a scan is off
+ * by one edge at most.
+ *
+ * @param table NUM_KEYS entries, all zero without CHATTER_STATS
+ */
+void ChatterSnapshot(ChatterKeyStats *table)
+{
+#if CHATTER_STATS
+    memcpy(table, chatter_table, sizeof(chatter_table));
+#else
+    memset(table, 0, NUM_KEYS * sizeof(ChatterKeyStats));
+#endif
+}
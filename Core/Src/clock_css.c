@@ -0,0 +1,104 @@
+/**
+ * @file clock_css.c
+ * @brief HSE crystal supervision: fall back to HSI instead of stopping.
+ */
+
+#include "clock_css.h"
+#include "retained.h"
+
+#if CLOCK_CSS_ENABLE
+static volatile bool     hse_failed;
+static volatile uint32_t hse_failures;
+#endif
+
+/**
+ * Check whether SystemClock_Config() should run the PLL from HSE
+ *
+ * @return false once the crystal failed this boot
+ */
+bool ClockCssHseUsable(void)
+{
+#if CLOCK_CSS_ENABLE
+    return !hse_failed;
+#else
+    return true;
+#endif
+}
+
+/**
+ * Stop using HSE for the rest of the boot
+ */
+void ClockCssHseFailed(void)
+{
+#if CLOCK_CSS_ENABLE
+    hse_failed = true;
+    hse_failures++;
+#endif
+}
+
+/**
+ * Number of crystal failures since boot, at start-up and at run time
+ */
+uint32_t ClockCssFailures(void)
+{
+#if CLOCK_CSS_ENABLE
+    return hse_failures;
+#else
+    return 0;
+#endif
+}
+
+#if CLOCK_CSS_ENABLE
+/**
+ * NMI entry, branched to before the handler touches the stack
+ *
+ * Only r0 is used, so a fault NMI reaches the fault hook with the
+ * exception frame and EXC_RETURN in lr as the core left them. The literal
+ * is RCC->CIR, 0x80 its CSSF bit.
+ */
+__attribute__((naked, used, externally_visible)) void ClockCssNmiEntry(void)
+{
+    __asm volatile(
+        "ldr   r0, =0x4002380C        \n"
+        "ldr   r0, [r0]               \n"
+        "tst   r0, #0x80              \n"
+        "bne   ClockCssIRQHandler     \n"
+#if RETAINED_FAULT_HOOK
+        "b     RetainedFaultEntry     \n"
+#else
+        "1:    b 1b                   \n"
+#endif
+    );
+}
+
+/**
+ * Clock security event: bring the PLL back on HSI
+ *
+ * The hardware has already switched SYSCLK to HSI and stopped HSE and the
+ * PLL. Same N, P and Q with a 1 MHz input from HSI give the same SYSCLK,
+ * so the dividers, flash wait states and every peripheral setting stay
+ * valid. Register level, SysTick does not run inside NMI.
+ */
+__attribute__((used, externally_visible)) void ClockCssIRQHandler(void)
+{
+    RCC->CIR = RCC_CIR_CSSC;
+    ClockCssHseFailed();
+
+    RCC->PLLCFGR = (RCC->PLLCFGR & ~(RCC_PLLCFGR_PLLSRC | RCC_PLLCFGR_PLLM)) |
+                   RCC_PLLCFGR_PLLSRC_HSI | (16u << RCC_PLLCFGR_PLLM_Pos);
+    RCC->CR |= RCC_CR_PLLON;
+    while ((RCC->CR & RCC_CR_PLLRDY) == 0) {
+    }
+    RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_SW) | RCC_CFGR_SW_PLL;
+    while ((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_PLL) {
+    }
+}
+#else
+void ClockCssNmiEntry(void)
+{
+}
+
+void ClockCssIRQHandler(void)
+{
+}
+#endif
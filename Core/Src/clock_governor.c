@@ -0,0 +1,131 @@
+/**
+ * @file clock_governor.c
+ * @brief Run-time switching between an idle and a boost system clock.
+ *
+ *            SYSCLK  AHB  APB1 / APB2              Flash
+ *   Idle     HSI 16   /1   /2 = 8 MHz (timers 16)   0 WS
+ *   Boost    PLL 64   /1   /8 = 8 MHz (timers 16)   1 WS
+ *
+ * SystemClock_Config() programs the PLL and boots boosted. Raising the clock
+ * first starts the PLL and only switches once it has locked, so the main
+ * loop keeps scanning at 16 MHz in the meantime. The switch itself is a
+ * single CFGR write (source and dividers together) with interrupts masked,
+ * done only while I2C1 is not BUSY; HAL_RCC_ClockConfig() would pass through
+ * APB /16 and briefly starve the I2C peripheral.
+ */
+
+#include "clock_governor.h"
+#include "right_side_keyboard.h"
+#include "trace.h"
+#include "periph.h"
+
+#if CLOCK_PROFILE == CLOCK_PROFILE_GOVERNOR
+
+#define GOVERNOR_CFGR_MASK  (RCC_CFGR_SW | RCC_CFGR_HPRE | RCC_CFGR_PPRE1 | RCC_CFGR_PPRE2)
+#define GOVERNOR_CFGR_IDLE  (RCC_CFGR_SW_HSI | RCC_CFGR_HPRE_DIV1 | RCC_CFGR_PPRE1_DIV2 | RCC_CFGR_PPRE2_DIV2)
+#define GOVERNOR_CFGR_BOOST (RCC_CFGR_SW_PLL | RCC_CFGR_HPRE_DIV1 | RCC_CFGR_PPRE1_DIV8 | RCC_CFGR_PPRE2_DIV8)
+
+typedef enum {
+    GOVERNOR_IDLE,      // HSI, PLL off
+    GOVERNOR_LOCKING,   // HSI, waiting for PLLRDY
+    GOVERNOR_BOOST      // PLL
+} GovernorState;
+
+static GovernorState state = GOVERNOR_BOOST;
+static uint32_t      last_activity;
+static uint32_t      last_active_tick;
+
+/**
+ * Move SYSCLK and the bus dividers to a new setting in one step
+ *
+ * @param cfgr New SW/HPRE/PPRE1/PPRE2 bits
+ * @param sws Expected SWS value once the switch is done
+ * @param latency Flash wait states for the new HCLK
+ * @return false if I2C1 is mid-transfer and the switch was not made
+ */
+static bool GovernorSwitch(uint32_t cfgr, uint32_t sws, uint32_t latency)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (I2C1->SR2 & I2C_SR2_BUSY) {
+        __set_PRIMASK(primask);
+        return false;
+    }
+
+    // More wait states before speeding up, fewer only after slowing down
+    if (latency > __HAL_FLASH_GET_LATENCY()) {
+        __HAL_FLASH_SET_LATENCY(latency);
+    }
+    MODIFY_REG(RCC->CFGR, GOVERNOR_CFGR_MASK, cfgr);
+    while ((RCC->CFGR & RCC_CFGR_SWS) != sws) {
+    }
+    if (latency < __HAL_FLASH_GET_LATENCY()) {
+        __HAL_FLASH_SET_LATENCY(latency);
+    }
+
+    // Keep the 1 ms HAL tick at the new HCLK
+    SystemCoreClockUpdate();
+    HAL_InitTick(uwTickPrio);
+    TraceClockUpdate();
+
+    __set_PRIMASK(primask);
+    return true;
+}
+
+/**
+ * Raise or drop the system clock depending on recent activity
+ *
+ * Called from the main loop.
+ *
+ * @param activity Counter that moves on every key change or I2C transfer,
+ *                 see RightKeyboardActivity()
+ */
+void ClockGovernorService(uint32_t activity)
+{
+    uint32_t now = PeriphTickMs();
+
+    if (activity != last_activity) {
+        last_activity = activity;
+        last_active_tick = now;
+    }
+    bool active = (now - last_active_tick) < CLOCK_GOVERNOR_IDLE_MS;
+
+    switch (state) {
+    case GOVERNOR_IDLE:
+        if (active) {
+            __HAL_RCC_PLL_ENABLE();
+            state = GOVERNOR_LOCKING;
+        }
+        break;
+
+    case GOVERNOR_LOCKING:
+        if (!active) {
+            __HAL_RCC_PLL_DISABLE();
+            state = GOVERNOR_IDLE;
+        } else if (__HAL_RCC_GET_FLAG(RCC_FLAG_PLLRDY) &&
+                   GovernorSwitch(GOVERNOR_CFGR_BOOST, RCC_CFGR_SWS_PLL, FLASH_LATENCY_1)) {
+            state = GOVERNOR_BOOST;
+        }
+        break;
+
+    case GOVERNOR_BOOST:
+        if (!active && GovernorSwitch(GOVERNOR_CFGR_IDLE, RCC_CFGR_SWS_HSI, FLASH_LATENCY_0)) {
+            __HAL_RCC_PLL_DISABLE();
+            state = GOVERNOR_IDLE;
+        }
+        break;
+    }
+}
+
+/**
+ * Check whether the PLL is in use or starting up
+ *
+ * @return true unless the governor is idle on HSI with the PLL off
+ */
+bool ClockGovernorBoosted(void)
+{
+    return state != GOVERNOR_IDLE;
+}
+
+#endif /* CLOCK_PROFILE == CLOCK_PROFILE_GOVERNOR */
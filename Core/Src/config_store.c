@@ -0,0 +1,291 @@
+/**
+ * @file config_store.c
+ * @brief Run-time settings kept in a flash log across resets.
+ *
+ * ConfigStoreSet() runs in the scan, which can be an interrupt (DMA
+ * sampler, address-match scan); the RAM copy and the dirty mask are only
+ * touched with interrupts masked. Flash is only written from the main loop
+ * and from ConfigStoreInit(), before the link starts.
+ */
+
+#include "config_store.h"
+#include "crc8.h"
+#include "periph.h"
+#include "transport.h"
+#include "watchdog.h"
+#include <string.h>
+
+#if CONFIG_STORE_ENABLE
+_Static_assert(CONFIG_KEYS <= 32, "One dirty bit per key");
+
+#define CONFIG_STORE_END (CONFIG_STORE_ADDR + CONFIG_STORE_SIZE)
+
+// Header word fields
+#define RECORD_ERASED    0xFFFFFFFFu
+#define RECORD_COMMITTED 0x00u
+
+#define FLASH_ERRORS (FLASH_SR_SOP | FLASH_SR_WRPERR | FLASH_SR_PGAERR | FLASH_SR_PGPERR | FLASH_SR_PGSERR | FLASH_SR_RDERR)
+
+typedef struct {
+    uint8_t len;                            // 0 = never set
+    uint8_t value[CONFIG_STORE_VALUE_MAX];
+} ConfigEntry;
+
+static ConfigEntry entries[CONFIG_KEYS];
+static uint32_t    dirty;                   /* keys not in the log yet */
+static uint32_t    write_addr;              /* first free word of the log */
+static bool        log_full;
+
+static uint32_t last_activity;
+static uint32_t quiet_deadline;
+
+/**
+ * Record length in flash: header plus the value in whole words
+ */
+static inline uint32_t RecordSize(uint32_t len)
+{
+    return 4u + ((len + 3u) & ~3u);
+}
+
+static uint8_t RecordCrc(uint8_t key, uint8_t len, const uint8_t *value)
+{
+    uint8_t crc = Crc8Update(CRC8_INIT, &key, 1);
+    crc = Crc8Update(crc, &len, 1);
+    return Crc8Update(crc, value, len);
+}
+
+/**
+ * Erase the log sector, from SRAM so the watchdog can be fed meanwhile
+ *
+ * Nothing in here may fetch from flash until BSY clears. Interrupts stay
+ * masked, their handlers live in flash.
+ *
+ * @return FLASH_SR error bits, 0 on success
+ */
+static __RAM_FUNC uint32_t ConfigStoreErase(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    FLASH->SR = FLASH_ERRORS | FLASH_SR_EOP;
+    FLASH->CR = FLASH_CR_PSIZE_1 | FLASH_CR_SER | ((uint32_t)CONFIG_STORE_SECTOR << FLASH_CR_SNB_Pos);
+    FLASH->CR |= FLASH_CR_STRT;
+    while (FLASH->SR & FLASH_SR_BSY) {
+#if WATCHDOG_ENABLE
+        IWDG->KR = 0xAAAAu;
+#endif
+    }
+    FLASH->CR &= ~(FLASH_CR_SER | FLASH_CR_SNB);
+    uint32_t errors = FLASH->SR & FLASH_ERRORS;
+    __set_PRIMASK(primask);
+    return errors;
+}
+
+/**
+ * Drop stale log words from the data cache after an erase, as
+ * HAL_FLASHEx_Erase() does
+ */
+static void ConfigStoreFlushCache(void)
+{
+    if (FLASH->ACR & FLASH_ACR_DCEN) {
+        __HAL_FLASH_DATA_CACHE_DISABLE();
+        __HAL_FLASH_DATA_CACHE_RESET();
+        __HAL_FLASH_DATA_CACHE_ENABLE();
+    }
+}
+
+/**
+ * Append one value to the log, flash already unlocked
+ *
+ * @param entry Value to write, a copy the scan can't change meanwhile
+ * @return false if the log is full or programming failed
+ */
+static bool ConfigStoreAppend(uint8_t key, const ConfigEntry *entry)
+{
+    uint32_t size = RecordSize(entry->len);
+
+    if (write_addr + size > CONFIG_STORE_END) {
+        log_full = true;
+        return false;
+    }
+
+    uint32_t addr = write_addr;
+    uint32_t header = key | ((uint32_t)entry->len << 8) |
+                      ((uint32_t)RecordCrc(key, entry->len, entry->value) << 16) | 0xFF000000u;
+    // The space is used up even if programming fails halfway
+    write_addr += size;
+
+    if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, addr, header) != HAL_OK) {
+        return false;
+    }
+    for (uint32_t n = 0; n < entry->len; n += 4) {
+        uint32_t word = RECORD_ERASED;
+        memcpy(&word, &entry->value[n], entry->len - n < 4 ? entry->len - n : 4);
+        if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, addr + 4u + n, word) != HAL_OK) {
+            return false;
+        }
+    }
+    // Clearing the commit byte makes the record count
+    return HAL_FLASH_Program(FLASH_TYPEPROGRAM_BYTE, addr + 3u, RECORD_COMMITTED) == HAL_OK;
+}
+
+/**
+ * Erase the log and write every known value back
+ */
+static void ConfigStoreCompact(void)
+{
+    HAL_FLASH_Unlock();
+    bool erased = ConfigStoreErase() == 0;
+    ConfigStoreFlushCache();
+    write_addr = erased ? CONFIG_STORE_ADDR : CONFIG_STORE_END;
+    log_full = !erased;
+    for (uint32_t key = 0; key < CONFIG_KEYS && erased; key++) {
+        if (entries[key].len != 0) {
+            ConfigStoreAppend((uint8_t)key, &entries[key]);
+        }
+    }
+    HAL_FLASH_Lock();
+    dirty = 0;
+}
+#endif /* CONFIG_STORE_ENABLE */
+
+/**
+ * Load the newest value of every key, one pass over the log
+ *
+ * Runs once at boot, before RightKeyboardInit() applies the values. A log
+ * past the compaction mark or with a broken header is compacted here.
+ */
+void ConfigStoreInit(void)
+{
+#if CONFIG_STORE_ENABLE
+    uint32_t addr = CONFIG_STORE_ADDR;
+    bool broken = false;
+
+    while (addr + 4u <= CONFIG_STORE_END) {
+        uint32_t header = *(const volatile uint32_t *)addr;
+        if (header == RECORD_ERASED) {
+            break;
+        }
+        uint8_t key = (uint8_t)header;
+        uint8_t len = (uint8_t)(header >> 8);
+        uint8_t crc = (uint8_t)(header >> 16);
+        uint8_t commit = (uint8_t)(header >> 24);
+        if (len == 0 || len > CONFIG_STORE_VALUE_MAX || addr + RecordSize(len) > CONFIG_STORE_END) {
+            // Torn header, the length of the rest is unknown
+            broken = true;
+            break;
+        }
+        const uint8_t *value = (const uint8_t *)(addr + 4u);
+        if (commit == RECORD_COMMITTED && key < CONFIG_KEYS && crc == RecordCrc(key, len, value)) {
+            entries[key].len = len;
+            memcpy(entries[key].value, value, len);
+        }
+        addr += RecordSize(len);
+    }
+    write_addr = addr;
+
+    if (broken || addr - CONFIG_STORE_ADDR > CONFIG_STORE_SIZE / 100u * CONFIG_STORE_COMPACT_PERCENT) {
+        ConfigStoreCompact();
+    }
+#endif
+}
+
+/**
+ * Get the stored value of a key
+ *
+ * @param len Expected length; a value of another length (older firmware
+ *            layout) counts as missing
+ * @return true if value was filled in
+ */
+bool ConfigStoreGet(ConfigKey key, void *value, uint32_t len)
+{
+#if CONFIG_STORE_ENABLE
+    if (key >= CONFIG_KEYS || entries[key].len != len) {
+        return false;
+    }
+    memcpy(value, entries[key].value, len);
+    return true;
+#else
+    (void)key;
+    (void)value;
+    (void)len;
+    return false;
+#endif
+}
+
+/**
+ * Change a value, the main loop writes it to flash later
+ *
+ * Cheap enough for the scan: a compare and a copy, nothing if the value
+ * did not change.
+ */
+void ConfigStoreSet(ConfigKey key, const void *value, uint32_t len)
+{
+#if CONFIG_STORE_ENABLE
+    if (key >= CONFIG_KEYS || len == 0 || len > CONFIG_STORE_VALUE_MAX) {
+        return;
+    }
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    ConfigEntry *entry = &entries[key];
+    if (entry->len != len || memcmp(entry->value, value, len) != 0) {
+        entry->len = (uint8_t)len;
+        memcpy(entry->value, value, len);
+        dirty |= 1u << key;
+    }
+    __set_PRIMASK(primask);
+#else
+    (void)key;
+    (void)value;
+    (void)len;
+#endif
+}
+
+/**
+ * Write one changed value once keys and link are quiet
+ *
+ * Runs as a periodic scheduler task (sched.h).
+ *
+ * @param activity Counter that moves on every key change or transfer,
+ *                 see RightKeyboardActivity()
+ */
+void ConfigStoreService(uint32_t activity)
+{
+#if CONFIG_STORE_ENABLE
+    if (dirty == 0 || log_full) {
+        return;
+    }
+    uint32_t now = PeriphTickMs();
+    if (activity != last_activity) {
+        last_activity = activity;
+        quiet_deadline = now + CONFIG_STORE_QUIET_MS;
+        return;
+    }
+    if ((int32_t)(now - quiet_deadline) < 0 || TransportBusy()) {
+        return;
+    }
+
+    // Take the value and its dirty bit together, a change from here on
+    // marks it again
+    ConfigEntry entry;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint8_t key = (uint8_t)__builtin_ctz(dirty);
+    entry = entries[key];
+    dirty &= ~(1u << key);
+    __set_PRIMASK(primask);
+
+    HAL_FLASH_Unlock();
+    bool written = ConfigStoreAppend(key, &entry);
+    HAL_FLASH_Lock();
+    if (!written) {
+        // Retried on a programming error; with the log full it stays in
+        // RAM and the next boot compacts and writes it
+        primask = __get_PRIMASK();
+        __disable_irq();
+        dirty |= 1u << key;
+        __set_PRIMASK(primask);
+    }
+#else
+    (void)activity;
+#endif
+}
@@ -0,0 +1,31 @@
+/**
+ * @file crc8.c
+ * @brief CRC-8 used to protect the frames sent to the left half.
+ */
+
+#include "crc8.h"
+#include "hot_path.h"
+
+// CRC of every 4-bit value, two lookups per byte keep the table at 16 bytes
+static const uint8_t crc8_nibble[16] = {
+    0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15,
+    0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D,
+};
+
+/**
+ * Feed bytes into a running CRC
+ *
+ * @param crc CRC so far, CRC8_INIT for the first block
+ * @param data Bytes to add
+ * @param len Number of bytes
+ * @return Updated CRC
+ */
+HOT_PATH uint8_t Crc8Update(uint8_t crc, const uint8_t *data, uint32_t len)
+{
+    for (uint32_t n = 0; n < len; ++n) {
+        crc ^= data[n];
+        crc = (uint8_t)(crc << 4) ^ crc8_nibble[crc >> 4];
+        crc = (uint8_t)(crc << 4) ^ crc8_nibble[crc >> 4];
+    }
+    return crc;
+}
@@ -0,0 +1,564 @@
+/**
+ * @file debounce.c
+ * @brief Debounce engines that work on packed key words.
+ */
+
+#include "debounce.h"
+#include "hot_path.h"
+
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+#include "cmsis_compiler.h"
+#endif
+
+/**
+ * Reset a vertical counter to a known debounced state
+ *
+ * @param vc Counter state
+ * @param initial Debounced key word to start from
+ */
+void VerticalCounterInit(VerticalCounter *vc, uint32_t initial)
+{
+    vc->state = initial;
+    vc->cnt0 = 0xFFFFFFFFu;
+    vc->cnt1 = 0xFFFFFFFFu;
+}
+
+/**
+ * Clock all key counters once with a new raw sample
+ *
+ * A key's counter runs while its raw level differs from the debounced one
+ * and resets as soon as they agree again, so a key flips after four
+ * consecutive updates at the new level. All keys are handled at once.
+ *
+ * @param vc Counter state
+ * @param raw Raw key word
+ * @return Debounced key word
+ */
+HOT_PATH uint32_t VerticalCounterUpdate(VerticalCounter *vc, uint32_t raw)
+{
+    uint32_t delta = vc->state ^ raw;
+
+    vc->cnt0 = ~(vc->cnt0 & delta);
+    vc->cnt1 = vc->cnt0 ^ (vc->cnt1 & delta);
+
+    // Keys whose counter rolled over (11 after four counts) take the new level
+    vc->state ^= delta & vc->cnt0 & vc->cnt1;
+
+    return vc->state;
+}
+
+/**
+ * Reset the lockout engine to a known debounced state, no lockout running
+ *
+ * @param ld Lockout state
+ * @param initial Debounced key word to start from
+ * @param lockout_us Time a key ignores its pin after an accepted edge,
+ *                   clamped to 65535
+ */
+void LockoutDebounceInit(LockoutDebounce *ld, uint32_t initial, uint32_t lockout_us)
+{
+    ld->state = initial;
+    ld->locked = 0;
+    ld->last_us = 0;
+    ld->lockout_us = lockout_us > UINT16_MAX ? UINT16_MAX : (uint16_t)lockout_us;
+}
+
+/**
+ * Feed one raw sample through the lockout engine
+ *
+ * Accepts any transition (press or release) instantly, then ignores the key
+ * for lockout_us. The countdowns of the locked keys run down by the time
+ * since the previous sample, and the reference point follows every sample
+ * while nothing is locked, so a long sleep can't leave it behind. A sample
+ * stamped before the previous one (a back-dated DMA batch after a scan from
+ * the I2C interrupt) keeps the reference point and starts its lockouts that
+ * much shorter. Only keys that are locked or just moved cost any work.
+ *
+ * @param ld Lockout state
+ * @param raw Raw key word
+ * @param now Time of the sample
+ * @return Debounced key word
+ */
+HOT_PATH uint32_t LockoutDebounceUpdate(LockoutDebounce *ld, uint32_t raw, uint32_t now)
+{
+    // With nothing locked there is no countdown to keep a reference for
+    if (ld->locked == 0) {
+        ld->last_us = now;
+    }
+    int32_t elapsed = (int32_t)(now - ld->last_us);
+    uint32_t behind = 0;
+
+    if (elapsed < 0) {
+        behind = (uint32_t)-elapsed;
+    } else {
+        ld->last_us = now;
+        for (uint32_t locked = ld->locked; locked; locked &= locked - 1u) {
+            uint32_t key = (uint32_t)__builtin_ctz(locked);
+            if (ld->remain[key] <= (uint32_t)elapsed) {
+                ld->locked &= ~(1u << key);
+            } else {
+                ld->remain[key] -= (uint16_t)elapsed;
+            }
+        }
+    }
+
+    uint32_t accepted = (raw ^ ld->state) & ~ld->locked;
+    uint16_t remain = ld->lockout_us > behind ? (uint16_t)(ld->lockout_us - behind) : 0u;
+    ld->state ^= accepted;
+    ld->locked |= accepted;
+    for (; accepted; accepted &= accepted - 1u) {
+        ld->remain[__builtin_ctz(accepted)] = remain;
+    }
+
+    return ld->state;
+}
+
+static uint16_t DebounceWindow(uint32_t us)
+{
+    return us > UINT16_MAX ? UINT16_MAX : (uint16_t)us;
+}
+
+/**
+ * Reset the asymmetric engine to a known debounced state, no window running
+ *
+ * Every key starts in profile 0 with the given policies and windows, the
+ * other profiles start empty.
+ *
+ * @param ad Asymmetric state
+ * @param initial Debounced key word to start from
+ * @param press_eager true to take presses at once, false to defer them
+ * @param press_us Press window, clamped to 65535
+ * @param release_eager true to take releases at once, false to defer them
+ * @param release_us Release window, clamped to 65535
+ */
+void AsymDebounceInit(AsymDebounce *ad, uint32_t initial, bool press_eager, uint32_t press_us,
+                      bool release_eager, uint32_t release_us)
+{
+    ad->state = initial;
+    ad->locked = 0;
+    ad->pending = 0;
+    ad->press_eager = press_eager ? 0xFFFFFFFFu : 0u;
+    ad->release_eager = release_eager ? 0xFFFFFFFFu : 0u;
+    ad->last_us = 0;
+    for (uint32_t i = 0; i < DEBOUNCE_PROFILES; i++) {
+        ad->profile[i].keys = 0;
+        ad->profile[i].press_us = 0;
+        ad->profile[i].release_us = 0;
+    }
+    ad->profile[0].keys = 0xFFFFFFFFu;
+    ad->profile[0].press_us = DebounceWindow(press_us);
+    ad->profile[0].release_us = DebounceWindow(release_us);
+}
+
+/**
+ * Move keys into a profile and set its policies and windows
+ *
+ * The keys leave whatever profile they were in. Policies and windows apply
+ * to every key of the profile, the ones already in it included. Windows
+ * running right now finish with their old length.
+ *
+ * @param ad Asymmetric state
+ * @param index Profile, below DEBOUNCE_PROFILES
+ * @param keys Keys to add to the profile, 0 to only change its settings
+ * @param press_eager true to take presses at once, false to defer them
+ * @param press_us Press window, clamped to 65535
+ * @param release_eager true to take releases at once, false to defer them
+ * @param release_us Release window, clamped to 65535
+ * @return false if there is no such profile
+ */
+bool AsymDebounceSetProfile(AsymDebounce *ad, uint32_t index, uint32_t keys, bool press_eager,
+                            uint32_t press_us, bool release_eager, uint32_t release_us)
+{
+    if (index >= DEBOUNCE_PROFILES) {
+        return false;
+    }
+    for (uint32_t i = 0; i < DEBOUNCE_PROFILES; i++) {
+        ad->profile[i].keys &= ~keys;
+    }
+
+    DebounceProfile *profile = &ad->profile[index];
+    profile->keys |= keys;
+    profile->press_us = DebounceWindow(press_us);
+    profile->release_us = DebounceWindow(release_us);
+    ad->press_eager = press_eager ? (ad->press_eager | profile->keys) : (ad->press_eager & ~profile->keys);
+    ad->release_eager = release_eager ? (ad->release_eager | profile->keys) : (ad->release_eager & ~profile->keys);
+    return true;
+}
+
+/**
+ * Feed one raw sample through the asymmetric engine
+ *
+ * A key that leaves its debounced level starts the window of that
+ * direction. Eager: the edge is taken now and the pin ignored until the
+ * window has run out. Deferred: the edge is taken on the first sample after
+ * the window that still shows the new level, a sample back at the old
+ * level drops it, so release bounce in a fast roll never reaches the report
+ * as a re-press. The window length comes from the key's profile.
+ * Countdowns and back-dated samples are handled as in
+ * LockoutDebounceUpdate().
+ *
+ * @param ad Asymmetric state
+ * @param raw Raw key word
+ * @param now Time of the sample
+ * @return Debounced key word
+ */
+HOT_PATH uint32_t AsymDebounceUpdate(AsymDebounce *ad, uint32_t raw, uint32_t now)
+{
+    uint32_t timed = ad->locked | ad->pending;
+
+    if (timed == 0) {
+        ad->last_us = now;
+    }
+    int32_t elapsed = (int32_t)(now - ad->last_us);
+    uint32_t behind = 0;
+    uint32_t expired = 0;
+
+    if (elapsed < 0) {
+        behind = (uint32_t)-elapsed;
+    } else {
+        ad->last_us = now;
+        for (; timed; timed &= timed - 1u) {
+            uint32_t key = (uint32_t)__builtin_ctz(timed);
+            if (ad->remain[key] <= (uint32_t)elapsed) {
+                expired |= 1u << key;
+            } else {
+                ad->remain[key] -= (uint16_t)elapsed;
+            }
+        }
+    }
+
+    uint32_t diff = raw ^ ad->state;
+
+    // Lockouts that ran out free their key for this very sample, deferred
+    // keys back at the old level drop out, the rest that ran out are taken
+    ad->locked &= ~expired;
+    ad->pending &= diff;
+    uint32_t taken = ad->pending & expired;
+    ad->state ^= taken;
+    ad->pending &= ~taken;
+
+    // Keys that just left their debounced level, 1 in state = released
+    uint32_t moved = diff & ~(ad->locked | ad->pending | taken);
+    uint32_t press = moved & ad->state;
+    uint32_t release = moved & ~ad->state;
+    uint32_t eager = (press & ad->press_eager) | (release & ad->release_eager);
+    ad->state ^= eager;
+    ad->locked |= eager;
+    ad->pending |= moved & ~eager;
+
+    // Start the windows profile by profile, only profiles with a moved key
+    // cost more than the mask test
+    for (uint32_t i = 0; i < DEBOUNCE_PROFILES && moved; i++) {
+        const DebounceProfile *profile = &ad->profile[i];
+        uint32_t keys = moved & profile->keys;
+        if (keys == 0) {
+            continue;
+        }
+        moved &= ~keys;
+        uint16_t press_remain = profile->press_us > behind ? (uint16_t)(profile->press_us - behind) : 0u;
+        uint16_t release_remain = profile->release_us > behind ? (uint16_t)(profile->release_us - behind) : 0u;
+        for (uint32_t k = keys & press; k; k &= k - 1u) {
+            ad->remain[__builtin_ctz(k)] = press_remain;
+        }
+        for (uint32_t k = keys & release; k; k &= k - 1u) {
+            ad->remain[__builtin_ctz(k)] = release_remain;
+        }
+    }
+
+    return ad->state;
+}
+
+/**
+ * Reset the adaptive engine to a known debounced state, no lockout running
+ *
+ * @param ad Adaptive state
+ * @param initial Debounced key word to start from
+ * @param start_us Bounce estimate every key starts with
+ * @param min_us Shortest window, clamped to 65535
+ * @param max_us Longest window, clamped to 65535, also the longest gap
+ *               between accepted edges still taken for bounce
+ * @param margin_us Window above the bounce estimate, clamped to 65535
+ */
+void AdaptiveDebounceInit(AdaptiveDebounce *ad, uint32_t initial, uint32_t start_us, uint32_t min_us,
+                          uint32_t max_us, uint32_t margin_us)
+{
+    ad->state = initial;
+    ad->locked = 0;
+    ad->raw = initial;
+    ad->measured = 0;
+    ad->last_us = 0;
+    ad->min_us = DebounceWindow(min_us);
+    ad->max_us = DebounceWindow(max_us);
+    ad->margin_us = DebounceWindow(margin_us);
+    for (uint32_t key = 0; key < 32u; key++) {
+        ad->bounce_us[key] = DebounceWindow(start_us);
+    }
+}
+
+/**
+ * Lockout window a key gets on its next accepted edge
+ *
+ * @param ad Adaptive state
+ * @param key Key index
+ * @return Bounce estimate plus margin, within the bounds
+ */
+uint32_t AdaptiveDebounceWindow(const AdaptiveDebounce *ad, uint32_t key)
+{
+    uint32_t window = (uint32_t)ad->bounce_us[key] + ad->margin_us;
+
+    if (window < ad->min_us) {
+        return ad->min_us;
+    }
+    return window > ad->max_us ? ad->max_us : window;
+}
+
+/**
+ * Raise a key's bounce estimate to an observed bounce
+ */
+static inline void AdaptiveLearn(AdaptiveDebounce *ad, uint32_t key, uint32_t bounce_us)
+{
+    if (bounce_us > ad->bounce_us[key]) {
+        ad->bounce_us[key] = DebounceWindow(bounce_us);
+    }
+}
+
+/**
+ * Feed one raw sample through the adaptive engine
+ *
+ * Works like LockoutDebounceUpdate(), except that each accepted edge locks
+ * its key for AdaptiveDebounceWindow(). The estimate jumps up to every
+ * bounce seen, a raw edge during the lockout (timed from the accepted edge)
+ * or an accepted edge within max_us of the previous one, and loses an
+ * eighth on every accepted edge. A clean switch so drifts down to min_us
+ * within a few dozen presses, a worn one is back at its bounce after the
+ * first burst. Only keys that are locked or just moved cost any work.
+ *
+ * @param ad Adaptive state
+ * @param raw Raw key word
+ * @param now Time of the sample
+ * @return Debounced key word
+ */
+HOT_PATH uint32_t AdaptiveDebounceUpdate(AdaptiveDebounce *ad, uint32_t raw, uint32_t now)
+{
+    uint32_t bouncing = (raw ^ ad->raw) & ad->locked;
+
+    ad->raw = raw;
+    if (ad->locked == 0) {
+        ad->last_us = now;
+    }
+    int32_t elapsed = (int32_t)(now - ad->last_us);
+    uint32_t behind = 0;
+
+    if (elapsed < 0) {
+        behind = (uint32_t)-elapsed;
+    } else {
+        ad->last_us = now;
+        for (uint32_t locked = ad->locked; locked; locked &= locked - 1u) {
+            uint32_t key = (uint32_t)__builtin_ctz(locked);
+            if (ad->remain[key] <= (uint32_t)elapsed) {
+                ad->locked &= ~(1u << key);
+            } else {
+                ad->remain[key] -= (uint16_t)elapsed;
+            }
+        }
+    }
+
+    for (; bouncing; bouncing &= bouncing - 1u) {
+        uint32_t key = (uint32_t)__builtin_ctz(bouncing);
+        int32_t bounce = (int32_t)(now - ad->accepted_us[key]);
+        if (bounce > 0) {
+            AdaptiveLearn(ad, key, (uint32_t)bounce);
+        }
+    }
+
+    uint32_t accepted = (raw ^ ad->state) & ~ad->locked;
+    ad->state ^= accepted;
+    ad->locked |= accepted;
+    for (; accepted; accepted &= accepted - 1u) {
+        uint32_t key = (uint32_t)__builtin_ctz(accepted);
+        uint32_t gap = now - ad->accepted_us[key];
+        if ((ad->measured & (1u << key)) && gap < ad->max_us) {
+            AdaptiveLearn(ad, key, gap);
+        }
+        uint32_t window = AdaptiveDebounceWindow(ad, key);
+        ad->remain[key] = window > behind ? (uint16_t)(window - behind) : 0u;
+        ad->bounce_us[key] -= ad->bounce_us[key] >> 3;
+        ad->accepted_us[key] = now;
+        ad->measured |= 1u << key;
+    }
+
+    return ad->state;
+}
+
+/**
+ * Reset the sample-count engine to a known debounced state
+ *
+ * @param sd Sample-count state
+ * @param initial Debounced key word to start from
+ * @param press_samples Consecutive samples a press must hold, clamped to
+ *                      1..SAMPLE_DEBOUNCE_MAX
+ * @param release_samples Same for a release
+ */
+void SampleDebounceInit(SampleDebounce *sd, uint32_t initial, uint32_t press_samples, uint32_t release_samples)
+{
+    sd->state = initial;
+    for (uint32_t i = 0; i < SAMPLE_DEBOUNCE_BITS; i++) {
+        sd->count[i] = 0;
+    }
+    press_samples = press_samples < 1u ? 1u : press_samples;
+    release_samples = release_samples < 1u ? 1u : release_samples;
+    sd->press_samples = (uint8_t)(press_samples > SAMPLE_DEBOUNCE_MAX ? SAMPLE_DEBOUNCE_MAX : press_samples);
+    sd->release_samples = (uint8_t)(release_samples > SAMPLE_DEBOUNCE_MAX ? SAMPLE_DEBOUNCE_MAX : release_samples);
+}
+
+/**
+ * Count one raw sample for every key
+ *
+ * Counters of keys back at their debounced level clear, the others go up
+ * by one with a ripple carry across the planes, and a key whose counter
+ * now equals the count of its direction takes the new level. The plane
+ * loop is the same for every key word, so the cost is fixed per sample
+ * and no time is read: the window is the count times the scan period.
+ *
+ * @param sd Sample-count state
+ * @param raw Raw key word
+ * @return Debounced key word
+ */
+HOT_PATH uint32_t SampleDebounceUpdate(SampleDebounce *sd, uint32_t raw)
+{
+    uint32_t delta = raw ^ sd->state;
+    uint32_t carry = delta;
+    uint32_t press_hit = delta & sd->state;     // 1 = released, so these are presses
+    uint32_t release_hit = delta & ~sd->state;
+
+    for (uint32_t i = 0; i < SAMPLE_DEBOUNCE_BITS; i++) {
+        uint32_t plane = sd->count[i] & delta;
+        uint32_t next = plane ^ carry;
+        carry &= plane;
+        sd->count[i] = next;
+
+        // Keep the keys whose bit i matches the count of their direction
+        uint32_t press_bit = 0u - ((sd->press_samples >> i) & 1u);
+        uint32_t release_bit = 0u - ((sd->release_samples >> i) & 1u);
+        press_hit &= ~(next ^ press_bit);
+        release_hit &= ~(next ^ release_bit);
+    }
+
+    uint32_t flip = press_hit | release_hit;
+    sd->state ^= flip;
+    for (uint32_t i = 0; i < SAMPLE_DEBOUNCE_BITS; i++) {
+        sd->count[i] &= ~flip;
+    }
+
+    return sd->state;
+}
+
+/**
+ * Spread four key bits over the bytes of a word, 0x01 per set bit
+ */
+static inline uint32_t IntegratorLanes(uint32_t keys)
+{
+    return ((keys & 0xFu) * 0x00204081u) & 0x01010101u;
+}
+
+/**
+ * Gather the low bit of every byte back into four key bits
+ */
+static inline uint32_t IntegratorKeys(uint32_t lanes)
+{
+    return ((lanes & 0x01010101u) * 0x10204080u) >> 28;
+}
+
+/**
+ * Step four counters one sample towards their raw level
+ *
+ * @param count Four counters, byte n = key n
+ * @param up 0x01 in the bytes of the released keys
+ * @param top samples in every byte
+ * @param at_top Set to 0xFF in the bytes whose counter is at top
+ * @param at_zero Set to 0xFF in the bytes whose counter is at 0
+ * @return The new counters
+ */
+HOT_PATH static inline uint32_t IntegratorStep(uint32_t count, uint32_t up, uint32_t top,
+                                               uint32_t *at_top, uint32_t *at_zero)
+{
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+    // Saturating up for released keys, down for held ones; USUB8 sets GE
+    // in the bytes at or above top, SEL clamps them and yields the mask
+    count = __UQSUB8(__UQADD8(count, up), up ^ 0x01010101u);
+    (void)__USUB8(count, top);
+    count = __SEL(top, count);
+    *at_top = __SEL(0xFFFFFFFFu, 0u);
+    (void)__USUB8(0u, count);
+    *at_zero = __SEL(0xFFFFFFFFu, 0u);
+    return count;
+#else
+    uint32_t next = 0;
+    *at_top = 0;
+    *at_zero = 0;
+    for (uint32_t shift = 0; shift < 32u; shift += 8u) {
+        uint32_t c = (count >> shift) & 0xFFu;
+        uint32_t t = (top >> shift) & 0xFFu;
+        if ((up >> shift) & 1u) {
+            c = c < 255u ? c + 1u : c;
+        } else {
+            c = c > 0u ? c - 1u : 0u;
+        }
+        c = c > t ? t : c;
+        next |= c << shift;
+        *at_top |= (c == t ? 0xFFu : 0u) << shift;
+        *at_zero |= (c == 0u ? 0xFFu : 0u) << shift;
+    }
+    return next;
+#endif
+}
+
+/**
+ * Reset the integrator to a known debounced state, every counter at the
+ * end of its key's level
+ *
+ * @param id Integrator state
+ * @param initial Debounced key word to start from
+ * @param samples Counter range, the samples an isolated edge takes; clamped
+ *                to 1..255
+ */
+void IntegratorDebounceInit(IntegratorDebounce *id, uint32_t initial, uint32_t samples)
+{
+    samples = samples < 1u ? 1u : (samples > 255u ? 255u : samples);
+    id->state = initial;
+    id->moving = 0;
+    id->samples = (uint8_t)samples;
+    for (uint32_t w = 0; w < INTEGRATOR_DEBOUNCE_WORDS; w++) {
+        id->count[w] = IntegratorLanes(initial >> (4u * w)) * samples;
+    }
+}
+
+/**
+ * Integrate one raw sample for every key
+ *
+ * Four keys per SIMD step with the DSP extension (UQADD8, UQSUB8, USUB8,
+ * SEL), a byte loop elsewhere, so the cost is fixed per sample like
+ * SampleDebounceUpdate(). Counts are kept within the range even when more
+ * samples than that come in while the key holds its level.
+ *
+ * @param id Integrator state
+ * @param raw Raw key word
+ * @return Debounced key word
+ */
+HOT_PATH uint32_t IntegratorDebounceUpdate(IntegratorDebounce *id, uint32_t raw)
+{
+    uint32_t top = id->samples * 0x01010101u;
+    uint32_t released = 0;
+    uint32_t pressed = 0;
+
+    for (uint32_t w = 0; w < INTEGRATOR_DEBOUNCE_WORDS; w++) {
+        uint32_t at_top, at_zero;
+        id->count[w] = IntegratorStep(id->count[w], IntegratorLanes(raw >> (4u * w)), top, &at_top, &at_zero);
+        released |= IntegratorKeys(at_top) << (4u * w);
+        pressed |= IntegratorKeys(at_zero) << (4u * w);
+    }
+
+    id->state = (id->state | released) & ~pressed;
+    id->moving = (id->state & ~released) | (~id->state & ~pressed);
+    return id->state;
+}
@@ -0,0 +1,637 @@
+/**
+ * @file debounce_bench.c
+ * @brief Side-by-side benchmark of the debounce engines over key traces.
+ *
+ * The vertical counter, sample-count and integrator engines are clocked
+ * once per sample, as the scan does, so each engine sees exactly what it
+ * would see in the firmware.
+ */
+
+#include "debounce_bench.h"
+#include <string.h>
+
+#if DEBOUNCE_BENCH_HOST
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#elif DEBOUNCE_BENCH
+#include "right_side_keyboard.h"
+#include "raw_capture.h"
+#endif
+
+#if DEBOUNCE_BENCH || DEBOUNCE_BENCH_HOST
+// Engine indices, the DEBOUNCE_ALGORITHM values
+#define BENCH_LOCKOUT    0u
+#define BENCH_VERTICAL   1u
+#define BENCH_ASYM       2u
+#define BENCH_ADAPTIVE   3u
+#define BENCH_SAMPLE     4u
+#define BENCH_INTEGRATOR 5u
+
+// Synthetic trace shape per kind, times in microseconds
+typedef struct {
+    uint32_t hold_min;          // Key held
+    uint32_t hold_max;
+    uint32_t gap_min;           // Key released
+    uint32_t gap_max;
+    uint32_t bounce_us;         // Longest bounce after an edge
+    uint32_t dropout;           // 1/n chance per held sample of a short dropout, 0 = none
+} BenchShape;
+
+static const BenchShape shapes[DEBOUNCE_BENCH_SYNTH_KINDS] = {
+    [DEBOUNCE_BENCH_CLEAN]   = { 20000u, 120000u, 20000u, 200000u, 0u,    0u   },
+    [DEBOUNCE_BENCH_BOUNCE]  = { 30000u, 150000u, 30000u, 200000u, 2000u, 0u   },
+    [DEBOUNCE_BENCH_CHATTER] = { 30000u, 150000u, 30000u, 200000u, 6000u, 400u },
+    [DEBOUNCE_BENCH_ROLL]    = { 15000u, 40000u,  12000u, 30000u,  1000u, 0u   },
+};
+
+// One reference change
+typedef struct {
+    uint32_t time_us;           // First raw edge of the burst
+    uint8_t  key;
+    uint8_t  pressed;
+} BenchChange;
+
+static BenchChange changes[DEBOUNCE_BENCH_CHANGES];
+static uint32_t    change_count;
+
+// Engine state, one engine runs at a time
+static struct {
+    VerticalCounter    vertical;
+    LockoutDebounce    lockout;
+    AsymDebounce       asym;
+    AdaptiveDebounce   adaptive;
+    SampleDebounce     sample;
+    IntegratorDebounce integrator;
+} engines;
+
+static const uint16_t state_bytes[DEBOUNCE_BENCH_ENGINES] = {
+    [BENCH_LOCKOUT]    = sizeof(LockoutDebounce),
+    [BENCH_VERTICAL]   = sizeof(VerticalCounter),
+    [BENCH_ASYM]       = sizeof(AsymDebounce),
+    [BENCH_ADAPTIVE]   = sizeof(AdaptiveDebounce),
+    [BENCH_SAMPLE]     = sizeof(SampleDebounce),
+    [BENCH_INTEGRATOR] = sizeof(IntegratorDebounce),
+};
+
+/**
+ * xorshift32, the synthetic traces only need to be repeatable
+ */
+static uint32_t BenchRandom(uint32_t *seed)
+{
+    uint32_t x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+    return x;
+}
+
+static uint32_t BenchRange(uint32_t *seed, uint32_t lo, uint32_t hi)
+{
+    return lo + BenchRandom(seed) % (hi - lo + 1u);
+}
+
+/**
+ * Find the reference changes of a trace
+ *
+ * A key's burst starts at its first raw edge away from the level it held
+ * and becomes a change once the raw level held settle_us at the other
+ * level. A trace that ends in a burst at the other level counts it.
+ *
+ * @return Samples covered; if the change list filled up, the samples
+ *         before the first burst that did not make it into the list
+ */
+static uint32_t BenchReference(const DebounceBenchSample *trace, uint32_t count, uint32_t settle_us)
+{
+    static uint32_t burst_us[32];
+    static uint32_t last_us[32];
+    uint32_t level = trace[0].keys;
+    uint32_t raw = level;
+    uint32_t bursting = 0;
+    uint32_t n;
+
+    change_count = 0;
+    for (n = 0; n < count; ++n) {
+        uint32_t now = trace[n].time_us;
+        uint32_t moved = trace[n].keys ^ raw;
+        raw = trace[n].keys;
+        for (uint32_t keys = moved; keys; keys &= keys - 1u) {
+            uint32_t key = (uint32_t)__builtin_ctz(keys);
+            if (!(bursting & (1u << key))) {
+                bursting |= 1u << key;
+                burst_us[key] = now;
+            }
+            last_us[key] = now;
+        }
+        for (uint32_t keys = bursting; keys; keys &= keys - 1u) {
+            uint32_t key = (uint32_t)__builtin_ctz(keys);
+            bool last = n + 1u == count;
+            if (now - last_us[key] < settle_us && !last) {
+                continue;
+            }
+            bursting &= ~(1u << key);
+            if (((raw ^ level) >> key) & 1u) {
+                if (change_count == DEBOUNCE_BENCH_CHANGES) {
+                    uint32_t first = now;
+                    for (uint32_t open = bursting | (1u << key); open; open &= open - 1u) {
+                        uint32_t t = burst_us[__builtin_ctz(open)];
+                        first = (int32_t)(t - first) < 0 ? t : first;
+                    }
+                    while (n > 0 && (int32_t)(trace[n - 1u].time_us - first) >= 0) {
+                        n--;
+                    }
+                    return n;
+                }
+                changes[change_count].time_us = burst_us[key];
+                changes[change_count].key = (uint8_t)key;
+                changes[change_count].pressed = ((raw >> key) & 1u) == 0;
+                change_count++;
+                level ^= 1u << key;
+            }
+        }
+    }
+    return n;
+}
+
+/**
+ * Next reference change of a key from index from on
+ */
+static uint32_t BenchNextChange(uint32_t key, uint32_t from)
+{
+    while (from < change_count && changes[from].key != key) {
+        from++;
+    }
+    return from;
+}
+
+static void BenchLatencyAdd(DebounceBenchLatency *latency, uint32_t us)
+{
+    uint32_t bucket = us / DEBOUNCE_BENCH_BUCKET_US;
+
+    if (latency->count == 0 || us < latency->min_us) {
+        latency->min_us = us;
+    }
+    if (us > latency->max_us) {
+        latency->max_us = us;
+    }
+    latency->sum_us += us;
+    latency->count++;
+    if (bucket >= DEBOUNCE_BENCH_BUCKETS) {
+        bucket = DEBOUNCE_BENCH_BUCKETS - 1u;
+    }
+    if (latency->histogram[bucket] < UINT16_MAX) {
+        latency->histogram[bucket]++;
+    }
+}
+
+/**
+ * Match one engine edge against the reference
+ *
+ * Changes of the key whose match window closed before this edge are
+ * missed; the edge then matches the next change if it has the same
+ * direction, otherwise it is a phantom.
+ *
+ * @param cursor Per key: index of its next unmatched reference change
+ */
+static void BenchMatch(DebounceBenchResult *result, uint32_t *cursor, uint32_t key, bool pressed,
+                       uint32_t now, uint32_t match_us)
+{
+    uint32_t n = cursor[key];
+
+    while (n < change_count && (int32_t)(now - changes[n].time_us) > (int32_t)match_us) {
+        result->missed++;
+        n = BenchNextChange(key, n + 1u);
+    }
+    if (n < change_count && changes[n].pressed == pressed && (int32_t)(now - changes[n].time_us) >= 0) {
+        BenchLatencyAdd(pressed ? &result->press : &result->release, now - changes[n].time_us);
+        n = BenchNextChange(key, n + 1u);
+    } else {
+        result->phantom++;
+    }
+    cursor[key] = n;
+}
+
+/**
+ * Samples a window takes at the trace's mean sample period, rounded up
+ */
+static uint8_t BenchSamples(uint32_t window_us, uint32_t period_us, uint32_t max)
+{
+    uint32_t samples = (window_us + period_us - 1u) / period_us;
+
+    if (samples < 1u) {
+        samples = 1u;
+    }
+    return samples > max ? (uint8_t)max : (uint8_t)samples;
+}
+
+static void BenchEngineInit(uint32_t engine, uint32_t initial, const DebounceBenchConfig *config,
+                            uint32_t period_us)
+{
+    switch (engine) {
+    case BENCH_VERTICAL:
+        VerticalCounterInit(&engines.vertical, initial);
+        break;
+    case BENCH_ASYM:
+        AsymDebounceInit(&engines.asym, initial, config->press_eager, config->press_us,
+                         config->release_eager, config->release_us);
+        break;
+    case BENCH_ADAPTIVE:
+        AdaptiveDebounceInit(&engines.adaptive, initial, config->lockout_us, config->adaptive_min_us,
+                             config->adaptive_max_us, config->adaptive_margin_us);
+        break;
+    case BENCH_SAMPLE:
+        SampleDebounceInit(&engines.sample, initial,
+                           config->press_samples ? config->press_samples
+                                                 : BenchSamples(config->press_us, period_us, SAMPLE_DEBOUNCE_MAX),
+                           config->release_samples ? config->release_samples
+                                                   : BenchSamples(config->release_us, period_us, SAMPLE_DEBOUNCE_MAX));
+        break;
+    case BENCH_INTEGRATOR:
+        IntegratorDebounceInit(&engines.integrator, initial,
+                               config->integrator_samples ? config->integrator_samples
+                                                          : BenchSamples(config->lockout_us, period_us, 255u));
+        break;
+    default:
+        LockoutDebounceInit(&engines.lockout, initial, config->lockout_us);
+        break;
+    }
+}
+
+static inline uint32_t BenchEngineUpdate(uint32_t engine, uint32_t raw, uint32_t now)
+{
+    switch (engine) {
+    case BENCH_VERTICAL:
+        return VerticalCounterUpdate(&engines.vertical, raw);
+    case BENCH_ASYM:
+        return AsymDebounceUpdate(&engines.asym, raw, now);
+    case BENCH_ADAPTIVE:
+        return AdaptiveDebounceUpdate(&engines.adaptive, raw, now);
+    case BENCH_SAMPLE:
+        return SampleDebounceUpdate(&engines.sample, raw);
+    case BENCH_INTEGRATOR:
+        return IntegratorDebounceUpdate(&engines.integrator, raw);
+    default:
+        return LockoutDebounceUpdate(&engines.lockout, raw, now);
+    }
+}
+
+/**
+ * Cost of reading the clock itself, the least of a few back-to-back reads
+ */
+static uint32_t BenchClockOverhead(DebounceBenchClock clock)
+{
+    uint32_t least = UINT32_MAX;
+
+    for (uint32_t n = 0; n < 16u; ++n) {
+        uint32_t start = clock();
+        uint32_t ticks = clock() - start;
+        if (ticks < least) {
+            least = ticks;
+        }
+    }
+    return least;
+}
+#endif /* DEBOUNCE_BENCH || DEBOUNCE_BENCH_HOST */
+
+/**
+ * Fill in the firmware's default engine settings and a 10 ms reference
+ */
+void DebounceBenchDefaults(DebounceBenchConfig *config)
+{
+    memset(config, 0, sizeof(*config));
+    config->lockout_us = 5000u;
+    config->press_eager = true;
+    config->release_eager = false;
+    config->press_us = 5000u;
+    config->release_us = 5000u;
+    config->adaptive_min_us = 1000u;
+    config->adaptive_max_us = 20000u;
+    config->adaptive_margin_us = 1000u;
+    config->settle_us = 10000u;
+    config->match_us = 50000u;
+}
+
+/**
+ * Generate a synthetic trace on keys 0..DEBOUNCE_BENCH_KEYS-1
+ *
+ * Every key presses and releases on its own random schedule. Bounce is a
+ * random level on every sample until the bounce time drawn for the edge is
+ * over; a dropout releases a held key for one to three samples, shorter
+ * than any settle time the reference would take for a change.
+ *
+ * @param kind DEBOUNCE_BENCH_CLEAN .. DEBOUNCE_BENCH_ROLL
+ * @param seed Any nonzero value, the same seed gives the same trace
+ * @return Samples written, max
+ */
+uint32_t DebounceBenchSynth(DebounceBenchSample *trace, uint32_t max, uint32_t kind,
+                            uint32_t period_us, uint32_t seed)
+{
+#if DEBOUNCE_BENCH || DEBOUNCE_BENCH_HOST
+    const BenchShape *shape = &shapes[kind < DEBOUNCE_BENCH_SYNTH_KINDS ? kind : DEBOUNCE_BENCH_CLEAN];
+    uint32_t next_us[DEBOUNCE_BENCH_KEYS];
+    uint32_t bounce_end[DEBOUNCE_BENCH_KEYS];
+    uint32_t dropout_end[DEBOUNCE_BENCH_KEYS];
+    uint32_t level = 0xFFFFFFFFu;
+
+    seed = seed ? seed : 1u;
+    for (uint32_t key = 0; key < DEBOUNCE_BENCH_KEYS; ++key) {
+        next_us[key] = BenchRange(&seed, 0u, shape->gap_max);
+        bounce_end[key] = 0;
+        dropout_end[key] = 0;
+    }
+    for (uint32_t n = 0; n < max; ++n) {
+        uint32_t now = n * period_us;
+        uint32_t raw = level;
+        for (uint32_t key = 0; key < DEBOUNCE_BENCH_KEYS; ++key) {
+            uint32_t bit = 1u << key;
+            if (now >= next_us[key]) {
+                level ^= bit;
+                bool held = (level & bit) == 0;
+                bounce_end[key] = now + (shape->bounce_us ? BenchRange(&seed, 0u, shape->bounce_us) : 0u);
+                next_us[key] = now + (held ? BenchRange(&seed, shape->hold_min, shape->hold_max)
+                                           : BenchRange(&seed, shape->gap_min, shape->gap_max));
+            }
+            raw = (raw & ~bit) | (level & bit);
+            if (now < bounce_end[key]) {
+                raw ^= (BenchRandom(&seed) & 1u) << key;
+            } else if (!(level & bit) && shape->dropout) {
+                if (now >= dropout_end[key] && BenchRandom(&seed) % shape->dropout == 0) {
+                    dropout_end[key] = now + BenchRange(&seed, 1u, 3u) * period_us;
+                }
+                if (now < dropout_end[key]) {
+                    raw |= bit;
+                }
+            }
+        }
+        trace[n].time_us = now;
+        trace[n].keys = raw;
+    }
+    return max;
+#else
+    (void)trace;
+    (void)kind;
+    (void)period_us;
+    (void)seed;
+    return max;
+#endif
+}
+
+/**
+ * Run every engine over one trace
+ *
+ * @param trace Samples in time order, at least two
+ * @param clock Timer for the updates, read right before and after each
+ * @param results One per engine, indexed by DEBOUNCE_ALGORITHM value
+ */
+void DebounceBenchRun(const DebounceBenchSample *trace, uint32_t count, const DebounceBenchConfig *config,
+                      DebounceBenchClock clock, DebounceBenchResult results[DEBOUNCE_BENCH_ENGINES])
+{
+    memset(results, 0, DEBOUNCE_BENCH_ENGINES * sizeof(DebounceBenchResult));
+#if DEBOUNCE_BENCH || DEBOUNCE_BENCH_HOST
+    if (count < 2u) {
+        return;
+    }
+    uint32_t end = BenchReference(trace, count, config->settle_us);
+    uint32_t period_us = (trace[count - 1u].time_us - trace[0].time_us) / (count - 1u);
+    uint32_t overhead = BenchClockOverhead(clock);
+    period_us = period_us ? period_us : 1u;
+    if (end == 0) {
+        return;
+    }
+
+    for (uint32_t engine = 0; engine < DEBOUNCE_BENCH_ENGINES; ++engine) {
+        DebounceBenchResult *result = &results[engine];
+        uint32_t cursor[32];
+        uint32_t state = trace[0].keys;
+        uint64_t total = 0;
+
+        for (uint32_t key = 0; key < 32u; ++key) {
+            cursor[key] = BenchNextChange(key, 0);
+        }
+        BenchEngineInit(engine, state, config, period_us);
+        for (uint32_t n = 0; n < end; ++n) {
+            uint32_t now = trace[n].time_us;
+            uint32_t start = clock();
+            uint32_t out = BenchEngineUpdate(engine, trace[n].keys, now);
+            uint32_t ticks = clock() - start;
+            ticks = ticks > overhead ? ticks - overhead : 0u;
+            total += ticks;
+            if (ticks > result->ticks_max) {
+                result->ticks_max = ticks;
+            }
+            for (uint32_t keys = out ^ state; keys; keys &= keys - 1u) {
+                uint32_t key = (uint32_t)__builtin_ctz(keys);
+                BenchMatch(result, cursor, key, ((out >> key) & 1u) == 0, now, config->match_us);
+            }
+            state = out;
+        }
+        // Whatever the engine never answered is missed, unless its match
+        // window runs past the trace
+        uint32_t last_us = trace[end - 1u].time_us;
+        for (uint32_t key = 0; key < 32u; ++key) {
+            for (uint32_t n = cursor[key]; n < change_count; n = BenchNextChange(key, n + 1u)) {
+                if ((int32_t)(last_us - changes[n].time_us) > (int32_t)config->match_us) {
+                    result->missed++;
+                }
+            }
+        }
+        result->engine = (uint8_t)engine;
+        result->state_bytes = state_bytes[engine];
+        result->samples = end;
+        result->ticks_mean = (uint32_t)(total / end);
+        result->changes = change_count;
+    }
+#else
+    (void)trace;
+    (void)count;
+    (void)config;
+    (void)clock;
+#endif
+}
+
+#if DEBOUNCE_BENCH && !DEBOUNCE_BENCH_HOST
+_Static_assert(BENCH_LOCKOUT == DEBOUNCE_LOCKOUT && BENCH_VERTICAL == DEBOUNCE_VERTICAL_COUNTER &&
+               BENCH_ASYM == DEBOUNCE_ASYMMETRIC && BENCH_ADAPTIVE == DEBOUNCE_ADAPTIVE &&
+               BENCH_SAMPLE == DEBOUNCE_SAMPLE_COUNT && BENCH_INTEGRATOR == DEBOUNCE_INTEGRATOR,
+               "Engine indices follow DEBOUNCE_ALGORITHM");
+_Static_assert(sizeof(DebounceBenchSample) == sizeof(RawSample), "Traces are raw capture dumps");
+
+// Readable from the debugger: one row per synthetic kind, then the capture
+DebounceBenchResult debounce_bench_results[DEBOUNCE_BENCH_SYNTH_KINDS + 1u][DEBOUNCE_BENCH_ENGINES];
+uint32_t            debounce_bench_runs;
+
+static DebounceBenchSample bench_trace[DEBOUNCE_BENCH_SAMPLES];
+static uint32_t            next_kind;
+static bool                capture_taken;
+
+static uint32_t BenchCycles(void)
+{
+    return DWT->CYCCNT;
+}
+
+/**
+ * Engine settings of this build
+ */
+static void BenchFirmwareConfig(DebounceBenchConfig *config)
+{
+    DebounceBenchDefaults(config);
+    config->lockout_us = DEBOUNCE_TIME_MS * 1000u;
+    config->press_eager = DEBOUNCE_PRESS_POLICY == DEBOUNCE_EAGER;
+    config->release_eager = DEBOUNCE_RELEASE_POLICY == DEBOUNCE_EAGER;
+    config->press_us = DEBOUNCE_PRESS_MS * 1000u;
+    config->release_us = DEBOUNCE_RELEASE_MS * 1000u;
+    config->adaptive_min_us = DEBOUNCE_ADAPTIVE_MIN_US;
+    config->adaptive_max_us = DEBOUNCE_ADAPTIVE_MAX_US;
+    config->adaptive_margin_us = DEBOUNCE_ADAPTIVE_MARGIN_US;
+}
+#endif
+
+/**
+ * Benchmark one trace, a scheduler task of DEBOUNCE_BENCH builds
+ *
+ * The synthetic kinds run one per call after boot, then each new frozen
+ * raw capture once.
+ */
+void DebounceBenchService(void)
+{
+#if DEBOUNCE_BENCH && !DEBOUNCE_BENCH_HOST
+    DebounceBenchConfig config;
+    uint32_t count;
+    uint32_t row;
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    BenchFirmwareConfig(&config);
+
+    if (next_kind < DEBOUNCE_BENCH_SYNTH_KINDS) {
+        row = next_kind++;
+        count = DebounceBenchSynth(bench_trace, DEBOUNCE_BENCH_SAMPLES, row, DEBOUNCE_BENCH_PERIOD_US, row + 1u);
+    } else {
+        count = RawCaptureCopy((RawSample *)bench_trace, DEBOUNCE_BENCH_SAMPLES);
+        if (count == 0) {
+            capture_taken = false;
+            return;
+        }
+        if (capture_taken) {
+            return;
+        }
+        capture_taken = true;
+        row = DEBOUNCE_BENCH_SYNTH_KINDS;
+    }
+    DebounceBenchRun(bench_trace, count, &config, BenchCycles, debounce_bench_results[row]);
+    debounce_bench_runs++;
+#endif
+}
+
+#if DEBOUNCE_BENCH_HOST
+static const char *const engine_names[DEBOUNCE_BENCH_ENGINES] = {
+    [BENCH_LOCKOUT]    = "lockout",
+    [BENCH_VERTICAL]   = "vertical",
+    [BENCH_ASYM]       = "asymmetric",
+    [BENCH_ADAPTIVE]   = "adaptive",
+    [BENCH_SAMPLE]     = "sample-count",
+    [BENCH_INTEGRATOR] = "integrator",
+};
+
+static const char *const kind_names[DEBOUNCE_BENCH_SYNTH_KINDS] = {
+    [DEBOUNCE_BENCH_CLEAN]   = "synthetic clean",
+    [DEBOUNCE_BENCH_BOUNCE]  = "synthetic bounce",
+    [DEBOUNCE_BENCH_CHATTER] = "synthetic chatter",
+    [DEBOUNCE_BENCH_ROLL]    = "synthetic roll",
+};
+
+static uint32_t HostClock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec);
+}
+
+static void HostPrintLatency(const char *label, const DebounceBenchLatency *latency)
+{
+    printf("    %-7s", label);
+    if (latency->count == 0) {
+        printf(" -\n");
+        return;
+    }
+    printf(" min %5u  mean %5u  max %5u us |", latency->min_us, latency->sum_us / latency->count,
+           latency->max_us);
+    for (uint32_t n = 0; n < DEBOUNCE_BENCH_BUCKETS; ++n) {
+        printf(" %u", latency->histogram[n]);
+    }
+    printf("\n");
+}
+
+// Engines that wait for the new level to hold (the asymmetric one for its
+// deferred release) must follow the clean and bounce traces exactly
+#define HOST_EXACT_ENGINES ((1u << BENCH_VERTICAL) | (1u << BENCH_ASYM) | (1u << BENCH_SAMPLE) | \
+                            (1u << BENCH_INTEGRATOR))
+#define HOST_EXACT_KINDS   ((1u << DEBOUNCE_BENCH_CLEAN) | (1u << DEBOUNCE_BENCH_BOUNCE))
+
+/**
+ * Check the engines that must not miss or invent a change on a trace kind
+ *
+ * @return Number of engines that did
+ */
+static uint32_t HostCheck(uint32_t kind, const DebounceBenchResult results[DEBOUNCE_BENCH_ENGINES])
+{
+    uint32_t failed = 0;
+
+    if (!((HOST_EXACT_KINDS >> kind) & 1u)) {
+        return 0;
+    }
+    for (uint32_t engine = 0; engine < DEBOUNCE_BENCH_ENGINES; ++engine) {
+        const DebounceBenchResult *r = &results[engine];
+        if (((HOST_EXACT_ENGINES >> engine) & 1u) && (r->missed || r->phantom)) {
+            printf("FAIL %s on %s: missed %u, phantom %u\n", engine_names[engine], kind_names[kind], r->missed,
+                   r->phantom);
+            failed++;
+        }
+    }
+    return failed;
+}
+
+static void HostPrint(const char *name, const DebounceBenchResult results[DEBOUNCE_BENCH_ENGINES])
+{
+    printf("%s: %u samples, %u changes\n", name, results[0].samples, results[0].changes);
+    for (uint32_t engine = 0; engine < DEBOUNCE_BENCH_ENGINES; ++engine) {
+        const DebounceBenchResult *r = &results[engine];
+        printf("  %-12s %4u B  %5u/%6u ns  missed %3u  phantom %3u\n", engine_names[engine], r->state_bytes,
+               r->ticks_mean, r->ticks_max, r->missed, r->phantom);
+        HostPrintLatency("press", &r->press);
+        HostPrintLatency("release", &r->release);
+    }
+}
+
+/**
+ * Benchmark the synthetic traces, then every raw capture dump named
+ */
+int main(int argc, char **argv)
+{
+    static DebounceBenchSample trace[DEBOUNCE_BENCH_SAMPLES];
+    DebounceBenchResult results[DEBOUNCE_BENCH_ENGINES];
+    DebounceBenchConfig config;
+    uint32_t failed = 0;
+
+    DebounceBenchDefaults(&config);
+    for (uint32_t kind = 0; kind < DEBOUNCE_BENCH_SYNTH_KINDS; ++kind) {
+        uint32_t count = DebounceBenchSynth(trace, DEBOUNCE_BENCH_SAMPLES, kind, DEBOUNCE_BENCH_PERIOD_US, kind + 1u);
+        DebounceBenchRun(trace, count, &config, HostClock, results);
+        HostPrint(kind_names[kind], results);
+        failed += HostCheck(kind, results);
+    }
+    for (int arg = 1; arg < argc; ++arg) {
+        FILE *file = fopen(argv[arg], "rb");
+        if (file == NULL) {
+            perror(argv[arg]);
+            return EXIT_FAILURE;
+        }
+        uint32_t count = (uint32_t)fread(trace, sizeof(trace[0]), DEBOUNCE_BENCH_SAMPLES, file);
+        fclose(file);
+        DebounceBenchRun(trace, count, &config, HostClock, results);
+        HostPrint(argv[arg], results);
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+#endif
@@ -0,0 +1,374 @@
+/**
+ * @file deep_idle.c
+ * @brief STOP mode after a long idle period, woken by keys or the I2C bus.
+ *
+ * The RTC wakeup timer runs from LSI and is only enabled while in STOP.
+ * EXTI line 7 belongs to key PA7 while awake; for STOP it is switched to
+ * PB7 (SDA, falling edge), PA7 is then covered by the RTC poll like the
+ * keys that never had a line of their own.
+ *
+ * TIM5 does not run in STOP, so the time spent there (residency.h) comes
+ * from the RTC calendar instead: its sub-second counter, read directly
+ * (BYPSHAD) on every wake-up, in steps of DEEP_IDLE_RTC_PREDIV_A + 1 LSI
+ * cycles. LSI is only good to tens of percent, so the steps are scaled by
+ * the LSI rate measured against TIM5 in the awake time between two STOPs.
+ */
+
+#include "deep_idle.h"
+#include "right_side_keyboard.h"
+#include "keyboard_layout.h"
+#include "irq_plan.h"
+#include "watchdog.h"
+#include "periph.h"
+#include "residency.h"
+#include "timebase.h"
+#include "transport.h"
+#if CLOCK_PROFILE == CLOCK_PROFILE_GOVERNOR
+#include "clock_governor.h"
+#endif
+
+#if DEEP_IDLE_ENABLE
+
+// RTC wakeup counter clocked from LSI / 16 (WUCKSEL = 000)
+#define DEEP_IDLE_WUT_HZ     (LSI_VALUE / 16U)
+#define DEEP_IDLE_WUT_RELOAD ((DEEP_IDLE_WUT_HZ * DEEP_IDLE_POLL_MS) / 1000U - 1U)
+
+// SDA (PB7) shares EXTI line 7 with key PA7
+#define DEEP_IDLE_SDA_LINE (1U << 7)
+
+// RTC asynchronous prescaler: sub-second steps of 8 LSI cycles (~250 us),
+// the synchronous one keeps the calendar at 1 Hz
+#define DEEP_IDLE_RTC_PREDIV_A 7U
+#define DEEP_IDLE_RTC_PREDIV_S (LSI_VALUE / (DEEP_IDLE_RTC_PREDIV_A + 1U) - 1U)
+#define DEEP_IDLE_RTC_STEPS_S  (DEEP_IDLE_RTC_PREDIV_S + 1U)
+#define DEEP_IDLE_RTC_STEPS_DAY (86400U * DEEP_IDLE_RTC_STEPS_S)
+
+// Awake windows longer than this (nominal LSI) may have wrapped TIM5 and
+// are left out of the LSI measurement
+#define DEEP_IDLE_CAL_MAX_US 0x40000000U
+
+// System clock setup from main.c, rerun after STOP for the PLL profiles
+extern void SystemClock_Config(void);
+
+static uint32_t last_activity;
+static uint32_t idle_deadline;
+static uint32_t stop_entries;
+static uint32_t stop_wake_us;
+
+// LSI rate: RTC steps and TIM5 microseconds of the awake windows so far,
+// and where the last STOP ended
+static uint64_t cal_steps;
+static uint64_t cal_us;
+static uint32_t exit_steps;
+static uint32_t exit_us;
+static bool     exited;
+
+static void RtcUnlock(void)
+{
+    RTC->WPR = 0xCA;
+    RTC->WPR = 0x53;
+}
+
+static void RtcLock(void)
+{
+    RTC->WPR = 0xFF;
+}
+
+static void RtcWakeupClear(void)
+{
+    // ISR flags are rc_w0, keep INIT as it is
+    RTC->ISR = (~(RTC_ISR_WUTF | RTC_ISR_INIT) & 0x0000FFFFu) | (RTC->ISR & RTC_ISR_INIT);
+    EXTI->PR = EXTI_PR_PR22;
+}
+
+/**
+ * Read the RTC calendar as sub-second steps since midnight
+ *
+ * With BYPSHAD the counters are read live, a second boundary between the
+ * two reads shows up as a changed SSR.
+ */
+static uint32_t RtcSteps(void)
+{
+    uint32_t ssr, tr;
+
+    do {
+        ssr = RTC->SSR;
+        tr = RTC->TR;
+    } while (ssr != RTC->SSR);
+
+    uint32_t hours = ((tr >> 20) & 0x3u) * 10u + ((tr >> 16) & 0xFu);
+    uint32_t minutes = ((tr >> 12) & 0x7u) * 10u + ((tr >> 8) & 0xFu);
+    uint32_t seconds = ((tr >> 4) & 0x7u) * 10u + (tr & 0xFu);
+    return ((hours * 60u + minutes) * 60u + seconds) * DEEP_IDLE_RTC_STEPS_S +
+           (DEEP_IDLE_RTC_PREDIV_S - (ssr & RTC_SSR_SS));
+}
+
+/**
+ * RTC steps from one reading to a later one, less than a day apart
+ */
+static inline uint32_t RtcStepsSince(uint32_t from, uint32_t to)
+{
+    return to >= from ? to - from : to + DEEP_IDLE_RTC_STEPS_DAY - from;
+}
+
+/**
+ * Convert RTC steps into microseconds at the measured LSI rate, nominal
+ * until a second of awake time was measured
+ */
+static uint32_t RtcStepsToUs(uint32_t steps)
+{
+    uint64_t us;
+
+    if (cal_steps >= DEEP_IDLE_RTC_STEPS_S) {
+        us = (uint64_t)steps * cal_us / cal_steps;
+    } else {
+        us = (uint64_t)steps * (DEEP_IDLE_RTC_PREDIV_A + 1U) * 1000000U / LSI_VALUE;
+    }
+    return us > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)us;
+}
+
+static void RtcWakeupEnable(bool enable)
+{
+    RtcUnlock();
+    if (enable) {
+        RTC->CR |= RTC_CR_WUTE;
+    } else {
+        RTC->CR &= ~RTC_CR_WUTE;
+    }
+    RtcLock();
+    RtcWakeupClear();
+}
+
+/**
+ * Clock the RTC from LSI and set up its wakeup timer, EXTI line 22 and IRQ
+ *
+ * @return true on success, false if LSI or the RTC did not come up
+ */
+bool DeepIdleInit(void)
+{
+    __HAL_RCC_PWR_CLK_ENABLE();
+    HAL_PWR_EnableBkUpAccess();
+
+    __HAL_RCC_LSI_ENABLE();
+    uint32_t start = HAL_GetTick();
+    while (!__HAL_RCC_GET_FLAG(RCC_FLAG_LSIRDY)) {
+        if ((HAL_GetTick() - start) > LSI_TIMEOUT_VALUE) {
+            return false;
+        }
+    }
+
+    // RTCSEL can only be changed again after a backup domain reset
+    if ((RCC->BDCR & RCC_BDCR_RTCSEL) != RCC_RTCCLKSOURCE_LSI) {
+        __HAL_RCC_BACKUPRESET_FORCE();
+        __HAL_RCC_BACKUPRESET_RELEASE();
+        __HAL_RCC_RTC_CONFIG(RCC_RTCCLKSOURCE_LSI);
+    }
+    __HAL_RCC_RTC_ENABLE();
+
+    RtcUnlock();
+    if ((RTC->PRER & (RTC_PRER_PREDIV_A | RTC_PRER_PREDIV_S)) !=
+        ((DEEP_IDLE_RTC_PREDIV_A << RTC_PRER_PREDIV_A_Pos) | DEEP_IDLE_RTC_PREDIV_S)) {
+        // Finer sub-second steps for the STOP residency, INIT mode only
+        RTC->ISR |= RTC_ISR_INIT;
+        start = HAL_GetTick();
+        while (!(RTC->ISR & RTC_ISR_INITF)) {
+            if ((HAL_GetTick() - start) > LSI_TIMEOUT_VALUE) {
+                RtcLock();
+                return false;
+            }
+        }
+        RTC->PRER = DEEP_IDLE_RTC_PREDIV_S;
+        RTC->PRER = (DEEP_IDLE_RTC_PREDIV_A << RTC_PRER_PREDIV_A_Pos) | DEEP_IDLE_RTC_PREDIV_S;
+        RTC->ISR &= ~RTC_ISR_INIT;
+    }
+    RTC->CR |= RTC_CR_BYPSHAD;
+    RTC->CR &= ~(RTC_CR_WUTE | RTC_CR_WUCKSEL);
+    start = HAL_GetTick();
+    while (!(RTC->ISR & RTC_ISR_WUTWF)) {
+        if ((HAL_GetTick() - start) > LSI_TIMEOUT_VALUE) {
+            RtcLock();
+            return false;
+        }
+    }
+    RTC->WUTR = DEEP_IDLE_WUT_RELOAD;
+    RTC->CR |= RTC_CR_WUTIE;
+    RtcLock();
+    RtcWakeupClear();
+
+    EXTI->IMR |= EXTI_IMR_MR22;
+    EXTI->RTSR |= EXTI_RTSR_TR22;
+    HAL_NVIC_SetPriority(RTC_WKUP_IRQn, IRQ_PRIO_WAKE, 0);
+    HAL_NVIC_EnableIRQ(RTC_WKUP_IRQn);
+
+    // Wake latency is measured in core cycles
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    idle_deadline = HAL_GetTick() + DEEP_IDLE_AFTER_MS;
+    return true;
+}
+
+/**
+ * Sleep in STOP until a key moved or a master started a transfer
+ *
+ * Runs with interrupts masked, the EXTI handlers run once the caller
+ * unmasks them. RTC poll wake-ups are handled here on HSI: when the keys
+ * still read the same the core goes straight back to STOP.
+ */
+static void DeepIdleStop(void)
+{
+    uint32_t keys_a = GPIOA->IDR & KEY_MASK_A;
+    uint32_t keys_b = GPIOB->IDR & KEY_MASK_B;
+
+    uint32_t exticr = SYSCFG->EXTICR[1];
+    uint32_t rtsr = EXTI->RTSR;
+    uint32_t ftsr = EXTI->FTSR;
+    uint32_t imr = EXTI->IMR;
+
+    // Line 7: PA7 key -> PB7 SDA, a START pulls SDA low while SCL is high
+    SYSCFG->EXTICR[1] = (exticr & ~SYSCFG_EXTICR2_EXTI7) | SYSCFG_EXTICR2_EXTI7_PB;
+    EXTI->RTSR = rtsr & ~DEEP_IDLE_SDA_LINE;
+    EXTI->FTSR = ftsr | DEEP_IDLE_SDA_LINE;
+    EXTI->IMR = imr | DEEP_IDLE_SDA_LINE;
+    EXTI->PR = DEEP_IDLE_SDA_LINE;
+    NVIC_ClearPendingIRQ(EXTI9_5_IRQn);
+
+    HAL_SuspendTick();
+    RtcWakeupEnable(true);
+    stop_entries++;
+
+    // The awake time since the last STOP measures LSI
+    uint32_t steps = RtcSteps();
+    uint32_t entry_us = TimebaseNowUs();
+    if (exited) {
+        uint32_t window = RtcStepsSince(exit_steps, steps);
+        if ((uint64_t)window * (DEEP_IDLE_RTC_PREDIV_A + 1U) * 1000000U / LSI_VALUE < DEEP_IDLE_CAL_MAX_US) {
+            cal_steps += window;
+            cal_us += entry_us - exit_us;
+            if (cal_us > 0xFFFFFFFFu) {
+                // Same rate, no overflow in RtcStepsToUs()
+                cal_steps /= 2u;
+                cal_us /= 2u;
+            }
+        }
+    }
+    uint32_t stop_steps = 0;
+
+    uint32_t wake_cycle;
+    for (;;) {
+        HAL_PWR_EnterSTOPMode(PWR_LOWPOWERREGULATOR_ON, PWR_STOPENTRY_WFI);
+        wake_cycle = DWT->CYCCNT;
+        WatchdogKick();
+
+        // Per wake-up, so a night in STOP never spans a calendar day
+        uint32_t now_steps = RtcSteps();
+        stop_steps += RtcStepsSince(steps, now_steps);
+        steps = now_steps;
+
+        uint32_t pending = EXTI->PR;
+        if ((pending & 0xFFFFu) != 0 || !(pending & EXTI_PR_PR22)) {
+            break;   // Key or SDA edge, or another interrupt
+        }
+        RtcWakeupClear();
+        NVIC_ClearPendingIRQ(RTC_WKUP_IRQn);
+        if ((GPIOA->IDR & KEY_MASK_A) != keys_a || (GPIOB->IDR & KEY_MASK_B) != keys_b) {
+            break;
+        }
+    }
+
+    RtcWakeupEnable(false);
+    NVIC_ClearPendingIRQ(RTC_WKUP_IRQn);
+    ResidencyStop(RtcStepsToUs(stop_steps));
+    exit_steps = steps;
+    exit_us = TimebaseNowUs();
+    exited = true;
+
+    // Hand line 7 back to PA7, a START seen on SDA is not a key edge
+    SYSCFG->EXTICR[1] = exticr;
+    EXTI->RTSR = rtsr;
+    EXTI->FTSR = ftsr;
+    EXTI->IMR = imr;
+    EXTI->PR = DEEP_IDLE_SDA_LINE;
+
+    // STOP exit runs from HSI with the PLL off
+#if CLOCK_PROFILE != CLOCK_PROFILE_HSI && CLOCK_PROFILE != CLOCK_PROFILE_GOVERNOR
+    SystemClock_Config();
+#endif
+    HAL_ResumeTick();
+
+    // Counted as HSI cycles, the few cycles after the PLL switch make this
+    // an upper bound
+    stop_wake_us = (DWT->CYCCNT - wake_cycle) / (HSI_VALUE / 1000000U);
+
+    // PA7 had no edge interrupt during STOP, rescan everything
+    RightKeyboardScanRequest();
+}
+
+/**
+ * Enter STOP once nothing happened for DEEP_IDLE_AFTER_MS
+ *
+ * Called as the scheduler's idle hook, before the main loop sleeps. After
+ * a wake-up the core stays up for DEEP_IDLE_GRACE_MS so the master's retry
+ * is served. While the master holds RIGHT_KEYBOARD_POWER_STOP, the grace
+ * period is the only wait: its own write, a release or a transfer each
+ * start the next one, and a press ends the state.
+ *
+ * @param activity Counter that moves on every key change or I2C transfer,
+ *                 see RightKeyboardActivity()
+ */
+void DeepIdleService(uint32_t activity)
+{
+    uint32_t now = PeriphTickMs();
+    bool suspended = RightKeyboardPowerState() == RIGHT_KEYBOARD_POWER_STOP;
+
+    if (activity != last_activity) {
+        last_activity = activity;
+        idle_deadline = now + (suspended ? DEEP_IDLE_GRACE_MS : DEEP_IDLE_AFTER_MS);
+        return;
+    }
+    if ((int32_t)(now - idle_deadline) < 0) {
+        return;
+    }
+#if CLOCK_PROFILE == CLOCK_PROFILE_GOVERNOR
+    // STOP exit restores HSI with the current dividers, only the idle ones fit
+    if (ClockGovernorBoosted()) {
+        return;
+    }
+#endif
+
+    __disable_irq();
+    // A start bit on PB7 (UART RX) wakes the core the same way as SDA
+    bool link_busy = TransportBusy();
+    if (!RightKeyboardScanPending() && !link_busy) {
+        DeepIdleStop();
+        idle_deadline = PeriphTickMs() + DEEP_IDLE_GRACE_MS;
+    }
+    __enable_irq();
+}
+
+/**
+ * RTC wakeup interrupt, normally consumed in DeepIdleStop() with
+ * interrupts masked
+ */
+void DeepIdleRtcIRQHandler(void)
+{
+    RtcWakeupClear();
+}
+#endif /* DEEP_IDLE_ENABLE */
+
+/**
+ * Read the deep idle statistics
+ *
+ * @param entries Set to the number of STOP entries since boot
+ * @param wake_us Set to the last wake-up time, STOP exit to clocks restored
+ */
+void DeepIdleStats(uint32_t *entries, uint32_t *wake_us)
+{
+#if DEEP_IDLE_ENABLE
+    *entries = stop_entries;
+    *wake_us = stop_wake_us;
+#else
+    *entries = 0;
+    *wake_us = 0;
+#endif
+}
@@ -0,0 +1,192 @@
+/**
+ * @file dma_sampler.c
+ * @brief Timer-triggered DMA sampling of the key ports.
+ *
+ * DMA2 request mapping (channel 6):
+ *   Stream5 <- TIM1_UP  : copies GPIOA->IDR
+ *   Stream1 <- TIM1_CH1 : copies GPIOB->IDR (CCR1 = 0, fires on the same tick)
+ *
+ * Only Stream1 raises interrupts. Its half/full-transfer events hand the
+ * matching half of both rings to RightKeyboardProcessSamples().
+ *
+ * KEY_WIRING_MATRIX:
+ *   Stream5 <- TIM1_UP  : writes the next column strobe to MATRIX_COL_PORT->BSRR
+ *   Stream1 <- TIM1_CH1 : copies MATRIX_ROW_PORT->IDR (CCR1 = ARR / 2)
+ * so the rows settle for half a sample period before they are captured,
+ * and full frames go to RightKeyboardProcessMatrix().
+ */
+
+#include "dma_sampler.h"
+#include "right_side_keyboard.h"
+#include "irq_plan.h"
+#include "mem_budget.h"
+
+#define DMA_SAMPLE_HALF_LEN (DMA_SAMPLE_RING_LEN / 2)
+
+DMA_HandleTypeDef hdma_tim1_up;
+DMA_HandleTypeDef hdma_tim1_ch1;
+
+#if KEY_WIRING == KEY_WIRING_MATRIX
+// Row samples, one per column strobe
+static uint16_t samples_rows[DMA_SAMPLE_RING_LEN] MEM_BSS(dma);
+
+// Strobe sequence shifted by one: column 0 is driven by software before
+// the timer starts, every update event then moves to the next column
+static uint32_t strobe_ring[MATRIX_COLS] MEM_BSS(dma);
+#else
+// Sample rings, the IDR registers only carry 16 valid bits
+static uint16_t samples_a[DMA_SAMPLE_RING_LEN] MEM_BSS(dma);
+static uint16_t samples_b[DMA_SAMPLE_RING_LEN] MEM_BSS(dma);
+#endif
+
+static void DmaSamplerHalfCplt(DMA_HandleTypeDef *hdma);
+static void DmaSamplerCplt(DMA_HandleTypeDef *hdma);
+
+/**
+ * Get the TIM1 kernel clock (APB2 timers run at 2x PCLK2 when APB2 is divided)
+ */
+static uint32_t DmaSamplerTimerClock(void)
+{
+    uint32_t pclk2 = HAL_RCC_GetPCLK2Freq();
+
+    if ((RCC->CFGR & RCC_CFGR_PPRE2) != RCC_CFGR_PPRE2_DIV1) {
+        pclk2 *= 2;
+    }
+    return pclk2;
+}
+
+static bool DmaSamplerInitStream(DMA_HandleTypeDef *hdma, DMA_Stream_TypeDef *stream, uint32_t priority,
+                                 uint32_t direction, bool word)
+{
+    hdma->Instance = stream;
+    hdma->Init.Channel = DMA_CHANNEL_6;
+    hdma->Init.Direction = direction;
+    hdma->Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma->Init.MemInc = DMA_MINC_ENABLE;
+    hdma->Init.PeriphDataAlignment = word ? DMA_PDATAALIGN_WORD : DMA_PDATAALIGN_HALFWORD;
+    hdma->Init.MemDataAlignment = word ? DMA_MDATAALIGN_WORD : DMA_MDATAALIGN_HALFWORD;
+    hdma->Init.Mode = DMA_CIRCULAR;
+    hdma->Init.Priority = priority;
+    hdma->Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+
+    return HAL_DMA_Init(hdma) == HAL_OK;
+}
+
+/**
+ * Configure TIM1 and the two DMA2 streams, sampling is not started yet
+ *
+ * @return true on success
+ */
+bool DmaSamplerInit(void)
+{
+    __HAL_RCC_DMA2_CLK_ENABLE();
+    __HAL_RCC_TIM1_CLK_ENABLE();
+
+#if KEY_WIRING == KEY_WIRING_MATRIX
+    // The strobe must land before the capture half a period later
+    if (!DmaSamplerInitStream(&hdma_tim1_up, DMA2_Stream5, DMA_PRIORITY_VERY_HIGH, DMA_MEMORY_TO_PERIPH, true)) {
+        return false;
+    }
+    for (uint32_t c = 0; c < MATRIX_COLS; ++c) {
+        strobe_ring[c] = matrix_strobe[(c + 1u) % MATRIX_COLS];
+    }
+#else
+    // GPIOA is sampled first and must win arbitration on the shared tick
+    if (!DmaSamplerInitStream(&hdma_tim1_up, DMA2_Stream5, DMA_PRIORITY_VERY_HIGH, DMA_PERIPH_TO_MEMORY, false)) {
+        return false;
+    }
+#endif
+    if (!DmaSamplerInitStream(&hdma_tim1_ch1, DMA2_Stream1, DMA_PRIORITY_HIGH, DMA_PERIPH_TO_MEMORY, false)) {
+        return false;
+    }
+    hdma_tim1_ch1.XferHalfCpltCallback = DmaSamplerHalfCplt;
+    hdma_tim1_ch1.XferCpltCallback = DmaSamplerCplt;
+
+    // Time base: split the period into PSC/ARR so it fits the 16-bit counter
+    uint32_t ticks = DmaSamplerTimerClock() / DMA_SAMPLE_RATE_HZ;
+    uint32_t psc = (ticks - 1) / 0x10000;
+
+    TIM1->CR1 = 0;
+    TIM1->PSC = psc;
+    TIM1->ARR = (ticks / (psc + 1)) - 1;
+    TIM1->CCMR1 = 0;   // CH1 frozen output compare, only used as a DMA trigger
+#if KEY_WIRING == KEY_WIRING_MATRIX
+    TIM1->CCR1 = (TIM1->ARR + 1u) / 2u;   // Capture the rows mid-period
+#else
+    TIM1->CCR1 = 0;    // Match right after the update event
+#endif
+    TIM1->EGR = TIM_EGR_UG;
+    TIM1->SR = 0;
+
+    HAL_NVIC_SetPriority(DMA2_Stream1_IRQn, IRQ_PRIO_SAMPLER, 0);
+    HAL_NVIC_EnableIRQ(DMA2_Stream1_IRQn);
+
+    return true;
+}
+
+/**
+ * Arm both DMA streams and start the sampling timer
+ *
+ * @return true on success
+ */
+bool DmaSamplerStart(void)
+{
+#if KEY_WIRING == KEY_WIRING_MATRIX
+    MATRIX_COL_PORT->BSRR = matrix_strobe[0];
+    if (HAL_DMA_Start(&hdma_tim1_up, (uint32_t)strobe_ring, (uint32_t)&MATRIX_COL_PORT->BSRR, MATRIX_COLS) != HAL_OK) {
+        return false;
+    }
+    if (HAL_DMA_Start_IT(&hdma_tim1_ch1, (uint32_t)&MATRIX_ROW_PORT->IDR, (uint32_t)samples_rows, DMA_SAMPLE_RING_LEN) != HAL_OK) {
+        HAL_DMA_Abort(&hdma_tim1_up);
+        return false;
+    }
+#else
+    if (HAL_DMA_Start(&hdma_tim1_up, (uint32_t)&GPIOA->IDR, (uint32_t)samples_a, DMA_SAMPLE_RING_LEN) != HAL_OK) {
+        return false;
+    }
+    if (HAL_DMA_Start_IT(&hdma_tim1_ch1, (uint32_t)&GPIOB->IDR, (uint32_t)samples_b, DMA_SAMPLE_RING_LEN) != HAL_OK) {
+        HAL_DMA_Abort(&hdma_tim1_up);
+        return false;
+    }
+#endif
+
+    TIM1->CNT = 0;
+    TIM1->DIER = TIM_DIER_UDE | TIM_DIER_CC1DE;
+    TIM1->CR1 = TIM_CR1_CEN;
+
+    return true;
+}
+
+/**
+ * Stop the sampling timer and both DMA streams
+ */
+void DmaSamplerStop(void)
+{
+    TIM1->CR1 = 0;
+    TIM1->DIER = 0;
+    HAL_DMA_Abort(&hdma_tim1_ch1);
+    HAL_DMA_Abort(&hdma_tim1_up);
+#if KEY_WIRING == KEY_WIRING_MATRIX
+    MATRIX_COL_PORT->BSRR = MATRIX_COL_MASK;
+#endif
+}
+
+static void DmaSamplerHalfCplt(DMA_HandleTypeDef *hdma)
+{
+    (void)hdma;
+#if KEY_WIRING == KEY_WIRING_MATRIX
+    RightKeyboardProcessMatrix(&samples_rows[0], DMA_SAMPLE_HALF_LEN / MATRIX_COLS);
+#else
+    RightKeyboardProcessSamples(&samples_a[0], &samples_b[0], DMA_SAMPLE_HALF_LEN);
+#endif
+}
+
+static void DmaSamplerCplt(DMA_HandleTypeDef *hdma)
+{
+    (void)hdma;
+#if KEY_WIRING == KEY_WIRING_MATRIX
+    RightKeyboardProcessMatrix(&samples_rows[DMA_SAMPLE_HALF_LEN], DMA_SAMPLE_HALF_LEN / MATRIX_COLS);
+#else
+    RightKeyboardProcessSamples(&samples_a[DMA_SAMPLE_HALF_LEN], &samples_b[DMA_SAMPLE_HALF_LEN], DMA_SAMPLE_HALF_LEN);
+#endif
+}
@@ -0,0 +1,216 @@
+/**
+ * @file edge_capture.c
+ * @brief Hardware edge timestamps for latency-critical keys on TIM5.
+ *
+ * The TIM5 interrupt (IRQ_PRIO_WAKE) and the scan share the key state:
+ * the scan runs EdgeCaptureUpdate() with interrupts masked and drains any
+ * capture still pending first, so a scan in the sampler interrupt, which
+ * TIM5 cannot preempt, sees the edges in the order they happened.
+ *
+ * A lockout only ends in the scan. Edges after its end but before the
+ * scan noticed count as bounce and are settled by the level check with
+ * their own capture time, so no compare ever spans more than the gap
+ * between two scans.
+ */
+
+#include "edge_capture.h"
+#include "hot_path.h"
+#include "timebase.h"
+
+#if EDGE_CAPTURE_ENABLE
+// CCxIF of the channel on PAn is bit n + 1 of TIM5->SR, CCxOF bit n + 9
+#define EDGE_CAPTURE_FLAGS ((uint32_t)EDGE_CAPTURE_PINS << 1)
+
+static uint32_t state = EDGE_CAPTURE_KEYS;  /* 1 = released, captured keys only */
+static uint32_t locked;                     /* keys in their lockout */
+static uint32_t bounced;                    /* keys with an edge since the last flip */
+static uint32_t accepted_at[4];             /* per pin: time of the last flip */
+static uint32_t last_edge[4];               /* per pin: time of the last edge */
+static uint32_t scan_time[4];               /* per pin: accepted_at as of the last scan */
+
+/**
+ * Key word bit of a captured pin
+ */
+static inline uint32_t EdgeCaptureBit(uint32_t pin)
+{
+    return KEY_GATHER(1u << pin, 0u);
+}
+
+/**
+ * Take the pending captures, with TIM5 masked or from its interrupt
+ *
+ * @return true if a key flipped
+ */
+HOT_PATH static bool EdgeCaptureTake(void)
+{
+    uint32_t flags = TIM5->SR & EDGE_CAPTURE_FLAGS;
+    bool flipped = false;
+
+    if (flags == 0) {
+        return false;
+    }
+    // An overcapture only lost an edge inside the burst, the newest counts
+    TIM5->SR = ~(flags | (flags << 8));
+    for (uint32_t pins = flags >> 1; pins; pins &= pins - 1u) {
+        uint32_t pin = (uint32_t)__builtin_ctz(pins);
+        uint32_t bit = EdgeCaptureBit(pin);
+        uint32_t t = (&TIM5->CCR2)[pin - 1u];
+
+        last_edge[pin] = t;
+        if (locked & bit) {
+            bounced |= bit;
+        } else {
+            // First edge after a quiet lockout: away from the state it left
+            state ^= bit;
+            locked |= bit;
+            bounced &= ~bit;
+            accepted_at[pin] = t;
+            flipped = true;
+        }
+    }
+    return flipped;
+}
+#endif
+
+/**
+ * Route the captured pins to TIM5 and start capturing both edges
+ *
+ * Runs after TimebaseInit() and before the first scan, with the pins
+ * already inputs with pull-up; the IDR keeps reading them in AF mode.
+ *
+ * @param raw_keys Key word read at init, seeds the state
+ */
+void EdgeCaptureInit(uint32_t raw_keys)
+{
+#if EDGE_CAPTURE_ENABLE
+    uint32_t now = TimebaseNowUs();
+
+    state = raw_keys & EDGE_CAPTURE_KEYS;
+    locked = 0;
+    bounced = 0;
+    for (uint32_t pins = EDGE_CAPTURE_PINS; pins; pins &= pins - 1u) {
+        uint32_t pin = (uint32_t)__builtin_ctz(pins);
+        accepted_at[pin] = now;
+        last_edge[pin] = now;
+        scan_time[pin] = now;
+
+        // AF2 = TIM5_CHx, pull-up left as the layout set it
+        GPIOA->AFR[0] = (GPIOA->AFR[0] & ~(0xFu << (4 * pin))) | (2u << (4 * pin));
+        GPIOA->MODER = (GPIOA->MODER & ~(3u << (2 * pin))) | (2u << (2 * pin));
+    }
+
+    // CC2-CC4 as inputs on their own TIx, filtered, both edges
+    // (CCxP and CCxNP set)
+    uint32_t ccmr1 = TIM5->CCMR1 & ~(TIM_CCMR1_CC2S | TIM_CCMR1_IC2F);
+    uint32_t ccmr2 = 0;
+    uint32_t ccer = TIM5->CCER & ~(TIM_CCER_CC2E | TIM_CCER_CC2P | TIM_CCER_CC2NP |
+                                   TIM_CCER_CC3E | TIM_CCER_CC3P | TIM_CCER_CC3NP |
+                                   TIM_CCER_CC4E | TIM_CCER_CC4P | TIM_CCER_CC4NP);
+    if (EDGE_CAPTURE_PINS & (1u << 1)) {
+        ccmr1 |= TIM_CCMR1_CC2S_0 | ((uint32_t)EDGE_CAPTURE_FILTER << TIM_CCMR1_IC2F_Pos);
+        ccer |= TIM_CCER_CC2E | TIM_CCER_CC2P | TIM_CCER_CC2NP;
+    }
+    if (EDGE_CAPTURE_PINS & (1u << 2)) {
+        ccmr2 |= TIM_CCMR2_CC3S_0 | ((uint32_t)EDGE_CAPTURE_FILTER << TIM_CCMR2_IC3F_Pos);
+        ccer |= TIM_CCER_CC3E | TIM_CCER_CC3P | TIM_CCER_CC3NP;
+    }
+    if (EDGE_CAPTURE_PINS & (1u << 3)) {
+        ccmr2 |= TIM_CCMR2_CC4S_0 | ((uint32_t)EDGE_CAPTURE_FILTER << TIM_CCMR2_IC4F_Pos);
+        ccer |= TIM_CCER_CC4E | TIM_CCER_CC4P | TIM_CCER_CC4NP;
+    }
+    TIM5->CCMR1 = ccmr1;
+    TIM5->CCMR2 = ccmr2;
+    TIM5->CCER = ccer;
+    TIM5->SR = ~(EDGE_CAPTURE_FLAGS | (EDGE_CAPTURE_FLAGS << 8));
+    TIM5->DIER |= EDGE_CAPTURE_FLAGS;
+#else
+    (void)raw_keys;
+#endif
+}
+
+/**
+ * Get the state of the captured keys for this scan
+ *
+ * Drains pending captures, ends the lockouts that are over and flips a
+ * key whose pin settled on the other level meanwhile.
+ *
+ * @param raw_keys Key word sampled at now
+ * @param now Time of the sample in microseconds
+ * @param settled Cleared while a captured key is in its lockout
+ * @return Bits of EDGE_CAPTURE_KEYS, 1 = released; 0 when compiled out
+ */
+HOT_PATH uint32_t EdgeCaptureUpdate(uint32_t raw_keys, uint32_t now, bool *settled)
+{
+#if EDGE_CAPTURE_ENABLE
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    EdgeCaptureTake();
+    for (uint32_t pins = EDGE_CAPTURE_PINS; pins; pins &= pins - 1u) {
+        uint32_t pin = (uint32_t)__builtin_ctz(pins);
+        uint32_t bit = EdgeCaptureBit(pin);
+
+        // Signed: a capture after the sample is newer than now
+        if ((locked & bit) && (int32_t)(now - accepted_at[pin]) >= (int32_t)EDGE_CAPTURE_LOCKOUT_US) {
+            locked &= ~bit;
+        }
+        if (!(locked & bit) && ((raw_keys ^ state) & bit)) {
+            // The lockout hid the last edge; without one the edge was not
+            // captured (STOP mode) and the sample is the best time there is
+            uint32_t t = (bounced & bit) ? last_edge[pin] : now;
+            state ^= bit;
+            locked |= bit;
+            bounced &= ~bit;
+            accepted_at[pin] = t;
+        } else if (!(locked & bit) && (int32_t)(last_edge[pin] - now) <= 0) {
+            // Bounce the sample already saw out
+            bounced &= ~bit;
+        }
+        scan_time[pin] = accepted_at[pin];
+    }
+    if (locked) {
+        *settled = false;
+    }
+    uint32_t keys = state;
+    __set_PRIMASK(primask);
+    return keys;
+#else
+    (void)raw_keys;
+    (void)now;
+    (void)settled;
+    return 0;
+#endif
+}
+
+/**
+ * Get the edge time of a captured key as of the last EdgeCaptureUpdate()
+ *
+ * @param key Key index in EDGE_CAPTURE_KEYS
+ * @return TIM5 count of the edge that flipped the key
+ */
+HOT_PATH uint32_t EdgeCaptureTime(uint32_t key)
+{
+#if EDGE_CAPTURE_ENABLE
+    for (uint32_t pins = EDGE_CAPTURE_PINS; pins; pins &= pins - 1u) {
+        uint32_t pin = (uint32_t)__builtin_ctz(pins);
+        if (EdgeCaptureBit(pin) == (1u << key)) {
+            return scan_time[pin];
+        }
+    }
+#endif
+    (void)key;
+    return TimebaseNowUs();
+}
+
+/**
+ * TIM5 capture interrupt part, a flipped key gets a scan right away
+ *
+ * Called from TIM5_IRQHandler() next to TimebaseIRQHandler().
+ */
+HOT_PATH void EdgeCaptureIRQHandler(void)
+{
+#if EDGE_CAPTURE_ENABLE
+    if (EdgeCaptureTake()) {
+        RightKeyboardScanRequest();
+    }
+#endif
+}
@@ -0,0 +1,93 @@
+/**
+ * @file encoder.c
+ * @brief Rotary encoder decoded by TIM2 in quadrature encoder mode.
+ */
+
+#include "encoder.h"
+#include "hot_path.h"
+
+#if ENCODER_ENABLE
+_Static_assert(!DATA_READY_ENABLE || DATA_READY_PIN != GPIO_PIN_15, "PA15 is encoder input A, move DATA_READY_PORT/PIN");
+
+// Counter at the last detent EncoderTake() handed out
+static uint32_t taken;
+
+/**
+ * Steps as a detent count, rounded toward zero
+ */
+static inline int32_t EncoderDetents(int32_t steps)
+{
+    return steps / ENCODER_STEPS_PER_DETENT;
+}
+#endif
+
+/**
+ * Set up PA15/PB3 and start TIM2 counting in encoder mode 3 from 0
+ *
+ * Runs before the scan starts. TIM2 runs on its own from here on, it
+ * raises no interrupt.
+ */
+void EncoderInit(void)
+{
+#if ENCODER_ENABLE
+    __HAL_RCC_GPIOA_CLK_ENABLE();
+    __HAL_RCC_GPIOB_CLK_ENABLE();
+    __HAL_RCC_TIM2_CLK_ENABLE();
+
+    // PA15 (reset state: JTDI pull-up) and PB3 to AF1 with pull-up
+    GPIOA->PUPDR = (GPIOA->PUPDR & ~(3u << (2 * 15))) | (1u << (2 * 15));
+    GPIOA->AFR[1] = (GPIOA->AFR[1] & ~(0xFu << (4 * 7))) | (1u << (4 * 7));
+    GPIOA->MODER = (GPIOA->MODER & ~(3u << (2 * 15))) | (2u << (2 * 15));
+    GPIOB->PUPDR = (GPIOB->PUPDR & ~(3u << (2 * 3))) | (1u << (2 * 3));
+    GPIOB->AFR[0] = (GPIOB->AFR[0] & ~(0xFu << (4 * 3))) | (1u << (4 * 3));
+    GPIOB->MODER = (GPIOB->MODER & ~(3u << (2 * 3))) | (2u << (2 * 3));
+
+    // TI1 and TI2 on their own inputs, filtered; SMS 011 counts both
+    // edges of both
+    TIM2->CR1 = 0;
+    TIM2->PSC = 0;
+    TIM2->ARR = 0xFFFFFFFFu;
+    TIM2->CCMR1 = TIM_CCMR1_CC1S_0 | TIM_CCMR1_CC2S_0 |
+                  ((uint32_t)ENCODER_FILTER << TIM_CCMR1_IC1F_Pos) |
+                  ((uint32_t)ENCODER_FILTER << TIM_CCMR1_IC2F_Pos);
+    TIM2->CCER = ENCODER_REVERSE ? TIM_CCER_CC1P : 0u;
+    TIM2->SMCR = TIM_SMCR_SMS_0 | TIM_SMCR_SMS_1;
+    TIM2->DIER = 0;
+    TIM2->CNT = 0;
+    TIM2->CR1 = TIM_CR1_CEN;
+    taken = 0;
+#endif
+}
+
+/**
+ * Take the whole detents turned since the last call, from the scan
+ *
+ * The scan is the only caller, as it is the only producer of the event
+ * queue. Steps short of a detent stay for the next call.
+ *
+ * @return Signed detents, positive = counting up
+ */
+HOT_PATH int32_t EncoderTake(void)
+{
+#if ENCODER_ENABLE
+    int32_t detents = EncoderDetents((int32_t)(TIM2->CNT - taken));
+    taken += (uint32_t)(detents * ENCODER_STEPS_PER_DETENT);
+    return detents;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Read the position for the register map
+ */
+void EncoderSnapshot(EncoderPosition *position)
+{
+#if ENCODER_ENABLE
+    position->steps = (int32_t)TIM2->CNT;
+    position->detents = EncoderDetents(position->steps);
+#else
+    position->steps = 0;
+    position->detents = 0;
+#endif
+}
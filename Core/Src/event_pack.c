@@ -0,0 +1,70 @@
+/**
+ * @file event_pack.c
+ * @brief Compact variable-length key event encoding (REPORT_TYPE_PACKED).
+ */
+
+#include "event_pack.h"
+#include "hot_path.h"
+
+/**
+ * Append a varint
+ *
+ * @return Bytes written
+ */
+HOT_PATH static inline uint32_t EventPackVarint(uint8_t *out, uint32_t value)
+{
+    uint32_t n = 0;
+
+    while (value >= 0x80u) {
+        out[n++] = (uint8_t)(value | 0x80u);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+/**
+ * Pack a run of events behind a status byte
+ *
+ * @param events Events to pack, oldest first, at most EVENT_PACK_COUNT_MASK
+ * @param count Number of events
+ * @param base Tick count of the event before events[0], unused if absolute
+ * @param absolute Send the full tick count of events[0] instead of a delta
+ * @param frame Filled with the frame, 1 + count * EVENT_PACK_EVENT_MAX bytes
+ *              at most
+ * @param ends Set to the frame length up to and including each event, so a
+ *             short read can tell which events arrived whole
+ * @return Frame length in bytes
+ */
+HOT_PATH uint32_t EventPackEncode(const KeyEvent *events, uint32_t count, uint32_t base, bool absolute,
+                                  uint8_t *frame, uint8_t *ends)
+{
+    uint32_t len = 1;
+
+    frame[0] = (uint8_t)((count & EVENT_PACK_COUNT_MASK) | (absolute ? EVENT_PACK_ABSOLUTE : 0u));
+    for (uint32_t n = 0; n < count; ++n) {
+        const KeyEvent *event = &events[n];
+        uint32_t tick = EventPackTick(event->timestamp);
+
+        if (event->key == KEY_EVENT_RESYNC) {
+            frame[len++] = EVENT_PACK_KEY_RESYNC;
+            frame[len++] = event->pressed;
+            for (uint32_t shift = 0; shift < 32u; shift += 8u) {
+                frame[len++] = (uint8_t)(event->timestamp >> shift);
+            }
+            ends[n] = (uint8_t)len;
+            continue;
+        }
+        if (event->key == KEY_EVENT_ENCODER) {
+            frame[len++] = EVENT_PACK_KEY_ENCODER;
+            frame[len++] = event->pressed;
+        } else {
+            frame[len++] = (uint8_t)((event->key & EVENT_PACK_KEY_MASK) |
+                                     (event->pressed ? EVENT_PACK_PRESSED : 0u));
+        }
+        len += EventPackVarint(&frame[len], (n == 0 && absolute) ? tick : (tick - base) & EVENT_PACK_TICK_MASK);
+        base = tick;
+        ends[n] = (uint8_t)len;
+    }
+    return len;
+}
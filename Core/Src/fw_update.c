@@ -0,0 +1,586 @@
+/**
+ * @file fw_update.c
+ * @brief Firmware update streamed by the master over the split link.
+ *
+ * Everything that runs once the update started is in .RamFunc and only
+ * touches registers and SRAM: flash stalls every fetch while it erases or
+ * programs, and the HAL, the link drivers and the C library all live
+ * there. That is also why the loop polls instead of taking interrupts, the
+ * handlers and the vector table are in flash too, and why the UART framing
+ * of link.c is repeated here. Tables the loop reads are kept non-const, so
+ * they land in .data.
+ *
+ * Nothing returns to normal operation: the loop ends in a reset, either
+ * into the new image or on ABORT.
+ */
+
+#include "fw_update.h"
+#include "watchdog.h"
+#include "link.h"
+#include "sched.h"
+
+#if FW_UPDATE_ENABLE
+
+#define FLASH_ERRORS (FLASH_SR_SOP | FLASH_SR_WRPERR | FLASH_SR_PGAERR | FLASH_SR_PGPERR | FLASH_SR_PGSERR | FLASH_SR_RDERR)
+
+// Largest command: register, command, offset, chunk
+#define FW_UPDATE_FRAME_LEN (6u + FW_UPDATE_CHUNK)
+
+// Bytes verified per loop pass, so the link is served in between
+#define FW_UPDATE_VERIFY_STEP 1024u
+
+typedef enum {
+    FLASH_OP_NONE,
+    FLASH_OP_ERASE,
+    FLASH_OP_PROGRAM
+} FlashOp;
+
+typedef struct {
+    uint32_t data[FW_UPDATE_PAGE / 4];
+    uint32_t offset;                    // Image offset of data[0]
+    uint32_t fill;                      // Bytes received
+    bool     full;                      // Handed to the flash side
+} UpdatePage;
+
+// Start of sectors 1 to 7, the application area ends where the config store begins
+static uint32_t sector_start[] = {
+    0x08004000u, 0x08008000u, 0x0800C000u, 0x08010000u, 0x08020000u, 0x08040000u, 0x08060000u,
+};
+
+static volatile bool enter_pending;
+static uint32_t image_len;
+static uint32_t image_crc;
+
+static FwUpdateStatus status;
+static UpdatePage pages[2];
+static uint32_t recv_page;              /* page the next chunk goes to */
+static uint32_t write_page;             /* page flash works on */
+static uint32_t write_pos;              /* bytes of it programmed */
+static uint32_t held_word;              /* initial stack pointer, programmed last */
+
+static FlashOp  flash_op;
+static uint32_t next_erase;             /* index into sector_start */
+static uint32_t erased_end;             /* first address not erased yet */
+
+static bool     finish_requested;
+static uint32_t verify_pos;
+static uint32_t verify_crc;
+
+static uint8_t  rx_frame[FW_UPDATE_FRAME_LEN];
+static uint32_t rx_len;
+
+#if LINK_TRANSPORT == LINK_TRANSPORT_I2C
+static bool     rx_active;
+static bool     tx_active;
+static uint32_t tx_index;
+#else
+static uint8_t  rx_state;               /* 0 sync, 1 length, 2 body, 3 CRC */
+static uint8_t  rx_expect;
+static uint8_t  rx_crc;
+static uint8_t  tx_buf[LINK_REPLY_EXTRA + sizeof(FwUpdateStatus)];
+static uint32_t tx_len;
+static uint32_t tx_index;
+#endif
+
+/**
+ * Byte copy that the compiler can't turn into a memcpy() call into flash
+ */
+static __RAM_FUNC void FwCopy(volatile uint8_t *dst, const uint8_t *src, uint32_t len)
+{
+    for (uint32_t n = 0; n < len; n++) {
+        dst[n] = src[n];
+    }
+}
+
+static __RAM_FUNC uint32_t FwRead32(const uint8_t *p)
+{
+    return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+ * CRC-32 as zlib computes it, bit by bit (no table in flash)
+ */
+static __RAM_FUNC uint32_t FwCrc32(uint32_t crc, uint32_t word)
+{
+    crc ^= word;
+    for (uint32_t bit = 0; bit < 32; bit++) {
+        crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+    }
+    return crc;
+}
+
+#if LINK_TRANSPORT != LINK_TRANSPORT_I2C
+/**
+ * CRC-8 of crc8.c, bit by bit
+ */
+static __RAM_FUNC uint8_t FwCrc8(uint8_t crc, uint8_t byte)
+{
+    crc ^= byte;
+    for (uint32_t bit = 0; bit < 8; bit++) {
+        crc = (uint8_t)((crc << 1) ^ ((crc & 0x80u) ? 0x07u : 0x00u));
+    }
+    return crc;
+}
+#endif
+
+static __RAM_FUNC void FwFail(uint8_t error)
+{
+    status.state = FW_UPDATE_FAILED;
+    status.error = error;
+}
+
+/**
+ * Forget every byte received so far and erase from the first sector again
+ */
+static __RAM_FUNC void FwRestart(void)
+{
+    while (FLASH->SR & FLASH_SR_BSY) {
+    }
+    FLASH->CR = 0;
+    FLASH->SR = FLASH_ERRORS | FLASH_SR_EOP;
+    flash_op = FLASH_OP_NONE;
+    next_erase = 0;
+    erased_end = sector_start[0];
+
+    for (uint32_t n = 0; n < 2; n++) {
+        pages[n].fill = 0;
+        pages[n].full = false;
+    }
+    recv_page = 0;
+    write_page = 0;
+    write_pos = 0;
+    held_word = 0xFFFFFFFFu;
+    finish_requested = false;
+
+    status.state = FW_UPDATE_RECEIVING;
+    status.error = FW_UPDATE_ERROR_NONE;
+    status.accepted = 0;
+    status.written = 0;
+}
+
+static __RAM_FUNC void FwStartErase(void)
+{
+    FLASH->CR = FLASH_CR_PSIZE_1 | FLASH_CR_SER | ((next_erase + 1u) << FLASH_CR_SNB_Pos);
+    FLASH->CR |= FLASH_CR_STRT;
+    flash_op = FLASH_OP_ERASE;
+}
+
+/**
+ * Advance flash by one operation: program the next word, or erase the
+ * next sector when it is needed or flash would idle otherwise
+ */
+static __RAM_FUNC void FwFlashStep(void)
+{
+    uint32_t sr = FLASH->SR;
+
+    if (sr & FLASH_SR_BSY) {
+        return;
+    }
+    if (sr & FLASH_ERRORS) {
+        FLASH->SR = FLASH_ERRORS;
+        flash_op = FLASH_OP_NONE;
+        FwFail(FW_UPDATE_ERROR_FLASH);
+        return;
+    }
+    if (flash_op == FLASH_OP_ERASE) {
+        next_erase++;
+        erased_end = sector_start[next_erase];
+    }
+    flash_op = FLASH_OP_NONE;
+    if (status.state != FW_UPDATE_RECEIVING && status.state != FW_UPDATE_VERIFYING) {
+        return;
+    }
+
+    UpdatePage *page = &pages[write_page];
+    if (page->full) {
+        uint32_t addr = FW_UPDATE_BASE + page->offset + write_pos;
+        if (addr >= erased_end) {
+            FwStartErase();
+            return;
+        }
+        uint32_t word = page->data[write_pos / 4u];
+        if (addr == FW_UPDATE_BASE) {
+            held_word = word;
+        } else {
+            FLASH->CR = FLASH_CR_PSIZE_1 | FLASH_CR_PG;
+            *(volatile uint32_t *)addr = word;
+            flash_op = FLASH_OP_PROGRAM;
+        }
+        write_pos += 4u;
+        if (write_pos == page->fill) {
+            status.written = page->offset + page->fill;
+            page->fill = 0;
+            page->full = false;
+            write_pos = 0;
+            write_page ^= 1u;
+        }
+        return;
+    }
+
+    // Nothing to program, erase ahead while the master sends
+    if (erased_end < FW_UPDATE_BASE + image_len) {
+        FwStartErase();
+    }
+}
+
+/**
+ * Check the image in flash once everything is programmed, a slice per
+ * pass; reset into it on a match
+ */
+static __RAM_FUNC void FwVerifyStep(void)
+{
+    if (status.state == FW_UPDATE_RECEIVING) {
+        if (!finish_requested || flash_op != FLASH_OP_NONE || (FLASH->SR & FLASH_SR_BSY) ||
+            pages[0].full || pages[1].full) {
+            return;
+        }
+        finish_requested = false;
+        if (status.written != image_len) {
+            FwFail(FW_UPDATE_ERROR_SHORT);
+            return;
+        }
+        // The data cache may still hold words from before the erase
+        FLASH->ACR &= ~FLASH_ACR_DCEN;
+        FLASH->ACR |= FLASH_ACR_DCRST;
+        FLASH->ACR &= ~FLASH_ACR_DCRST;
+        FLASH->ACR |= FLASH_ACR_DCEN;
+        status.state = FW_UPDATE_VERIFYING;
+        verify_pos = 0;
+        verify_crc = 0xFFFFFFFFu;
+        return;
+    }
+    if (status.state != FW_UPDATE_VERIFYING) {
+        return;
+    }
+
+    uint32_t end = verify_pos + FW_UPDATE_VERIFY_STEP;
+    if (end > image_len) {
+        end = image_len;
+    }
+    for (; verify_pos < end; verify_pos += 4u) {
+        uint32_t word = verify_pos == 0 ? held_word : *(const volatile uint32_t *)(FW_UPDATE_BASE + verify_pos);
+        verify_crc = FwCrc32(verify_crc, word);
+    }
+    if (verify_pos < image_len) {
+        return;
+    }
+
+    if (~verify_crc != image_crc) {
+        FwFail(FW_UPDATE_ERROR_CRC);
+        return;
+    }
+
+    // Image complete, the stack pointer word makes it bootable
+    FLASH->CR = FLASH_CR_PSIZE_1 | FLASH_CR_PG;
+    *(volatile uint32_t *)FW_UPDATE_BASE = held_word;
+    while (FLASH->SR & FLASH_SR_BSY) {
+    }
+    FLASH->CR = FLASH_CR_LOCK;
+    if (FLASH->SR & FLASH_ERRORS) {
+        FwFail(FW_UPDATE_ERROR_FLASH);
+        return;
+    }
+    __DSB();
+    SCB->AIRCR = (0x5FAu << SCB_AIRCR_VECTKEY_Pos) | (SCB->AIRCR & SCB_AIRCR_PRIGROUP_Msk) | SCB_AIRCR_SYSRESETREQ_Msk;
+    __DSB();
+    while (1) {
+    }
+}
+
+/**
+ * Take one chunk into the page being filled
+ */
+static __RAM_FUNC void FwData(uint32_t offset, const uint8_t *data, uint32_t len)
+{
+    UpdatePage *page = &pages[recv_page];
+
+    if (status.state != FW_UPDATE_RECEIVING || finish_requested || page->full ||
+        offset != status.accepted || (len & 3u) != 0 || len == 0 || len > FW_UPDATE_CHUNK ||
+        len > image_len - status.accepted) {
+        return;
+    }
+    if (page->fill == 0) {
+        page->offset = offset;
+    }
+    FwCopy((volatile uint8_t *)page->data + page->fill, data, len);
+    page->fill += len;
+    status.accepted += len;
+    if (page->fill == FW_UPDATE_PAGE || status.accepted == image_len) {
+        page->full = true;
+        recv_page ^= 1u;
+    }
+}
+
+/**
+ * Act on one master write in update mode
+ */
+static __RAM_FUNC void FwCommand(const uint8_t *frame, uint32_t len)
+{
+    if (len < 2 || frame[0] != RIGHT_KEYBOARD_REG_UPDATE) {
+        return;
+    }
+    switch (frame[1]) {
+    case FW_UPDATE_CMD_ENTER:
+        if (len >= 14 && FwRead32(&frame[2]) == FW_UPDATE_MAGIC) {
+            uint32_t length = FwRead32(&frame[6]);
+            if (length >= 8u && length <= FW_UPDATE_MAX && (length & 3u) == 0) {
+                image_len = length;
+                image_crc = FwRead32(&frame[10]);
+                FwRestart();
+            }
+        }
+        break;
+    case FW_UPDATE_CMD_DATA:
+        if (len >= 6) {
+            FwData(FwRead32(&frame[2]), &frame[6], len - 6u);
+        }
+        break;
+    case FW_UPDATE_CMD_FINISH:
+        if (status.state == FW_UPDATE_RECEIVING) {
+            finish_requested = true;
+        }
+        break;
+    case FW_UPDATE_CMD_ABORT:
+        while (FLASH->SR & FLASH_SR_BSY) {
+        }
+        __DSB();
+        SCB->AIRCR = (0x5FAu << SCB_AIRCR_VECTKEY_Pos) | (SCB->AIRCR & SCB_AIRCR_PRIGROUP_Msk) |
+                     SCB_AIRCR_SYSRESETREQ_Msk;
+        __DSB();
+        while (1) {
+        }
+    default:
+        break;
+    }
+}
+
+#if LINK_TRANSPORT == LINK_TRANSPORT_I2C
+/**
+ * Serve I2C1 by polling SR1, the register driver's events in one pass
+ */
+static __RAM_FUNC void FwLinkPoll(void)
+{
+    uint32_t sr1 = I2C1->SR1;
+
+    if (sr1 & I2C_SR1_ADDR) {
+        uint32_t sr2 = I2C1->SR2;
+        if (rx_active) {
+            // Repeated start after a write
+            rx_active = false;
+            FwCommand(rx_frame, rx_len);
+        }
+        tx_active = (sr2 & I2C_SR2_TRA) != 0;
+        tx_index = 0;
+        rx_active = !tx_active;
+        rx_len = 0;
+        return;
+    }
+    if (tx_active && (sr1 & (I2C_SR1_TXE | I2C_SR1_BTF))) {
+        if (tx_index < sizeof(status)) {
+            I2C1->DR = ((const uint8_t *)&status)[tx_index++];
+        } else if (sr1 & I2C_SR1_BTF) {
+            I2C1->DR = 0xFFu;
+        }
+    }
+    if (sr1 & I2C_SR1_RXNE) {
+        uint8_t data = (uint8_t)I2C1->DR;
+        if (rx_active && rx_len < sizeof(rx_frame)) {
+            rx_frame[rx_len++] = data;
+        }
+    }
+    if (sr1 & I2C_SR1_STOPF) {
+        I2C1->CR1 |= I2C_CR1_ACK;
+        tx_active = false;
+        if (rx_active) {
+            rx_active = false;
+            FwCommand(rx_frame, rx_len);
+        }
+    }
+    if (sr1 & I2C_SR1_AF) {
+        I2C1->SR1 = (uint32_t)~I2C_SR1_AF;
+        bool stale = tx_active && !(I2C1->SR1 & I2C_SR1_TXE);
+        tx_active = false;
+        if (stale) {
+            // Drop the byte left in DR, PE=0 also clears ACK
+            I2C1->CR1 &= ~I2C_CR1_PE;
+            I2C1->CR1 |= I2C_CR1_PE;
+            I2C1->CR1 |= I2C_CR1_ACK;
+        }
+    }
+    if (sr1 & (I2C_SR1_BERR | I2C_SR1_ARLO | I2C_SR1_OVR)) {
+        I2C1->SR1 = (uint32_t)~(sr1 & (I2C_SR1_BERR | I2C_SR1_ARLO | I2C_SR1_OVR));
+        rx_active = false;
+        tx_active = false;
+        I2C1->CR1 |= I2C_CR1_ACK;
+    }
+}
+
+/**
+ * Take I2C1 over from the interrupt-driven driver
+ */
+static void FwLinkTakeOver(void)
+{
+    I2C1->CR2 &= ~(I2C_CR2_ITEVTEN | I2C_CR2_ITBUFEN | I2C_CR2_ITERREN | I2C_CR2_DMAEN);
+    I2C1->CR1 |= I2C_CR1_ACK;
+}
+#else
+/**
+ * Queue the status reply to a request, UART link framing
+ */
+static __RAM_FUNC void FwReply(void)
+{
+    const uint8_t *frame = (const uint8_t *)&status;
+    uint8_t crc;
+
+    tx_buf[0] = LINK_SYNC_REPLY;
+    tx_buf[1] = RIGHT_KEYBOARD_REG_UPDATE;
+    tx_buf[2] = sizeof(status);
+    tx_buf[3] = 0;
+    crc = FwCrc8(FwCrc8(FwCrc8(0, tx_buf[1]), tx_buf[2]), tx_buf[3]);
+    for (uint32_t n = 0; n < sizeof(status); n++) {
+        tx_buf[LINK_REPLY_HEADER + n] = frame[n];
+        crc = FwCrc8(crc, frame[n]);
+    }
+    tx_buf[LINK_REPLY_HEADER + sizeof(status)] = crc;
+    tx_len = sizeof(tx_buf);
+    tx_index = 0;
+}
+
+/**
+ * Serve USART1 by polling: parse requests as link.c does, send replies a
+ * byte at a time
+ */
+static __RAM_FUNC void FwLinkPoll(void)
+{
+    uint32_t sr = USART1->SR;
+
+    if (sr & (USART_SR_RXNE | USART_SR_ORE | USART_SR_FE | USART_SR_NE)) {
+        // Reading DR after SR also clears the error flags
+        uint8_t byte = (uint8_t)USART1->DR;
+        if (sr & (USART_SR_ORE | USART_SR_FE | USART_SR_NE)) {
+            rx_state = 0;
+        } else if (rx_state == 0) {
+            rx_state = byte == LINK_SYNC_REQUEST ? 1u : 0u;
+        } else if (rx_state == 1) {
+            if (byte == 0 || byte > sizeof(rx_frame)) {
+                rx_state = 0;
+            } else {
+                rx_expect = byte;
+                rx_crc = FwCrc8(0, byte);
+                rx_len = 0;
+                rx_state = 2;
+            }
+        } else if (rx_state == 2) {
+            rx_frame[rx_len++] = byte;
+            rx_crc = FwCrc8(rx_crc, byte);
+            if (rx_len == rx_expect) {
+                rx_state = 3;
+            }
+        } else {
+            rx_state = 0;
+            if (byte == rx_crc) {
+                FwCommand(rx_frame, rx_len);
+                FwReply();
+            }
+        }
+    }
+    if ((sr & USART_SR_TXE) && tx_index < tx_len) {
+        USART1->DR = tx_buf[tx_index++];
+    }
+}
+
+/**
+ * Take USART1 over from the DMA driver
+ */
+static void FwLinkTakeOver(void)
+{
+    USART1->CR1 &= ~(USART_CR1_IDLEIE | USART_CR1_RXNEIE | USART_CR1_TCIE | USART_CR1_TXEIE | USART_CR1_PEIE);
+    USART1->CR3 &= ~(USART_CR3_DMAR | USART_CR3_DMAT | USART_CR3_EIE);
+    DMA2_Stream2->CR &= ~DMA_SxCR_EN;
+    DMA2_Stream7->CR &= ~DMA_SxCR_EN;
+}
+#endif /* LINK_TRANSPORT == LINK_TRANSPORT_I2C */
+
+/**
+ * The update loop, in SRAM until the reset
+ */
+static __RAM_FUNC __attribute__((noreturn)) void FwUpdateRun(void)
+{
+    while (1) {
+#if WATCHDOG_ENABLE
+        IWDG->KR = 0xAAAAu;
+#endif
+        FwLinkPoll();
+        FwFlashStep();
+        FwVerifyStep();
+    }
+}
+#endif /* FW_UPDATE_ENABLE */
+
+/**
+ * Check an ENTER command written in normal operation
+ *
+ * Runs in the link interrupt; the main loop switches over with
+ * FwUpdateService(), after the transfer that carried the command ended.
+ *
+ * @param data Register byte, command and its arguments
+ * @param len Number of bytes
+ * @return true if the update will start
+ */
+bool FwUpdateRequest(const uint8_t *data, uint32_t len)
+{
+#if FW_UPDATE_ENABLE
+    if (len < 14 || data[1] != FW_UPDATE_CMD_ENTER || FwRead32(&data[2]) != FW_UPDATE_MAGIC) {
+        return false;
+    }
+    uint32_t length = FwRead32(&data[6]);
+    if (length < 8u || length > FW_UPDATE_MAX || (length & 3u) != 0) {
+        return false;
+    }
+    image_len = length;
+    image_crc = FwRead32(&data[10]);
+    enter_pending = true;
+    SchedSignal(SCHED_TASK_FW_UPDATE);
+    return true;
+#else
+    (void)data;
+    (void)len;
+    return false;
+#endif
+}
+
+/**
+ * Leave normal operation for the update loop once an ENTER arrived
+ *
+ * Runs as a scheduler task, signaled by FwUpdateRequest(); does not
+ * return after an ENTER.
+ */
+void FwUpdateService(void)
+{
+#if FW_UPDATE_ENABLE
+    if (!enter_pending) {
+        return;
+    }
+    __disable_irq();
+    HAL_FLASH_Unlock();
+    FwLinkTakeOver();
+    FwRestart();
+    FwUpdateRun();
+#endif
+}
+
+/**
+ * Copy the update status for a read of the update register in normal
+ * operation
+ */
+void FwUpdateSnapshot(FwUpdateStatus *report)
+{
+#if FW_UPDATE_ENABLE
+    report->state = enter_pending ? FW_UPDATE_RECEIVING : FW_UPDATE_IDLE;
+#else
+    report->state = FW_UPDATE_IDLE;
+#endif
+    report->error = FW_UPDATE_ERROR_NONE;
+    report->accepted = 0;
+    report->written = 0;
+}
@@ -0,0 +1,423 @@
+/**
+ * @file hall_sensor.c
+ * @brief Analog Hall-effect key sensing for KEY_WIRING_HALL.
+ *
+ * Everything the frame processing keeps per key is in RAM arrays indexed
+ * by key, so one frame is a single pass over its samples. Per-key flags
+ * (pressed, rapid-trigger zone) are bits of one word, like the key word.
+ */
+
+#include "right_side_keyboard.h"
+
+#if KEY_WIRING == KEY_WIRING_HALL
+
+#include "hall_sensor.h"
+#include "hot_path.h"
+#include "irq_plan.h"
+#include "mem_budget.h"
+
+#define HALL_FRAME_LEN (HALL_KEYS)
+#define HALL_RING_LEN  (HALL_RING_FRAMES * HALL_FRAME_LEN)
+#define HALL_HALF_LEN  (HALL_RING_LEN / 2)
+
+#define HALL_MUX_BITS (HALL_MUX_WAYS == 8 ? 3u : HALL_MUX_WAYS == 4 ? 2u : HALL_MUX_WAYS == 2 ? 1u : 0u)
+#define HALL_MUX_MASK (((1u << HALL_MUX_BITS) - 1u) << HALL_MUX_FIRST_PIN)
+
+#define HALL_KEY_MASK (0xFFFFFFFFu >> (32 - HALL_KEYS))
+
+// Stream 4 flags, in HISR/HIFCR
+#define HALL_DMA_FLAGS (DMA_HIFCR_CTCIF4 | DMA_HIFCR_CHTIF4 | DMA_HIFCR_CTEIF4 | DMA_HIFCR_CDMEIF4 | DMA_HIFCR_CFEIF4)
+
+// 56 ADC clock sampling time (011) for every input
+#define HALL_SMP 3u
+
+#if HALL_MUX_BITS != 0 && HALL_MUX_FIRST_PIN + HALL_MUX_BITS > 16
+#error "Mux select lines run past the end of HALL_MUX_PORT"
+#endif
+
+_Static_assert((HALL_PINS_B & BOARD_I2C_PINS) == 0, "The I2C1 pins are reserved for the link");
+
+#define HALL_ADC_CHANNEL_ENTRY(idx, channel, port, pin) [idx] = (channel),
+static const uint8_t hall_adc_channels[HALL_CHANNELS] = {
+    HALL_CHANNEL_MAP(HALL_ADC_CHANNEL_ENTRY)
+};
+
+static uint16_t samples[HALL_RING_LEN] MEM_BSS(dma);
+
+#if HALL_MUX_WAYS > 1
+// Select word for way n + 1: way 0 is set by software before the timer
+// starts, every update event then moves to the next way
+static uint32_t mux_ring[HALL_MUX_WAYS] MEM_BSS(dma);
+#endif
+
+static uint32_t rest_acc[HALL_KEYS];    /* rest << HALL_REST_SHIFT */
+static uint16_t bottom[HALL_KEYS];
+static uint32_t travel_scale[HALL_KEYS];    /* Q16 of 256 / bottom */
+static uint8_t  travel[HALL_KEYS];
+static uint8_t  actuation[HALL_KEYS];
+static uint8_t  release[HALL_KEYS];
+static uint32_t pressed;
+#if HALL_RAPID_TRIGGER
+static uint8_t  rt_press[HALL_KEYS];
+static uint8_t  rt_release[HALL_KEYS];
+static uint8_t  extreme[HALL_KEYS];     /* peak while pressed, trough while released */
+static uint32_t rt_zone;                /* pressed since last below release point */
+#endif
+static bool     seeded;
+static volatile uint32_t key_word = HALL_KEY_MASK;
+
+/**
+ * Get the TIM3 kernel clock (APB1 timers run at 2x PCLK1 when APB1 is divided)
+ */
+static uint32_t HallTimerClock(void)
+{
+    uint32_t pclk1 = HAL_RCC_GetPCLK1Freq();
+
+    if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_CFGR_PPRE1_DIV1) {
+        pclk1 *= 2;
+    }
+    return pclk1;
+}
+
+/**
+ * BSRR word that selects one mux way
+ */
+static inline uint32_t HallMuxSelect(uint32_t way)
+{
+    uint32_t set = (way << HALL_MUX_FIRST_PIN) & HALL_MUX_MASK;
+    return set | ((HALL_MUX_MASK & ~set) << 16);
+}
+
+static void HallSetBottom(uint32_t key, uint32_t deflection)
+{
+    bottom[key] = (uint16_t)deflection;
+    travel_scale[key] = (256u << 16) / deflection;
+}
+
+/**
+ * Set up the analog pins, the mux lines, ADC1, TIM3 and both DMA streams;
+ * sampling starts with HallStart()
+ *
+ * @return true on success
+ */
+bool HallInit(void)
+{
+    __HAL_RCC_ADC1_CLK_ENABLE();
+    __HAL_RCC_TIM3_CLK_ENABLE();
+    __HAL_RCC_DMA1_CLK_ENABLE();
+    __HAL_RCC_DMA2_CLK_ENABLE();
+
+    // Inputs to analog mode (11), no pull
+#define HALL_PIN_ANALOG(idx, channel, port, pin) \
+    GPIO##port->PUPDR &= ~(3u << (2 * (pin)));   \
+    GPIO##port->MODER |= 3u << (2 * (pin));
+    HALL_CHANNEL_MAP(HALL_PIN_ANALOG)
+#undef HALL_PIN_ANALOG
+
+#if HALL_MUX_WAYS > 1
+    // Select lines: push-pull outputs at way 0
+    HALL_MUX_PORT->BSRR = HallMuxSelect(0);
+    for (uint32_t pin = HALL_MUX_FIRST_PIN; pin < HALL_MUX_FIRST_PIN + HALL_MUX_BITS; ++pin) {
+        HALL_MUX_PORT->OTYPER &= ~(1u << pin);
+        HALL_MUX_PORT->PUPDR &= ~(3u << (2 * pin));
+        HALL_MUX_PORT->MODER = (HALL_MUX_PORT->MODER & ~(3u << (2 * pin))) | (1u << (2 * pin));
+    }
+    for (uint32_t way = 0; way < HALL_MUX_WAYS; ++way) {
+        mux_ring[way] = HallMuxSelect((way + 1u) % HALL_MUX_WAYS);
+    }
+#endif
+
+    for (uint32_t key = 0; key < HALL_KEYS; ++key) {
+        HallSetBottom(key, HALL_MIN_TRAVEL);
+        actuation[key] = HALL_ACTUATION_Q8;
+        release[key] = HALL_RELEASE_Q8;
+#if HALL_RAPID_TRIGGER
+        rt_press[key] = HALL_RT_PRESS_Q8;
+        rt_release[key] = HALL_RT_RELEASE_Q8;
+#endif
+    }
+
+    // ADC1: PCLK2 / 4, 12 bits, one scan sequence per TIM3 CC1 rising edge
+    // (EXTSEL 0111), DMA requests kept up for the circular ring
+    ADC->CCR = (ADC->CCR & ~ADC_CCR_ADCPRE) | ADC_CCR_ADCPRE_0;
+    ADC1->CR1 = ADC_CR1_SCAN;
+    ADC1->SMPR1 = 0;
+    ADC1->SMPR2 = 0;
+    ADC1->SQR1 = (uint32_t)(HALL_CHANNELS - 1) << ADC_SQR1_L_Pos;
+    ADC1->SQR2 = 0;
+    ADC1->SQR3 = 0;
+    for (uint32_t n = 0; n < HALL_CHANNELS; ++n) {
+        uint32_t channel = hall_adc_channels[n];
+        if (channel < 10) {
+            ADC1->SMPR2 |= HALL_SMP << (3 * channel);
+        } else {
+            ADC1->SMPR1 |= HALL_SMP << (3 * (channel - 10));
+        }
+        if (n < 6) {
+            ADC1->SQR3 |= channel << (5 * n);
+        } else if (n < 12) {
+            ADC1->SQR2 |= channel << (5 * (n - 6));
+        } else {
+            ADC1->SQR1 |= channel << (5 * (n - 12));
+        }
+    }
+    ADC1->CR2 = ADC_CR2_EXTEN_0 | ADC_CR2_EXTSEL_0 | ADC_CR2_EXTSEL_1 | ADC_CR2_EXTSEL_2 |
+                ADC_CR2_DMA | ADC_CR2_DDS | ADC_CR2_ADON;
+
+    // Conversions into the ring, half word in direct mode
+    DMA2_Stream4->CR = 0;
+    while (DMA2_Stream4->CR & DMA_SxCR_EN) {
+    }
+    DMA2->HIFCR = HALL_DMA_FLAGS;
+    DMA2_Stream4->PAR = (uint32_t)&ADC1->DR;
+    DMA2_Stream4->M0AR = (uint32_t)samples;
+    DMA2_Stream4->NDTR = HALL_RING_LEN;
+    DMA2_Stream4->CR = DMA_SxCR_PL_1 | DMA_SxCR_MSIZE_0 | DMA_SxCR_PSIZE_0 | DMA_SxCR_MINC |
+                       DMA_SxCR_CIRC | DMA_SxCR_HTIE | DMA_SxCR_TCIE;
+
+#if HALL_MUX_WAYS > 1
+    // Mux selects from the ring, channel 5 (TIM3_UP), word wide
+    DMA1_Stream2->CR = 0;
+    while (DMA1_Stream2->CR & DMA_SxCR_EN) {
+    }
+    DMA1->LIFCR = DMA_LIFCR_CTCIF2 | DMA_LIFCR_CHTIF2 | DMA_LIFCR_CTEIF2 | DMA_LIFCR_CDMEIF2 | DMA_LIFCR_CFEIF2;
+    DMA1_Stream2->PAR = (uint32_t)&HALL_MUX_PORT->BSRR;
+    DMA1_Stream2->M0AR = (uint32_t)mux_ring;
+    DMA1_Stream2->NDTR = HALL_MUX_WAYS;
+    DMA1_Stream2->CR = (5u << DMA_SxCR_CHSEL_Pos) | DMA_SxCR_PL_1 | DMA_SxCR_PL_0 | DMA_SxCR_MSIZE_1 |
+                       DMA_SxCR_PSIZE_1 | DMA_SxCR_MINC | DMA_SxCR_CIRC | DMA_SxCR_DIR_0;
+#endif
+
+    // TIM3: one update per mux step, CC1 (PWM mode 1, output enabled for
+    // the ADC trigger, no pin) at half the step
+    uint32_t ticks = HallTimerClock() / HALL_STEP_RATE_HZ;
+    uint32_t psc = (ticks - 1) / 0x10000;
+    TIM3->CR1 = 0;
+    TIM3->PSC = psc;
+    TIM3->ARR = (ticks / (psc + 1)) - 1;
+    TIM3->CCMR1 = TIM_CCMR1_OC1M_2 | TIM_CCMR1_OC1M_1;
+    TIM3->CCR1 = (TIM3->ARR + 1u) / 2u;
+    TIM3->CCER = TIM_CCER_CC1E;
+    TIM3->EGR = TIM_EGR_UG;
+    TIM3->SR = 0;
+
+    HAL_NVIC_SetPriority(DMA2_Stream4_IRQn, IRQ_PRIO_SAMPLER, 0);
+    HAL_NVIC_EnableIRQ(DMA2_Stream4_IRQn);
+    return true;
+}
+
+/**
+ * Arm both streams and start TIM3
+ *
+ * Every key reads as released until the first frame seeded the rest
+ * levels, HALL_FRAME_US x HALL_RING_FRAMES / 2 after this.
+ *
+ * @return true on success
+ */
+bool HallStart(void)
+{
+    DMA2_Stream4->CR |= DMA_SxCR_EN;
+#if HALL_MUX_WAYS > 1
+    HALL_MUX_PORT->BSRR = HallMuxSelect(0);
+    DMA1_Stream2->CR |= DMA_SxCR_EN;
+    TIM3->DIER = TIM_DIER_UDE;
+#endif
+    TIM3->CNT = 0;
+    TIM3->CR1 = TIM_CR1_CEN;
+    return true;
+}
+
+/**
+ * Turn one frame into a key word
+ *
+ * @param frame HALL_KEYS conversions in key order
+ * @return Key word (bit n = key n, 1 = released)
+ */
+HOT_PATH static uint32_t HallFrame(const uint16_t *frame)
+{
+    if (!seeded) {
+        seeded = true;
+        for (uint32_t key = 0; key < HALL_KEYS; ++key) {
+            rest_acc[key] = (uint32_t)frame[key] << HALL_REST_SHIFT;
+        }
+    }
+
+    for (uint32_t key = 0; key < HALL_KEYS; ++key) {
+        int32_t value = frame[key];
+        int32_t rest = (int32_t)(rest_acc[key] >> HALL_REST_SHIFT);
+#if HALL_POLARITY_RISING
+        int32_t deflection = value - rest;
+#else
+        int32_t deflection = rest - value;
+#endif
+        uint32_t bit = 1u << key;
+        uint32_t level = 0;
+
+        if (deflection < 0) {
+            // Past the rest level, this is the new one
+            rest_acc[key] = (uint32_t)value << HALL_REST_SHIFT;
+        } else {
+            if ((uint32_t)deflection > bottom[key]) {
+                HallSetBottom(key, (uint32_t)deflection);
+            }
+            level = ((uint32_t)deflection * travel_scale[key]) >> 16;
+            if (level > 255u) {
+                level = 255u;
+            }
+        }
+        travel[key] = (uint8_t)level;
+
+        if (pressed & bit) {
+            bool up = level < release[key];
+#if HALL_RAPID_TRIGGER
+            if (level > extreme[key]) {
+                extreme[key] = (uint8_t)level;
+            }
+            up = up || (rt_release[key] != 0 && level + rt_release[key] <= extreme[key]);
+#endif
+            if (up) {
+                pressed &= ~bit;
+#if HALL_RAPID_TRIGGER
+                extreme[key] = (uint8_t)level;
+#endif
+            }
+            continue;
+        }
+
+        bool down = level >= actuation[key];
+#if HALL_RAPID_TRIGGER
+        if (level < release[key]) {
+            rt_zone &= ~bit;
+        }
+        if (level < extreme[key]) {
+            extreme[key] = (uint8_t)level;
+        }
+        down = down || ((rt_zone & bit) && rt_press[key] != 0 && level >= extreme[key] + rt_press[key]);
+#endif
+        if (down) {
+            pressed |= bit;
+#if HALL_RAPID_TRIGGER
+            rt_zone |= bit;
+            extreme[key] = (uint8_t)level;
+#endif
+        } else if (level < release[key] / 2u) {
+            // Released and near rest: follow drift
+            rest_acc[key] += (uint32_t)(value - rest);
+        }
+    }
+    return ~pressed & HALL_KEY_MASK;
+}
+
+/**
+ * Process one half of the ring, from the stream 4 interrupt
+ */
+HOT_PATH static void HallProcess(const uint16_t *half)
+{
+    uint32_t words[HALL_RING_FRAMES / 2];
+
+    for (uint32_t n = 0; n < HALL_RING_FRAMES / 2; ++n) {
+        words[n] = HallFrame(&half[n * HALL_FRAME_LEN]);
+    }
+    key_word = words[HALL_RING_FRAMES / 2 - 1];
+    RightKeyboardProcessHall(words, HALL_RING_FRAMES / 2);
+}
+
+/**
+ * DMA2 stream 4 interrupt: half or whole ring filled
+ */
+HOT_PATH void HallIRQHandler(void)
+{
+    uint32_t flags = DMA2->HISR;
+
+    DMA2->HIFCR = HALL_DMA_FLAGS;
+    if (flags & DMA_HISR_HTIF4) {
+        HallProcess(&samples[0]);
+    }
+    if (flags & DMA_HISR_TCIF4) {
+        HallProcess(&samples[HALL_HALF_LEN]);
+    }
+}
+
+/**
+ * Get the key word of the newest frame
+ */
+HOT_PATH uint32_t HallKeys(void)
+{
+    return key_word;
+}
+
+/**
+ * Copy the calibration of every key for the register map
+ *
+ * @param keys HALL_KEYS entries
+ */
+void HallSnapshot(HallKeyState *keys)
+{
+    for (uint32_t key = 0; key < HALL_KEYS; ++key) {
+        keys[key].rest = (uint16_t)(rest_acc[key] >> HALL_REST_SHIFT);
+        keys[key].bottom = bottom[key];
+        keys[key].travel = travel[key];
+        keys[key].actuation = actuation[key];
+        keys[key].release = release[key];
+#if HALL_RAPID_TRIGGER
+        keys[key].rt_press = rt_press[key];
+        keys[key].rt_release = rt_release[key];
+#else
+        keys[key].rt_press = 0;
+        keys[key].rt_release = 0;
+#endif
+    }
+}
+
+/**
+ * Move the actuation and release points of one key or all of them
+ *
+ * Runs in the link interrupt, which the sampler interrupt does not
+ * preempt, so a frame never sees half a change.
+ *
+ * @param key Key index, 0xFF for every key
+ * @return false if the points are out of order or the key does not exist
+ */
+bool HallSetPoints(uint8_t key, uint8_t actuation_q8, uint8_t release_q8)
+{
+    if (release_q8 >= actuation_q8 || (key >= HALL_KEYS && key != 0xFFu)) {
+        return false;
+    }
+    for (uint32_t n = 0; n < HALL_KEYS; ++n) {
+        if (key == 0xFFu || key == n) {
+            actuation[n] = actuation_q8;
+            release[n] = release_q8;
+        }
+    }
+    return true;
+}
+
+/**
+ * Change the rapid-trigger deltas of one key or all of them
+ *
+ * @param key Key index, 0xFF for every key
+ * @param press_q8 Travel past the lowest point that presses again
+ * @param release_q8 Travel back from the highest point that releases
+ * @return false if only one delta is 0, rapid trigger is compiled out or
+ *         the key does not exist
+ */
+bool HallSetRapidTrigger(uint8_t key, uint8_t press_q8, uint8_t release_q8)
+{
+#if HALL_RAPID_TRIGGER
+    if ((press_q8 == 0) != (release_q8 == 0) || (key >= HALL_KEYS && key != 0xFFu)) {
+        return false;
+    }
+    for (uint32_t n = 0; n < HALL_KEYS; ++n) {
+        if (key == 0xFFu || key == n) {
+            rt_press[n] = press_q8;
+            rt_release[n] = release_q8;
+        }
+    }
+    return true;
+#else
+    (void)key;
+    return press_q8 == 0 && release_q8 == 0;
+#endif
+}
+
+#endif /* KEY_WIRING == KEY_WIRING_HALL */
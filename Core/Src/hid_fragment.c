@@ -0,0 +1,201 @@
+/**
+ * @file hid_fragment.c
+ * @brief HID report fragment kept ready for the master to splice.
+ *
+ * The scan edits a working copy and publishes it into whichever of two
+ * buffers the I2C interrupt is not serving, then switches the index. The
+ * I2C interrupts are never preempted by scan work (irq_plan.h), so a copy
+ * taken there always sees one whole fragment.
+ */
+
+#include "hid_fragment.h"
+#include "hot_path.h"
+#include <string.h>
+
+#if HID_FRAGMENT_ENABLE
+// Keys of the published report the fragment shows
+static uint32_t fragment_keys;
+
+// Fragment as edited by the scan
+static HidFragment work;
+
+// Published fragments, the I2C interrupt copies published[published_index]
+static HidFragment published[2];
+static volatile uint8_t published_index;
+
+#if HID_FRAGMENT_FORMAT == HID_FRAGMENT_BOOT
+// Held keys whose code found no free slot, in ErrorRollOver until one frees
+static uint32_t overflow_keys;
+#endif
+
+/**
+ * Check whether any of the given keys resolved to a code
+ */
+static bool CodeHeld(uint8_t code, uint32_t keys)
+{
+    for (; keys; keys &= keys - 1u) {
+        if (KeymapCode((uint32_t)__builtin_ctz(keys)) == code) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#if HID_FRAGMENT_FORMAT == HID_FRAGMENT_BOOT
+/**
+ * Find the slot holding a code
+ *
+ * @return Slot index, KEYMAP_REPORT_CODES if none
+ */
+static uint32_t SlotOf(uint8_t code)
+{
+    uint32_t slot = 0;
+    while (slot < KEYMAP_REPORT_CODES && work.codes[slot] != code) {
+        slot++;
+    }
+    return slot;
+}
+
+/**
+ * Move overflowed codes into the free slots, lowest key index first
+ */
+static void SlotsRefill(void)
+{
+    uint32_t slot;
+
+    while (overflow_keys && (slot = SlotOf(KEYMAP_NONE)) < KEYMAP_REPORT_CODES) {
+        uint8_t code = KeymapCode((uint32_t)__builtin_ctz(overflow_keys));
+        work.codes[slot] = code;
+        // Keys sharing the code come out of overflow with it
+        for (uint32_t keys = overflow_keys; keys; keys &= keys - 1u) {
+            uint32_t key = (uint32_t)__builtin_ctz(keys);
+            if (KeymapCode(key) == code) {
+                overflow_keys &= ~(1u << key);
+            }
+        }
+    }
+}
+#endif
+
+/**
+ * Add the code of a newly pressed key
+ */
+static void FragmentPress(uint32_t key)
+{
+    uint8_t code = KeymapCode(key);
+
+    if (code >= KEYMAP_MODIFIER_FIRST && code <= KEYMAP_MODIFIER_LAST) {
+        work.modifiers |= (uint8_t)(1u << (code - KEYMAP_MODIFIER_FIRST));
+    } else if (code == KEYMAP_NONE) {
+        return;
+    } else {
+#if HID_FRAGMENT_FORMAT == HID_FRAGMENT_BOOT
+        if (SlotOf(code) < KEYMAP_REPORT_CODES) {
+            return;
+        }
+        uint32_t slot = SlotOf(KEYMAP_NONE);
+        if (slot < KEYMAP_REPORT_CODES) {
+            work.codes[slot] = code;
+        } else {
+            overflow_keys |= 1u << key;
+        }
+#else
+        if (code < 8u * HID_FRAGMENT_NKRO_BYTES) {
+            work.usages[code >> 3] |= (uint8_t)(1u << (code & 7u));
+        }
+#endif
+    }
+}
+
+/**
+ * Remove the code of a released key, unless another held key shares it
+ *
+ * @param key Released key
+ * @param held Keys of the new report
+ */
+static void FragmentRelease(uint32_t key, uint32_t held)
+{
+    uint8_t code = KeymapCode(key);
+
+#if HID_FRAGMENT_FORMAT == HID_FRAGMENT_BOOT
+    if (overflow_keys & (1u << key)) {
+        overflow_keys &= ~(1u << key);
+        return;
+    }
+#endif
+    if (code == KEYMAP_NONE || CodeHeld(code, held)) {
+        return;
+    }
+    if (code >= KEYMAP_MODIFIER_FIRST && code <= KEYMAP_MODIFIER_LAST) {
+        work.modifiers &= (uint8_t)~(1u << (code - KEYMAP_MODIFIER_FIRST));
+    } else {
+#if HID_FRAGMENT_FORMAT == HID_FRAGMENT_BOOT
+        uint32_t slot = SlotOf(code);
+        if (slot < KEYMAP_REPORT_CODES) {
+            work.codes[slot] = KEYMAP_NONE;
+            SlotsRefill();
+        }
+#else
+        if (code < 8u * HID_FRAGMENT_NKRO_BYTES) {
+            work.usages[code >> 3] &= (uint8_t)~(1u << (code & 7u));
+        }
+#endif
+    }
+}
+#endif /* HID_FRAGMENT_ENABLE */
+
+/**
+ * Apply a new published report to the fragment and publish the result
+ *
+ * Called by the scan for every report it publishes, after the keymap has
+ * resolved the keys pressed in it. Releases go first, so their slots are
+ * free for the presses of the same report.
+ *
+ * @param pressed Key word of the report (1 = pressed)
+ */
+HOT_PATH void HidFragmentUpdate(uint32_t pressed)
+{
+#if HID_FRAGMENT_ENABLE
+    uint32_t released = fragment_keys & ~pressed;
+    uint32_t new_keys = pressed & ~fragment_keys;
+
+    if ((released | new_keys) == 0) {
+        return;
+    }
+    fragment_keys = pressed;
+    for (; released; released &= released - 1u) {
+        FragmentRelease((uint32_t)__builtin_ctz(released), pressed);
+    }
+    for (; new_keys; new_keys &= new_keys - 1u) {
+        FragmentPress((uint32_t)__builtin_ctz(new_keys));
+    }
+
+    uint8_t next = published_index ^ 1u;
+    published[next] = work;
+#if HID_FRAGMENT_FORMAT == HID_FRAGMENT_BOOT
+    if (overflow_keys) {
+        // Phantom state as the boot protocol defines it
+        memset(published[next].codes, KEYMAP_ERROR_ROLLOVER, sizeof(published[next].codes));
+    }
+#endif
+    // The buffer is complete before the interrupt can pick it
+    __DMB();
+    published_index = next;
+#else
+    (void)pressed;
+#endif
+}
+
+/**
+ * Copy the published fragment, from the I2C interrupt
+ *
+ * @param fragment Filled with the fragment, all zero without HID_FRAGMENT_ENABLE
+ */
+HOT_PATH void HidFragmentSnapshot(HidFragment *fragment)
+{
+#if HID_FRAGMENT_ENABLE
+    *fragment = published[published_index];
+#else
+    memset(fragment, 0, sizeof(*fragment));
+#endif
+}
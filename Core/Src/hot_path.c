@@ -0,0 +1,40 @@
+/**
+ * @file hot_path.c
+ * @brief Placement of the latency-critical code in SRAM.
+ */
+
+#include "hot_path.h"
+#include "stm32f4xx.h"
+
+#if RAM_VECTOR_TABLE
+// 16 system exceptions followed by the device interrupts up to SPI5
+#define HOT_PATH_VECTOR_COUNT (16u + (uint32_t)SPI5_IRQn + 1u)
+
+// VTOR needs the table aligned to the next power of two above its size
+static uint32_t ram_vectors[HOT_PATH_VECTOR_COUNT] __attribute__((section(".ram_vector"), aligned(512)));
+
+_Static_assert(sizeof(ram_vectors) <= 512, "ram_vectors outgrew its VTOR alignment");
+#endif
+
+/**
+ * Copy the active vector table to SRAM and switch VTOR over
+ *
+ * Must run after VTOR points at the application's flash table and before
+ * any handler is installed at run time.
+ */
+void HotPathRelocateVectors(void)
+{
+#if RAM_VECTOR_TABLE
+    const uint32_t *flash_vectors = (const uint32_t *)SCB->VTOR;
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    for (uint32_t n = 0; n < HOT_PATH_VECTOR_COUNT; ++n) {
+        ram_vectors[n] = flash_vectors[n];
+    }
+    SCB->VTOR = (uint32_t)ram_vectors;
+    __DSB();
+    __ISB();
+    __set_PRIMASK(primask);
+#endif
+}
@@ -0,0 +1,401 @@
+/**
+ * @file i2c_fault.c
+ * @brief I2C bus fault injection and recovery-time measurement.
+ *
+ * I2CFaultService() runs the injection from thread context; the hooks
+ * I2CFaultLinkEvent() and I2CFaultTransferDone() run in the I2C interrupt
+ * and only stamp times. The service reads those stamps and updates the
+ * statistics with interrupts masked, so I2CFaultSnapshot(), called from
+ * the read of RIGHT_KEYBOARD_REG_FAULT, always copies a whole update.
+ */
+
+#include "i2c_fault.h"
+#include "board.h"
+#include "hot_path.h"
+#include "timebase.h"
+#include <string.h>
+
+#if I2C_FAULT_ENABLE
+typedef enum {
+    FAULT_IDLE,                 // Waiting for the next fault
+    FAULT_HOLD,                 // A stuck line is held low
+    FAULT_WAIT,                 // Lines free, waiting for a clean transfer
+} FaultPhase;
+
+static I2CFaultKindStats stats[I2C_FAULT_KINDS];
+static uint32_t          recover_sum[I2C_FAULT_KINDS];
+
+static volatile uint8_t  active = I2C_FAULT_NONE;
+static volatile uint8_t  phase = FAULT_IDLE;
+static volatile uint8_t  requested = I2C_FAULT_NONE;
+static volatile bool     clear_requested;
+static uint8_t           auto_last = I2C_FAULT_KINDS - 1u;
+static uint32_t          next_auto_us;
+static uint32_t          hold_until_us;
+
+// Stamps of the fault in progress, TimebaseNowUs()
+static uint32_t          started_us;
+static volatile uint32_t ended_us;      /* release, then the last error */
+static volatile uint32_t detected_us;
+static volatile bool     detected;
+static volatile uint32_t clean_us;
+static volatile bool     clean_seen;
+
+/**
+ * Pull a fault output low or let it float
+ */
+static inline void FaultLine(GPIO_TypeDef *port, uint32_t pin, bool low)
+{
+    port->BSRR = low ? (1u << (pin + 16u)) : (1u << pin);
+}
+
+static inline void FaultRelease(void)
+{
+    FaultLine(I2C_FAULT_SDA_PORT, I2C_FAULT_SDA_PIN, false);
+    FaultLine(I2C_FAULT_SCL_PORT, I2C_FAULT_SCL_PIN, false);
+}
+
+/**
+ * Wait for a transfer to this slave
+ *
+ * @param transmit Only a read, this slave driving SDA
+ * @return true once one runs, false after I2C_FAULT_WAIT_US without
+ */
+static bool FaultAwaitTransfer(bool transmit)
+{
+    uint32_t need = I2C_SR2_BUSY | (transmit ? I2C_SR2_TRA : 0u);
+    uint32_t deadline = TimebaseNowUs() + I2C_FAULT_WAIT_US;
+
+    while ((I2C1->SR2 & need) != need) {
+        if (TimebaseReached(TimebaseNowUs(), deadline)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Open the measurement of one fault, with interrupts masked
+ *
+ * @return false if the master opened one meanwhile
+ */
+static bool FaultOpen(uint8_t kind, uint32_t now)
+{
+    if (active != I2C_FAULT_NONE) {
+        return false;
+    }
+    active = kind;
+    started_us = now;
+    ended_us = now;
+    detected = false;
+    clean_seen = false;
+    stats[kind].injected++;
+    return true;
+}
+
+/**
+ * Put one line fault on the bus
+ *
+ * @return false if a pulse kind found no transfer to hit
+ */
+static bool FaultInject(uint8_t kind)
+{
+    uint32_t primask;
+
+    switch (kind) {
+    case I2C_FAULT_STUCK_SDA:
+    case I2C_FAULT_STUCK_SCL:
+        primask = __get_PRIMASK();
+        __disable_irq();
+        if (!FaultOpen(kind, TimebaseNowUs())) {
+            __set_PRIMASK(primask);
+            return false;
+        }
+        phase = FAULT_HOLD;
+        __set_PRIMASK(primask);
+        hold_until_us = started_us + I2C_FAULT_STUCK_MS * 1000u;
+        if (kind == I2C_FAULT_STUCK_SDA) {
+            FaultLine(I2C_FAULT_SDA_PORT, I2C_FAULT_SDA_PIN, true);
+        } else {
+            FaultLine(I2C_FAULT_SCL_PORT, I2C_FAULT_SCL_PIN, true);
+        }
+        return true;
+    case I2C_FAULT_COLLISION:
+        if (!FaultAwaitTransfer(true)) {
+            return false;
+        }
+        primask = __get_PRIMASK();
+        __disable_irq();
+        if (!FaultOpen(kind, TimebaseNowUs())) {
+            __set_PRIMASK(primask);
+            return false;
+        }
+        FaultLine(I2C_FAULT_SDA_PORT, I2C_FAULT_SDA_PIN, true);
+        while (!TimebaseReached(TimebaseNowUs(), started_us + I2C_FAULT_PULSE_US)) {
+        }
+        FaultRelease();
+        ended_us = TimebaseNowUs();
+        phase = FAULT_WAIT;
+        __set_PRIMASK(primask);
+        return true;
+    case I2C_FAULT_GLITCH: {
+        if (!FaultAwaitTransfer(false)) {
+            return false;
+        }
+        primask = __get_PRIMASK();
+        __disable_irq();
+        // SDA falling then rising while SCL is high: START, then STOP
+        uint32_t deadline = TimebaseNowUs() + I2C_FAULT_WAIT_US;
+        while ((GPIOB->IDR & BOARD_I2C_PINS) != BOARD_I2C_PINS) {
+            if (TimebaseReached(TimebaseNowUs(), deadline)) {
+                __set_PRIMASK(primask);
+                return false;
+            }
+        }
+        if (!FaultOpen(kind, TimebaseNowUs())) {
+            __set_PRIMASK(primask);
+            return false;
+        }
+        FaultLine(I2C_FAULT_SDA_PORT, I2C_FAULT_SDA_PIN, true);
+        while (!TimebaseReached(TimebaseNowUs(), started_us + 1u)) {
+        }
+        FaultRelease();
+        ended_us = TimebaseNowUs();
+        phase = FAULT_WAIT;
+        __set_PRIMASK(primask);
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+/**
+ * Check that I2C1 answers on its own address again
+ */
+static bool FaultPeripheralListening(void)
+{
+    return (I2C1->CR1 & (I2C_CR1_PE | I2C_CR1_ACK)) == (I2C_CR1_PE | I2C_CR1_ACK) &&
+           ((I2C1->OAR1 >> 1) & 0x7Fu) == RIGHT_KEYBOARD_I2C_ADDRESS;
+}
+
+/**
+ * Close the fault in progress and fold it into its statistics, with
+ * interrupts masked
+ *
+ * @param recovered A clean transfer followed the fault
+ */
+static void FaultClose(bool recovered)
+{
+    I2CFaultKindStats *kind = &stats[active];
+
+    if (detected) {
+        uint32_t detect_us = detected_us - started_us;
+        if (detect_us > kind->detect_us_max) {
+            kind->detect_us_max = detect_us;
+        }
+    }
+    if (recovered) {
+        uint32_t recover_us = clean_us - ended_us;
+        if (kind->recovered == 0 || recover_us < kind->recover_us_min) {
+            kind->recover_us_min = recover_us;
+        }
+        if (recover_us > kind->recover_us_max) {
+            kind->recover_us_max = recover_us;
+        }
+        recover_sum[active] += recover_us;
+        kind->recovered++;
+        kind->recover_us_mean = recover_sum[active] / kind->recovered;
+        if (recover_us > I2C_FAULT_BUDGET_US) {
+            kind->over_budget++;
+        }
+        if (!RightKeyboardSnapshotConsistent() || !FaultPeripheralListening()) {
+            kind->inconsistent++;
+        }
+    }
+    active = I2C_FAULT_NONE;
+    phase = FAULT_IDLE;
+}
+
+/**
+ * Next automatic kind after the last one
+ */
+static uint8_t FaultNextAuto(void)
+{
+    for (uint32_t i = 1; i <= I2C_FAULT_KINDS; i++) {
+        uint32_t kind = (auto_last + i) % I2C_FAULT_KINDS;
+        if (I2C_FAULT_AUTO_KINDS & (1u << kind)) {
+            return (uint8_t)kind;
+        }
+    }
+    return I2C_FAULT_NONE;
+}
+#endif /* I2C_FAULT_ENABLE */
+
+/**
+ * Set the fault outputs up as released open-drain outputs
+ *
+ * Runs after RightKeyboardInit(), so the first fault finds the link up.
+ */
+void I2CFaultInit(void)
+{
+#if I2C_FAULT_ENABLE
+    __HAL_RCC_GPIOC_CLK_ENABLE();
+    FaultRelease();
+
+    GPIO_InitTypeDef GPIO_InitStruct = {0};
+    GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_OD;
+    GPIO_InitStruct.Pull = GPIO_NOPULL;
+    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
+    GPIO_InitStruct.Pin = 1u << I2C_FAULT_SDA_PIN;
+    HAL_GPIO_Init(I2C_FAULT_SDA_PORT, &GPIO_InitStruct);
+    GPIO_InitStruct.Pin = 1u << I2C_FAULT_SCL_PIN;
+    HAL_GPIO_Init(I2C_FAULT_SCL_PORT, &GPIO_InitStruct);
+
+    next_auto_us = TimebaseNowUs() + I2C_FAULT_PERIOD_MS * 1000u;
+#endif
+}
+
+/**
+ * Scheduler task: inject, release and close faults
+ */
+void I2CFaultService(void)
+{
+#if I2C_FAULT_ENABLE
+    uint32_t now = TimebaseNowUs();
+    uint32_t primask = __get_PRIMASK();
+
+    if (clear_requested) {
+        __disable_irq();
+        memset(stats, 0, sizeof(stats));
+        memset(recover_sum, 0, sizeof(recover_sum));
+        clear_requested = false;
+        __set_PRIMASK(primask);
+    }
+
+    switch (phase) {
+    case FAULT_HOLD:
+        if (TimebaseReached(now, hold_until_us)) {
+            __disable_irq();
+            FaultRelease();
+            ended_us = TimebaseNowUs();
+            phase = FAULT_WAIT;
+            __set_PRIMASK(primask);
+        }
+        break;
+    case FAULT_WAIT:
+        __disable_irq();
+        // Sampled masked, the stamps are never newer than now
+        now = TimebaseNowUs();
+        if (clean_seen && now - clean_us >= I2C_FAULT_QUIET_MS * 1000u) {
+            FaultClose(true);
+        } else if (!clean_seen && now - ended_us >= I2C_FAULT_TIMEOUT_MS * 1000u) {
+            FaultClose(false);
+        }
+        __set_PRIMASK(primask);
+        break;
+    default: {
+        uint8_t kind = requested;
+        bool automatic = false;
+
+        if (kind == I2C_FAULT_NONE && I2C_FAULT_PERIOD_MS > 0 && TimebaseReached(now, next_auto_us)) {
+            kind = FaultNextAuto();
+            automatic = true;
+        }
+        if (kind == I2C_FAULT_NONE) {
+            break;
+        }
+        if (FaultInject(kind)) {
+            requested = I2C_FAULT_NONE;
+            if (automatic) {
+                auto_last = kind;
+                next_auto_us = now + I2C_FAULT_PERIOD_MS * 1000u;
+            }
+        }
+        break;
+    }
+    }
+#endif
+}
+
+/**
+ * Master command written to RIGHT_KEYBOARD_REG_FAULT
+ *
+ * A line kind is injected by the next service pass. A master kind opens
+ * its window at once, so the errors that follow the write right away are
+ * not missed. Ignored while a fault is in progress.
+ *
+ * @param command Fault kind, or I2C_FAULT_CMD_CLEAR
+ */
+HOT_PATH void I2CFaultCommand(uint8_t command)
+{
+#if I2C_FAULT_ENABLE
+    if (command == I2C_FAULT_CMD_CLEAR) {
+        clear_requested = true;
+    } else if (command < I2C_FAULT_KINDS && active == I2C_FAULT_NONE) {
+        if (I2C_FAULT_LINE_KINDS & (1u << command)) {
+            requested = command;
+        } else if (FaultOpen(command, TimebaseNowUs())) {
+            phase = FAULT_WAIT;
+        }
+    }
+#else
+    (void)command;
+#endif
+}
+
+/**
+ * Link error, link fault or bus reset while a fault is in progress
+ *
+ * The first one is the detection; every one moves the fault end, so the
+ * recovery counts from the last reset rather than the release.
+ */
+HOT_PATH void I2CFaultLinkEvent(void)
+{
+#if I2C_FAULT_ENABLE
+    if (active == I2C_FAULT_NONE) {
+        return;
+    }
+    uint32_t now = TimebaseNowUs();
+    if (!detected) {
+        detected = true;
+        detected_us = now;
+    }
+    if (phase == FAULT_WAIT) {
+        ended_us = now;
+        clean_seen = false;
+    }
+#endif
+}
+
+/**
+ * A read or write completed in full
+ */
+HOT_PATH void I2CFaultTransferDone(void)
+{
+#if I2C_FAULT_ENABLE
+    // A master kind without an error yet has not started misbehaving
+    if (phase == FAULT_WAIT && !clean_seen &&
+        (detected || (I2C_FAULT_LINE_KINDS & (1u << active)))) {
+        clean_us = TimebaseNowUs();
+        clean_seen = true;
+    }
+#endif
+}
+
+/**
+ * Copy the fault statistics for a read of RIGHT_KEYBOARD_REG_FAULT
+ *
+ * @param report Filled with the statistics; zero with I2C_FAULT_ENABLE off
+ */
+void I2CFaultSnapshot(I2CFaultReport *report)
+{
+    memset(report, 0, sizeof(*report));
+    report->active = I2C_FAULT_NONE;
+#if I2C_FAULT_ENABLE
+    report->enabled = 1;
+    report->active = active;
+    report->budget_us = I2C_FAULT_BUDGET_US;
+    memcpy(report->kind, stats, sizeof(stats));
+#endif
+}
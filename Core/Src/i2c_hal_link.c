@@ -0,0 +1,243 @@
+/**
+ * @file i2c_hal_link.c
+ * @brief HAL I2C1 slave drivers, interrupt or DMA transmit.
+ *
+ * The driver owns the HAL handle: listen mode is only armed from the end
+ * of a transaction and from I2CHalLinkService(), and the transfers
+ * themselves only from the address match. Nothing else touches the frame
+ * buffers while a read is in flight.
+ */
+
+#include "i2c_hal_link.h"
+#include "periph.h"
+#include "trace.h"
+
+#if LINK_TRANSPORT == LINK_TRANSPORT_I2C && I2C_DRIVER != I2C_DRIVER_REGISTER
+// I2C handle from main.c
+extern I2C_HandleTypeDef hi2c1;
+
+// HAL transmit call for the selected driver, DMA costs one interrupt per transfer
+#if I2C_DRIVER == I2C_DRIVER_HAL_DMA
+#define I2C_SLAVE_TRANSMIT HAL_I2C_Slave_Seq_Transmit_DMA
+#else
+#define I2C_SLAVE_TRANSMIT HAL_I2C_Slave_Seq_Transmit_IT
+#endif
+
+static uint8_t rx_registers[I2C_HAL_LINK_RX_LEN];
+static bool    rx_pending;
+static bool    rx_general_call;
+static bool    rx_dropped;              /* write to the report address */
+static bool    tx_pending;
+
+// Listen mode restarts, for the I2C health counters
+static volatile uint32_t listen_rearms;
+
+/**
+ * Hand a pending master write to the register map
+ *
+ * A write ends on STOP (reported as an AF error by the HAL when the buffer
+ * is not full), on a full buffer or on the repeated start of the read.
+ */
+static void FinishRegisterWrite(I2C_HandleTypeDef *hi2c)
+{
+    if (rx_pending) {
+        rx_pending = false;
+        if (rx_general_call) {
+            RightKeyboardGeneralCall(rx_registers, hi2c->XferSize - hi2c->XferCount);
+        } else if (!rx_dropped) {
+            RightKeyboardRxEnd(rx_registers, hi2c->XferSize - hi2c->XferCount);
+        }
+    }
+}
+
+/**
+ * Estimate how much of a read the master took before NACKing it early
+ *
+ * Counts low: resending an event is harmless since it carries the new
+ * level, losing one is not.
+ */
+static uint32_t AbortedBytesSent(I2C_HandleTypeDef *hi2c)
+{
+#if I2C_DRIVER == I2C_DRIVER_HAL_DMA
+    // The stream is already aborted, its remaining count is gone
+    (void)hi2c;
+    return 0;
+#else
+    // The byte loaded after the last acknowledged one never left DR
+    uint32_t loaded = hi2c->XferSize - hi2c->XferCount;
+    return loaded > 0 ? loaded - 1u : 0u;
+#endif
+}
+
+/**
+ * Put the slave back into listen mode once the HAL handle is idle
+ */
+static void I2CArmListen(void)
+{
+    // Listen mode ends after every transaction and on errors
+    if (HAL_I2C_GetState(&hi2c1) != HAL_I2C_STATE_READY) {
+        return;
+    }
+
+    if (HAL_I2C_EnableListen_IT(&hi2c1) == HAL_OK) {
+        listen_rearms++;
+    }
+}
+#endif /* LINK_TRANSPORT == LINK_TRANSPORT_I2C && I2C_DRIVER != I2C_DRIVER_REGISTER */
+
+/**
+ * Start listening for the own address
+ *
+ * @return true if listen mode is armed
+ */
+bool I2CHalLinkStart(void)
+{
+#if LINK_TRANSPORT == LINK_TRANSPORT_I2C && I2C_DRIVER != I2C_DRIVER_REGISTER
+    return HAL_I2C_EnableListen_IT(&hi2c1) == HAL_OK;
+#else
+    return true;
+#endif
+}
+
+/**
+ * Reset I2C1 and start listening again
+ *
+ * SWRST releases SDA/SCL and clears a stuck BUSY flag. HAL_I2C_Init() then
+ * restores the MX_I2C1_Init() settings and own address from hi2c1.Init
+ * without going through the MSP again. Called with the I2C interrupts
+ * masked; whatever was in flight is returned as not delivered.
+ */
+void I2CHalLinkReset(void)
+{
+#if LINK_TRANSPORT == LINK_TRANSPORT_I2C && I2C_DRIVER != I2C_DRIVER_REGISTER
+#if I2C_DRIVER == I2C_DRIVER_HAL_DMA
+    if (hi2c1.hdmatx != NULL) {
+        CLEAR_BIT(I2C1->CR2, I2C_CR2_DMAEN);
+        HAL_DMA_Abort(hi2c1.hdmatx);
+    }
+#endif
+
+    I2C1->CR1 |= I2C_CR1_SWRST;
+    I2C1->CR1 &= ~I2C_CR1_SWRST;
+
+    rx_pending = false;
+    tx_pending = false;
+    RightKeyboardTxEnd(0);
+
+    __HAL_UNLOCK(&hi2c1);
+    HAL_I2C_Init(&hi2c1);
+    HAL_I2C_EnableListen_IT(&hi2c1);
+    listen_rearms++;
+#endif
+}
+
+/**
+ * Re-arm listen mode from thread context if the callbacks missed it
+ *
+ * Normally HAL_I2C_ListenCpltCallback() has already re-armed, so this is
+ * one read of the handle state per loop pass; the I2C interrupts are only
+ * held off for the few cycles it takes otherwise.
+ */
+void I2CHalLinkService(void)
+{
+#if LINK_TRANSPORT == LINK_TRANSPORT_I2C && I2C_DRIVER != I2C_DRIVER_REGISTER
+    if (HAL_I2C_GetState(&hi2c1) == HAL_I2C_STATE_READY) {
+        PeriphI2CIrqEnable(false);
+        I2CArmListen();
+        PeriphI2CIrqEnable(true);
+    }
+#endif
+}
+
+/**
+ * Listen mode restarts since boot
+ */
+uint32_t I2CHalLinkRearms(void)
+{
+#if LINK_TRANSPORT == LINK_TRANSPORT_I2C && I2C_DRIVER != I2C_DRIVER_REGISTER
+    return listen_rearms;
+#else
+    return 0;
+#endif
+}
+
+#if LINK_TRANSPORT == LINK_TRANSPORT_I2C && I2C_DRIVER != I2C_DRIVER_REGISTER
+// Address match in listen mode - arm the transfer the master asked for
+void HAL_I2C_AddrCallback(I2C_HandleTypeDef *hi2c, uint8_t TransferDirection, uint16_t AddrMatchCode)
+{
+    // AddrMatchCode is OwnAddress1 or OwnAddress2 as set in hi2c1.Init
+    bool diag = I2C_DIAG_ADDRESS && AddrMatchCode == (I2C_DIAG_ADDRESS << 1);
+
+    if (hi2c->Instance == I2C1) {
+        // A repeated start ends the pointer write without a STOP
+        FinishRegisterWrite(hi2c);
+
+        if (TransferDirection == I2C_DIRECTION_TRANSMIT) {
+            // Master writes the register pointer, or a command to address 0x00.
+            // GENCALL stays set until the STOP, ADDR is still pending so
+            // reading SR2 here only clears it a little early.
+            rx_general_call = (hi2c->Instance->SR2 & I2C_SR2_GENCALL) != 0;
+            rx_dropped = I2C_DIAG_ADDRESS && !diag && !rx_general_call;
+            rx_pending = true;
+            TRACE(TRACE_I2C_ADDR, TRACE_I2C_WRITE);
+            HAL_I2C_Slave_Seq_Receive_IT(hi2c, rx_registers, sizeof(rx_registers), I2C_FIRST_FRAME);
+        } else {
+            // Master reads the selected register, or the report
+            const uint8_t *frame;
+            uint32_t len = diag || !I2C_DIAG_ADDRESS ? RightKeyboardTxBegin(&frame)
+                                                     : RightKeyboardReportBegin(&frame);
+            tx_pending = true;
+            I2C_SLAVE_TRANSMIT(hi2c, (uint8_t *)frame, (uint16_t)len, I2C_LAST_FRAME);
+        }
+    }
+}
+
+// I2C event callback - will be called by HAL when I2C events occur
+void HAL_I2C_SlaveTxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+    if (hi2c->Instance == I2C1) {
+        // Whole frame handed over, the master's NACK ends listen mode next
+        tx_pending = false;
+        RightKeyboardTxEnd(hi2c->XferSize - hi2c->XferCount);
+    }
+}
+
+void HAL_I2C_SlaveRxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+    if (hi2c->Instance == I2C1) {
+        // Write buffer full, anything beyond it is not acknowledged
+        FinishRegisterWrite(hi2c);
+    }
+}
+
+void HAL_I2C_ListenCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+    if (hi2c->Instance == I2C1) {
+        // Transaction over, listen for the next address match
+        I2CArmListen();
+    }
+}
+
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c)
+{
+    if (hi2c->Instance == I2C1) {
+        RightKeyboardLinkError(HAL_I2C_GetError(hi2c));
+
+        // AF: the master stopped a write or NACKed a read early
+        if (rx_pending) {
+            FinishRegisterWrite(hi2c);
+        } else if (tx_pending) {
+            tx_pending = false;
+            RightKeyboardTxEnd(AbortedBytesSent(hi2c));
+        }
+
+        // Bus errors mask the I2C interrupts without leaving listen mode,
+        // drop out of it and let RightKeyboardI2CService() reset I2C1.
+        // After an AF the HAL ends listen mode itself (ListenCpltCallback).
+        if (!(HAL_I2C_GetError(hi2c) & HAL_I2C_ERROR_AF)) {
+            HAL_I2C_DisableListen_IT(hi2c);
+            RightKeyboardLinkFault();
+        }
+    }
+}
+#endif /* LINK_TRANSPORT == LINK_TRANSPORT_I2C && I2C_DRIVER != I2C_DRIVER_REGISTER */
@@ -0,0 +1,327 @@
+/**
+ * @file i2c_slave.c
+ * @brief Register-level I2C1 slave driver.
+ *
+ * Slave transmitter: the frame is fetched on ADDR and loaded on TXE while
+ * bytes remain. After the last byte TXE is no longer serviced, so a master
+ * that reads exactly the frame ends with DR empty. Over-reads are padded on
+ * BTF. A master that stops early leaves one byte in DR, which is discarded by
+ * toggling PE so it can't leak into the next read.
+ *
+ * With I2C_SLAVE_PRELOAD the frame is fetched once the bus goes idle (STOP)
+ * and its first byte written to DR right away. ADDR then only has to be
+ * cleared for the shift register to pick it up. A write in between (a new
+ * register pointer) hands the staged frame back and stages a new one.
+ */
+
+#include "i2c_slave.h"
+#include "hot_path.h"
+#include "trace.h"
+
+// I2C handle from main.c, for the re-init after a reset
+extern I2C_HandleTypeDef hi2c1;
+
+static const uint8_t *tx_frame;
+static uint32_t       tx_len;
+static uint32_t       tx_index;
+static bool           tx_active;
+
+static uint8_t        rx_buffer[I2C_SLAVE_RX_LEN];
+static uint32_t       rx_len;
+static bool           rx_active;
+static bool           rx_general_call;  /* write addressed to 0x00 */
+static bool           rx_dropped;       /* write to the report address */
+
+#if I2C_SLAVE_PRELOAD
+static bool           tx_staged;        /* frame fetched, first byte in DR */
+static volatile bool  restage_pending;  /* set by I2CSlaveRefresh() */
+#endif
+
+#if I2C_SLAVE_STRETCH_STATS
+static uint32_t       stretch_start;
+static uint32_t       stretch_last;
+static uint32_t       stretch_max;
+
+HOT_PATH static void I2CSlaveStretchEnd(void)
+{
+    stretch_last = DWT->CYCCNT - stretch_start;
+    if (stretch_last > stretch_max) {
+        stretch_max = stretch_last;
+    }
+}
+#endif
+
+#if I2C_SLAVE_PRELOAD
+/**
+ * Fetch the next read frame and park its first byte in DR
+ */
+HOT_PATH static void I2CSlaveStage(void)
+{
+    tx_len = RightKeyboardTxBegin(&tx_frame);
+    I2C1->DR = tx_len > 0 ? tx_frame[0] : I2C_SLAVE_PAD_BYTE;
+    tx_index = 1;
+    tx_staged = true;
+}
+
+/**
+ * Hand a staged frame back unread, e.g. after the register pointer changed
+ */
+HOT_PATH static void I2CSlaveUnstage(void)
+{
+    if (tx_staged) {
+        tx_staged = false;
+        RightKeyboardTxEnd(0);
+    }
+}
+#endif
+
+/**
+ * Enable address acknowledge and the event/error interrupts
+ */
+void I2CSlaveStart(void)
+{
+    tx_active = false;
+    rx_active = false;
+
+#if I2C_SLAVE_STRETCH_STATS
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+
+    I2C1->CR1 |= I2C_CR1_PE;
+    I2C1->CR1 |= I2C_CR1_ACK;
+#if I2C_SLAVE_PRELOAD
+    tx_staged = false;
+    I2CSlaveStage();
+#endif
+    I2C1->CR2 |= I2C_CR2_ITEVTEN | I2C_CR2_ITERREN;
+}
+
+/**
+ * Stop acknowledging the own address and mask the interrupts
+ */
+void I2CSlaveStop(void)
+{
+    I2C1->CR2 &= ~(I2C_CR2_ITEVTEN | I2C_CR2_ITBUFEN | I2C_CR2_ITERREN);
+    I2C1->CR1 &= ~I2C_CR1_ACK;
+#if I2C_SLAVE_PRELOAD
+    I2CSlaveUnstage();
+#endif
+}
+
+/**
+ * Reset I2C1 and start answering again
+ *
+ * SWRST releases SDA/SCL and clears a stuck BUSY flag. HAL_I2C_Init() then
+ * restores the MX_I2C1_Init() settings and own address from hi2c1.Init
+ * without going through the MSP again. Called with the I2C interrupts
+ * masked; whatever was in flight is returned as not delivered.
+ */
+void I2CSlaveReset(void)
+{
+    I2CSlaveStop();
+
+    I2C1->CR1 |= I2C_CR1_SWRST;
+    I2C1->CR1 &= ~I2C_CR1_SWRST;
+    RightKeyboardTxEnd(0);
+
+    __HAL_UNLOCK(&hi2c1);
+    HAL_I2C_Init(&hi2c1);
+    I2CSlaveStart();
+}
+
+/**
+ * Re-stage the next read frame because the data behind it changed
+ *
+ * Called from thread context. The staging itself runs in the I2C event
+ * interrupt, which is pended here, so it never races a transfer.
+ */
+void I2CSlaveRefresh(void)
+{
+#if I2C_SLAVE_PRELOAD
+    restage_pending = true;
+    NVIC_SetPendingIRQ(I2C1_EV_IRQn);
+#endif
+}
+
+/**
+ * Read the SCL stretch measured at the start of a read, in CPU cycles
+ *
+ * @param last_cycles Set to the stretch of the last read
+ * @param max_cycles Set to the longest stretch since boot
+ */
+void I2CSlaveStretchStats(uint32_t *last_cycles, uint32_t *max_cycles)
+{
+#if I2C_SLAVE_STRETCH_STATS
+    *last_cycles = stretch_last;
+    *max_cycles = stretch_max;
+#else
+    *last_cycles = 0;
+    *max_cycles = 0;
+#endif
+}
+
+HOT_PATH static void I2CSlaveFinishTx(void)
+{
+    if (tx_active) {
+        tx_active = false;
+        I2C1->CR2 &= ~I2C_CR2_ITBUFEN;
+        // The byte still waiting in DR (TXE clear) never reached the master
+        uint32_t sent = tx_index;
+        if (!(I2C1->SR1 & I2C_SR1_TXE) && sent > 0) {
+            sent--;
+        }
+        RightKeyboardTxEnd(sent > tx_len ? tx_len : sent);
+    }
+}
+
+HOT_PATH static void I2CSlaveFinishRx(void)
+{
+    if (rx_active) {
+        rx_active = false;
+        I2C1->CR2 &= ~I2C_CR2_ITBUFEN;
+#if I2C_SLAVE_PRELOAD
+        // The staged frame belongs to the old register pointer
+        I2CSlaveUnstage();
+#endif
+        if (rx_general_call) {
+            RightKeyboardGeneralCall(rx_buffer, rx_len);
+        } else if (!rx_dropped) {
+            RightKeyboardRxEnd(rx_buffer, rx_len);
+        }
+    }
+}
+
+/**
+ * I2C1 event interrupt: address match, data and stop
+ */
+HOT_PATH void I2CSlaveEventIRQHandler(void)
+{
+#if I2C_SLAVE_STRETCH_STATS
+    uint32_t entry = DWT->CYCCNT;
+#endif
+    uint32_t sr1 = I2C1->SR1;
+
+    if (sr1 & I2C_SR1_ADDR) {
+#if I2C_SLAVE_STRETCH_STATS
+        stretch_start = entry;
+#endif
+        // Reading SR2 after SR1 clears ADDR and releases SCL
+        uint32_t sr2 = I2C1->SR2;
+
+        // A repeated start ends the previous phase without a STOP
+        I2CSlaveFinishRx();
+        I2CSlaveFinishTx();
+
+        if (sr2 & I2C_SR2_TRA) {
+#if I2C_SLAVE_PRELOAD
+            // The first byte normally went out of DR as ADDR cleared
+            if (!tx_staged) {
+                I2CSlaveStage();
+            }
+            tx_staged = false;
+#if I2C_SLAVE_STRETCH_STATS
+            I2CSlaveStretchEnd();
+#endif
+#elif I2C_DIAG_ADDRESS
+            // DUALF: the diagnostics address matched, it reads the pointer
+            tx_len = (sr2 & I2C_SR2_DUALF) ? RightKeyboardTxBegin(&tx_frame)
+                                           : RightKeyboardReportBegin(&tx_frame);
+            tx_index = 0;
+#else
+            tx_len = RightKeyboardTxBegin(&tx_frame);
+            tx_index = 0;
+#endif
+            tx_active = true;
+        } else {
+            rx_len = 0;
+            rx_general_call = (sr2 & I2C_SR2_GENCALL) != 0;
+            rx_dropped = I2C_DIAG_ADDRESS && !(sr2 & (I2C_SR2_GENCALL | I2C_SR2_DUALF));
+            rx_active = true;
+            TRACE(TRACE_I2C_ADDR, TRACE_I2C_WRITE);
+        }
+        I2C1->CR2 |= I2C_CR2_ITBUFEN;
+        return;
+    }
+
+#if I2C_SLAVE_PRELOAD
+    // Pended by I2CSlaveRefresh(), only swap the frame while the bus is idle
+    if (restage_pending && !tx_active && !rx_active) {
+        restage_pending = false;
+        I2CSlaveUnstage();
+        I2CSlaveStage();
+    }
+#endif
+
+    if (tx_active && (sr1 & (I2C_SR1_TXE | I2C_SR1_BTF))) {
+        if (tx_index < tx_len) {
+#if I2C_SLAVE_STRETCH_STATS && !I2C_SLAVE_PRELOAD
+            if (tx_index == 0) {
+                I2CSlaveStretchEnd();
+            }
+#endif
+            I2C1->DR = tx_frame[tx_index++];
+        } else if (sr1 & I2C_SR1_BTF) {
+            // Master keeps reading past the frame, SCL is held until DR is written
+            I2C1->DR = I2C_SLAVE_PAD_BYTE;
+            tx_index++;
+        } else {
+            // Frame fully loaded, only BTF (over-read) needs service from here
+            I2C1->CR2 &= ~I2C_CR2_ITBUFEN;
+        }
+    }
+
+    if (sr1 & I2C_SR1_RXNE) {
+        uint8_t data = (uint8_t)I2C1->DR;
+        if (rx_active && rx_len < I2C_SLAVE_RX_LEN) {
+            rx_buffer[rx_len++] = data;
+        }
+    }
+
+    if (sr1 & I2C_SR1_STOPF) {
+        // STOPF is cleared by reading SR1 (done above) then writing CR1
+        I2C1->CR1 |= I2C_CR1_ACK;
+        I2CSlaveFinishRx();
+        I2CSlaveFinishTx();
+#if I2C_SLAVE_PRELOAD
+        // Bus idle again, get the next read ready
+        if (!tx_staged) {
+            I2CSlaveStage();
+        }
+#endif
+    }
+}
+
+/**
+ * I2C1 error interrupt: NACK at the end of a read and bus errors
+ */
+HOT_PATH void I2CSlaveErrorIRQHandler(void)
+{
+    uint32_t sr1 = I2C1->SR1;
+
+    if (sr1 & I2C_SR1_AF) {
+        // Master NACKed: normal end of a slave transmission
+        I2C1->SR1 = (uint32_t)~I2C_SR1_AF;
+        bool stale = tx_active && !(I2C1->SR1 & I2C_SR1_TXE);
+
+        I2CSlaveFinishTx();
+
+        if (stale) {
+            RightKeyboardLinkError(HAL_I2C_ERROR_AF);
+            // Drop the byte left in DR, PE=0 also clears ACK
+            I2C1->CR1 &= ~I2C_CR1_PE;
+            I2C1->CR1 |= I2C_CR1_PE;
+            I2C1->CR1 |= I2C_CR1_ACK;
+        }
+    }
+
+    if (sr1 & (I2C_SR1_BERR | I2C_SR1_ARLO | I2C_SR1_OVR)) {
+        I2C1->SR1 = (uint32_t)~(sr1 & (I2C_SR1_BERR | I2C_SR1_ARLO | I2C_SR1_OVR));
+        // SR1 bits 8-11 line up with HAL_I2C_ERROR_BERR/ARLO/AF/OVR
+        RightKeyboardLinkError((sr1 >> I2C_SR1_BERR_Pos) &
+                               (HAL_I2C_ERROR_BERR | HAL_I2C_ERROR_ARLO | HAL_I2C_ERROR_OVR));
+        I2CSlaveFinishRx();
+        I2CSlaveFinishTx();
+        I2C1->CR1 |= I2C_CR1_ACK;
+    }
+}
@@ -0,0 +1,135 @@
+/**
+ * @file irq_plan.c
+ * @brief Interrupt priority plan and per-source handler timing.
+ */
+
+#include "irq_plan.h"
+#include "hot_path.h"
+
+#if IRQ_PLAN_STATS
+static const uint8_t source_priority[IRQ_SOURCE_COUNT] = {
+    [IRQ_SOURCE_I2C_EV]   = IRQ_PRIO_I2C,
+    [IRQ_SOURCE_I2C_ER]   = IRQ_PRIO_I2C,
+    [IRQ_SOURCE_I2C_DMA]  = IRQ_PRIO_I2C,
+    [IRQ_SOURCE_UART]     = IRQ_PRIO_I2C,
+    [IRQ_SOURCE_UART_DMA] = IRQ_PRIO_I2C,
+    [IRQ_SOURCE_SPI_NSS]  = IRQ_PRIO_I2C,
+    [IRQ_SOURCE_USB]      = IRQ_PRIO_I2C,
+    [IRQ_SOURCE_SYSTICK]  = IRQ_PRIO_SYSTICK,
+    [IRQ_SOURCE_SAMPLER]  = IRQ_PRIO_SAMPLER,
+    [IRQ_SOURCE_EXTI]     = IRQ_PRIO_WAKE,
+    [IRQ_SOURCE_RTC]      = IRQ_PRIO_WAKE,
+    [IRQ_SOURCE_TIMEBASE] = IRQ_PRIO_WAKE,
+    [IRQ_SOURCE_SCHED_KICK] = IRQ_PRIO_WAKE,
+};
+
+// Longest handler run per source in core cycles, readable from a debugger
+static volatile uint32_t max_cycles[IRQ_SOURCE_COUNT];
+
+// Longest delay from SysTick reload to its handler running
+static volatile uint32_t tick_latency_max;
+#endif
+
+/**
+ * Apply the priority grouping and move SysTick to its planned level
+ *
+ * HAL_Init() has already set up SysTick at TICK_INT_PRIORITY. Any later
+ * HAL_InitTick() (clock changes) keeps uwTickPrio, so this sticks.
+ */
+void IrqPlanInit(void)
+{
+    HAL_NVIC_SetPriorityGrouping(NVIC_PRIORITYGROUP_4);
+    HAL_InitTick(IRQ_PRIO_SYSTICK);
+
+#if IRQ_PLAN_STATS
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+}
+
+/**
+ * Fold one handler run into the statistics
+ *
+ * @param source Interrupt source
+ * @param cycles Run time in core cycles
+ */
+HOT_PATH void IrqPlanRecord(IrqSource source, uint32_t cycles)
+{
+#if IRQ_PLAN_STATS
+    if (cycles > max_cycles[source]) {
+        max_cycles[source] = cycles;
+    }
+#else
+    (void)source;
+    (void)cycles;
+#endif
+}
+
+/**
+ * Record how long SysTick waited since its reload, call first in its handler
+ */
+HOT_PATH void IrqPlanRecordTickLatency(void)
+{
+#if IRQ_PLAN_STATS
+    // The counter reloads to LOAD and counts down, so LOAD - VAL cycles
+    // passed since the tick fired
+    uint32_t latency = SysTick->LOAD - SysTick->VAL;
+    if (latency > tick_latency_max) {
+        tick_latency_max = latency;
+    }
+#endif
+}
+
+/**
+ * Get the longest recorded run of a handler
+ *
+ * @param source Interrupt source
+ * @return Core cycles, 0 without IRQ_PLAN_STATS
+ */
+uint32_t IrqPlanMaxCycles(IrqSource source)
+{
+#if IRQ_PLAN_STATS
+    return max_cycles[source];
+#else
+    (void)source;
+    return 0;
+#endif
+}
+
+/**
+ * Bound the entry latency of a source from the recorded run times
+ *
+ * One handler at the same level may be running (no preemption between
+ * equals) and every more urgent source may fire once on top. SysTick uses
+ * its directly measured latency if that is larger.
+ *
+ * @param source Interrupt source
+ * @return Core cycles, 0 without IRQ_PLAN_STATS
+ */
+uint32_t IrqPlanWorstLatency(IrqSource source)
+{
+#if IRQ_PLAN_STATS
+    uint32_t same_level = 0;
+    uint32_t above = 0;
+
+    for (uint32_t s = 0; s < IRQ_SOURCE_COUNT; ++s) {
+        if (s == (uint32_t)source) {
+            continue;
+        }
+        if (source_priority[s] < source_priority[source]) {
+            above += max_cycles[s];
+        } else if (source_priority[s] == source_priority[source] && max_cycles[s] > same_level) {
+            same_level = max_cycles[s];
+        }
+    }
+
+    uint32_t bound = same_level + above;
+    if (source == IRQ_SOURCE_SYSTICK && tick_latency_max > bound) {
+        bound = tick_latency_max;
+    }
+    return bound;
+#else
+    (void)source;
+    return 0;
+#endif
+}
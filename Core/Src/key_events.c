@@ -0,0 +1,332 @@
+/**
+ * @file key_events.c
+ * @brief Lock-free single-producer/single-consumer queue of key events.
+ */
+
+#include "key_events.h"
+#include "hot_path.h"
+#include "mem_budget.h"
+#include "stm32f4xx.h"
+
+#define KEY_EVENT_INDEX_MASK (KEY_EVENT_RING_LEN - 1u)
+
+static KeyEvent          events[KEY_EVENT_RING_LEN] MEM_BSS(events);
+static volatile uint32_t head;          /* written by the producer only, sequence of the next event */
+static volatile uint32_t tail;          /* written by the consumer only */
+static volatile uint32_t dropped;       /* events lost because the queue was full */
+
+// Resync after an overflow: the producer bumps resync_seq with every new
+// resync_keys, the consumer acknowledges the one it delivered
+static volatile uint32_t resync_seq;
+static volatile uint32_t resync_ack;    /* written by the consumer only */
+static volatile uint32_t resync_keys;   /* pressed keys, bit n = key n held */
+static volatile bool     resync_dirty;  /* producer: dropped since the last KeyEventSync() */
+static uint32_t          resync_peeked; /* consumer: resync_seq of the record handed out */
+static uint32_t          lost_peeked;   /* consumer: dropped as of that record */
+static uint32_t          lost_acked;    /* consumer: dropped as of the last delivered record */
+static bool              resync_out;    /* consumer: the last peek handed out the record */
+
+/**
+ * Queue one record (producer side)
+ *
+ * @return false if the queue was full and the event was dropped
+ */
+HOT_PATH static inline bool KeyEventAppend(uint8_t key, uint8_t value, uint32_t timestamp)
+{
+    uint32_t h = head;
+
+    // Nothing queues behind a resync that has not been delivered yet
+    if (resync_dirty || resync_seq != resync_ack || h - tail >= KEY_EVENT_QUEUE_LEN) {
+        dropped++;
+        resync_dirty = true;
+        return false;
+    }
+
+    KeyEvent *event = &events[h & KEY_EVENT_INDEX_MASK];
+    event->key = key;
+    event->pressed = value;
+    event->timestamp = timestamp;
+
+    // The record must be complete before the consumer can see it
+    __DMB();
+    head = h + 1;
+    return true;
+}
+
+/**
+ * Queue a key transition (producer side)
+ *
+ * @param key Key index
+ * @param pressed true for a press, false for a release
+ * @param timestamp Time of the accepted edge
+ * @return false if the queue was full and the event was dropped
+ */
+HOT_PATH bool KeyEventPush(uint8_t key, bool pressed, uint32_t timestamp)
+{
+    return KeyEventAppend(key, pressed ? 1u : 0u, timestamp);
+}
+
+/**
+ * Queue an encoder turn (producer side)
+ *
+ * @param detents Signed detents since the previous turn event
+ * @param timestamp Time of the scan that saw them
+ * @return false if the queue was full and the event was dropped
+ */
+HOT_PATH bool KeyEventPushTurn(int8_t detents, uint32_t timestamp)
+{
+    return KeyEventAppend(KEY_EVENT_ENCODER, (uint8_t)detents, timestamp);
+}
+
+/**
+ * Record the key state a resync would carry (producer side)
+ *
+ * Called after every scan's pushes. Only does anything once an event was
+ * dropped; the state then stands in for everything lost.
+ *
+ * @param pressed Debounced keys, bit n = key n held
+ */
+HOT_PATH void KeyEventSync(uint32_t pressed)
+{
+    if (resync_dirty) {
+        resync_keys = pressed;
+        // The state must be complete before the consumer can see it
+        __DMB();
+        resync_seq++;
+        resync_dirty = false;
+    }
+}
+
+/**
+ * Hand out the resync record if one is due (consumer side)
+ *
+ * The producer queues nothing while a resync is due, so the head stays
+ * put and the queued backlog, which the record supersedes, is dropped
+ * into the history.
+ *
+ * @param record Filled with the record
+ * @return true if a resync is due
+ */
+HOT_PATH static bool KeyEventTakeResync(KeyEvent *record)
+{
+    uint32_t seq = resync_seq;
+
+    resync_out = false;
+    if (seq == resync_ack) {
+        return false;
+    }
+    __DMB();
+    uint32_t lost = dropped;
+    record->key = KEY_EVENT_RESYNC;
+    record->pressed = (uint8_t)(lost - lost_acked > 0xFFu ? 0xFFu : lost - lost_acked);
+    record->timestamp = resync_keys;
+
+    tail = head;
+    resync_peeked = seq;
+    lost_peeked = lost;
+    resync_out = true;
+    return true;
+}
+
+/**
+ * Count a handed-out resync record as delivered (consumer side)
+ *
+ * @return true if the delivered position was the record
+ */
+HOT_PATH static bool KeyEventDeliverResync(void)
+{
+    if (!resync_out) {
+        return false;
+    }
+    resync_out = false;
+    lost_acked = lost_peeked;
+    __DMB();
+    resync_ack = resync_peeked;
+    return true;
+}
+
+/**
+ * Copy the oldest event without removing it (consumer side)
+ *
+ * @param event Filled with the oldest event, or KEY_EVENT_NONE if empty
+ * @return true if an event was available
+ */
+HOT_PATH bool KeyEventPeek(KeyEvent *event)
+{
+    if (KeyEventTakeResync(event)) {
+        return true;
+    }
+
+    uint32_t t = tail;
+    if (t == head) {
+        event->key = KEY_EVENT_NONE;
+        event->pressed = 0;
+        event->timestamp = 0;
+        return false;
+    }
+
+    __DMB();
+    *event = events[t & KEY_EVENT_INDEX_MASK];
+    return true;
+}
+
+/**
+ * Copy up to max of the oldest events without removing them (consumer side)
+ *
+ * @param batch Filled with the oldest events, oldest first
+ * @param max Capacity of batch
+ * @return Number of events copied
+ */
+HOT_PATH uint32_t KeyEventPeekBatch(KeyEvent *batch, uint32_t max)
+{
+    // A resync record goes alone, it ends the frame
+    if (max > 0 && KeyEventTakeResync(&batch[0])) {
+        return 1;
+    }
+
+    uint32_t t = tail;
+    uint32_t count = head - t;
+
+    if (count > max) {
+        count = max;
+    }
+
+    __DMB();
+    for (uint32_t n = 0; n < count; ++n) {
+        batch[n] = events[(t + n) & KEY_EVENT_INDEX_MASK];
+    }
+    return count;
+}
+
+/**
+ * Remove the count oldest events once they have been delivered (consumer side)
+ *
+ * @param count Number of events to remove, clamped to the queue fill
+ */
+HOT_PATH void KeyEventDropBatch(uint32_t count)
+{
+    if (count > 0 && KeyEventDeliverResync()) {
+        count--;
+    }
+
+    uint32_t t = tail;
+
+    if (count > head - t) {
+        count = head - t;
+    }
+    if (count) {
+        __DMB();
+        tail = t + count;
+    }
+}
+
+/**
+ * Copy the events from a sequence number on, delivered or not (consumer side)
+ *
+ * A number older than the history starts at the oldest event still kept,
+ * so first != since tells the master that events were lost in between.
+ * A resync record due goes alone, numbered first = next; KeyEventDropBatch()
+ * delivers it and the stream goes on at next.
+ *
+ * @param since Sequence number of the first event wanted
+ * @param batch Filled with the events, oldest first
+ * @param max Capacity of batch
+ * @param first Set to the sequence number of batch[0]
+ * @param next Set to the sequence number the next recorded event gets
+ * @return Number of events copied
+ */
+HOT_PATH uint32_t KeyEventReplay(uint16_t since, KeyEvent *batch, uint32_t max, uint16_t *first, uint16_t *next)
+{
+    if (max > 0 && KeyEventTakeResync(&batch[0])) {
+        *first = (uint16_t)head;
+        *next = (uint16_t)head;
+        return 1;
+    }
+
+    uint32_t h = head;
+    uint32_t t = tail;
+    uint32_t kept = h - t;
+#if KEY_EVENT_HISTORY_LEN
+    // Until the first KEY_EVENT_HISTORY_LEN deliveries only the tail's worth exists
+    kept += t < KEY_EVENT_HISTORY_LEN ? t : KEY_EVENT_HISTORY_LEN;
+#endif
+    uint32_t back = (uint16_t)((uint16_t)h - since);
+
+    if (back > kept) {
+        back = kept;
+    }
+    uint32_t from = h - back;
+    uint32_t count = back < max ? back : max;
+
+    __DMB();
+    for (uint32_t n = 0; n < count; ++n) {
+        batch[n] = events[(from + n) & KEY_EVENT_INDEX_MASK];
+    }
+    *first = (uint16_t)from;
+    *next = (uint16_t)h;
+    return count;
+}
+
+/**
+ * Remove every queued event before a sequence number once a replay
+ * delivered them (consumer side)
+ *
+ * @param next Sequence number of the first event the master has not seen
+ * @return false if next is behind the tail or ahead of the head, nothing removed
+ */
+HOT_PATH bool KeyEventAcknowledge(uint16_t next)
+{
+    uint32_t t = tail;
+    uint32_t ahead = (uint16_t)(next - (uint16_t)t);
+
+    if (ahead > head - t) {
+        return false;
+    }
+    if (ahead) {
+        __DMB();
+        tail = t + ahead;
+    }
+    return true;
+}
+
+/**
+ * Remove the oldest event once it has been delivered (consumer side)
+ */
+HOT_PATH void KeyEventDrop(void)
+{
+    if (KeyEventDeliverResync()) {
+        return;
+    }
+
+    uint32_t t = tail;
+
+    if (t != head) {
+        __DMB();
+        tail = t + 1;
+    }
+}
+
+/**
+ * Number of queued events, a resync record due counts as one
+ */
+HOT_PATH uint32_t KeyEventCount(void)
+{
+    return head - tail + (resync_seq != resync_ack ? 1u : 0u);
+}
+
+/**
+ * Check whether the master should read faster: the queue is past
+ * KEY_EVENT_HIGH_WATER, or overflowed and a resync is due
+ */
+HOT_PATH bool KeyEventBacklog(void)
+{
+    return resync_dirty || resync_seq != resync_ack || head - tail >= KEY_EVENT_HIGH_WATER;
+}
+
+/**
+ * Number of events lost to a full queue since boot
+ */
+uint32_t KeyEventDropped(void)
+{
+    return dropped;
+}
@@ -0,0 +1,126 @@
+/**
+ * @file key_report.c
+ * @brief Report building from the debounced key word.
+ */
+
+#include "key_report.h"
+#include "hot_path.h"
+
+/**
+ * Keep at most max_keys pressed keys, lowest key index first
+ *
+ * @param pressed Pressed key word (1 = pressed)
+ * @param max_keys Maximum number of keys to keep (0 means no limit)
+ * @return Pressed key word with the excess keys cleared
+ */
+HOT_PATH uint32_t KeyReportRollover(uint32_t pressed, uint8_t max_keys)
+{
+    if (max_keys == 0) {
+        return pressed;
+    }
+
+    uint32_t kept = 0;
+    for (uint8_t n = 0; n < max_keys && pressed; ++n) {
+        uint32_t lowest = pressed & (0u - pressed);
+        kept |= lowest;
+        pressed ^= lowest;
+    }
+    return kept;
+}
+
+/**
+ * Turn a pressed key word into an active-low bitmap word
+ *
+ * @param pressed Pressed key word (1 = pressed)
+ * @param bytes Number of report bytes, 1 to 4; the bits above them are zero
+ * @return Bitmap word, key n in bit n (0 = pressed), little-endian bytes are
+ *         the report bytes in wire order
+ */
+HOT_PATH uint32_t KeyReportWord(uint32_t pressed, uint32_t bytes)
+{
+    return ~pressed & (0xFFFFFFFFu >> (32 - 8 * bytes));
+}
+
+/**
+ * Start with no key held
+ *
+ * @param order Press order state
+ */
+void KeyPressOrderInit(KeyPressOrder *order)
+{
+    order->pressed = 0;
+    order->count = 0;
+}
+
+/**
+ * Follow a new pressed key word
+ *
+ * Released keys leave the queue, new presses join at its end; presses that
+ * arrive in the same scan join lowest key index first.
+ *
+ * @param order Press order state
+ * @param pressed Pressed key word (1 = pressed)
+ */
+HOT_PATH void KeyPressOrderUpdate(KeyPressOrder *order, uint32_t pressed)
+{
+    uint32_t released = order->pressed & ~pressed;
+
+    if (released) {
+        uint32_t kept = 0;
+        for (uint32_t n = 0; n < order->count; ++n) {
+            uint8_t key = order->order[n];
+            if (!(released & (1u << key))) {
+                order->order[kept++] = key;
+            }
+        }
+        order->count = (uint8_t)kept;
+    }
+    for (uint32_t added = pressed & ~order->pressed; added; added &= added - 1u) {
+        order->order[order->count++] = (uint8_t)__builtin_ctz(added);
+    }
+    order->pressed = pressed;
+}
+
+/**
+ * Pick the keys a report shows under a rollover policy
+ *
+ * Keys of the queue that are no longer in pressed are skipped, so a word
+ * that is newer or older than the queue by one scan still gives a subset of
+ * its pressed keys.
+ *
+ * @param order Press order state
+ * @param policy Rollover policy
+ * @param pressed Pressed key word (1 = pressed)
+ * @param max_keys Maximum number of keys to keep (0 means no limit)
+ * @return Pressed key word with the excess keys cleared
+ */
+HOT_PATH uint32_t KeyPressOrderSelect(const KeyPressOrder *order, KeyRolloverPolicy policy,
+                                      uint32_t pressed, uint8_t max_keys)
+{
+    if (max_keys == 0 || policy == KEY_ROLLOVER_ALL || (uint32_t)__builtin_popcount(pressed) <= max_keys) {
+        return pressed;
+    }
+
+    uint32_t kept = 0;
+    uint32_t left = max_keys;
+    if (policy == KEY_ROLLOVER_FIRST) {
+        for (uint32_t n = 0; n < order->count && left; ++n) {
+            uint32_t bit = 1u << order->order[n];
+            if (pressed & bit) {
+                kept |= bit;
+                left--;
+            }
+        }
+    } else if (policy == KEY_ROLLOVER_LAST) {
+        for (uint32_t n = order->count; n > 0 && left; --n) {
+            uint32_t bit = 1u << order->order[n - 1u];
+            if (pressed & bit) {
+                kept |= bit;
+                left--;
+            }
+        }
+    } else {
+        return KeyReportRollover(pressed, max_keys);
+    }
+    return kept;
+}
@@ -0,0 +1,87 @@
+/**
+ * @file keyboard_matrix.c
+ * @brief Row/column matrix wiring for KEY_WIRING_MATRIX.
+ */
+
+#include "right_side_keyboard.h"
+
+#if KEY_WIRING == KEY_WIRING_MATRIX
+
+#include "keyboard_matrix.h"
+#include "timebase.h"
+#include "hot_path.h"
+
+#define MATRIX_COL_PIN_ENTRY(col, pin) [col] = (pin),
+
+static const uint8_t matrix_col_pins[MATRIX_COLS] = {
+    MATRIX_COL_MAP(MATRIX_COL_PIN_ENTRY)
+};
+
+uint32_t matrix_strobe[MATRIX_COLS];
+
+/**
+ * Widen a pin mask to the two-bit fields of MODER/PUPDR
+ */
+static uint32_t MatrixField2(uint32_t mask)
+{
+    uint32_t fields = 0;
+
+    for (uint32_t pin = 0; pin < 16; ++pin) {
+        if (mask & (1u << pin)) {
+            fields |= 3u << (2 * pin);
+        }
+    }
+    return fields;
+}
+
+/**
+ * Set up the rows as inputs with pull-up and release every column
+ */
+void MatrixInit(void)
+{
+    uint32_t rows = MatrixField2(MATRIX_ROW_MASK);
+    uint32_t cols = MatrixField2(MATRIX_COL_MASK);
+
+    MATRIX_ROW_PORT->MODER &= ~rows;
+    MATRIX_ROW_PORT->PUPDR = (MATRIX_ROW_PORT->PUPDR & ~rows) | (rows & 0x55555555u);
+
+    // Columns: released open-drain outputs (01 = output, no pull)
+    MATRIX_COL_PORT->BSRR = MATRIX_COL_MASK;
+    MATRIX_COL_PORT->OTYPER |= MATRIX_COL_MASK;
+    MATRIX_COL_PORT->PUPDR &= ~cols;
+    MATRIX_COL_PORT->MODER = (MATRIX_COL_PORT->MODER & ~cols) | (cols & 0x55555555u);
+
+    // Each strobe pulls its own column low and releases all others
+    // (upper BSRR half resets, lower half sets)
+    for (uint32_t c = 0; c < MATRIX_COLS; ++c) {
+        uint32_t pin = 1u << matrix_col_pins[c];
+        matrix_strobe[c] = (pin << 16) | (MATRIX_COL_MASK & ~pin);
+    }
+}
+
+/**
+ * Strobe every column once from the CPU and gather the key word
+ *
+ * Takes about MATRIX_COLS * MATRIX_SETTLE_US. Not for SCAN_MODE_DMA, where
+ * TIM1 owns the columns.
+ *
+ * @return Key word (1 = released)
+ */
+HOT_PATH uint32_t MatrixScan(void)
+{
+    uint16_t rows[MATRIX_COLS];
+
+    for (uint32_t c = 0; c < MATRIX_COLS; ++c) {
+        MATRIX_COL_PORT->BSRR = matrix_strobe[c];
+        // One count more, the current microsecond may be almost over
+        uint32_t settled = TimebaseNowUs() + MATRIX_SETTLE_US + 1u;
+        while (!TimebaseReached(TimebaseNowUs(), settled)) {
+        }
+        rows[c] = (uint16_t)MATRIX_ROW_PORT->IDR;
+    }
+    MATRIX_COL_PORT->BSRR = MATRIX_COL_MASK;
+
+    return MatrixGather(rows);
+}
+
+#endif /* KEY_WIRING == KEY_WIRING_MATRIX */
@@ -0,0 +1,175 @@
+/**
+ * @file keymap.c
+ * @brief On-device keymap: key indices to HID usage codes through layers.
+ */
+
+#include "keymap.h"
+#include "hot_path.h"
+#include <string.h>
+
+#if KEYMAP_ENABLE
+_Static_assert(NUM_KEYS == 24, "The keymap below describes 24 keys, adapt it to this board");
+
+// Shorthand for the table below
+#define ____ KEYMAP_TRANSPARENT
+
+// Four rows of six keys, key index = row * 6 + column
+static const uint8_t keymap[KEYMAP_LAYERS][NUM_KEYS] = {
+    // Base: 6 7 8 9 0 - / Y U I O P [ / H J K L ; ' / N M , . / RShift
+    [0] = {
+        0x23, 0x24, 0x25, 0x26, 0x27, 0x2D,
+        0x1C, 0x18, 0x0C, 0x12, 0x13, 0x2F,
+        0x0B, 0x0D, 0x0E, 0x0F, 0x33, 0x34,
+        0x11, 0x10, 0x36, 0x37, 0x38, 0xE5,
+    },
+#if KEYMAP_LAYERS > 1
+    // Function: F6-F11 on the number row, arrows on H J K L
+    [1] = {
+        0x3F, 0x40, 0x41, 0x42, 0x43, 0x44,
+        ____, ____, ____, ____, ____, ____,
+        0x50, 0x51, 0x52, 0x4F, ____, ____,
+        ____, ____, ____, ____, ____, ____,
+    },
+#endif
+#if KEYMAP_LAYERS > 2
+    // Unused layers are all transparent
+    [2 ... KEYMAP_LAYERS - 1] = {
+        ____, ____, ____, ____, ____, ____,
+        ____, ____, ____, ____, ____, ____,
+        ____, ____, ____, ____, ____, ____,
+        ____, ____, ____, ____, ____, ____,
+    },
+#endif
+};
+
+#undef ____
+
+// Active layers, bit n = layer n, written from the I2C interrupt
+static volatile uint8_t active_layers = 0x01;
+
+// Code each key resolved to when it was last pressed
+static uint8_t key_codes[NUM_KEYS];
+#endif
+
+/**
+ * Look a key up through the active layers
+ *
+ * @param key Key index
+ * @param layers Active layers, bit n = layer n
+ * @return Code of the highest active layer that is not transparent
+ */
+HOT_PATH uint8_t KeymapLookup(uint32_t key, uint8_t layers)
+{
+#if KEYMAP_ENABLE
+    layers |= 0x01u;
+    for (int32_t layer = KEYMAP_LAYERS - 1; layer >= 0; --layer) {
+        uint8_t code = keymap[layer][key];
+        if ((layers & (1u << layer)) && code != KEYMAP_TRANSPARENT) {
+            return code;
+        }
+    }
+#else
+    (void)key;
+    (void)layers;
+#endif
+    return KEYMAP_NONE;
+}
+
+/**
+ * Resolve the keys that were just pressed
+ *
+ * Called by the scan before it publishes the report that first shows them.
+ *
+ * @param pressed_keys Keys pressed since the previous report
+ * @param layers Active layers, KeymapLayers()
+ */
+HOT_PATH void KeymapPress(uint32_t pressed_keys, uint8_t layers)
+{
+#if KEYMAP_ENABLE
+    for (; pressed_keys; pressed_keys &= pressed_keys - 1u) {
+        uint32_t key = (uint32_t)__builtin_ctz(pressed_keys);
+        key_codes[key] = KeymapLookup(key, layers);
+    }
+#else
+    (void)pressed_keys;
+    (void)layers;
+#endif
+}
+
+/**
+ * Get the code a key resolved to on its last press
+ *
+ * @param key Key index
+ * @return Usage code, KEYMAP_NONE without KEYMAP_ENABLE
+ */
+HOT_PATH uint8_t KeymapCode(uint32_t key)
+{
+#if KEYMAP_ENABLE
+    return key_codes[key];
+#else
+    (void)key;
+    return KEYMAP_NONE;
+#endif
+}
+
+/**
+ * Set the active layers, from a master write
+ *
+ * @param layers Bit n = layer n, the base layer stays active
+ */
+void KeymapSetLayers(uint8_t layers)
+{
+#if KEYMAP_ENABLE
+    active_layers = layers | 0x01u;
+#else
+    (void)layers;
+#endif
+}
+
+/**
+ * Get the active layers
+ *
+ * @return Bit n = layer n, 0 without KEYMAP_ENABLE
+ */
+uint8_t KeymapLayers(void)
+{
+#if KEYMAP_ENABLE
+    return active_layers;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Build the boot-style report of the held keys
+ *
+ * Runs in the I2C interrupt from the published report word, the codes of
+ * the keys in it were stored before it was published.
+ *
+ * @param pressed Pressed key word of the published report (1 = pressed)
+ * @param report Filled with modifiers and codes, all zero without KEYMAP_ENABLE
+ */
+HOT_PATH void KeymapReportBuild(uint32_t pressed, KeymapReport *report)
+{
+    memset(report, 0, sizeof(*report));
+#if KEYMAP_ENABLE
+    uint32_t slots = 0;
+
+    for (; pressed; pressed &= pressed - 1u) {
+        uint8_t code = key_codes[__builtin_ctz(pressed)];
+        if (code >= KEYMAP_MODIFIER_FIRST && code <= KEYMAP_MODIFIER_LAST) {
+            report->modifiers |= (uint8_t)(1u << (code - KEYMAP_MODIFIER_FIRST));
+        } else if (code == KEYMAP_NONE) {
+            continue;
+        } else if (slots < KEYMAP_REPORT_CODES) {
+            report->codes[slots++] = code;
+        } else {
+            // Phantom state as the boot protocol defines it
+            memset(report->codes, KEYMAP_ERROR_ROLLOVER, sizeof(report->codes));
+            break;
+        }
+    }
+#else
+    (void)pressed;
+#endif
+}
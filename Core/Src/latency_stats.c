@@ -0,0 +1,209 @@
+/**
+ * @file latency_stats.c
+ * @brief Key edge to I2C transmit latency statistics.
+ *
+ * The scanner moves a change from IDLE to PUBLISHED, only the transmit
+ * side (I2C interrupt) moves it back to IDLE. Each side only acts on the
+ * states it owns, so the two need no lock; a change the scanner sees just
+ * as a transmit retires the old one is simply not timed.
+ */
+
+#include "latency_stats.h"
+#include "hot_path.h"
+#include "mem_budget.h"
+#include <string.h>
+
+#if LATENCY_STATS
+
+#define LATENCY_BUCKETS 32
+
+typedef enum {
+    TRACK_IDLE,
+    TRACK_EDGE,
+    TRACK_ACCEPTED,
+    TRACK_PUBLISHED
+} TrackState;
+
+static volatile TrackState track = TRACK_IDLE;
+static uint32_t edge_us;
+static uint32_t accept_us;
+static uint32_t publish_us;
+
+static uint16_t histogram[LATENCY_STAGES][LATENCY_BUCKETS] MEM_BSS(stats);
+static uint32_t stage_max[LATENCY_STAGES] MEM_BSS(stats);
+static uint32_t samples;
+
+/**
+ * Bucket of a latency: 0 and 1 us exact, then two buckets per octave
+ */
+static uint32_t LatencyBucket(uint32_t us)
+{
+    if (us < 2u) {
+        return us;
+    }
+    uint32_t octave = 31u - (uint32_t)__builtin_clz(us);
+    uint32_t bucket = 2u * octave + ((us >> (octave - 1u)) & 1u);
+    return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1u;
+}
+
+/**
+ * Largest latency that falls into a bucket
+ */
+static uint32_t LatencyBucketTop(uint32_t bucket)
+{
+    if (bucket < 2u) {
+        return bucket;
+    }
+    uint32_t octave = bucket / 2u;
+    uint32_t low = (2u + (bucket & 1u)) << (octave - 1u);
+    return low + (1u << (octave - 1u)) - 1u;
+}
+
+static void LatencyAdd(LatencyStage stage, uint32_t us)
+{
+    uint16_t *bin = &histogram[stage][LatencyBucket(us)];
+    if (*bin != UINT16_MAX) {
+        (*bin)++;
+    }
+    if (us > stage_max[stage]) {
+        stage_max[stage] = us;
+    }
+}
+
+/**
+ * Read a percentile off a stage histogram
+ *
+ * @param stage Stage to read
+ * @param permille Fraction of the samples at or below the result, 0-1000
+ * @return Bucket upper bound in microseconds, capped at the exact maximum
+ */
+static uint32_t LatencyPercentile(LatencyStage stage, uint32_t permille)
+{
+    uint32_t total = 0;
+    for (uint32_t b = 0; b < LATENCY_BUCKETS; ++b) {
+        total += histogram[stage][b];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    uint32_t wanted = (total * permille + 999u) / 1000u;
+    uint32_t seen = 0;
+    for (uint32_t b = 0; b < LATENCY_BUCKETS; ++b) {
+        seen += histogram[stage][b];
+        if (seen >= wanted) {
+            // The last bucket is open-ended
+            if (b == LATENCY_BUCKETS - 1u) {
+                return stage_max[stage];
+            }
+            uint32_t top = LatencyBucketTop(b);
+            return top < stage_max[stage] ? top : stage_max[stage];
+        }
+    }
+    return stage_max[stage];
+}
+#endif /* LATENCY_STATS */
+
+/**
+ * A raw key level changed, start timing unless a change is in flight
+ *
+ * @param now Sample time in microseconds
+ */
+HOT_PATH void LatencyEdge(uint32_t now)
+{
+#if LATENCY_STATS
+    if (track == TRACK_IDLE) {
+        edge_us = now;
+        track = TRACK_EDGE;
+    }
+#else
+    (void)now;
+#endif
+}
+
+/**
+ * The debounce accepted a change
+ *
+ * @param now Time of the decision in microseconds
+ */
+HOT_PATH void LatencyAccept(uint32_t now)
+{
+#if LATENCY_STATS
+    if (track == TRACK_EDGE) {
+        accept_us = now;
+        track = TRACK_ACCEPTED;
+    }
+#else
+    (void)now;
+#endif
+}
+
+/**
+ * The accepted change is published for the transmitter
+ *
+ * @param now Time in microseconds
+ */
+HOT_PATH void LatencyPublish(uint32_t now)
+{
+#if LATENCY_STATS
+    if (track == TRACK_ACCEPTED) {
+        publish_us = now;
+        track = TRACK_PUBLISHED;
+    }
+#else
+    (void)now;
+#endif
+}
+
+/**
+ * The raw edge settled back without an accepted change (a filtered glitch)
+ */
+HOT_PATH void LatencyCancel(void)
+{
+#if LATENCY_STATS
+    if (track == TRACK_EDGE) {
+        track = TRACK_IDLE;
+    }
+#endif
+}
+
+/**
+ * A report read started, close the change in flight
+ *
+ * @param now Time of the address match in microseconds
+ */
+HOT_PATH void LatencyTransmit(uint32_t now)
+{
+#if LATENCY_STATS
+    if (track != TRACK_PUBLISHED) {
+        return;
+    }
+    LatencyAdd(LATENCY_EDGE_TO_ACCEPT, accept_us - edge_us);
+    LatencyAdd(LATENCY_ACCEPT_TO_PUBLISH, publish_us - accept_us);
+    LatencyAdd(LATENCY_PUBLISH_TO_TRANSMIT, now - publish_us);
+    LatencyAdd(LATENCY_EDGE_TO_TRANSMIT, now - edge_us);
+    samples++;
+    track = TRACK_IDLE;
+#else
+    (void)now;
+#endif
+}
+
+/**
+ * Fill the latency register, runs in the I2C interrupt
+ *
+ * @param report Percentiles per stage, all zero without LATENCY_STATS
+ */
+void LatencySnapshot(LatencyReport *report)
+{
+#if LATENCY_STATS
+    report->samples = samples;
+    for (uint32_t s = 0; s < LATENCY_STAGES; ++s) {
+        report->stage[s].p50_us = LatencyPercentile((LatencyStage)s, 500);
+        report->stage[s].p99_us = LatencyPercentile((LatencyStage)s, 990);
+        report->stage[s].max_us = stage_max[s];
+    }
+#else
+    memset(report, 0, sizeof(*report));
+#endif
+}
@@ -0,0 +1,193 @@
+/**
+ * @file led_strip.c
+ * @brief WS2812-style per-key RGB LEDs, waveform from TIM3 PWM and DMA.
+ */
+
+#include "led_strip.h"
+#include "mem_budget.h"
+#include "timebase.h"
+#include <string.h>
+
+#if LED_STRIP_ENABLE
+// Bit rate and high times of the two symbols, in nanoseconds
+#define LED_BIT_HZ   800000u
+#define LED_T0H_NS   400u
+#define LED_T1H_NS   800u
+
+// One duty cycle per bit, then a 0 that leaves the line low
+#define LED_WAVE_LEN (LED_COUNT * 24u + 1u)
+
+#define LED_DMA_FLAGS (DMA_LIFCR_CTCIF2 | DMA_LIFCR_CHTIF2 | DMA_LIFCR_CTEIF2 | DMA_LIFCR_CDMEIF2 | DMA_LIFCR_CFEIF2)
+
+static uint8_t  frame[LED_COUNT * 3u];          /* r, g, b per LED */
+static uint16_t wave[LED_WAVE_LEN] MEM_BSS(dma);
+static uint16_t nibble_wave[16][4];             /* duty cycles of 4 bits, MSB first */
+static volatile bool dirty;
+static bool     sending;
+static uint32_t latch_at;
+
+/**
+ * Get the TIM3 kernel clock (APB1 timers run at 2x PCLK1 when APB1 is divided)
+ */
+static uint32_t LedTimerClock(void)
+{
+    uint32_t pclk1 = HAL_RCC_GetPCLK1Freq();
+
+    if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_CFGR_PPRE1_DIV1) {
+        pclk1 *= 2;
+    }
+    return pclk1;
+}
+
+/**
+ * Append the 8 duty cycles of one colour byte
+ */
+static inline uint16_t *LedEncodeByte(uint16_t *out, uint8_t value)
+{
+    memcpy(out, nibble_wave[value >> 4], sizeof(nibble_wave[0]));
+    memcpy(out + 4, nibble_wave[value & 0x0Fu], sizeof(nibble_wave[0]));
+    return out + 8;
+}
+#endif
+
+/**
+ * Set up PA7, TIM3 at the bit rate with CCR2 at 0 and the DMA stream;
+ * every LED starts dark with the first LedStripService()
+ */
+void LedStripInit(void)
+{
+#if LED_STRIP_ENABLE
+    __HAL_RCC_GPIOA_CLK_ENABLE();
+    __HAL_RCC_TIM3_CLK_ENABLE();
+    __HAL_RCC_DMA1_CLK_ENABLE();
+
+    uint32_t clock = LedTimerClock();
+    uint16_t t0 = (uint16_t)((clock / 1000u) * LED_T0H_NS / 1000000u);
+    uint16_t t1 = (uint16_t)((clock / 1000u) * LED_T1H_NS / 1000000u);
+    for (uint32_t n = 0; n < 16; ++n) {
+        for (uint32_t bit = 0; bit < 4; ++bit) {
+            nibble_wave[n][bit] = (n & (8u >> bit)) ? t1 : t0;
+        }
+    }
+
+    // PA7: AF2, push-pull, medium speed for the 400 ns pulses
+    GPIOA->OTYPER &= ~(1u << 7);
+    GPIOA->OSPEEDR = (GPIOA->OSPEEDR & ~(3u << (2 * 7))) | (1u << (2 * 7));
+    GPIOA->AFR[0] = (GPIOA->AFR[0] & ~(0xFu << (4 * 7))) | (2u << (4 * 7));
+    GPIOA->MODER = (GPIOA->MODER & ~(3u << (2 * 7))) | (2u << (2 * 7));
+
+    // PWM mode 1 on CH2 with preload, so a DMA write lands at the next
+    // update; the update event requests the DMA
+    TIM3->CR1 = TIM_CR1_ARPE;
+    TIM3->PSC = 0;
+    TIM3->ARR = clock / LED_BIT_HZ - 1u;
+    TIM3->CCR2 = 0;
+    TIM3->CCMR1 = TIM_CCMR1_OC2M_2 | TIM_CCMR1_OC2M_1 | TIM_CCMR1_OC2PE;
+    TIM3->CCER = TIM_CCER_CC2E;
+    TIM3->EGR = TIM_EGR_UG;
+    TIM3->SR = 0;
+    TIM3->DIER = TIM_DIER_UDE;
+
+    // Channel 5 (TIM3_UP), half words into CCR2, low priority: the key
+    // sampler and the link streams go first
+    DMA1_Stream2->CR = 0;
+    while (DMA1_Stream2->CR & DMA_SxCR_EN) {
+    }
+    DMA1->LIFCR = LED_DMA_FLAGS;
+    DMA1_Stream2->PAR = (uint32_t)&TIM3->CCR2;
+    DMA1_Stream2->M0AR = (uint32_t)wave;
+    DMA1_Stream2->CR = (5u << DMA_SxCR_CHSEL_Pos) | DMA_SxCR_MSIZE_0 | DMA_SxCR_PSIZE_0 |
+                       DMA_SxCR_MINC | DMA_SxCR_DIR_0;
+
+    TIM3->CR1 |= TIM_CR1_CEN;
+    dirty = true;
+#endif
+}
+
+/**
+ * Send a changed frame once the previous one latched, a periodic
+ * scheduler task
+ *
+ * Skips while a scan is due, so the encoding never delays one.
+ */
+void LedStripService(void)
+{
+#if LED_STRIP_ENABLE
+    uint32_t now = TimebaseNowUs();
+
+    if (sending) {
+        if (DMA1_Stream2->CR & DMA_SxCR_EN) {
+            return;
+        }
+        // The last bit is still on the line, the reset time covers it
+        sending = false;
+        latch_at = now + LED_RESET_US;
+    }
+    if (!dirty || !TimebaseReached(now, latch_at) || RightKeyboardScanPending()) {
+        return;
+    }
+
+    // A write from here on marks the frame again
+    dirty = false;
+    uint16_t *out = wave;
+    for (uint32_t led = 0; led < LED_COUNT; ++led) {
+        const uint8_t *rgb = &frame[led * 3u];
+        out = LedEncodeByte(out, rgb[1]);
+        out = LedEncodeByte(out, rgb[0]);
+        out = LedEncodeByte(out, rgb[2]);
+    }
+    *out = 0;
+
+    DMA1->LIFCR = LED_DMA_FLAGS;
+    DMA1_Stream2->NDTR = LED_WAVE_LEN;
+    DMA1_Stream2->CR |= DMA_SxCR_EN;
+    sending = true;
+#endif
+}
+
+/**
+ * Take a master write of RIGHT_KEYBOARD_REG_LEDS, from the link interrupt
+ *
+ * @param data First LED (0xFF = all), then r, g, b per LED
+ * @param len Bytes after the register byte
+ * @return false if the colours run past the last LED
+ */
+bool LedStripWrite(const uint8_t *data, uint32_t len)
+{
+#if LED_STRIP_ENABLE
+    if (len < 4) {
+        return false;
+    }
+    if (data[0] == 0xFFu) {
+        for (uint32_t led = 0; led < LED_COUNT; ++led) {
+            memcpy(&frame[led * 3u], &data[1], 3);
+        }
+    } else {
+        uint32_t count = (len - 1u) / 3u;
+        if (data[0] + count > LED_COUNT) {
+            return false;
+        }
+        memcpy(&frame[data[0] * 3u], &data[1], count * 3u);
+    }
+    dirty = true;
+    return true;
+#else
+    (void)data;
+    (void)len;
+    return false;
+#endif
+}
+
+/**
+ * Copy the RGB frame for the register map
+ *
+ * @param rgb LED_COUNT x 3 bytes
+ */
+void LedStripSnapshot(uint8_t *rgb)
+{
+#if LED_STRIP_ENABLE
+    memcpy(rgb, frame, sizeof(frame));
+#else
+    (void)rgb;
+#endif
+}
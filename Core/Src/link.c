@@ -0,0 +1,100 @@
+/**
+ * @file link.c
+ * @brief Request and reply framing shared by the UART and SPI links.
+ */
+
+#include "link.h"
+#include "crc8.h"
+#include "hot_path.h"
+#include <string.h>
+
+typedef enum {
+    LINK_RX_SYNC,
+    LINK_RX_LENGTH,
+    LINK_RX_DATA,
+    LINK_RX_CRC
+} LinkRxState;
+
+/**
+ * Drop a partly parsed request and wait for the next sync byte
+ */
+void LinkParserReset(LinkParser *parser)
+{
+    parser->state = LINK_RX_SYNC;
+}
+
+/**
+ * Feed one received byte to a request parser
+ *
+ * Requests with a bad length or CRC are counted as LINK_ERROR_FRAME and
+ * dropped, the parser then looks for the next sync byte.
+ *
+ * @param parser Parser of the link the byte came from
+ * @param byte Received byte
+ * @return true once a checked request is in parser->frame, parser->len bytes
+ */
+HOT_PATH bool LinkParse(LinkParser *parser, uint8_t byte)
+{
+    switch (parser->state) {
+    case LINK_RX_SYNC:
+        if (byte == LINK_SYNC_REQUEST) {
+            parser->state = LINK_RX_LENGTH;
+        }
+        break;
+    case LINK_RX_LENGTH:
+        if (byte == 0 || byte > LINK_REQUEST_LEN) {
+            RightKeyboardLinkError(LINK_ERROR_FRAME);
+            parser->state = LINK_RX_SYNC;
+            break;
+        }
+        parser->len = byte;
+        parser->count = 0;
+        parser->state = LINK_RX_DATA;
+        break;
+    case LINK_RX_DATA:
+        parser->frame[parser->count++] = byte;
+        if (parser->count == parser->len) {
+            parser->state = LINK_RX_CRC;
+        }
+        break;
+    default: {
+        uint8_t crc = Crc8Update(Crc8Update(CRC8_INIT, &parser->len, 1), parser->frame, parser->len);
+
+        parser->state = LINK_RX_SYNC;
+        if (byte == crc) {
+            return true;
+        }
+        RightKeyboardLinkError(LINK_ERROR_FRAME);
+        break;
+    }
+    }
+    return false;
+}
+
+/**
+ * Check whether a parser is between requests
+ */
+bool LinkParserIdle(const LinkParser *parser)
+{
+    return parser->state == LINK_RX_SYNC;
+}
+
+/**
+ * Frame a register read as a reply
+ *
+ * @param buf Reply buffer, LINK_REPLY_EXTRA + LINK_REPLY_LEN bytes
+ * @param reg Register the frame belongs to
+ * @param frame Frame from RightKeyboardTxBegin()
+ * @param len Frame length, at most LINK_REPLY_LEN
+ * @return Reply length in bytes
+ */
+HOT_PATH uint32_t LinkReplyBuild(uint8_t *buf, uint8_t reg, const uint8_t *frame, uint32_t len)
+{
+    buf[0] = LINK_SYNC_REPLY;
+    buf[1] = reg;
+    buf[2] = (uint8_t)len;
+    buf[3] = (uint8_t)(len >> 8);
+    memcpy(&buf[LINK_REPLY_HEADER], frame, len);
+    buf[LINK_REPLY_HEADER + len] = Crc8Update(CRC8_INIT, &buf[1], LINK_REPLY_HEADER - 1u + len);
+    return LINK_REPLY_EXTRA + len;
+}
@@ -22,6 +22,27 @@
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 #include "right_side_keyboard.h"
+#include "hot_path.h"
+#include "irq_plan.h"
+#include "profile.h"
+#include "trace.h"
+#include "stack_monitor.h"
+#include "bench.h"
+#include "debounce_bench.h"
+#include "i2c_fault.h"
+#include "retained.h"
+#include "watchdog.h"
+#include "config_store.h"
+#include "fw_update.h"
+#include "led_strip.h"
+#include "sched.h"
+#include "clock_css.h"
+#if CLOCK_PROFILE == CLOCK_PROFILE_GOVERNOR
+#include "clock_governor.h"
+#endif
+#if DEEP_IDLE_ENABLE
+#include "deep_idle.h"
+#endif
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -43,7 +64,9 @@
 I2C_HandleTypeDef hi2c1;
 
 /* USER CODE BEGIN PV */
-
+#if I2C_DRIVER == I2C_DRIVER_HAL_DMA
+DMA_HandleTypeDef hdma_i2c1_tx;
+#endif
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
@@ -51,12 +74,84 @@ void SystemClock_Config(void);
 static void MX_GPIO_Init(void);
 static void MX_I2C1_Init(void);
 /* USER CODE BEGIN PFP */
-
+#if I2C_DRIVER == I2C_DRIVER_HAL_DMA
+static void MX_DMA_Init(void);
+#endif
 /* USER CODE END PFP */
 
 /* Private user code ---------------------------------------------------------*/
 /* USER CODE BEGIN 0 */
+#if BOOT_READY_PIN_ENABLE
+/**
+  * @brief Drive the boot debug pin low, before anything else is set up
+  * @retval None
+  */
+static void BootReadyPinInit(void)
+{
+  RCC->AHB1ENR |= 1u << GPIO_GET_INDEX(BOOT_READY_PORT);
+  (void)RCC->AHB1ENR;
+  BOOT_READY_PORT->BSRR = (uint32_t)BOOT_READY_PIN << 16;
+  uint32_t field = 3u << (2 * __builtin_ctz(BOOT_READY_PIN));
+  BOOT_READY_PORT->MODER = (BOOT_READY_PORT->MODER & ~field) | (field & 0x55555555u);
+}
+#endif
+
+/**
+  * @brief Scan task, only ready while a scan is due
+  */
+static void TaskScan(void)
+{
+  RightKeyboardScan6KRO(NULL, REPORT_KEY_LIMIT);
+}
 
+/**
+  * @brief Stored settings the master changed, once keys and link are quiet
+  */
+static void TaskConfig(void)
+{
+  ConfigStoreService(RightKeyboardActivity());
+}
+
+#if CLOCK_PROFILE == CLOCK_PROFILE_GOVERNOR
+static void TaskClock(void)
+{
+  ClockGovernorService(RightKeyboardActivity());
+}
+#endif
+
+#if DEEP_IDLE_ENABLE
+/**
+  * @brief STOP after a long idle period, returns once woken and rescanning
+  */
+static void TaskIdle(void)
+{
+  DeepIdleService(RightKeyboardActivity());
+}
+#endif
+
+// Thread-context work, most urgent first (sched.h). In DMA mode the
+// sampler interrupt scans by itself, the scan task is then never ready.
+// The watchdog is fed last, so a task that hogs the loop starves it.
+static const SchedTask tasks[SCHED_TASKS] = {
+  [SCHED_TASK_SCAN]      = { TaskScan, RightKeyboardScanPending, 0, 0 },
+  [SCHED_TASK_FW_UPDATE] = { FwUpdateService, NULL, 0, 0 },
+  [SCHED_TASK_LINK]      = { RightKeyboardI2CService, NULL, 1000u, 5000u },
+#if LED_STRIP_ENABLE
+  [SCHED_TASK_LEDS]      = { LedStripService, NULL, 1000u, 0 },
+#endif
+#if CLOCK_PROFILE == CLOCK_PROFILE_GOVERNOR
+  [SCHED_TASK_CLOCK]     = { TaskClock, NULL, 1000u, 5000u },
+#endif
+  [SCHED_TASK_CONFIG]    = { TaskConfig, NULL, 10000u, 0 },
+  [SCHED_TASK_RETAINED]  = { RetainedService, NULL, 10000u, 0 },
+#if I2C_FAULT_ENABLE
+  [SCHED_TASK_FAULT]     = { I2CFaultService, NULL, 1000u, 0 },
+#endif
+#if DEBOUNCE_BENCH
+  [SCHED_TASK_BENCH]     = { DebounceBenchService, NULL, 100000u, 0 },
+#endif
+  [SCHED_TASK_WATCHDOG]  = { WatchdogKick, NULL, 10000u, WATCHDOG_TIMEOUT_MS * 250u },
+};
 /* USER CODE END 0 */
 
 /**
@@ -67,7 +162,12 @@ int main(void)
 {
 
   /* USER CODE BEGIN 1 */
-
+  StackPaint();
+  RetainedInit();
+  WatchdogInit();
+#if BOOT_READY_PIN_ENABLE
+  BootReadyPinInit();
+#endif
   /* USER CODE END 1 */
 
   /* MCU Configuration--------------------------------------------------------*/
@@ -77,6 +177,11 @@ int main(void)
   SCB->VTOR = FLASH_BASE | 0x4000;
 
   /* USER CODE BEGIN Init */
+  IrqPlanInit();
+  ProfileInit();
+#if RAM_VECTOR_TABLE
+  HotPathRelocateVectors();
+#endif
 
   /* USER CODE END Init */
 
@@ -84,7 +189,11 @@ int main(void)
   SystemClock_Config();
 
   /* USER CODE BEGIN SysInit */
-
+  TraceInit();
+#if I2C_DRIVER == I2C_DRIVER_HAL_DMA
+  // The DMA controller must be clocked before HAL_I2C_MspInit links the stream
+  MX_DMA_Init();
+#endif
   /* USER CODE END SysInit */
 
   /* Initialize all configured peripherals */
@@ -92,10 +201,35 @@ int main(void)
   MX_I2C1_Init();
   /* USER CODE BEGIN 2 */
   
+  // Stored settings first, a full log is compacted before the link starts
+  ConfigStoreInit();
+
   // Initialize the keyboard
   if (!RightKeyboardInit()) {
     Error_Handler();
   }
+  BenchInit();
+  I2CFaultInit();
+
+#if BOOT_READY_PIN_ENABLE
+  // First report scanned and the slave is listening
+  BOOT_READY_PORT->BSRR = BOOT_READY_PIN;
+#endif
+
+  // LEDs start dark, after the link so they don't add to the boot time
+  LedStripInit();
+
+#if DEEP_IDLE_ENABLE
+  if (!DeepIdleInit()) {
+    Error_Handler();
+  }
+#endif
+
+#if DEEP_IDLE_ENABLE
+  SchedInit(tasks, TaskIdle);
+#else
+  SchedInit(tasks, NULL);
+#endif
   
   /* USER CODE END 2 */
 
@@ -106,18 +240,8 @@ int main(void)
     /* USER CODE END WHILE */
 
     /* USER CODE BEGIN 3 */
-    // Create a local keyboard state
-    RightKeyboardState state;
-    
-    // Scan the keyboard
-    RightKeyboardScan6KRO(&state, 6);
-    
-    // Update the global keyboard state in case I2C callback gets triggered
-    // This ensures we always have fresh key data to send
-    HAL_I2C_Slave_Transmit_IT(&hi2c1, (uint8_t*)&state, sizeof(state));
-    
-    // Small delay to avoid busy-waiting and consuming too much power
-    HAL_Delay(10);
+    // Tasks by priority, WFI between them; does not return
+    SchedRun();
   }
   /* USER CODE END 3 */
 }
@@ -134,7 +258,12 @@ void SystemClock_Config(void)
   /** Configure the main internal regulator output voltage
   */
   __HAL_RCC_PWR_CLK_ENABLE();
+#if CLOCK_PROFILE == CLOCK_PROFILE_GOVERNOR
+  /* Scale 3 covers HCLK up to 64 MHz, VOS can only change while the PLL is off */
+  __HAL_PWR_VOLTAGESCALING_CONFIG(PWR_REGULATOR_VOLTAGE_SCALE3);
+#else
   __HAL_PWR_VOLTAGESCALING_CONFIG(PWR_REGULATOR_VOLTAGE_SCALE1);
+#endif
 
   /** Initializes the RCC Oscillators according to the specified parameters
   * in the RCC_OscInitTypeDef structure.
@@ -142,9 +271,56 @@ void SystemClock_Config(void)
   RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSI;
   RCC_OscInitStruct.HSIState = RCC_HSI_ON;
   RCC_OscInitStruct.HSICalibrationValue = RCC_HSICALIBRATION_DEFAULT;
+#if CLOCK_PROFILE != CLOCK_PROFILE_HSI
+  /* 1 MHz VCO input from either oscillator */
+#if CLOCK_PLL_SOURCE == CLOCK_PLL_SOURCE_HSE
+  /* HSI once the crystal failed this boot (clock_css.h) */
+  if (ClockCssHseUsable())
+  {
+    RCC_OscInitStruct.OscillatorType |= RCC_OSCILLATORTYPE_HSE;
+    RCC_OscInitStruct.HSEState = RCC_HSE_ON;
+    RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSE;
+    RCC_OscInitStruct.PLL.PLLM = HSE_VALUE / 1000000U;
+  }
+  else
+#endif
+  {
+    RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSI;
+    RCC_OscInitStruct.PLL.PLLM = 16;
+  }
+  RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
+#if CLOCK_PROFILE == CLOCK_PROFILE_PLL_100
+  /* VCO 200 MHz / P 2 = 100 MHz */
+  RCC_OscInitStruct.PLL.PLLN = 200;
+  RCC_OscInitStruct.PLL.PLLP = RCC_PLLP_DIV2;
+#elif CLOCK_PROFILE == CLOCK_PROFILE_PLL_96
+  /* VCO 192 MHz / P 2 = 96 MHz, / Q 4 = 48 MHz for OTG FS */
+  RCC_OscInitStruct.PLL.PLLN = 192;
+  RCC_OscInitStruct.PLL.PLLP = RCC_PLLP_DIV2;
+#elif CLOCK_PROFILE == CLOCK_PROFILE_GOVERNOR
+  /* VCO 128 MHz / P 2 = 64 MHz boost clock, restarted by the governor */
+  RCC_OscInitStruct.PLL.PLLN = 128;
+  RCC_OscInitStruct.PLL.PLLP = RCC_PLLP_DIV2;
+#else
+  /* VCO 160 MHz / P 4 = 40 MHz, APB1 40 MHz for an exact 400 kHz SCL */
+  RCC_OscInitStruct.PLL.PLLN = 160;
+  RCC_OscInitStruct.PLL.PLLP = RCC_PLLP_DIV4;
+#endif
+  RCC_OscInitStruct.PLL.PLLQ = 4;
+#else
   RCC_OscInitStruct.PLL.PLLState = RCC_PLL_NONE;
+#endif
   if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
   {
+#if CLOCK_CSS_ENABLE
+    /* Crystal did not start: the same PLL output from HSI */
+    if (ClockCssHseUsable())
+    {
+      ClockCssHseFailed();
+      SystemClock_Config();
+      return;
+    }
+#endif
     Error_Handler();
   }
 
@@ -152,15 +328,44 @@ void SystemClock_Config(void)
   */
   RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_HCLK|RCC_CLOCKTYPE_SYSCLK
                               |RCC_CLOCKTYPE_PCLK1|RCC_CLOCKTYPE_PCLK2;
+#if CLOCK_PROFILE != CLOCK_PROFILE_HSI
+  RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
+#else
   RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_HSI;
+#endif
   RCC_ClkInitStruct.AHBCLKDivider = RCC_SYSCLK_DIV1;
+#if CLOCK_PROFILE == CLOCK_PROFILE_PLL_100 || CLOCK_PROFILE == CLOCK_PROFILE_PLL_96
+  /* APB1 is limited to 50 MHz */
+  RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV2;
+  RCC_ClkInitStruct.APB2CLKDivider = RCC_HCLK_DIV1;
+#elif CLOCK_PROFILE == CLOCK_PROFILE_GOVERNOR
+  /* Boot boosted; PCLKs 8 MHz, timers 16 MHz, same as the HSI idle setting */
+  RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV8;
+  RCC_ClkInitStruct.APB2CLKDivider = RCC_HCLK_DIV8;
+#else
   RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV1;
   RCC_ClkInitStruct.APB2CLKDivider = RCC_HCLK_DIV1;
-
+#endif
+
+  /* Wait states for 2.7-3.6 V: 0 up to 30 MHz, 1 up to 64 MHz, 3 up to 100 MHz */
+#if CLOCK_PROFILE == CLOCK_PROFILE_PLL_100 || CLOCK_PROFILE == CLOCK_PROFILE_PLL_96
+  if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_3) != HAL_OK)
+#elif CLOCK_PROFILE == CLOCK_PROFILE_PLL_40 || CLOCK_PROFILE == CLOCK_PROFILE_GOVERNOR
+  if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_1) != HAL_OK)
+#else
   if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_0) != HAL_OK)
+#endif
   {
     Error_Handler();
   }
+
+#if CLOCK_CSS_ENABLE
+  /* A crystal that stops from here on raises NMI, ClockCssIRQHandler() */
+  if (ClockCssHseUsable())
+  {
+    HAL_RCC_EnableCSS();
+  }
+#endif
 }
 
 /**
@@ -172,6 +377,10 @@ static void MX_I2C1_Init(void)
 {
 
   /* USER CODE BEGIN I2C1_Init 0 */
+#if LINK_TRANSPORT != LINK_TRANSPORT_I2C
+  /* The UART or SPI link is set up by RightKeyboardInit() instead */
+  return;
+#endif
 
   /* USER CODE END I2C1_Init 0 */
 
@@ -179,13 +388,17 @@ static void MX_I2C1_Init(void)
 
   /* USER CODE END I2C1_Init 1 */
   hi2c1.Instance = I2C1;
-  hi2c1.Init.ClockSpeed = 100000;
-  hi2c1.Init.DutyCycle = I2C_DUTYCYCLE_2;
+  hi2c1.Init.ClockSpeed = I2C_CLOCK_SPEED;
+  hi2c1.Init.DutyCycle = I2C_DUTY_CYCLE;
   hi2c1.Init.OwnAddress1 = RIGHT_KEYBOARD_I2C_ADDRESS << 1; // Right keyboard I2C address (shifted left for HAL)
   hi2c1.Init.AddressingMode = I2C_ADDRESSINGMODE_7BIT;
+#if I2C_DIAG_ADDRESS
+  hi2c1.Init.DualAddressMode = I2C_DUALADDRESS_ENABLE;
+#else
   hi2c1.Init.DualAddressMode = I2C_DUALADDRESS_DISABLE;
-  hi2c1.Init.OwnAddress2 = 0;
-  hi2c1.Init.GeneralCallMode = I2C_GENERALCALL_DISABLE;
+#endif
+  hi2c1.Init.OwnAddress2 = I2C_DIAG_ADDRESS << 1;
+  hi2c1.Init.GeneralCallMode = I2C_GENERAL_CALL_MODE;
   hi2c1.Init.NoStretchMode = I2C_NOSTRETCH_DISABLE;
   if (HAL_I2C_Init(&hi2c1) != HAL_OK)
   {
@@ -220,7 +433,22 @@ static void MX_GPIO_Init(void)
 }
 
 /* USER CODE BEGIN 4 */
+#if I2C_DRIVER == I2C_DRIVER_HAL_DMA
+/**
+  * @brief Enable DMA controller clock
+  * @retval None
+  */
+static void MX_DMA_Init(void)
+{
+  /* DMA controller clock enable */
+  __HAL_RCC_DMA1_CLK_ENABLE();
 
+  /* DMA interrupt init */
+  /* DMA1_Stream6_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Stream6_IRQn, IRQ_PRIO_I2C, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Stream6_IRQn);
+}
+#endif
 /* USER CODE END 4 */
 
 /**
@@ -231,6 +459,7 @@ void Error_Handler(void)
 {
   /* USER CODE BEGIN Error_Handler_Debug */
   /* User can add his own implementation to report the HAL error return state */
+  RetainedError((uint32_t)__builtin_return_address(0));
   __disable_irq();
   while (1)
   {
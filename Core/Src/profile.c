@@ -0,0 +1,117 @@
+/**
+ * @file profile.c
+ * @brief DWT cycle-count profiling of the scan and I2C hot paths.
+ */
+
+#include "profile.h"
+#include "hot_path.h"
+#include "mem_budget.h"
+#include <string.h>
+
+#if PROFILE_ENABLE
+// Readable from the debugger. The mean field is only filled in snapshots,
+// from the debugger take profile_sums[s] / profile_stats[s].count.
+ProfileStats profile_stats[PROFILE_SLOTS] MEM_BSS(stats);
+uint64_t     profile_sums[PROFILE_SLOTS];
+#endif
+
+/**
+ * Start the cycle counter and clear the statistics
+ */
+void ProfileInit(void)
+{
+#if PROFILE_ENABLE
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    ProfileReset();
+#endif
+}
+
+/**
+ * Clear the statistics of every slot
+ */
+void ProfileReset(void)
+{
+#if PROFILE_ENABLE
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    memset(profile_stats, 0, sizeof(profile_stats));
+    memset(profile_sums, 0, sizeof(profile_sums));
+    for (uint32_t s = 0; s < PROFILE_SLOTS; ++s) {
+        profile_stats[s].min = UINT32_MAX;
+    }
+    __set_PRIMASK(primask);
+#endif
+}
+
+/**
+ * Add one run to a slot
+ *
+ * Masks interrupts for a few cycles, the scan slots are also recorded from
+ * the I2C and DMA interrupts.
+ *
+ * @param slot Section that ran
+ * @param cycles Its run time in core cycles
+ */
+HOT_PATH void ProfileRecord(ProfileSlot slot, uint32_t cycles)
+{
+#if PROFILE_ENABLE
+    uint32_t bucket = 0;
+    if (cycles >> PROFILE_HIST_SHIFT) {
+        bucket = 32u - PROFILE_HIST_SHIFT - (uint32_t)__builtin_clz(cycles);
+        if (bucket >= PROFILE_HIST_BUCKETS) {
+            bucket = PROFILE_HIST_BUCKETS - 1u;
+        }
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    ProfileStats *stats = &profile_stats[slot];
+    if (stats->count != UINT32_MAX) {
+        stats->count++;
+        profile_sums[slot] += cycles;
+    }
+    if (cycles < stats->min) {
+        stats->min = cycles;
+    }
+    if (cycles > stats->max) {
+        stats->max = cycles;
+    }
+    if (stats->hist[bucket] != UINT16_MAX) {
+        stats->hist[bucket]++;
+    }
+
+    __set_PRIMASK(primask);
+#else
+    (void)slot;
+    (void)cycles;
+#endif
+}
+
+/**
+ * Copy a consistent snapshot of one slot
+ *
+ * @param slot Section to read
+ * @param stats Filled with its statistics, all zero without PROFILE_ENABLE
+ */
+void ProfileSnapshot(ProfileSlot slot, ProfileStats *stats)
+{
+#if PROFILE_ENABLE
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    *stats = profile_stats[slot];
+    uint64_t sum = profile_sums[slot];
+    __set_PRIMASK(primask);
+
+    // The division stays out of the recording path
+    if (stats->count == 0) {
+        stats->min = 0;
+    } else {
+        stats->mean = (uint32_t)(sum / stats->count);
+    }
+#else
+    (void)slot;
+    memset(stats, 0, sizeof(*stats));
+#endif
+}
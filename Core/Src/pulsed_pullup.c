@@ -0,0 +1,118 @@
+/**
+ * @file pulsed_pullup.c
+ * @brief Key pull-ups switched on only around each sample.
+ */
+
+#include "pulsed_pullup.h"
+#include "keyboard_layout.h"
+#include "timebase.h"
+#include "hot_path.h"
+
+#if PULSED_PULLUP_ENABLE
+static uint32_t settle_ns;
+static uint32_t settle_cycles;
+static uint32_t settle_clock_hz;        /* SystemCoreClock settle_cycles is for */
+
+#define PULSED_PULLUP_UP   0x55555555u
+#define PULSED_PULLUP_DOWN 0xAAAAAAAAu
+
+/**
+ * Put the key pins on their pull-ups (01) or pull-downs (10)
+ */
+HOT_PATH static inline void PulsedPullupSet(uint32_t pattern)
+{
+    GPIOA->PUPDR = (GPIOA->PUPDR & ~KEY_FIELD2_A) | (KEY_FIELD2_A & pattern);
+    GPIOB->PUPDR = (GPIOB->PUPDR & ~KEY_FIELD2_B) | (KEY_FIELD2_B & pattern);
+}
+
+/**
+ * Time the slowest released line from pull-up on to high
+ *
+ * @return Cycles from the PUPDR writes to the last key that went high, 0 if
+ *         none rose after the first read
+ */
+static uint32_t PulsedPullupMeasure(void)
+{
+    uint32_t window = PULSED_PULLUP_MEASURE_US * (SystemCoreClock / 1000000u);
+    uint32_t last = 0;
+
+    // Discharge every line first
+    PulsedPullupSet(PULSED_PULLUP_DOWN);
+    uint32_t discharged = TimebaseNowUs() + KEY_PULLUP_SETTLE_US;
+    while (!TimebaseReached(TimebaseNowUs(), discharged)) {
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t start = DWT->CYCCNT;
+    PulsedPullupSet(PULSED_PULLUP_UP);
+    uint32_t keys = KEY_GATHER(GPIOA->IDR, GPIOB->IDR);
+    for (uint32_t elapsed = 0; elapsed < window; elapsed = DWT->CYCCNT - start) {
+        uint32_t now_keys = KEY_GATHER(GPIOA->IDR, GPIOB->IDR);
+        if (now_keys != keys) {
+            keys = now_keys;
+            last = DWT->CYCCNT - start;
+        }
+    }
+    PulsedPullupSet(PULSED_PULLUP_DOWN);
+    __set_PRIMASK(primask);
+
+    return last;
+}
+#endif
+
+/**
+ * Enable the cycle counter, set the settle time and park the key pins on
+ * their pull-downs
+ *
+ * Runs once the pull-ups set up in RightKeyboardInit() had
+ * KEY_PULLUP_SETTLE_US, before the first sample.
+ */
+void PulsedPullupInit(void)
+{
+#if PULSED_PULLUP_ENABLE
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+#if PULSED_PULLUP_SETTLE_NS
+    settle_ns = PULSED_PULLUP_SETTLE_NS;
+    PulsedPullupSet(PULSED_PULLUP_DOWN);
+#else
+    uint32_t cycles = PulsedPullupMeasure();
+    settle_ns = (uint32_t)((uint64_t)cycles * 1000u / (SystemCoreClock / 1000000u)) * PULSED_PULLUP_MARGIN;
+#endif
+    if (settle_ns < PULSED_PULLUP_MIN_NS) {
+        settle_ns = PULSED_PULLUP_MIN_NS;
+    }
+    settle_clock_hz = 0;
+#endif
+}
+
+/**
+ * Sample the key pins with the pull-ups on for the settle time
+ *
+ * @return Packed key word (bit n = key n, 1 = released)
+ */
+HOT_PATH uint32_t PulsedPullupSample(void)
+{
+#if PULSED_PULLUP_ENABLE
+    if (settle_clock_hz != SystemCoreClock) {
+        settle_clock_hz = SystemCoreClock;
+        settle_cycles = (uint32_t)(((uint64_t)settle_ns * (SystemCoreClock / 1000000u) + 999u) / 1000u);
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    PulsedPullupSet(PULSED_PULLUP_UP);
+    uint32_t start = DWT->CYCCNT;
+    while ((DWT->CYCCNT - start) < settle_cycles) {
+    }
+    uint32_t keys = KEY_GATHER(GPIOA->IDR, GPIOB->IDR);
+    PulsedPullupSet(PULSED_PULLUP_DOWN);
+    __set_PRIMASK(primask);
+
+    return keys;
+#else
+    return KEY_GATHER(GPIOA->IDR, GPIOB->IDR);
+#endif
+}
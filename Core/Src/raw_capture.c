@@ -0,0 +1,180 @@
+/**
+ * @file raw_capture.c
+ * @brief Triggered capture of raw key samples for offline debounce tuning.
+ *
+ * The ring belongs to the scanner. The I2C interrupt only reads it once it
+ * is frozen, and asks for a re-arm through a flag the scanner picks up
+ * with the next sample.
+ */
+
+#include "raw_capture.h"
+#include "hot_path.h"
+#include "mem_budget.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#if RAW_CAPTURE
+_Static_assert(RAW_CAPTURE_PRETRIGGER < RAW_CAPTURE_SAMPLES, "RAW_CAPTURE_PRETRIGGER must leave room after the trigger");
+_Static_assert(RAW_CAPTURE_SAMPLES <= 0xFFFFu, "Capture indices are 16 bits on the wire");
+
+// Readable from the debugger, see raw_capture.h
+RawSample        raw_capture[RAW_CAPTURE_SAMPLES] MEM_BSS(capture);
+volatile uint8_t raw_capture_state = RAW_CAPTURE_ARMED;
+uint32_t         raw_capture_first;
+uint32_t         raw_capture_count;
+uint32_t         raw_capture_trigger;
+
+static uint32_t      head;
+static uint32_t      filled;
+static uint32_t      post_left;
+static uint32_t      last_keys;
+static bool          seeded;
+static volatile bool arm_requested;
+
+// Dump cursor, owned by the I2C interrupt
+static uint32_t      cursor;
+static uint32_t      cursor_next;
+#endif
+
+/**
+ * Record one raw sample
+ *
+ * Called for every raw key word before the debounce.
+ *
+ * @param keys Raw key word (1 = released)
+ * @param now Sample time in microseconds
+ */
+HOT_PATH void RawCaptureSample(uint32_t keys, uint32_t now)
+{
+#if RAW_CAPTURE
+    if (arm_requested) {
+        arm_requested = false;
+        head = 0;
+        filled = 0;
+        seeded = false;
+        raw_capture_state = RAW_CAPTURE_ARMED;
+    }
+
+    uint8_t state = raw_capture_state;
+    if (state == RAW_CAPTURE_DONE) {
+        return;
+    }
+
+    raw_capture[head].time_us = now;
+    raw_capture[head].keys = keys;
+    head = head + 1u < RAW_CAPTURE_SAMPLES ? head + 1u : 0u;
+    if (filled < RAW_CAPTURE_SAMPLES) {
+        filled++;
+    }
+
+    if (state == RAW_CAPTURE_ARMED && seeded && ((keys ^ last_keys) & RAW_CAPTURE_TRIGGER_MASK)) {
+        state = RAW_CAPTURE_TRIGGERED;
+        post_left = RAW_CAPTURE_SAMPLES - RAW_CAPTURE_PRETRIGGER;
+    }
+    if (state == RAW_CAPTURE_TRIGGERED && --post_left == 0) {
+        raw_capture_first = filled < RAW_CAPTURE_SAMPLES ? 0u : head;
+        raw_capture_count = filled;
+        raw_capture_trigger = filled - (RAW_CAPTURE_SAMPLES - RAW_CAPTURE_PRETRIGGER);
+        state = RAW_CAPTURE_DONE;
+    }
+    raw_capture_state = state;
+    last_keys = keys;
+    seeded = true;
+#else
+    (void)keys;
+    (void)now;
+#endif
+}
+
+/**
+ * Apply a command written to the capture register
+ *
+ * @param command RAW_CAPTURE_CMD_ARM or RAW_CAPTURE_CMD_REWIND
+ */
+void RawCaptureCommand(uint8_t command)
+{
+#if RAW_CAPTURE
+    if (command == RAW_CAPTURE_CMD_ARM) {
+        cursor = 0;
+        arm_requested = true;
+    } else if (command == RAW_CAPTURE_CMD_REWIND) {
+        cursor = 0;
+    }
+#else
+    (void)command;
+#endif
+}
+
+/**
+ * Fill the next dump frame
+ *
+ * @param chunk Frame to fill
+ * @return Frame length in bytes, the header alone while nothing is frozen
+ */
+uint32_t RawCaptureChunkRead(RawCaptureChunk *chunk)
+{
+    memset(chunk, 0, sizeof(*chunk));
+#if RAW_CAPTURE
+    chunk->state = arm_requested ? RAW_CAPTURE_ARMED : raw_capture_state;
+    if (chunk->state != RAW_CAPTURE_DONE) {
+        cursor_next = cursor;
+        return offsetof(RawCaptureChunk, sample);
+    }
+
+    uint32_t n = 0;
+    while (n < RAW_CAPTURE_CHUNK && cursor + n < raw_capture_count) {
+        uint32_t slot = raw_capture_first + cursor + n;
+        if (slot >= RAW_CAPTURE_SAMPLES) {
+            slot -= RAW_CAPTURE_SAMPLES;
+        }
+        chunk->sample[n] = raw_capture[slot];
+        n++;
+    }
+    chunk->samples = (uint8_t)n;
+    chunk->total = (uint16_t)raw_capture_count;
+    chunk->trigger = (uint16_t)raw_capture_trigger;
+    chunk->index = (uint16_t)cursor;
+    cursor_next = cursor + n;
+    return offsetof(RawCaptureChunk, sample) + n * sizeof(RawSample);
+#else
+    return offsetof(RawCaptureChunk, sample);
+#endif
+}
+
+/**
+ * Move the dump cursor on once the last frame was read completely
+ */
+void RawCaptureChunkDone(void)
+{
+#if RAW_CAPTURE
+    cursor = cursor_next;
+#endif
+}
+
+/**
+ * Copy a frozen capture out, oldest sample first
+ *
+ * For on-device consumers such as the debounce benchmark (debounce_bench.h).
+ *
+ * @param out Up to max samples
+ * @return Samples copied, 0 unless RAW_CAPTURE_DONE
+ */
+uint32_t RawCaptureCopy(RawSample *out, uint32_t max)
+{
+#if RAW_CAPTURE
+    if (arm_requested || raw_capture_state != RAW_CAPTURE_DONE) {
+        return 0;
+    }
+    uint32_t count = raw_capture_count < max ? raw_capture_count : max;
+    for (uint32_t n = 0; n < count; ++n) {
+        uint32_t slot = raw_capture_first + n;
+        out[n] = raw_capture[slot < RAW_CAPTURE_SAMPLES ? slot : slot - RAW_CAPTURE_SAMPLES];
+    }
+    return count;
+#else
+    (void)out;
+    (void)max;
+    return 0;
+#endif
+}
@@ -0,0 +1,135 @@
+/**
+ * @file residency.c
+ * @brief Power-state residency and duty-cycle accounting.
+ *
+ * Spans are opened and closed from any priority, so every update runs
+ * with interrupts masked. A span's own time is its length less the time
+ * of the spans that closed inside it: closed_us sums the own time of
+ * every span so far, the mark keeps its value at the start.
+ */
+
+#include "residency.h"
+#include "hot_path.h"
+#include "timebase.h"
+#include <string.h>
+
+#if RESIDENCY_STATS
+static uint64_t work_us[RESIDENCY_WORK_KINDS];
+static uint64_t awake_us;               /* TIM5 time, extended to 64 bits */
+static uint64_t sleep_us;
+static uint64_t stop_us;
+static uint32_t clock_last_us;          /* TIM5 starts from 0 in TimebaseInit() */
+static uint32_t closed_us;              /* own time of every closed span, wraps */
+
+/**
+ * Carry TIM5 into the 64-bit awake time, interrupts masked
+ *
+ * Sleep and span ends call this far more often than TIM5 wraps.
+ */
+HOT_PATH static inline void ResidencyClock(uint32_t now)
+{
+    awake_us += now - clock_last_us;
+    clock_last_us = now;
+}
+#endif
+
+/**
+ * Open a span of scan or link work
+ *
+ * @param mark Filled with the start, passed to ResidencyExit()
+ */
+HOT_PATH void ResidencyEnter(ResidencyMark *mark)
+{
+#if RESIDENCY_STATS
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    mark->start_us = TimebaseNowUs();
+    mark->nested_us = closed_us;
+    __set_PRIMASK(primask);
+#else
+    (void)mark;
+#endif
+}
+
+/**
+ * Close a span and add its own time to its kind
+ *
+ * @param work Kind of work the span did
+ * @param mark Filled by ResidencyEnter()
+ */
+HOT_PATH void ResidencyExit(ResidencyWork work, const ResidencyMark *mark)
+{
+#if RESIDENCY_STATS
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t now = TimebaseNowUs();
+    uint32_t own = (now - mark->start_us) - (closed_us - mark->nested_us);
+    closed_us += own;
+    work_us[work] += own;
+    ResidencyClock(now);
+    __set_PRIMASK(primask);
+#else
+    (void)work;
+    (void)mark;
+#endif
+}
+
+/**
+ * Count a WFI sleep
+ *
+ * @param start_us TimebaseNowUs() before WFI
+ * @param end_us TimebaseNowUs() after it, before the wake-up handlers ran
+ */
+HOT_PATH void ResidencySleep(uint32_t start_us, uint32_t end_us)
+{
+#if RESIDENCY_STATS
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    sleep_us += end_us - start_us;
+    ResidencyClock(end_us);
+    __set_PRIMASK(primask);
+#else
+    (void)start_us;
+    (void)end_us;
+#endif
+}
+
+/**
+ * Count a STOP period, time TIM5 did not see
+ *
+ * @param us Length of the period
+ */
+void ResidencyStop(uint32_t us)
+{
+#if RESIDENCY_STATS
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    stop_us += us;
+    __set_PRIMASK(primask);
+#else
+    (void)us;
+#endif
+}
+
+/**
+ * Copy the counters for a read of RIGHT_KEYBOARD_REG_RESIDENCY
+ *
+ * @param report Filled with the counters as of now; zero with
+ *               RESIDENCY_STATS off
+ */
+void ResidencySnapshot(ResidencyReport *report)
+{
+    memset(report, 0, sizeof(*report));
+#if RESIDENCY_STATS
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    ResidencyClock(TimebaseNowUs());
+    report->total_us = awake_us + stop_us;
+    report->run_us = awake_us - sleep_us;
+    report->sleep_us = sleep_us;
+    report->stop_us = stop_us;
+    report->scan_us = work_us[RESIDENCY_SCAN];
+    report->link_us = work_us[RESIDENCY_LINK];
+    __set_PRIMASK(primask);
+#endif
+}
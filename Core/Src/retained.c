@@ -0,0 +1,190 @@
+/**
+ * @file retained.c
+ * @brief Diagnostics kept in .noinit RAM across warm resets.
+ *
+ * Every writer reseals the whole record, so an error or fault that preempts
+ * RetainedService() halfway through a save still leaves a valid one behind.
+ */
+
+#include "retained.h"
+#include "crc8.h"
+#include "periph.h"
+#include <string.h>
+
+#if RETAINED_DIAG
+// A different record layout never validates an old record
+#define RETAINED_MAGIC (0x4E4B5200u ^ (uint32_t)sizeof(RetainedReport))
+
+typedef struct {
+    uint32_t       magic;
+    RetainedReport report;
+    uint8_t        crc;
+} RetainedRecord;
+
+static RetainedRecord retained __attribute__((section(".noinit")));
+
+// Record as found at boot, served by the retained register
+static RetainedReport retained_boot;
+static uint32_t       last_save_ms;
+
+static uint8_t RetainedCrc(void)
+{
+    return Crc8Update(CRC8_INIT, (const uint8_t *)&retained.report, sizeof(retained.report));
+}
+
+static void RetainedSeal(void)
+{
+    retained.magic = RETAINED_MAGIC;
+    retained.crc = RetainedCrc();
+}
+#endif /* RETAINED_DIAG */
+
+#if RETAINED_FAULT_HOOK
+/**
+ * End of an error or fault path: breakpoint under a debugger, otherwise
+ * reset with FAULT_RESET or spin
+ */
+__attribute__((noreturn)) static void RetainedStop(void)
+{
+    __disable_irq();
+    if (CoreDebug->DHCSR & CoreDebug_DHCSR_C_DEBUGEN_Msk) {
+        __BKPT(0);
+    }
+#if FAULT_RESET
+    NVIC_SystemReset();
+#endif
+    while (1) {
+    }
+}
+
+// Only reached from assembly, so it keeps its plain global name; with LTO
+// the attributes keep it from being dropped or localised
+void RetainedFaultRecord(const uint32_t *frame);
+
+/**
+ * Store the fault frame and stop, tail-called from RetainedFaultEntry()
+ *
+ * @param frame Exception frame: r0-r3, r12, lr, pc, xPSR
+ */
+__attribute__((used, externally_visible, noinline, noreturn)) void RetainedFaultRecord(const uint32_t *frame)
+{
+#if RETAINED_DIAG
+    RetainedFault *fault = &retained.report.fault;
+
+    fault->exception = __get_IPSR();
+    fault->lr = frame[5];
+    fault->pc = frame[6];
+    fault->psr = frame[7];
+    fault->cfsr = SCB->CFSR;
+    fault->hfsr = SCB->HFSR;
+    fault->mmfar = SCB->MMFAR;
+    fault->bfar = SCB->BFAR;
+    retained.report.faults++;
+    RetainedSeal();
+#else
+    (void)frame;
+#endif
+    RetainedStop();
+}
+#endif /* RETAINED_FAULT_HOOK */
+
+/**
+ * Validate the record, count this boot and keep a copy of it for the master
+ *
+ * Called first thing in main(). Clears the reset flags in RCC->CSR, so the
+ * next reset reports only its own cause.
+ */
+void RetainedInit(void)
+{
+#if RETAINED_DIAG
+    uint32_t csr = RCC->CSR;
+    RCC->CSR |= RCC_CSR_RMVF;
+
+    if (retained.magic != RETAINED_MAGIC || retained.crc != RetainedCrc()) {
+        // Power-on, or a record that did not survive
+        memset(&retained, 0, sizeof(retained));
+    }
+    retained.report.boots++;
+    retained.report.reset_flags = csr;
+    RetainedSeal();
+
+    retained_boot = retained.report;
+#endif
+}
+
+/**
+ * Copy the running statistics into the record every RETAINED_SAVE_MS
+ *
+ * Called from the main loop.
+ */
+void RetainedService(void)
+{
+#if RETAINED_DIAG
+    uint32_t now = PeriphTickMs();
+
+    if (now - last_save_ms < RETAINED_SAVE_MS) {
+        return;
+    }
+    last_save_ms = now;
+
+    LatencySnapshot(&retained.report.latency);
+    RightKeyboardI2CHealthSnapshot(&retained.report.i2c_health);
+    retained.report.saved_tick_ms = now;
+    RetainedSeal();
+#endif
+}
+
+/**
+ * Record an Error_Handler() call, then stop as the recovery policy says
+ *
+ * Returns only without FAULT_RESET and RETAINED_DIAG, Error_Handler() then
+ * spins as generated.
+ *
+ * @param caller Return address of the Error_Handler() call
+ */
+void RetainedError(uint32_t caller)
+{
+#if RETAINED_DIAG
+    __disable_irq();
+    retained.report.errors++;
+    retained.report.error_caller = caller;
+    RetainedSeal();
+#else
+    (void)caller;
+#endif
+#if RETAINED_FAULT_HOOK
+    RetainedStop();
+#endif
+}
+
+#if RETAINED_FAULT_HOOK
+/**
+ * Fault entry, branched to before the handler touches the stack
+ *
+ * Picks the stack the core pushed the exception frame to from EXC_RETURN
+ * in lr and hands it to RetainedFaultRecord().
+ */
+__attribute__((naked, used, externally_visible)) void RetainedFaultEntry(void)
+{
+    __asm volatile(
+        "tst   lr, #4                 \n"
+        "ite   eq                     \n"
+        "mrseq r0, msp                \n"
+        "mrsne r0, psp                \n"
+        "b     RetainedFaultRecord    \n");
+}
+#endif
+
+/**
+ * Copy the record as it was found at boot
+ *
+ * @param report Filled with the record, all zero without RETAINED_DIAG
+ */
+void RetainedSnapshot(RetainedReport *report)
+{
+#if RETAINED_DIAG
+    *report = retained_boot;
+#else
+    memset(report, 0, sizeof(*report));
+#endif
+}
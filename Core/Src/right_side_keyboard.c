@@ -4,73 +4,579 @@
  */
 
 #include "right_side_keyboard.h"
-
+#include "keyboard_layout.h"
+#include "debounce.h"
+#include "key_report.h"
+#include "keymap.h"
+#include "tap_hold.h"
+#include "hid_fragment.h"
+#include "time_sync.h"
+#include "config_store.h"
+#include "fw_update.h"
+#include "encoder.h"
+#include "edge_capture.h"
+#include "pulsed_pullup.h"
+#include "i2c_fault.h"
+#include "led_strip.h"
+#include "clock_css.h"
+#include "sched.h"
+#include "key_events.h"
+#include "event_pack.h"
+#include "timebase.h"
+#include "deep_idle.h"
+#include "dma_sampler.h"
+#include "hot_path.h"
+#include "irq_plan.h"
+#include "scan_rate.h"
+#include "profile.h"
+#include "residency.h"
+#include "latency_stats.h"
+#include "chatter_stats.h"
+#include "trace.h"
+#include "stack_monitor.h"
+#include "bench.h"
+#include "raw_capture.h"
+#include "scan_jitter.h"
+#include "retained.h"
+#include "periph.h"
+#include "usb_hid.h"
 #include <string.h>
 
-// Global keyboard state
-static RightKeyboardState keyboard_state;
-
-// Define the GPIO pins for each key
-// Each key has its own dedicated pin
-static const uint16_t KEY_PINS[NUM_KEYS] = {
-    GPIO_PIN_0, GPIO_PIN_1, GPIO_PIN_2, GPIO_PIN_3,  // Keys 0-3 on GPIOA
-    GPIO_PIN_4, GPIO_PIN_5, GPIO_PIN_6, GPIO_PIN_7,  // Keys 4-7 on GPIOA
-    GPIO_PIN_8, GPIO_PIN_9, GPIO_PIN_10, GPIO_PIN_11, // Keys 8-11 on GPIOA
-    GPIO_PIN_0, GPIO_PIN_1, GPIO_PIN_2, GPIO_PIN_15,  // Keys 12-15 on GPIOB
-    GPIO_PIN_4, GPIO_PIN_5, GPIO_PIN_8, GPIO_PIN_9,   // Keys 16-20 on GPIOB
-    GPIO_PIN_10, GPIO_PIN_12, GPIO_PIN_13, GPIO_PIN_14 // Keys 20-24 on GPIOB
+#if REPORT_INTEGRITY
+#include "crc8.h"
+#endif
+
+#include "transport.h"
+
+// Published keyboard state: one word the scanner writes and the I2C
+// transmitter reads. Bitmap and flags go in with a single store and come out
+// with a single load, so neither side masks interrupts. Each read streams
+// the transmitter's own copy, a publish during a transfer shows in the next.
+static volatile uint32_t  published_report = RIGHT_KEYBOARD_REPORT_KEY_MASK;
+static RightKeyboardState tx_report;        /* frame of the current key read */
+
+// Register map state, see RIGHT_KEYBOARD_REG_* in right_side_keyboard.h
+static volatile uint8_t default_register = RIGHT_KEYBOARD_REG_DEFAULT;
+static volatile uint8_t register_pointer = RIGHT_KEYBOARD_REG_DEFAULT;
+static uint8_t          tx_register;        /* register the current read streams */
+static uint32_t         tx_length;          /* length of the current read frame */
+
+// Event being transmitted, only removed from the queue once fully sent
+static KeyEvent tx_event;
+static bool     tx_event_queued;
+static TapHoldAction tx_action;         /* frame of the current action read */
+static bool     tx_action_queued;
+
+// Event batch register: count byte, then the oldest queued events
+typedef struct __attribute__((packed)) {
+    uint8_t  count;
+    KeyEvent events[REPORT_EVENT_BATCH];
+} EventBatchFrame;
+
+static EventBatchFrame tx_batch;
+
+// Replay register: header, then the events from replay_since on
+typedef struct __attribute__((packed)) {
+    RightKeyboardReplay header;
+    KeyEvent            events[REPORT_EVENT_BATCH];
+} EventReplayFrame;
+
+static EventReplayFrame  tx_replay;
+static volatile uint16_t replay_since;  /* first event of the next replay read */
+
+// Packed event register: the frame, where each event ends in it, and the
+// tick the next frame's first delta starts from
+_Static_assert(1u + REPORT_EVENT_BATCH * EVENT_PACK_EVENT_MAX <= 255u &&
+               REPORT_EVENT_BATCH <= EVENT_PACK_COUNT_MASK, "Packed frame offsets are one byte");
+
+static uint8_t       tx_packed[1u + REPORT_EVENT_BATCH * EVENT_PACK_EVENT_MAX];
+static uint8_t       tx_packed_ends[REPORT_EVENT_BATCH];
+static uint32_t      packed_base;
+static volatile bool packed_absolute = true;
+
+// Bits of the packed key word that belong to a key
+#define KEY_WORD_MASK (0xFFFFFFFFu >> (32 - NUM_KEYS))
+
+// Delta register: bitmap the master acknowledged last, and the one in flight
+static RightKeyboardDelta tx_delta;
+static uint32_t           tx_delta_keys;
+static uint32_t           acked_keys = KEY_WORD_MASK;   /* all released */
+static uint8_t            delta_sequence;
+
+// Counters snapshot taken when the counters register is read
+static RightKeyboardCounters tx_counters;
+
+// I2C link counters, only touched with I2C1 interrupts held off, and the
+// snapshot served from them
+static RightKeyboardI2CHealth i2c_health;
+static RightKeyboardI2CHealth tx_i2c_health;
+
+// Scan rate snapshot taken when the scan rate register is read
+static RightKeyboardScanRate tx_scan_rate;
+
+// Profiling snapshot taken when a profile register is read
+static ProfileStats tx_profile;
+
+// Latency percentiles computed when the latency register is read
+static LatencyReport tx_latency;
+
+// Benchmark results copied when the bench register is read
+static BenchReport tx_bench;
+
+// Fault injection statistics copied when the fault register is read
+static I2CFaultReport tx_fault;
+
+// Residency counters copied when the residency register is read
+static ResidencyReport tx_residency;
+
+// Raw capture frame of the current dump read
+static RawCaptureChunk tx_capture;
+
+// Scan jitter snapshot taken when the jitter register is read
+static ScanJitterReport tx_jitter;
+
+// Retained record served by the retained register
+static RetainedReport tx_retained;
+
+// Chatter table copied when the chatter register is read
+static ChatterKeyStats tx_chatter[NUM_KEYS];
+
+// Debounce profiles copied when the debounce register is read
+static RightKeyboardDebounceProfile tx_debounce[DEBOUNCE_PROFILES];
+
+// Per-key windows copied when the windows register is read
+static uint16_t tx_windows[NUM_KEYS];
+
+// Rollover settings, written by the master through the rollover register
+#if REPORT_TYPE == REPORT_TYPE_NKRO
+static volatile uint8_t rollover_policy = KEY_ROLLOVER_ALL;
+#else
+static volatile uint8_t rollover_policy = REPORT_ROLLOVER;
+#endif
+static volatile uint8_t rollover_max_keys = REPORT_KEY_LIMIT;
+static volatile bool    rollover_changed;
+static KeyPressOrder    press_order;
+
+// Open chord window, the debounced word waits to be published
+static bool     chord_open;
+#if CHORD_WINDOW_US
+static uint32_t chord_start_us;
+#endif
+static RightKeyboardRollover tx_rollover;
+
+// Settings block written by the master, checked on the write and applied
+// by the next scan
+static RightKeyboardSettings settings_write;
+static volatile bool         settings_write_pending;
+static uint8_t               settings_applied;
+static uint8_t               settings_rejected;
+static RightKeyboardSettings tx_settings;
+
+// Keymap frames of the current read
+static KeymapReport tx_codes;
+static uint8_t      tx_layers;
+
+// HID fragment of the current read
+static HidFragment tx_hid;
+
+// Time register frame of the current read
+static TimeSyncReport tx_time;
+
+// Update register frame of the current read
+static FwUpdateStatus tx_update;
+
+// Encoder register frame of the current read
+static EncoderPosition tx_encoder;
+
+// Task accounting of the current read
+static SchedTaskStats tx_tasks[SCHED_TASKS];
+
+#if LED_STRIP_ENABLE
+// LED colours of the current read
+static uint8_t tx_leds[LED_COUNT * 3u];
+#endif
+
+#if KEY_WIRING == KEY_WIRING_HALL
+// Sensor calibration frame of the current read
+static HallKeyState tx_hall[NUM_KEYS];
+#endif
+
+#if KEY_WIRING == KEY_WIRING_HALL && HALL_RAPID_TRIGGER
+#define CAPS_RAPID_TRIGGER RIGHT_KEYBOARD_CAP_RAPID_TRIGGER
+#else
+#define CAPS_RAPID_TRIGGER 0u
+#endif
+
+static const RightKeyboardConfig keyboard_config = {
+    .num_keys = NUM_KEYS,
+    .report_max_keys = REPORT_KEY_LIMIT,
+    .debounce_time_ms = DEBOUNCE_TIME_MS,
+    .report_type = REPORT_TYPE,
+    .scan_mode = SCAN_MODE,
+    .report_bytes = RIGHT_KEYBOARD_REPORT_BYTES,
+    .hid_format = HID_FRAGMENT_FORMAT,
+    .hid_bytes = HID_FRAGMENT_ENABLE ? sizeof(HidFragment) : 0,
+    .board = BOARD,
 };
 
-static GPIO_TypeDef* const KEY_PORTS[NUM_KEYS] = {
-    GPIOA, GPIOA, GPIOA, GPIOA,  // Keys 0-3
-    GPIOA, GPIOA, GPIOA, GPIOA,  // Keys 4-7
-    GPIOA, GPIOA, GPIOA, GPIOA,  // Keys 8-11
-    GPIOB, GPIOB, GPIOB, GPIOB,  // Keys 12-15
-    GPIOB, GPIOB, GPIOB, GPIOB,   // Keys 16-20
-    GPIOB, GPIOB, GPIOB, GPIOB   // Keys 21-24
+static const RightKeyboardCaps keyboard_caps = {
+    .protocol_version = RIGHT_KEYBOARD_PROTOCOL_VERSION,
+    .num_keys = NUM_KEYS,
+    .report_type = REPORT_TYPE,
+    .report_types = (1u << REPORT_TYPE_BITMAP) | (1u << REPORT_TYPE_DELTA) |
+                    (REPORT_RECORDS_EVENTS ? (1u << REPORT_TYPE_EVENTS) | (1u << REPORT_TYPE_EVENT_BATCH) |
+                                             (1u << REPORT_TYPE_PACKED) : 0u) |
+                    (REPORT_TYPE == REPORT_TYPE_NKRO ? 1u << REPORT_TYPE_NKRO : 0u) |
+                    (KEYMAP_ENABLE ? 1u << REPORT_TYPE_KEYCODES : 0u) |
+                    (HID_FRAGMENT_ENABLE ? 1u << REPORT_TYPE_HID : 0u),
+    .transport = LINK_TRANSPORT,
+    .last_register = RIGHT_KEYBOARD_REG_LAST,
+    .event_queue_len = REPORT_RECORDS_EVENTS ? KEY_EVENT_QUEUE_LEN : 0,
+    .event_batch = REPORT_EVENT_BATCH,
+    .debounce_algorithm = DEBOUNCE_ALGORITHM,
+    .timestamp_ns = 1000,
+    .features = (REPORT_INTEGRITY ? RIGHT_KEYBOARD_CAP_INTEGRITY : 0u) |
+                (TIME_SYNC_ENABLE ? RIGHT_KEYBOARD_CAP_TIME_SYNC : 0u) |
+                (CONFIG_STORE_ENABLE ? RIGHT_KEYBOARD_CAP_CONFIG_STORE : 0u) |
+                (FW_UPDATE_ENABLE ? RIGHT_KEYBOARD_CAP_FW_UPDATE : 0u) |
+                (DATA_READY_ENABLE ? RIGHT_KEYBOARD_CAP_DATA_READY : 0u) |
+                (I2C_GENERAL_CALL_SAMPLE ? RIGHT_KEYBOARD_CAP_GENERAL_CALL : 0u) |
+                (TAP_HOLD_ENABLE ? RIGHT_KEYBOARD_CAP_TAP_HOLD : 0u) |
+                (DEBOUNCE_ALGORITHM == DEBOUNCE_ASYMMETRIC ? RIGHT_KEYBOARD_CAP_DEBOUNCE : 0u) |
+                (SCAN_ON_ADDRESS_MATCH ? RIGHT_KEYBOARD_CAP_ADDR_SCAN : 0u) |
+                (USB_HID_ENABLE ? RIGHT_KEYBOARD_CAP_USB_HID : 0u) |
+                (I2C_DIAG_ADDRESS ? RIGHT_KEYBOARD_CAP_DIAG_ADDRESS : 0u) |
+                CAPS_RAPID_TRIGGER |
+                (ENCODER_ENABLE ? RIGHT_KEYBOARD_CAP_ENCODER : 0u) |
+                (LED_STRIP_ENABLE ? RIGHT_KEYBOARD_CAP_LEDS : 0u) |
+                (REPORT_RECORDS_EVENTS && KEY_EVENT_HISTORY_LEN ? RIGHT_KEYBOARD_CAP_REPLAY : 0u) |
+                (EDGE_CAPTURE_ENABLE ? RIGHT_KEYBOARD_CAP_EDGE_CAPTURE : 0u),
+    .features2 = (RESIDENCY_STATS ? RIGHT_KEYBOARD_CAP2_RESIDENCY : 0u) |
+                 (I2C_FAULT_ENABLE ? RIGHT_KEYBOARD_CAP2_FAULT : 0u),
 };
 
+static const uint8_t invalid_register = RIGHT_KEYBOARD_REG_INVALID;
+
+#if REPORT_INTEGRITY
+// Largest payload any register returns
+typedef union {
+    RightKeyboardState    keys;
+    KeyEvent              event;
+    EventBatchFrame       batch;
+    EventReplayFrame      replay;
+    uint8_t               packed[sizeof(tx_packed)];
+    RightKeyboardDelta    delta;
+    RightKeyboardCounters counters;
+    RightKeyboardScanRate scan_rate;
+    ProfileStats          profile;
+    LatencyReport         latency;
+    ChatterKeyStats       chatter[NUM_KEYS];
+    RightKeyboardI2CHealth i2c_health;
+    BenchReport           bench;
+    I2CFaultReport        fault;
+    ResidencyReport       residency;
+    RawCaptureChunk       capture;
+    ScanJitterReport      jitter;
+    RetainedReport        retained;
+    RightKeyboardDebounceProfile debounce[DEBOUNCE_PROFILES];
+    uint16_t              windows[NUM_KEYS];
+    RightKeyboardRollover rollover;
+    KeymapReport          codes;
+    TapHoldAction         action;
+    HidFragment           hid;
+    TimeSyncReport        time;
+    RightKeyboardSettings settings;
+    FwUpdateStatus        update;
+    RightKeyboardConfig   config;
+    RightKeyboardCaps     caps;
+    RightKeyboardPower    power;
+#if KEY_WIRING == KEY_WIRING_HALL
+    HallKeyState          hall[NUM_KEYS];
+#endif
+    EncoderPosition       encoder;
+    SchedTaskStats        tasks[SCHED_TASKS];
+#if LED_STRIP_ENABLE
+    uint8_t               leds[LED_COUNT * 3u];
+#endif
+} RegisterPayload;
+
+// Header plus the copied payload of the current read
+static uint8_t tx_framed[sizeof(RightKeyboardReportHeader) + sizeof(RegisterPayload)];
+static uint8_t report_sequence;
+#endif
+
+// Debounced key word of the last scan (bit n = key n, 1 = released)
+static volatile uint32_t debounced_word = 0xFFFFFFFFu;
+
+// Number of debounce passes since boot
+static volatile uint32_t scan_count;
+
+// Number of scans that changed the debounced state
+static volatile uint32_t key_changes;
+
+// Power state written by the master, left on the next key press
+#define POWER_SUPPORTED ((1u << RIGHT_KEYBOARD_POWER_ACTIVE) | \
+                         (SCAN_MODE == SCAN_MODE_POLL ? 1u << RIGHT_KEYBOARD_POWER_SLOW : 0u) | \
+                         (DEEP_IDLE_ENABLE ? 1u << RIGHT_KEYBOARD_POWER_STOP : 0u))
+static volatile uint8_t power_state;
+static uint8_t          power_resumes;
+static uint8_t          power_rejected;
+static RightKeyboardPower tx_power;
+
+// Raw key word of the last scan, to spot the first sample of an edge
+static uint32_t last_raw_keys = 0xFFFFFFFFu;
+
+// I2C bus recovery: transfers seen, stuck tracking and recovery statistics
+static volatile uint32_t i2c_activity;
+#if LINK_TRANSPORT == LINK_TRANSPORT_I2C
+static uint32_t          stuck_activity;
+static uint32_t          stuck_since;
+static volatile bool     i2c_recovery_requested;
+static volatile uint32_t i2c_fault_tick;
+#endif
+static uint16_t          i2c_recoveries;
+static uint16_t          i2c_recovery_ms;
+
+#if I2C_GENERAL_CALL_SAMPLE
+// Snapshot latched by the general-call sample strobe, served by the next
+// key or delta read
+static uint32_t           latched_report;
+static bool               latched_valid;
+#endif
+
+#if DATA_READY_ENABLE
+// Bumped on every change the master has to see, the data-ready line is
+// only released if no change arrived since the frame was picked
+static volatile uint32_t data_ready_changes;
+static uint32_t          tx_data_ready_changes;
+#endif
+
+#if SCAN_ON_ADDRESS_MATCH
+// Set while a scan runs below the I2C interrupt priority. The address match
+// must not re-enter the debounce state then, it serves the snapshot that
+// scan is about to publish instead.
+static volatile bool scan_running;
+#endif
+
+#if KEY_WIRING == KEY_WIRING_DIRECT
+// Each key has its own dedicated pin, see KEY_MAP in keyboard_layout.h
+_Static_assert(KEY_MAP_COUNT == NUM_KEYS, "KEY_MAP must describe NUM_KEYS keys");
+#endif
+
 // Debounce tracking
-static uint32_t      lockout_until[NUM_KEYS]       = {0};       /* time-stamp of last accepted edge + DEBOUNCE */
-static GPIO_PinState debounced_state[NUM_KEYS]     = {GPIO_PIN_SET};
+#if DEBOUNCE_COUNTS_SAMPLES
+// Every scan is one sample, so the scans have to be evenly spaced
+#if SCAN_MODE == SCAN_MODE_DMA && KEY_WIRING == KEY_WIRING_MATRIX
+#define DEBOUNCE_SAMPLE_US DMA_MATRIX_FRAME_US
+#elif SCAN_MODE == SCAN_MODE_DMA && KEY_WIRING == KEY_WIRING_HALL
+#define DEBOUNCE_SAMPLE_US HALL_FRAME_US
+#elif SCAN_MODE == SCAN_MODE_DMA
+#define DEBOUNCE_SAMPLE_US DMA_SAMPLE_PERIOD_US
+#elif SCAN_MODE == SCAN_MODE_POLL && !SCAN_RATE_ADAPTIVE
+#define DEBOUNCE_SAMPLE_US (SCAN_POLL_INTERVAL_MS * 1000u)
+#else
+#error "Sample-counting debounce needs SCAN_MODE_DMA, or SCAN_MODE_POLL without SCAN_RATE_ADAPTIVE"
+#endif
+#if SCAN_ON_ADDRESS_MATCH || I2C_GENERAL_CALL_SAMPLE
+#error "Sample-counting debounce would take scans from the I2C interrupt as samples"
+#endif
+#endif
+
+#if DEBOUNCE_ALGORITHM == DEBOUNCE_VERTICAL_COUNTER
+// Scans a key must hold its new level for, the counters are 2 bits wide
+#define DEBOUNCE_VERTICAL_SAMPLES 4u
+_Static_assert(DEBOUNCE_VERTICAL_SAMPLES * DEBOUNCE_SAMPLE_US <= UINT16_MAX,
+               "Vertical counter window above 65535 us, lower the scan period");
+
+static VerticalCounter vertical_counter = { 0xFFFFFFFFu, 0xFFFFFFFFu, 0xFFFFFFFFu };
+#elif DEBOUNCE_ALGORITHM == DEBOUNCE_ASYMMETRIC
+static AsymDebounce asym_debounce;
+
+// Profile written by the master, applied by the next scan
+static RightKeyboardDebounceProfile debounce_write;
+static uint8_t                      debounce_write_index;
+static volatile bool                debounce_write_pending;
+#elif DEBOUNCE_ALGORITHM == DEBOUNCE_ADAPTIVE
+static AdaptiveDebounce adaptive_debounce;
+#elif DEBOUNCE_ALGORITHM == DEBOUNCE_INTEGRATOR
+#ifndef DEBOUNCE_INTEGRATOR_SAMPLES
+#define DEBOUNCE_INTEGRATOR_SAMPLES ((DEBOUNCE_TIME_MS * 1000u + DEBOUNCE_SAMPLE_US - 1u) / DEBOUNCE_SAMPLE_US)
+#endif
+_Static_assert(DEBOUNCE_INTEGRATOR_SAMPLES >= 1 && DEBOUNCE_INTEGRATOR_SAMPLES <= 255,
+               "DEBOUNCE_INTEGRATOR_SAMPLES out of range, lower the window or the scan rate");
+
+static IntegratorDebounce integrator_debounce;
+#elif DEBOUNCE_ALGORITHM == DEBOUNCE_SAMPLE_COUNT
+#ifndef DEBOUNCE_PRESS_SAMPLES
+#define DEBOUNCE_PRESS_SAMPLES ((DEBOUNCE_PRESS_MS * 1000u + DEBOUNCE_SAMPLE_US - 1u) / DEBOUNCE_SAMPLE_US)
+#endif
+#ifndef DEBOUNCE_RELEASE_SAMPLES
+#define DEBOUNCE_RELEASE_SAMPLES ((DEBOUNCE_RELEASE_MS * 1000u + DEBOUNCE_SAMPLE_US - 1u) / DEBOUNCE_SAMPLE_US)
+#endif
+_Static_assert(DEBOUNCE_PRESS_SAMPLES >= 1 && DEBOUNCE_PRESS_SAMPLES <= SAMPLE_DEBOUNCE_MAX,
+               "DEBOUNCE_PRESS_SAMPLES out of range, lower the window or the scan rate");
+_Static_assert(DEBOUNCE_RELEASE_SAMPLES >= 1 && DEBOUNCE_RELEASE_SAMPLES <= SAMPLE_DEBOUNCE_MAX,
+               "DEBOUNCE_RELEASE_SAMPLES out of range, lower the window or the scan rate");
+
+static SampleDebounce sample_debounce;
+#else
+static LockoutDebounce lockout;
+#endif
+
+#if SCAN_MODE == SCAN_MODE_EXTI
+// Set by an edge interrupt, cleared once a scan finds every key stable
+static volatile bool scan_burst_active = true;
+
+// EXTI lines are shared between ports (PA0/PB0 both use line 0), so the
+// port B keys on a port A line (KEY_POLLED_B) are checked on every wake instead
+static uint32_t last_raw_b;
+#elif SCAN_MODE == SCAN_MODE_POLL
+// Time of the next periodic scan in microseconds, see scan_rate.h
+static uint32_t next_poll_us;
+static uint32_t poll_interval_us;   /* the one next_poll_us was set with */
+#endif
 
-// I2C handle from main.c
-extern I2C_HandleTypeDef hi2c1;
+static uint32_t ReadRawKeys(void);
+static bool ScanFromKeys(uint32_t raw_keys, uint32_t now);
+static bool ScanGuarded(uint32_t raw_keys, uint32_t now);
+#if DATA_READY_ENABLE
+static void DataReadySignal(void);
+static void DataReadyAcknowledge(void);
+#endif
+static void PublishReport(uint32_t debounced_keys);
+static uint32_t SelectRegisterFrame(const uint8_t **frame);
+static void CompleteRegisterFrame(uint32_t bytes_sent);
+static void WriteRegisters(const uint8_t *data, uint32_t len);
+static void GeneralCall(const uint8_t *data, uint32_t len);
+static inline bool IsReportRegister(uint8_t reg);
+static void SettingsSnapshot(RightKeyboardSettings *settings);
+static void SettingsWrite(const uint8_t *data);
+static void SettingsApply(void);
+static uint32_t ReportForRead(void);
+static void I2CCountErrors(uint32_t errors);
+#if LINK_TRANSPORT == LINK_TRANSPORT_I2C
+static bool I2CBusStuck(uint32_t now);
+static void I2CRecover(uint32_t now);
+#endif
+static uint32_t BuildReport(uint32_t debounced_keys, uint8_t max_keys);
+#if TIME_SYNC_ENABLE
+static void EventTimesToMaster(KeyEvent *events, uint32_t count);
+#endif
+static void DebounceSeed(uint32_t raw_keys);
+static uint32_t DebounceActive(uint32_t raw_keys);
+#if REPORT_RECORDS_EVENTS && ENCODER_ENABLE
+static void ScanEncoder(uint32_t now);
+#endif
+static void ConfigRestore(void);
 
 bool RightKeyboardInit(void)
 {
-    GPIO_InitTypeDef GPIO_InitStruct = {0};
+    // Clear the keyboard state, all keys not pressed (1 = not pressed)
+    published_report = RIGHT_KEYBOARD_REPORT_KEY_MASK;
     
-    // Clear the keyboard state
-    for (int i = 0; i < sizeof(keyboard_state.key_states); i++) {
-        keyboard_state.key_states[i] = 0xFF; // All keys not pressed (1 = not pressed)
+    // Configure all key pins as inputs with pull-up: one MODER and one
+    // PUPDR write per port (00 = input, 01 = pull-up)
+    TimebaseInit();
+#if KEY_WIRING == KEY_WIRING_MATRIX
+    MatrixInit();
+#elif KEY_WIRING == KEY_WIRING_HALL
+    // Sensors read as released until the sampler seeded their rest levels
+    if (!HallInit()) {
+        return false;
     }
+#else
+    GPIOA->MODER &= ~KEY_FIELD2_A;
+    GPIOB->MODER &= ~KEY_FIELD2_B;
+    GPIOA->PUPDR = (GPIOA->PUPDR & ~KEY_FIELD2_A) | (KEY_FIELD2_A & 0x55555555u);
+    GPIOB->PUPDR = (GPIOB->PUPDR & ~KEY_FIELD2_B) | (KEY_FIELD2_B & 0x55555555u);
+#endif
+    uint32_t pullups_settled = TimebaseNowUs() + KEY_PULLUP_SETTLE_US;
+    EncoderInit();
+
+#if SCAN_MODE == SCAN_MODE_EXTI
+    // Line routing from KEY_MAP, port B keys behind a port A line are polled
+    __HAL_RCC_SYSCFG_CLK_ENABLE();
+    SYSCFG->EXTICR[0] = (SYSCFG->EXTICR[0] & ~KEY_EXTICR_MASK(0)) | KEY_EXTICR_VALUE(0);
+    SYSCFG->EXTICR[1] = (SYSCFG->EXTICR[1] & ~KEY_EXTICR_MASK(1)) | KEY_EXTICR_VALUE(1);
+    SYSCFG->EXTICR[2] = (SYSCFG->EXTICR[2] & ~KEY_EXTICR_MASK(2)) | KEY_EXTICR_VALUE(2);
+    SYSCFG->EXTICR[3] = (SYSCFG->EXTICR[3] & ~KEY_EXTICR_MASK(3)) | KEY_EXTICR_VALUE(3);
+    EXTI->RTSR |= KEY_EXTI_LINES;
+    EXTI->FTSR |= KEY_EXTI_LINES;
+    EXTI->PR = KEY_EXTI_LINES;
+    EXTI->IMR |= KEY_EXTI_LINES;
+#endif
     
-    // Configure all key pins as inputs with pull-up
-    for (int i = 0; i < NUM_KEYS; i++) {
-        GPIO_InitStruct.Pin = KEY_PINS[i];
-        GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
-        GPIO_InitStruct.Pull = GPIO_PULLUP;
-        GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
-        HAL_GPIO_Init(KEY_PORTS[i], &GPIO_InitStruct);
+#if DATA_READY_ENABLE
+    // Data-ready line, released (high-Z) until the first change
+    GPIO_InitTypeDef GPIO_InitStruct = {0};
+    HAL_GPIO_WritePin(DATA_READY_PORT, DATA_READY_PIN, GPIO_PIN_SET);
+    GPIO_InitStruct.Pin = DATA_READY_PIN;
+    GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_OD;
+    GPIO_InitStruct.Pull = GPIO_NOPULL;
+    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
+    HAL_GPIO_Init(DATA_READY_PORT, &GPIO_InitStruct);
+#endif
+
+    // I2C1 already runs with the own address and general-call setting from
+    // MX_I2C1_Init(), it only has to start listening below
+
+    // Seed the debounce state straight from the pins, so keys held while
+    // the half is plugged in show up in the very first report instead of
+    // after a lockout window. As the USB keyboard nothing caps the report.
+    if (UsbHidRoleSelected()) {
+        rollover_max_keys = 0;
     }
-    
-    // Set up I2C in slave mode with the correct address
-    // Note: The I2C initialization is done in MX_I2C1_Init() in main.c
-    // We just need to set the slave address
-    hi2c1.Init.OwnAddress1 = RIGHT_KEYBOARD_I2C_ADDRESS << 1; // Shift left because HAL expects 7-bit address in upper bits
-    if (HAL_I2C_Init(&hi2c1) != HAL_OK) {
+    while (!TimebaseReached(TimebaseNowUs(), pullups_settled)) {
+    }
+    PulsedPullupInit();
+    uint32_t raw_keys = ReadRawKeys();
+    DebounceSeed(raw_keys);
+    EdgeCaptureInit(raw_keys);
+    ConfigRestore();
+    ScanFromKeys(raw_keys, TimebaseNowUs());
+#if SCAN_MODE == SCAN_MODE_POLL
+    ScanRateInit(TimebaseNowUs());
+    next_poll_us = TimebaseNowUs();
+#endif
+
+#if SCAN_MODE == SCAN_MODE_DMA && KEY_WIRING == KEY_WIRING_HALL
+    // Hand sampling over to TIM3/ADC1/DMA
+    if (!HallStart()) {
         return false;
     }
+#elif SCAN_MODE == SCAN_MODE_DMA
+    // Hand sampling over to TIM1/DMA2
+    if (!DmaSamplerInit() || !DmaSamplerStart()) {
+        return false;
+    }
+#endif
     
-    // Update the keyboard state with initial scan
-    RightKeyboardScan6KRO(&keyboard_state, 6);
-    
-    // Start listening for I2C master requests by setting up the transmit buffer
-    // This ensures the slave is ready to respond when the master initiates a read request
-    if (HAL_I2C_Slave_Transmit_IT(&hi2c1, (uint8_t*)&keyboard_state, sizeof(keyboard_state)) != HAL_OK) {
+    // Start listening for master requests, every address match (or UART
+    // request) selects the frame for the register the master asked for,
+    // or enumerate as a keyboard with VBUS present
+    if (UsbHidRoleSelected()) {
+        UsbHidStart();
+    } else if (!TransportStart()) {
         return false;
     }
+
+#if SCAN_MODE == SCAN_MODE_EXTI
+    // Below the I2C interrupts, edges only have to wake the main loop
+    HAL_NVIC_SetPriority(EXTI0_IRQn, IRQ_PRIO_WAKE, 0);
+    HAL_NVIC_EnableIRQ(EXTI0_IRQn);
+    HAL_NVIC_SetPriority(EXTI1_IRQn, IRQ_PRIO_WAKE, 0);
+    HAL_NVIC_EnableIRQ(EXTI1_IRQn);
+    HAL_NVIC_SetPriority(EXTI2_IRQn, IRQ_PRIO_WAKE, 0);
+    HAL_NVIC_EnableIRQ(EXTI2_IRQn);
+    HAL_NVIC_SetPriority(EXTI3_IRQn, IRQ_PRIO_WAKE, 0);
+    HAL_NVIC_EnableIRQ(EXTI3_IRQn);
+    HAL_NVIC_SetPriority(EXTI4_IRQn, IRQ_PRIO_WAKE, 0);
+    HAL_NVIC_EnableIRQ(EXTI4_IRQn);
+    HAL_NVIC_SetPriority(EXTI9_5_IRQn, IRQ_PRIO_WAKE, 0);
+    HAL_NVIC_EnableIRQ(EXTI9_5_IRQn);
+    HAL_NVIC_SetPriority(EXTI15_10_IRQn, IRQ_PRIO_WAKE, 0);
+    HAL_NVIC_EnableIRQ(EXTI15_10_IRQn);
+#endif
     
     return true;
 }
@@ -85,96 +591,1673 @@ void RightKeyboardScan(RightKeyboardState *state)
 }
 
 /**
- * Optimized keyboard scan function with early-exit capability for 6KRO
+ * Keyboard scan function with a 6KRO-style report limit
+ *
+ * Scanning runs in the caller's context (the main loop) and publishes the
+ * snapshot the I2C ISR sends. In SCAN_MODE_DMA the pins are sampled by the
+ * DMA engine, so this only builds the report from the latest samples.
  *
- * @param state Pointer to keyboard state structure to fill
- * @param max_keys Maximum number of keys to scan for (0 means scan all)
+ * @param state Keyboard state structure to fill, flags taken from the
+ *              published snapshot, or NULL when the caller only needs the
+ *              published snapshot (the I2C ISR sends that as it is)
+ * @param max_keys Maximum number of keys to report as pressed (0 means all)
  */
 void RightKeyboardScan6KRO(RightKeyboardState *state, uint8_t max_keys) {
-    if (!state) return;
+    RESIDENCY_ENTER();
+    PROFILE_BEGIN(PROFILE_SCAN);
+
+#if SCAN_MODE == SCAN_MODE_EXTI
+    // Clear before scanning so an edge arriving mid-scan keeps the burst alive
+    scan_burst_active = false;
+    TRACE(TRACE_SCAN_BEGIN, 1);
+    uint32_t raw_a = GPIOA->IDR;
+    last_raw_b = GPIOB->IDR;
+    bool settled = ScanGuarded(KEY_GATHER(raw_a, last_raw_b), TimebaseNowUs());
+    if (!settled) {
+        scan_burst_active = true;
+    }
+    TRACE(TRACE_SCAN_END, settled);
+#elif SCAN_MODE == SCAN_MODE_POLL
+    // Optimize port access - cache GPIOx->IDR register values. The next
+    // scan comes sooner while keys are moving, TIM5 wakes the main loop
+    // for intervals below the HAL tick.
+    TRACE(TRACE_SCAN_BEGIN, 1);
+    uint32_t now = TimebaseNowUs();
+#if SCAN_JITTER_STATS
+    ScanJitterRecord(now, poll_interval_us);
+#endif
+    bool settled = ScanGuarded(ReadRawKeys(), now);
+    TRACE(TRACE_SCAN_END, settled);
+    poll_interval_us = ScanRateUpdate(settled, now);
+    if (power_state == RIGHT_KEYBOARD_POWER_SLOW && settled) {
+        // Host suspended, the first bounce of a press brings the fast rate back
+        uint32_t fast_us;
+        ScanRateIntervals(&fast_us, &poll_interval_us);
+    }
+    next_poll_us = now + poll_interval_us;
+    TimebaseWakeAt(next_poll_us);
+#endif
 
-    uint32_t now = HAL_GetTick();
-    uint8_t pressed_count = 0;
+    if (state) {
+        state->word = BuildReport(debounced_word, max_keys) |
+                      (published_report & ~RIGHT_KEYBOARD_REPORT_KEY_MASK);
+    }
+    PROFILE_END(PROFILE_SCAN);
+    RESIDENCY_EXIT(RESIDENCY_SCAN);
+}
 
-    /* start with "all released" */
-    memset(state->key_states, 0xFF, sizeof(state->key_states));
+/**
+ * Check whether the main loop has scanning work to do
+ *
+ * In SCAN_MODE_EXTI this is true while a burst started by a key edge is
+ * still running, or when one of the keys without its own EXTI line moved.
+ * SCAN_MODE_POLL wants a scan once the interval picked by scan_rate.c is
+ * over (SCAN_POLL_INTERVAL_MS without SCAN_RATE_ADAPTIVE); SCAN_MODE_DMA
+ * never does, the sampler interrupt scans on its own.
+ *
+ * @return true if RightKeyboardScan6KRO() should run before sleeping
+ */
+bool RightKeyboardScanPending(void)
+{
+#if SCAN_MODE == SCAN_MODE_EXTI
+    return scan_burst_active || ((GPIOB->IDR ^ last_raw_b) & KEY_POLLED_B);
+#elif SCAN_MODE == SCAN_MODE_POLL
+    return TimebaseReached(TimebaseNowUs(), next_poll_us);
+#else
+    return false;
+#endif
+}
+
+/**
+ * Make the main loop scan all keys before it sleeps again
+ *
+ * Used after deep idle, when some keys had no edge interrupt, after a
+ * master write the next scan has to apply, and by a captured key edge
+ * (edge_capture.h), which may interrupt the main loop.
+ */
+void RightKeyboardScanRequest(void)
+{
+#if SCAN_MODE == SCAN_MODE_EXTI
+    scan_burst_active = true;
+#elif SCAN_MODE == SCAN_MODE_POLL
+    next_poll_us = TimebaseNowUs();
+#endif
+}
+
+/**
+ * Get a counter that moves on every key change and every I2C transfer
+ *
+ * Only differences between two calls carry meaning, e.g. for the clock
+ * governor to tell "busy" from "idle".
+ *
+ * @return Activity count, wraps
+ */
+uint32_t RightKeyboardActivity(void)
+{
+    return key_changes + i2c_activity;
+}
+
+/**
+ * Get the power state the master asked for, RIGHT_KEYBOARD_POWER_*
+ */
+uint8_t RightKeyboardPowerState(void)
+{
+    return power_state;
+}
+
+/**
+ * Feed a batch of captured IDR samples through the debounce and report logic
+ *
+ * Called from the DMA half/full-transfer interrupts with one half of the
+ * sample ring. Samples are processed oldest first so every edge is seen,
+ * each stamped with its own time on the sampling grid.
+ *
+ * @param idr_a GPIOA->IDR samples
+ * @param idr_b GPIOB->IDR samples taken on the same timer tick
+ * @param count Number of samples in each array
+ */
+HOT_PATH void RightKeyboardProcessSamples(const uint16_t *idr_a, const uint16_t *idr_b, uint32_t count)
+{
+    // The newest sample was taken just now, the others one period apart
+    uint32_t now = TimebaseNowUs();
+    uint32_t stamp = now - (count - 1u) * DMA_SAMPLE_PERIOD_US;
+    bool settled = true;
+    RESIDENCY_ENTER();
+
+#if SCAN_JITTER_STATS
+    ScanJitterRecord(now, count * DMA_SAMPLE_PERIOD_US);
+#endif
+
+    TRACE(TRACE_SCAN_BEGIN, count);
+    for (uint32_t n = 0; n < count; ++n) {
+        settled = ScanGuarded(KEY_GATHER(idr_a[n], idr_b[n]), stamp);
+        stamp += DMA_SAMPLE_PERIOD_US;
+    }
+    TRACE(TRACE_SCAN_END, settled);
+    (void)settled;
+    RESIDENCY_EXIT(RESIDENCY_SCAN);
+}
+
+#if KEY_WIRING == KEY_WIRING_MATRIX
+/**
+ * Feed a batch of captured matrix frames through the debounce and report logic
+ *
+ * Called from the DMA half/full-transfer interrupts. Every frame holds one
+ * row reading per column, oldest frame first.
+ *
+ * @param rows MATRIX_ROW_PORT->IDR samples, MATRIX_COLS per frame
+ * @param frames Number of complete frames
+ */
+HOT_PATH void RightKeyboardProcessMatrix(const uint16_t *rows, uint32_t frames)
+{
+    uint32_t now = TimebaseNowUs();
+    uint32_t stamp = now - (frames - 1u) * DMA_MATRIX_FRAME_US;
+    bool settled = true;
+    RESIDENCY_ENTER();
 
-    // Optimize port access - cache GPIOx->IDR register values
-    uint32_t gpio_a_state = GPIOA->IDR;
-    uint32_t gpio_b_state = GPIOB->IDR;
+#if SCAN_JITTER_STATS
+    ScanJitterRecord(now, frames * DMA_MATRIX_FRAME_US);
+#endif
 
-    // For each GPIO port (A and B), we'll batch process the keys
-    // This reduces individual HAL_GPIO_ReadPin calls with direct bit testing
-    for (int i = 0; i < NUM_KEYS; ++i) {
-        // 1) Sample the raw pin (direct bit testing instead of HAL call)
-        GPIO_PinState raw;
-        if (KEY_PORTS[i] == GPIOA) {
-            raw = (gpio_a_state & KEY_PINS[i]) ? GPIO_PIN_SET : GPIO_PIN_RESET;
-        } else { // GPIOB
-            raw = (gpio_b_state & KEY_PINS[i]) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+    TRACE(TRACE_SCAN_BEGIN, frames);
+    for (uint32_t n = 0; n < frames; ++n) {
+        settled = ScanGuarded(MatrixGather(&rows[n * MATRIX_COLS]), stamp);
+        stamp += DMA_MATRIX_FRAME_US;
+    }
+    TRACE(TRACE_SCAN_END, settled);
+    (void)settled;
+    RESIDENCY_EXIT(RESIDENCY_SCAN);
+}
+#endif
+
+#if KEY_WIRING == KEY_WIRING_HALL
+/**
+ * Feed a batch of Hall sensor frames through the debounce and report logic
+ *
+ * Called from the ADC DMA half/full-transfer interrupt once the sensor
+ * engine thresholded every frame, oldest first.
+ *
+ * @param keys Key word of each frame (1 = released)
+ * @param frames Number of frames
+ */
+HOT_PATH void RightKeyboardProcessHall(const uint32_t *keys, uint32_t frames)
+{
+    uint32_t now = TimebaseNowUs();
+    uint32_t stamp = now - (frames - 1u) * HALL_FRAME_US;
+    bool settled = true;
+    RESIDENCY_ENTER();
+
+#if SCAN_JITTER_STATS
+    ScanJitterRecord(now, frames * HALL_FRAME_US);
+#endif
+
+    TRACE(TRACE_SCAN_BEGIN, frames);
+    for (uint32_t n = 0; n < frames; ++n) {
+        settled = ScanGuarded(keys[n], stamp);
+        stamp += HALL_FRAME_US;
+    }
+    TRACE(TRACE_SCAN_END, settled);
+    (void)settled;
+    RESIDENCY_EXIT(RESIDENCY_SCAN);
+}
+#endif
+
+/**
+ * Run a scan that the I2C address match interrupt may preempt
+ *
+ * With SCAN_ON_ADDRESS_MATCH the I2C interrupt scans too, the flag keeps
+ * it out of the debounce state while this scan is still running.
+ */
+HOT_PATH static bool ScanGuarded(uint32_t raw_keys, uint32_t now)
+{
+#if SCAN_ON_ADDRESS_MATCH
+    scan_running = true;
+    __COMPILER_BARRIER();
+    bool settled = ScanFromKeys(raw_keys, now);
+    __COMPILER_BARRIER();
+    scan_running = false;
+    return settled;
+#else
+    return ScanFromKeys(raw_keys, now);
+#endif
+}
+
+/**
+ * Read the raw key word from the pins
+ *
+ * Direct wiring packs both IDR snapshots, with PULSED_PULLUP_ENABLE taken
+ * inside one pull-up pulse; a matrix is strobed once by the CPU.
+ *
+ * @return Packed key word (bit n = key n, 1 = released)
+ */
+HOT_PATH static uint32_t ReadRawKeys(void)
+{
+#if KEY_WIRING == KEY_WIRING_MATRIX
+    return MatrixScan();
+#elif KEY_WIRING == KEY_WIRING_HALL
+    return HallKeys();
+#elif PULSED_PULLUP_ENABLE
+    return PulsedPullupSample();
+#else
+    return KEY_GATHER(GPIOA->IDR, GPIOB->IDR);
+#endif
+}
+
+/**
+ * Start the debounce engine at a raw key word, with no lockout running
+ *
+ * @param raw_keys Packed key word (bit n = key n, 1 = released)
+ */
+static void DebounceSeed(uint32_t raw_keys)
+{
+#if DEBOUNCE_ALGORITHM == DEBOUNCE_VERTICAL_COUNTER
+    VerticalCounterInit(&vertical_counter, raw_keys);
+#elif DEBOUNCE_ALGORITHM == DEBOUNCE_ASYMMETRIC
+    AsymDebounceInit(&asym_debounce, raw_keys & KEY_WORD_MASK,
+                     DEBOUNCE_PRESS_POLICY == DEBOUNCE_EAGER, DEBOUNCE_PRESS_MS * 1000u,
+                     DEBOUNCE_RELEASE_POLICY == DEBOUNCE_EAGER, DEBOUNCE_RELEASE_MS * 1000u);
+#define DEBOUNCE_PROFILE_APPLY(index, keys, press_policy, press_us, release_policy, release_us) \
+    _Static_assert((index) < DEBOUNCE_PROFILES, "DEBOUNCE_PROFILE_TABLE uses profile " #index); \
+    AsymDebounceSetProfile(&asym_debounce, (index), (keys) & KEY_WORD_MASK, \
+                           (press_policy) == DEBOUNCE_EAGER, (press_us), \
+                           (release_policy) == DEBOUNCE_EAGER, (release_us));
+    DEBOUNCE_PROFILE_TABLE(DEBOUNCE_PROFILE_APPLY)
+#undef DEBOUNCE_PROFILE_APPLY
+#elif DEBOUNCE_ALGORITHM == DEBOUNCE_ADAPTIVE
+    AdaptiveDebounceInit(&adaptive_debounce, raw_keys & KEY_WORD_MASK, DEBOUNCE_TIME_MS * 1000u,
+                         DEBOUNCE_ADAPTIVE_MIN_US, DEBOUNCE_ADAPTIVE_MAX_US, DEBOUNCE_ADAPTIVE_MARGIN_US);
+#elif DEBOUNCE_ALGORITHM == DEBOUNCE_SAMPLE_COUNT
+    SampleDebounceInit(&sample_debounce, raw_keys & KEY_WORD_MASK, DEBOUNCE_PRESS_SAMPLES, DEBOUNCE_RELEASE_SAMPLES);
+#elif DEBOUNCE_ALGORITHM == DEBOUNCE_INTEGRATOR
+    IntegratorDebounceInit(&integrator_debounce, raw_keys & KEY_WORD_MASK, DEBOUNCE_INTEGRATOR_SAMPLES);
+#else
+    LockoutDebounceInit(&lockout, raw_keys & KEY_WORD_MASK, DEBOUNCE_TIME_MS * 1000u);
+#endif
+}
+
+/**
+ * Get the keys the debounce engine still has work for
+ *
+ * @param raw_keys Packed key word (bit n = key n, 1 = released)
+ * @return Keys whose raw level is not accepted yet or whose lockout,
+ *         window or counter runs
+ */
+HOT_PATH static inline uint32_t DebounceActive(uint32_t raw_keys)
+{
+#if DEBOUNCE_ALGORITHM == DEBOUNCE_VERTICAL_COUNTER
+    return VerticalCounterActive(&vertical_counter, raw_keys);
+#elif DEBOUNCE_ALGORITHM == DEBOUNCE_ASYMMETRIC
+    return AsymDebounceActive(&asym_debounce, raw_keys);
+#elif DEBOUNCE_ALGORITHM == DEBOUNCE_ADAPTIVE
+    return AdaptiveDebounceActive(&adaptive_debounce, raw_keys);
+#elif DEBOUNCE_ALGORITHM == DEBOUNCE_SAMPLE_COUNT
+    return SampleDebounceActive(&sample_debounce, raw_keys);
+#elif DEBOUNCE_ALGORITHM == DEBOUNCE_INTEGRATOR
+    return IntegratorDebounceActive(&integrator_debounce, raw_keys);
+#else
+    return LockoutDebounceActive(&lockout, raw_keys);
+#endif
+}
+
+#if DEBOUNCE_ALGORITHM == DEBOUNCE_ASYMMETRIC
+/**
+ * Apply the profile the master wrote
+ *
+ * Runs with interrupts masked so a second write can't tear the staged
+ * profile and a register read never sees the engine halfway through.
+ */
+static void DebounceApplyWrite(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    const RightKeyboardDebounceProfile *p = &debounce_write;
+    if (AsymDebounceSetProfile(&asym_debounce, debounce_write_index, p->keys & KEY_WORD_MASK,
+                               (p->flags & RIGHT_KEYBOARD_DEBOUNCE_PRESS_DEFERRED) == 0, p->press_us,
+                               (p->flags & RIGHT_KEYBOARD_DEBOUNCE_RELEASE_DEFERRED) == 0, p->release_us)) {
+        ConfigStoreSet((ConfigKey)(CONFIG_KEY_DEBOUNCE + debounce_write_index), p, sizeof(*p));
+    }
+    debounce_write_pending = false;
+    __set_PRIMASK(primask);
+}
+#endif
+
+/**
+ * Bring back the settings and debounce profiles the master stored
+ *
+ * Runs once from RightKeyboardInit(), after the debounce state is seeded.
+ * Stored values go through the same checks as a master write, so a value
+ * this build can't take is dropped.
+ */
+static void ConfigRestore(void)
+{
+    RightKeyboardSettings settings;
+    if (ConfigStoreGet(CONFIG_KEY_SETTINGS, &settings, sizeof(settings) - 2u)) {
+        SettingsWrite((const uint8_t *)&settings);
+    }
+#if DEBOUNCE_ALGORITHM == DEBOUNCE_ASYMMETRIC
+    for (uint32_t i = 0; i < DEBOUNCE_PROFILES; i++) {
+        if (ConfigStoreGet((ConfigKey)(CONFIG_KEY_DEBOUNCE + i), &debounce_write, sizeof(debounce_write))) {
+            debounce_write_index = (uint8_t)i;
+            DebounceApplyWrite();
         }
+    }
+#endif
+}
 
-        // 2) Immediate edge + lock-out debounce
-        //    - Accept any transition (press or release) instantly
-        //    - Then ignore further changes for DEBOUNCE_TIME_MS
-        if (raw != debounced_state[i] && now >= lockout_until[i]) {
-            debounced_state[i] = raw;
-            lockout_until[i] = now + DEBOUNCE_TIME_MS;
+/**
+ * Copy the debounce profiles for the debounce register
+ *
+ * The fixed engines show up as a single profile with their equivalent
+ * policy, the vertical counter as deferred/deferred over its 4 ticks. The
+ * adaptive engine has no shared window, its profile shows 0 and the
+ * windows register has the per-key ones.
+ *
+ * @param profiles DEBOUNCE_PROFILES entries, unused ones all zero
+ */
+static void DebounceProfileSnapshot(RightKeyboardDebounceProfile *profiles)
+{
+    memset(profiles, 0, DEBOUNCE_PROFILES * sizeof(*profiles));
+#if DEBOUNCE_ALGORITHM == DEBOUNCE_ASYMMETRIC
+    for (uint32_t i = 0; i < DEBOUNCE_PROFILES; i++) {
+        const DebounceProfile *profile = &asym_debounce.profile[i];
+        profiles[i].keys = profile->keys & KEY_WORD_MASK;
+        if (profiles[i].keys & ~asym_debounce.press_eager) {
+            profiles[i].flags |= RIGHT_KEYBOARD_DEBOUNCE_PRESS_DEFERRED;
+        }
+        if (profiles[i].keys & ~asym_debounce.release_eager) {
+            profiles[i].flags |= RIGHT_KEYBOARD_DEBOUNCE_RELEASE_DEFERRED;
         }
+        profiles[i].press_us = profile->press_us;
+        profiles[i].release_us = profile->release_us;
+    }
+#elif DEBOUNCE_ALGORITHM == DEBOUNCE_VERTICAL_COUNTER
+    profiles[0].keys = KEY_WORD_MASK;
+    profiles[0].flags = RIGHT_KEYBOARD_DEBOUNCE_PRESS_DEFERRED | RIGHT_KEYBOARD_DEBOUNCE_RELEASE_DEFERRED;
+    profiles[0].press_us = DEBOUNCE_VERTICAL_SAMPLES * DEBOUNCE_SAMPLE_US;
+    profiles[0].release_us = DEBOUNCE_VERTICAL_SAMPLES * DEBOUNCE_SAMPLE_US;
+#elif DEBOUNCE_ALGORITHM == DEBOUNCE_ADAPTIVE
+    profiles[0].keys = KEY_WORD_MASK;
+#elif DEBOUNCE_ALGORITHM == DEBOUNCE_SAMPLE_COUNT
+    profiles[0].keys = KEY_WORD_MASK;
+    profiles[0].flags = RIGHT_KEYBOARD_DEBOUNCE_PRESS_DEFERRED | RIGHT_KEYBOARD_DEBOUNCE_RELEASE_DEFERRED;
+    profiles[0].press_us = DEBOUNCE_PRESS_SAMPLES * DEBOUNCE_SAMPLE_US;
+    profiles[0].release_us = DEBOUNCE_RELEASE_SAMPLES * DEBOUNCE_SAMPLE_US;
+#elif DEBOUNCE_ALGORITHM == DEBOUNCE_INTEGRATOR
+    profiles[0].keys = KEY_WORD_MASK;
+    profiles[0].flags = RIGHT_KEYBOARD_DEBOUNCE_PRESS_DEFERRED | RIGHT_KEYBOARD_DEBOUNCE_RELEASE_DEFERRED;
+    profiles[0].press_us = DEBOUNCE_INTEGRATOR_SAMPLES * DEBOUNCE_SAMPLE_US;
+    profiles[0].release_us = DEBOUNCE_INTEGRATOR_SAMPLES * DEBOUNCE_SAMPLE_US;
+#else
+    profiles[0].keys = KEY_WORD_MASK;
+    profiles[0].press_us = DEBOUNCE_TIME_MS * 1000u;
+    profiles[0].release_us = DEBOUNCE_TIME_MS * 1000u;
+#endif
+}
+
+/**
+ * Copy the lockout window of every key for the windows register
+ *
+ * Runs in the I2C interrupt, a key caught in the middle of a scan shows
+ * its window from before or after that scan.
+ *
+ * @param windows NUM_KEYS entries in microseconds, the window the next
+ *                accepted edge gets; all zero for the engines without one
+ */
+static void DebounceWindowSnapshot(uint16_t *windows)
+{
+    for (uint32_t key = 0; key < NUM_KEYS; key++) {
+#if DEBOUNCE_ALGORITHM == DEBOUNCE_ADAPTIVE
+        windows[key] = (uint16_t)AdaptiveDebounceWindow(&adaptive_debounce, key);
+#elif DEBOUNCE_ALGORITHM == DEBOUNCE_LOCKOUT
+        windows[key] = lockout.lockout_us;
+#else
+        windows[key] = 0;
+#endif
+    }
+}
+
+/**
+ * Copy the live settings for the settings register
+ *
+ * @param settings Block as the master writes it back
+ */
+static void SettingsSnapshot(RightKeyboardSettings *settings)
+{
+    memset(settings, 0, sizeof(*settings));
+    settings->default_register = default_register;
+    settings->rollover_policy = rollover_policy;
+    settings->rollover_max_keys = rollover_max_keys;
+#if SCAN_MODE == SCAN_MODE_POLL
+    _Static_assert(SCAN_POLL_INTERVAL_MS * 1000u <= UINT16_MAX, "scan_slow_us holds at most 65 ms");
+    uint32_t fast_us, slow_us;
+    ScanRateIntervals(&fast_us, &slow_us);
+    settings->scan_fast_us = (uint16_t)fast_us;
+    settings->scan_slow_us = (uint16_t)slow_us;
+#endif
+#if DEBOUNCE_ALGORITHM == DEBOUNCE_LOCKOUT
+    settings->lockout_us = lockout.lockout_us;
+#endif
+    settings->applied = settings_applied;
+    settings->rejected = settings_rejected;
+}
 
-        // 3) Map debounced state into the report (0 = pressed, 1 = released)
-        if (debounced_state[i] == GPIO_PIN_RESET) {
-            // Use bit shifts instead of division and modulo
-            uint8_t byte_idx = i >> 3;      // i / 8
-            uint8_t bit_pos = i & 0x07;     // i % 8
-            state->key_states[byte_idx] &= ~(1u << bit_pos);
+/**
+ * Check a settings block from the master and stage it for the next scan
+ *
+ * A second block before that scan replaces the first one.
+ *
+ * @param data Block without the pointer, the two counters may be missing
+ */
+static void SettingsWrite(const uint8_t *data)
+{
+    RightKeyboardSettings block, live;
+
+    memcpy(&block, data, sizeof(block) - 2u);
+    SettingsSnapshot(&live);
+    bool valid = IsReportRegister(block.default_register);
+#if REPORT_TYPE == REPORT_TYPE_NKRO
+    valid = valid && block.rollover_policy == live.rollover_policy &&
+            block.rollover_max_keys == live.rollover_max_keys;
+#else
+    valid = valid && block.rollover_policy < KEY_ROLLOVER_POLICIES;
+#endif
+#if SCAN_MODE == SCAN_MODE_POLL && !DEBOUNCE_COUNTS_SAMPLES
+    valid = valid && block.scan_fast_us >= 50u && block.scan_fast_us <= SCAN_RATE_MEDIUM_US &&
+            block.scan_slow_us >= SCAN_RATE_MEDIUM_US;
+#else
+    // Sample counts are sized for the build-time scan rate
+    valid = valid && block.scan_fast_us == live.scan_fast_us && block.scan_slow_us == live.scan_slow_us;
+#endif
+#if DEBOUNCE_ALGORITHM == DEBOUNCE_LOCKOUT && KEY_WIRING == KEY_WIRING_HALL && HALL_RAPID_TRIGGER
+    // The sensor thresholds filter, no lockout needed
+#elif DEBOUNCE_ALGORITHM == DEBOUNCE_LOCKOUT
+    valid = valid && block.lockout_us > 0;
+#else
+    valid = valid && block.lockout_us == 0;
+#endif
 
-            // Count pressed keys for early-exit
-            pressed_count++;
+    if (!valid) {
+        settings_rejected++;
+        return;
+    }
+    settings_write = block;
+    settings_write_pending = true;
+    RightKeyboardScanRequest();
+}
+
+/**
+ * Apply the staged settings block, between two scans
+ *
+ * Runs with interrupts masked like DebounceApplyWrite(), so a read never
+ * sees half of a block and a new write can't tear it.
+ */
+static void SettingsApply(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    const RightKeyboardSettings *s = &settings_write;
+    default_register = s->default_register;
+#if REPORT_TYPE != REPORT_TYPE_NKRO
+    if (s->rollover_policy != rollover_policy || s->rollover_max_keys != rollover_max_keys) {
+        rollover_policy = s->rollover_policy;
+        rollover_max_keys = s->rollover_max_keys;
+        rollover_changed = true;
+    }
+#endif
+#if SCAN_MODE == SCAN_MODE_POLL && !DEBOUNCE_COUNTS_SAMPLES
+    ScanRateSetIntervals(s->scan_fast_us, s->scan_slow_us);
+#endif
+#if DEBOUNCE_ALGORITHM == DEBOUNCE_LOCKOUT
+    lockout.lockout_us = s->lockout_us;
+#endif
+    settings_applied++;
+    settings_write_pending = false;
+    ConfigStoreSet(CONFIG_KEY_SETTINGS, s, sizeof(*s) - 2u);
+    __set_PRIMASK(primask);
+}
 
-            // Early-exit if we've reached the maximum specified key count
-            // and it's not zero (which means no limit)
-            if (max_keys > 0 && pressed_count >= max_keys) {
-                break;
-            }
+#if REPORT_RECORDS_EVENTS && ENCODER_ENABLE
+/**
+ * Queue the detents counted by TIM2 since the last scan
+ *
+ * @param now Time of the scan in microseconds
+ */
+HOT_PATH static void ScanEncoder(uint32_t now)
+{
+    int32_t turn = EncoderTake();
+    if (turn != 0) {
+        while (turn != 0) {
+            int32_t part = turn > 127 ? 127 : (turn < -127 ? -127 : turn);
+            KeyEventPushTurn((int8_t)part, now);
+            turn -= part;
         }
+#if DATA_READY_ENABLE
+        DataReadySignal();
+#endif
+        TransportPublish();
     }
 }
+#endif
 
-// This function would be called by the I2C interrupt handler when the master
-// requests data
-void RightKeyboardI2CTransmit(void)
+/**
+ * Debounce one raw key word and publish the report
+ *
+ * The engines in debounce.c work on the whole key word at once, so the
+ * cost hardly depends on how many keys are held. The rollover limit only
+ * touches the report. A scan with no key to work on, none whose raw level
+ * moved since the last scan and none the engine has a lockout, window or
+ * counter open for, would change nothing: it skips the engine, the events
+ * and the report and only keeps the encoder going. Everything after that
+ * visits the changed keys only, lowest first.
+ *
+ * @param raw_keys Packed key word, KEY_GATHER() or MatrixGather()
+ * @param now Time of the snapshot in microseconds (TimebaseNowUs())
+ * @return true if every key is stable (raw == debounced, no lockout)
+ */
+HOT_PATH static bool ScanFromKeys(uint32_t raw_keys, uint32_t now)
 {
-    // Scan the keyboard to get the latest state
-    RightKeyboardScan6KRO(&keyboard_state, 6);
-    
-    // Prepare to transmit data when requested by the master
-    HAL_I2C_Slave_Transmit_IT(&hi2c1, (uint8_t*)&keyboard_state, sizeof(keyboard_state));
+    PROFILE_BEGIN(PROFILE_DEBOUNCE);
+    uint32_t debounced_keys;
+    bool settled;
+
+    if (settings_write_pending) {
+        SettingsApply();
+    }
+#if BENCH_MODE == BENCH_MODE_INJECT
+    // Synthetic presses from the benchmark pattern, see bench.h
+    raw_keys &= ~BenchInjectedKeys();
+#endif
+#if RAW_CAPTURE
+    RawCaptureSample(raw_keys & KEY_WORD_MASK, now);
+#endif
+#if EDGE_CAPTURE_ENABLE
+    // TIM5 debounces and timestamps its keys, the debounce below sees them
+    // released
+    bool captured_settled = true;
+    uint32_t captured_keys = EdgeCaptureUpdate(raw_keys, now, &captured_settled);
+    raw_keys |= EDGE_CAPTURE_KEYS;
+#endif
+#if DEBOUNCE_ALGORITHM == DEBOUNCE_ASYMMETRIC
+    if (debounce_write_pending) {
+        DebounceApplyWrite();
+    }
+#endif
+
+    // Keys to work on: raw edges since the last scan, and what the engine
+    // has in flight
+    uint32_t raw_changed = (raw_keys ^ last_raw_keys) & KEY_WORD_MASK;
+    last_raw_keys = raw_keys;
+    bool idle = (raw_changed | (DebounceActive(raw_keys) & KEY_WORD_MASK)) == 0 && !rollover_changed &&
+                !chord_open;
+#if EDGE_CAPTURE_ENABLE
+    idle = idle && captured_settled && captured_keys == (debounced_word & EDGE_CAPTURE_KEYS);
+#endif
+#if TAP_HOLD_ENABLE
+    idle = idle && !TapHoldBusy();
+#endif
+    if (idle) {
+#if REPORT_RECORDS_EVENTS && ENCODER_ENABLE
+        ScanEncoder(now);
+        KeyEventSync(~debounced_word & KEY_WORD_MASK);
+#endif
+        scan_count++;
+        PROFILE_END(PROFILE_DEBOUNCE);
+        return true;
+    }
+
+#if DEBOUNCE_ALGORITHM == DEBOUNCE_VERTICAL_COUNTER
+    // Debounce all keys at once, the counters advance once per scan
+    debounced_keys = VerticalCounterUpdate(&vertical_counter, raw_keys);
+    settled = ((raw_keys ^ debounced_keys) & KEY_WORD_MASK) == 0;
+#elif DEBOUNCE_ALGORITHM == DEBOUNCE_ASYMMETRIC
+    // Per-direction eager or deferred debounce, see AsymDebounceUpdate()
+    raw_keys &= KEY_WORD_MASK;
+    debounced_keys = AsymDebounceUpdate(&asym_debounce, raw_keys, now);
+    settled = AsymDebounceSettled(&asym_debounce, raw_keys);
+#elif DEBOUNCE_ALGORITHM == DEBOUNCE_ADAPTIVE
+    // Immediate edge + per-key learned lock-out, see AdaptiveDebounceUpdate()
+    raw_keys &= KEY_WORD_MASK;
+    debounced_keys = AdaptiveDebounceUpdate(&adaptive_debounce, raw_keys, now);
+    settled = AdaptiveDebounceSettled(&adaptive_debounce, raw_keys);
+#elif DEBOUNCE_ALGORITHM == DEBOUNCE_SAMPLE_COUNT
+    // Consecutive-sample counters, see SampleDebounceUpdate()
+    raw_keys &= KEY_WORD_MASK;
+    debounced_keys = SampleDebounceUpdate(&sample_debounce, raw_keys);
+    settled = raw_keys == debounced_keys;
+#elif DEBOUNCE_ALGORITHM == DEBOUNCE_INTEGRATOR
+    // Saturating per-key integrators, see IntegratorDebounceUpdate()
+    raw_keys &= KEY_WORD_MASK;
+    debounced_keys = IntegratorDebounceUpdate(&integrator_debounce, raw_keys);
+    settled = IntegratorDebounceActive(&integrator_debounce, raw_keys) == 0;
+#else
+    // Immediate edge + lock-out debounce, see LockoutDebounceUpdate()
+    raw_keys &= KEY_WORD_MASK;
+    debounced_keys = LockoutDebounceUpdate(&lockout, raw_keys, now);
+    settled = LockoutDebounceSettled(&lockout, raw_keys);
+#endif
+
+#if EDGE_CAPTURE_ENABLE
+    debounced_keys = (debounced_keys & ~EDGE_CAPTURE_KEYS) | captured_keys;
+    settled = settled && captured_settled;
+#endif
+
+#if REPORT_RECORDS_EVENTS
+    // Queue one event per accepted edge, lowest key index first; captured
+    // keys carry the TIM5 count of their edge
+    uint32_t changed = (debounced_keys ^ debounced_word) & KEY_WORD_MASK;
+    while (changed) {
+        uint32_t key = __builtin_ctz(changed);
+        changed &= changed - 1u;
+        uint32_t stamp = ((EDGE_CAPTURE_KEYS >> key) & 1u) ? EdgeCaptureTime(key) : now;
+        KeyEventPush((uint8_t)key, ((debounced_keys >> key) & 1u) == 0, stamp);
+    }
+#if ENCODER_ENABLE
+    // Detents counted by TIM2 since the last scan, after this scan's keys
+    ScanEncoder(now);
+#endif
+    // After an overflow the state stands in for the events dropped
+    KeyEventSync(~debounced_keys & KEY_WORD_MASK);
+#endif
+#if TRACE_ITM
+    for (uint32_t keys = (debounced_keys ^ debounced_word) & KEY_WORD_MASK; keys; keys &= keys - 1u) {
+        uint32_t key = (uint32_t)__builtin_ctz(keys);
+        TRACE(TRACE_KEY_ACCEPT, key | (((debounced_keys >> key) & 1u) ? 0u : TRACE_ARG_KEY_PRESSED));
+    }
+#endif
+
+    // 3) Publish the snapshot for the I2C transmitter
+    bool changed_keys = ((debounced_keys ^ debounced_word) & KEY_WORD_MASK) != 0;
+#if CHATTER_STATS
+    ChatterUpdate(raw_changed, (debounced_keys ^ debounced_word) & KEY_WORD_MASK, now);
+#endif
+#if LATENCY_STATS
+    if (raw_changed) {
+        LatencyEdge(now);
+    }
+    if (changed_keys) {
+        LatencyAccept(TimebaseNowUs());
+    } else if (settled) {
+        LatencyCancel();
+    }
+#endif
+#if KEYMAP_ENABLE
+    // Resolve new presses before a report can show them
+    KeymapPress(debounced_word & ~debounced_keys & KEY_WORD_MASK, KeymapLayers());
+#endif
+#if TAP_HOLD_ENABLE
+    // Tap-hold and combo decisions on this scan's timestamp; an open one
+    // keeps the scans coming until its term runs out
+    bool actions = TapHoldInput((debounced_keys ^ debounced_word) & KEY_WORD_MASK,
+                                ~debounced_keys & KEY_WORD_MASK, now);
+    actions |= TapHoldService(now);
+    settled = settled && !TapHoldBusy();
+#if DATA_READY_ENABLE
+    if (actions) {
+        DataReadySignal();
+    }
+#else
+    (void)actions;
+#endif
+#endif
+    uint32_t new_presses = debounced_word & ~debounced_keys & KEY_WORD_MASK;
+    debounced_word = debounced_keys;
+    scan_count++;
+
+    if (changed_keys) {
+        KeyPressOrderUpdate(&press_order, ~debounced_keys & KEY_WORD_MASK);
+        if (power_state != RIGHT_KEYBOARD_POWER_ACTIVE && new_presses) {
+            // A press resumes, the data-ready edge below wakes the master
+            power_state = RIGHT_KEYBOARD_POWER_ACTIVE;
+            power_resumes++;
+        }
+        key_changes++;
+    }
+
+    // The report only depends on the debounced word and the rollover
+    // settings, otherwise the transmitter keeps the snapshot it holds
+    bool publish = changed_keys;
+#if CHORD_WINDOW_US
+    // Hold the changes back until the chord window closes, the scans keep
+    // coming meanwhile
+    if (changed_keys && !chord_open) {
+        chord_open = true;
+        chord_start_us = now;
+    }
+    if (chord_open) {
+        publish = (int32_t)(now - chord_start_us) >= (int32_t)CHORD_WINDOW_US;
+        chord_open = !publish;
+        settled = settled && !chord_open;
+    }
+#endif
+    if (publish) {
+        rollover_changed = false;
+        PublishReport(debounced_keys);
+        TRACE(TRACE_PUBLISH, key_changes & 0xFFu);
+#if LATENCY_STATS
+        LatencyPublish(TimebaseNowUs());
+#endif
+#if DATA_READY_ENABLE
+        DataReadySignal();
+#endif
+        // Pushed, or a preloaded frame would still carry the old state
+        TransportPublish();
+        UsbHidPublish();
+    } else if (rollover_changed && !chord_open) {
+        rollover_changed = false;
+        PublishReport(debounced_keys);
+        TransportPublish();
+        UsbHidPublish();
+    }
+
+    PROFILE_END(PROFILE_DEBOUNCE);
+    return settled;
+}
+
+/**
+ * Build the report and publish it with one word store
+ *
+ * @param debounced_keys Debounced key word (1 = released)
+ */
+HOT_PATH static void PublishReport(uint32_t debounced_keys)
+{
+    uint32_t report = BuildReport(debounced_keys, rollover_max_keys);
+#if HID_FRAGMENT_ENABLE
+    // Fragment first, so a read woken by the new word finds it current
+    HidFragmentUpdate(~report & KEY_WORD_MASK);
+#endif
+#ifdef RIGHT_KEYBOARD_REPORT_SEQ_MASK
+    // Only the scanner writes the word, the sequence needs no read-modify-write guard
+    report |= (published_report + (1u << RIGHT_KEYBOARD_REPORT_SEQ_SHIFT)) &
+              RIGHT_KEYBOARD_REPORT_SEQ_MASK;
+#endif
+    published_report = report;
+}
+
+/**
+ * Check whether a register carries the key state, the reads that latency,
+ * data-ready and the address-match scan are about
+ */
+static inline bool IsReportRegister(uint8_t reg)
+{
+    return reg == RIGHT_KEYBOARD_REG_KEYS || reg == RIGHT_KEYBOARD_REG_EVENT ||
+           reg == RIGHT_KEYBOARD_REG_DELTA || reg == RIGHT_KEYBOARD_REG_EVENTS ||
+           reg == RIGHT_KEYBOARD_REG_CODES || reg == RIGHT_KEYBOARD_REG_ACTIONS ||
+           reg == RIGHT_KEYBOARD_REG_HID || reg == RIGHT_KEYBOARD_REG_REPLAY ||
+           reg == RIGHT_KEYBOARD_REG_PACKED;
+}
+
+/**
+ * Pick the frame for a master read from the register pointer
+ *
+ * Runs on the address match of a read. The pointer is consumed, so the next
+ * read without a pointer write returns the default register again.
+ *
+ * @param frame Set to the frame to send, valid until CompleteRegisterFrame()
+ * @return Frame length in bytes
+ */
+HOT_PATH static uint32_t SelectRegisterFrame(const uint8_t **frame)
+{
+    tx_register = register_pointer;
+    register_pointer = default_register;
+    TRACE(TRACE_I2C_ADDR, tx_register);
+
+#if SCAN_ON_ADDRESS_MATCH
+    // Final debounce and report step right at the address match, unless the
+    // master asked for the state latched by its strobe
+    if (IsReportRegister(tx_register) &&
+#if I2C_GENERAL_CALL_SAMPLE
+        !latched_valid &&
+#endif
+        !scan_running) {
+        ScanFromKeys(ReadRawKeys(), TimebaseNowUs());
+    }
+#endif
+#if DATA_READY_ENABLE
+    // Changes published from here on are not covered by this frame
+    tx_data_ready_changes = data_ready_changes;
+#endif
+#if LATENCY_STATS
+    if (IsReportRegister(tx_register)) {
+        LatencyTransmit(TimebaseNowUs());
+    }
+#endif
+
+    switch (tx_register) {
+    case RIGHT_KEYBOARD_REG_KEYS:
+        tx_report.word = ReportForRead();
+#if BENCH_MODE != BENCH_MODE_OFF
+        BenchObserve(~tx_report.word & KEY_WORD_MASK, TimebaseNowUs());
+#endif
+        *frame = tx_report.key_states;
+        tx_length = sizeof(tx_report.key_states);
+        break;
+    case RIGHT_KEYBOARD_REG_EVENT:
+        tx_event_queued = KeyEventPeek(&tx_event);
+#if TIME_SYNC_ENABLE
+        EventTimesToMaster(&tx_event, 1);
+#endif
+        *frame = (const uint8_t *)&tx_event;
+        tx_length = sizeof(tx_event);
+        break;
+    case RIGHT_KEYBOARD_REG_EVENTS:
+        tx_batch.count = (uint8_t)KeyEventPeekBatch(tx_batch.events, REPORT_EVENT_BATCH);
+#if TIME_SYNC_ENABLE
+        EventTimesToMaster(tx_batch.events, tx_batch.count);
+#endif
+        *frame = (const uint8_t *)&tx_batch;
+        tx_length = 1u + tx_batch.count * sizeof(KeyEvent);
+        if (KeyEventBacklog()) {
+            tx_batch.count |= RIGHT_KEYBOARD_EVENTS_BACKLOG;
+        }
+        break;
+    case RIGHT_KEYBOARD_REG_PACKED:
+        // The batch buffer keeps the events, their ticks are the next base
+        tx_batch.count = (uint8_t)KeyEventPeekBatch(tx_batch.events, REPORT_EVENT_BATCH);
+#if TIME_SYNC_ENABLE
+        EventTimesToMaster(tx_batch.events, tx_batch.count);
+#endif
+        tx_length = EventPackEncode(tx_batch.events, tx_batch.count, packed_base, packed_absolute,
+                                    tx_packed, tx_packed_ends);
+        if (KeyEventBacklog()) {
+            tx_packed[0] |= EVENT_PACK_BACKLOG;
+        }
+        *frame = tx_packed;
+        break;
+    case RIGHT_KEYBOARD_REG_REPLAY: {
+        uint16_t first, next;
+        tx_replay.header.count = (uint8_t)KeyEventReplay(replay_since, tx_replay.events, REPORT_EVENT_BATCH,
+                                                         &first, &next);
+        tx_replay.header.first = first;
+        tx_replay.header.next = next;
+#if TIME_SYNC_ENABLE
+        EventTimesToMaster(tx_replay.events, tx_replay.header.count);
+#endif
+        *frame = (const uint8_t *)&tx_replay;
+        tx_length = sizeof(tx_replay.header) + tx_replay.header.count * sizeof(KeyEvent);
+        if (KeyEventBacklog()) {
+            tx_replay.header.count |= RIGHT_KEYBOARD_EVENTS_BACKLOG;
+        }
+        break;
+    }
+    case RIGHT_KEYBOARD_REG_DELTA: {
+        tx_delta_keys = ReportForRead() & KEY_WORD_MASK;
+#if BENCH_MODE != BENCH_MODE_OFF
+        BenchObserve(~tx_delta_keys & KEY_WORD_MASK, TimebaseNowUs());
+#endif
+        uint32_t changed = tx_delta_keys ^ acked_keys;
+        tx_delta.status = (changed ? RIGHT_KEYBOARD_DELTA_CHANGED : 0u) |
+                          (delta_sequence & RIGHT_KEYBOARD_DELTA_SEQ_MASK);
+        for (uint32_t n = 0; n < sizeof(tx_delta.changed); ++n) {
+            tx_delta.changed[n] = (uint8_t)(changed >> (n * 8));
+        }
+        *frame = (const uint8_t *)&tx_delta;
+        tx_length = sizeof(tx_delta);
+        break;
+    }
+    case RIGHT_KEYBOARD_REG_COUNTERS:
+        tx_counters.scan_count = scan_count;
+        tx_counters.events_dropped = KeyEventDropped();
+        tx_counters.events_queued = (uint8_t)KeyEventCount();
+        tx_counters.i2c_recoveries = i2c_recoveries;
+        tx_counters.i2c_recovery_ms = i2c_recovery_ms;
+#if LINK_TRANSPORT == LINK_TRANSPORT_I2C && I2C_DRIVER == I2C_DRIVER_REGISTER
+        {
+            uint32_t last, max;
+            I2CSlaveStretchStats(&last, &max);
+            tx_counters.i2c_stretch_max_cycles = max > 0xFFFFu ? 0xFFFFu : (uint16_t)max;
+        }
+#endif
+        {
+            uint32_t entries, wake_us;
+            DeepIdleStats(&entries, &wake_us);
+            tx_counters.deep_idle_entries = entries > 0xFFFFu ? 0xFFFFu : (uint16_t)entries;
+            tx_counters.deep_idle_wake_us = wake_us > 0xFFFFu ? 0xFFFFu : (uint16_t)wake_us;
+        }
+        {
+            uint32_t failures = ClockCssFailures();
+            tx_counters.hse_failures = failures > 0xFFu ? 0xFFu : (uint8_t)failures;
+        }
+#if STACK_MONITOR
+        {
+            uint32_t free_bytes = StackFreeBytes();
+            tx_counters.stack_free_bytes = free_bytes > 0xFFFFu ? 0xFFFFu : (uint16_t)free_bytes;
+        }
+#endif
+        *frame = (const uint8_t *)&tx_counters;
+        tx_length = sizeof(tx_counters);
+        break;
+    case RIGHT_KEYBOARD_REG_SCAN_RATE:
+        tx_scan_rate.interval_us = ScanRateInterval();
+        tx_scan_rate.level = (uint8_t)ScanRateCurrent();
+        tx_scan_rate.changes = ScanRateChanges();
+        *frame = (const uint8_t *)&tx_scan_rate;
+        tx_length = sizeof(tx_scan_rate);
+        break;
+    case RIGHT_KEYBOARD_REG_LATENCY:
+        LatencySnapshot(&tx_latency);
+        *frame = (const uint8_t *)&tx_latency;
+        tx_length = sizeof(tx_latency);
+        break;
+    case RIGHT_KEYBOARD_REG_CHATTER:
+        ChatterSnapshot(tx_chatter);
+        *frame = (const uint8_t *)tx_chatter;
+        tx_length = sizeof(tx_chatter);
+        break;
+    case RIGHT_KEYBOARD_REG_I2C_HEALTH:
+        RightKeyboardI2CHealthSnapshot(&tx_i2c_health);
+        *frame = (const uint8_t *)&tx_i2c_health;
+        tx_length = sizeof(tx_i2c_health);
+        break;
+    case RIGHT_KEYBOARD_REG_BENCH:
+        BenchSnapshot(&tx_bench);
+        *frame = (const uint8_t *)&tx_bench;
+        tx_length = sizeof(tx_bench);
+        break;
+    case RIGHT_KEYBOARD_REG_CAPTURE:
+        tx_length = RawCaptureChunkRead(&tx_capture);
+        *frame = (const uint8_t *)&tx_capture;
+        break;
+    case RIGHT_KEYBOARD_REG_JITTER:
+        ScanJitterSnapshot(&tx_jitter);
+        *frame = (const uint8_t *)&tx_jitter;
+        tx_length = sizeof(tx_jitter);
+        break;
+    case RIGHT_KEYBOARD_REG_RETAINED:
+        RetainedSnapshot(&tx_retained);
+        *frame = (const uint8_t *)&tx_retained;
+        tx_length = sizeof(tx_retained);
+        break;
+    case RIGHT_KEYBOARD_REG_DEBOUNCE:
+        DebounceProfileSnapshot(tx_debounce);
+        *frame = (const uint8_t *)tx_debounce;
+        tx_length = sizeof(tx_debounce);
+        break;
+    case RIGHT_KEYBOARD_REG_WINDOWS:
+        DebounceWindowSnapshot(tx_windows);
+        *frame = (const uint8_t *)tx_windows;
+        tx_length = sizeof(tx_windows);
+        break;
+    case RIGHT_KEYBOARD_REG_ROLLOVER:
+        tx_rollover.policy = rollover_policy;
+        tx_rollover.max_keys = rollover_max_keys;
+        tx_rollover.held = (uint8_t)__builtin_popcount(~debounced_word & KEY_WORD_MASK);
+        *frame = (const uint8_t *)&tx_rollover;
+        tx_length = sizeof(tx_rollover);
+        break;
+    case RIGHT_KEYBOARD_REG_LAYERS:
+        tx_layers = KeymapLayers();
+        *frame = &tx_layers;
+        tx_length = sizeof(tx_layers);
+        break;
+    case RIGHT_KEYBOARD_REG_CODES:
+        KeymapReportBuild(~ReportForRead() & KEY_WORD_MASK, &tx_codes);
+        *frame = (const uint8_t *)&tx_codes;
+        tx_length = sizeof(tx_codes);
+        break;
+    case RIGHT_KEYBOARD_REG_ACTIONS:
+        tx_action_queued = TapHoldActionPeek(&tx_action);
+#if TIME_SYNC_ENABLE
+        tx_action.timestamp = TimeSyncToMaster(tx_action.timestamp);
+#endif
+        *frame = (const uint8_t *)&tx_action;
+        tx_length = sizeof(tx_action);
+        break;
+    case RIGHT_KEYBOARD_REG_HID:
+        HidFragmentSnapshot(&tx_hid);
+        *frame = (const uint8_t *)&tx_hid;
+        tx_length = sizeof(tx_hid);
+        break;
+    case RIGHT_KEYBOARD_REG_TIME:
+        TimeSyncSnapshot(&tx_time);
+        *frame = (const uint8_t *)&tx_time;
+        tx_length = sizeof(tx_time);
+        break;
+    case RIGHT_KEYBOARD_REG_SETTINGS:
+        SettingsSnapshot(&tx_settings);
+        *frame = (const uint8_t *)&tx_settings;
+        tx_length = sizeof(tx_settings);
+        break;
+    case RIGHT_KEYBOARD_REG_UPDATE:
+        FwUpdateSnapshot(&tx_update);
+        *frame = (const uint8_t *)&tx_update;
+        tx_length = sizeof(tx_update);
+        break;
+    case RIGHT_KEYBOARD_REG_CONFIG:
+        *frame = (const uint8_t *)&keyboard_config;
+        tx_length = sizeof(keyboard_config);
+        break;
+    case RIGHT_KEYBOARD_REG_POWER:
+        tx_power.state = power_state;
+        tx_power.supported = POWER_SUPPORTED;
+        tx_power.resumes = power_resumes;
+        tx_power.rejected = power_rejected;
+        *frame = (const uint8_t *)&tx_power;
+        tx_length = sizeof(tx_power);
+        break;
+#if KEY_WIRING == KEY_WIRING_HALL
+    case RIGHT_KEYBOARD_REG_HALL:
+        HallSnapshot(tx_hall);
+        *frame = (const uint8_t *)tx_hall;
+        tx_length = sizeof(tx_hall);
+        break;
+#endif
+    case RIGHT_KEYBOARD_REG_ENCODER:
+        EncoderSnapshot(&tx_encoder);
+        *frame = (const uint8_t *)&tx_encoder;
+        tx_length = sizeof(tx_encoder);
+        break;
+#if LED_STRIP_ENABLE
+    case RIGHT_KEYBOARD_REG_LEDS:
+        LedStripSnapshot(tx_leds);
+        *frame = tx_leds;
+        tx_length = sizeof(tx_leds);
+        break;
+#endif
+    case RIGHT_KEYBOARD_REG_TASKS:
+        SchedSnapshot(tx_tasks);
+        *frame = (const uint8_t *)tx_tasks;
+        tx_length = sizeof(tx_tasks);
+        break;
+    case RIGHT_KEYBOARD_REG_FAULT:
+        I2CFaultSnapshot(&tx_fault);
+        *frame = (const uint8_t *)&tx_fault;
+        tx_length = sizeof(tx_fault);
+        break;
+    case RIGHT_KEYBOARD_REG_RESIDENCY:
+        ResidencySnapshot(&tx_residency);
+        *frame = (const uint8_t *)&tx_residency;
+        tx_length = sizeof(tx_residency);
+        break;
+    case RIGHT_KEYBOARD_REG_CAPS:
+        *frame = (const uint8_t *)&keyboard_caps;
+        tx_length = sizeof(keyboard_caps);
+        break;
+    default:
+        if (tx_register >= RIGHT_KEYBOARD_REG_PROFILE &&
+            tx_register < RIGHT_KEYBOARD_REG_PROFILE + PROFILE_SLOTS) {
+            ProfileSnapshot((ProfileSlot)(tx_register - RIGHT_KEYBOARD_REG_PROFILE), &tx_profile);
+            *frame = (const uint8_t *)&tx_profile;
+            tx_length = sizeof(tx_profile);
+            break;
+        }
+        *frame = &invalid_register;
+        tx_length = sizeof(invalid_register);
+        break;
+    }
+
+#if REPORT_INTEGRITY
+    // Copy behind the header, the payload buffers keep changing
+    RightKeyboardReportHeader *header = (RightKeyboardReportHeader *)tx_framed;
+    header->sequence = report_sequence++;
+    memcpy(&tx_framed[sizeof(*header)], *frame, tx_length);
+    header->crc = Crc8Update(Crc8Update(CRC8_INIT, &header->sequence, 1),
+                             &tx_framed[sizeof(*header)], tx_length);
+    *frame = tx_framed;
+    return sizeof(*header) + tx_length;
+#else
+    return tx_length;
+#endif
+}
+
+/**
+ * Finish a master read, queued events and deltas only count once fully read
+ *
+ * @param bytes_sent Number of frame bytes that reached the master
+ */
+HOT_PATH static void CompleteRegisterFrame(uint32_t bytes_sent)
+{
+    TRACE(TRACE_I2C_DONE, bytes_sent);
+    if (bytes_sent > 0) {
+        i2c_health.reads++;
+        i2c_health.bytes_sent += bytes_sent;
+    }
+#if REPORT_INTEGRITY
+    // Counts below refer to the payload behind the header
+    bytes_sent = bytes_sent > sizeof(RightKeyboardReportHeader) ?
+                 bytes_sent - sizeof(RightKeyboardReportHeader) : 0;
+#endif
+
+    // Batched events count one by one, a short read keeps the rest queued
+    if (tx_register == RIGHT_KEYBOARD_REG_EVENTS && bytes_sent > 0) {
+        KeyEventDropBatch((bytes_sent - 1u) / sizeof(KeyEvent));
+    }
+    if (tx_register == RIGHT_KEYBOARD_REG_PACKED) {
+        uint32_t whole = 0;
+        while (whole < tx_batch.count && tx_packed_ends[whole] <= bytes_sent) {
+            whole++;
+        }
+        if (whole > 0) {
+            KeyEventDropBatch(whole);
+            // A resync record has no time to continue from
+            packed_absolute = tx_batch.events[whole - 1u].key == KEY_EVENT_RESYNC;
+            packed_base = EventPackTick(tx_batch.events[whole - 1u].timestamp);
+        }
+    } else if ((tx_register == RIGHT_KEYBOARD_REG_EVENT || tx_register == RIGHT_KEYBOARD_REG_EVENTS ||
+                tx_register == RIGHT_KEYBOARD_REG_REPLAY) && bytes_sent > 0) {
+        // Events may leave the queue without the packed base seeing them
+        packed_absolute = true;
+    }
+    // Same for a replay, and the next one continues behind the last event read
+    if (tx_register == RIGHT_KEYBOARD_REG_REPLAY && bytes_sent >= sizeof(RightKeyboardReplay)) {
+        uint32_t read = (bytes_sent - sizeof(RightKeyboardReplay)) / sizeof(KeyEvent);
+        if (read > 0 && tx_replay.events[0].key == KEY_EVENT_RESYNC) {
+            // The record stands in for the backlog, the stream goes on at next
+            KeyEventDropBatch(1);
+            replay_since = tx_replay.header.next;
+        } else {
+            uint16_t next = (uint16_t)(tx_replay.header.first + read);
+            replay_since = next;
+            KeyEventAcknowledge(next);
+        }
+    }
+
+    if (bytes_sent == tx_length) {
+        if (tx_event_queued) {
+            KeyEventDrop();
+        }
+        if (tx_action_queued) {
+            TapHoldActionDrop();
+        }
+        if (tx_register == RIGHT_KEYBOARD_REG_CAPTURE) {
+            RawCaptureChunkDone();
+        }
+        if (tx_register == RIGHT_KEYBOARD_REG_DELTA && (tx_delta.status & RIGHT_KEYBOARD_DELTA_CHANGED)) {
+            acked_keys = tx_delta_keys;
+            delta_sequence++;
+        }
+#if DATA_READY_ENABLE
+        if (IsReportRegister(tx_register)) {
+            DataReadyAcknowledge();
+        }
+#endif
+    }
+    tx_event_queued = false;
+    tx_action_queued = false;
+}
+
+#if DATA_READY_ENABLE
+/**
+ * Assert the data-ready line for a change the master has not read yet
+ *
+ * The change is counted before the line is driven, so an acknowledge that
+ * preempts in between sees it and keeps the line asserted.
+ */
+HOT_PATH static void DataReadySignal(void)
+{
+    data_ready_changes++;
+    __COMPILER_BARRIER();
+    DATA_READY_PORT->BSRR = (uint32_t)DATA_READY_PIN << 16;
+}
+
+/**
+ * Release the data-ready line if the frame just read covers every change
+ *
+ * Queued events and actions keep it asserted, the master reads them one
+ * per transfer.
+ */
+HOT_PATH static void DataReadyAcknowledge(void)
+{
+    if (data_ready_changes == tx_data_ready_changes && KeyEventCount() == 0 && TapHoldActionCount() == 0) {
+        DATA_READY_PORT->BSRR = DATA_READY_PIN;
+    }
+}
+#endif
+
+/**
+ * Apply a master write: the first byte selects the register
+ *
+ * @param data Received bytes
+ * @param len Number of received bytes
+ */
+HOT_PATH static void WriteRegisters(const uint8_t *data, uint32_t len)
+{
+    i2c_health.writes++;
+    i2c_health.bytes_received += len;
+
+    // Only the registers marked writable in right_side_keyboard.h take data
+    // (see the checks below), anything else after the pointer is ignored
+    if (len > 0) {
+        register_pointer = data[0];
+    }
+#if TIME_SYNC_ENABLE
+    if (len >= 5 && data[0] == RIGHT_KEYBOARD_REG_TIME) {
+        uint32_t master_us;
+        memcpy(&master_us, &data[1], sizeof(master_us));
+        TimeSyncSample(master_us, TimebaseNowUs());
+    }
+#endif
+    if (len >= 3 && data[0] == RIGHT_KEYBOARD_REG_REPLAY) {
+        replay_since = (uint16_t)(data[1] | (data[2] << 8));
+    }
+    if (len > 1 && data[0] == RIGHT_KEYBOARD_REG_PACKED) {
+        // Master lost track of the time base
+        packed_absolute = true;
+    }
+    if (len > 1 && data[0] == RIGHT_KEYBOARD_REG_CAPTURE) {
+        RawCaptureCommand(data[1]);
+    }
+    if (len > 1 && data[0] == RIGHT_KEYBOARD_REG_FAULT) {
+        I2CFaultCommand(data[1]);
+    }
+    if (len > 1 && data[0] == RIGHT_KEYBOARD_REG_LAYERS) {
+        KeymapSetLayers(data[1]);
+    }
+#if KEY_WIRING == KEY_WIRING_HALL
+    // Key (0xFF = all), actuation and release point, then optionally the
+    // rapid-trigger press and release deltas
+    if (len >= 4 && data[0] == RIGHT_KEYBOARD_REG_HALL) {
+        HallSetPoints(data[1], data[2], data[3]);
+    }
+    if (len >= 6 && data[0] == RIGHT_KEYBOARD_REG_HALL) {
+        HallSetRapidTrigger(data[1], data[4], data[5]);
+    }
+#endif
+#if LED_STRIP_ENABLE
+    // First LED (0xFF = all), then r, g, b per LED
+    if (len >= 5 && data[0] == RIGHT_KEYBOARD_REG_LEDS) {
+        LedStripWrite(&data[1], len - 1u);
+    }
+#endif
+    if (len > 1 && data[0] == RIGHT_KEYBOARD_REG_POWER) {
+        if (data[1] < RIGHT_KEYBOARD_POWER_STATES && (POWER_SUPPORTED & (1u << data[1]))) {
+            // Taken up by the next scan interval or DeepIdleService()
+            power_state = data[1];
+        } else {
+            power_rejected++;
+        }
+    }
+#if REPORT_TYPE != REPORT_TYPE_NKRO
+    if (len >= 3 && data[0] == RIGHT_KEYBOARD_REG_ROLLOVER && data[1] < KEY_ROLLOVER_POLICIES) {
+        // Picked up by the next scan, which republishes the report
+        rollover_policy = data[1];
+        rollover_max_keys = data[2];
+        rollover_changed = true;
+        RightKeyboardScanRequest();
+    }
+#endif
+    if (len >= 1u + sizeof(RightKeyboardSettings) - 2u && data[0] == RIGHT_KEYBOARD_REG_SETTINGS) {
+        SettingsWrite(&data[1]);
+    }
+#if FW_UPDATE_ENABLE
+    if (len >= 14 && data[0] == RIGHT_KEYBOARD_REG_UPDATE) {
+        FwUpdateRequest(data, len);
+    }
+#endif
+#if DEBOUNCE_ALGORITHM == DEBOUNCE_ASYMMETRIC
+    // Profile index and one entry, staged for the next scan
+    if (len >= 2u + sizeof(RightKeyboardDebounceProfile) && data[0] == RIGHT_KEYBOARD_REG_DEBOUNCE) {
+        debounce_write_index = data[1];
+        memcpy(&debounce_write, &data[2], sizeof(debounce_write));
+        debounce_write_pending = true;
+        RightKeyboardScanRequest();
+    }
+#endif
+}
+
+/**
+ * Handle a write to the general call address
+ *
+ * @param data Received bytes, the first one is the command
+ * @param len Number of received bytes
+ */
+HOT_PATH static void GeneralCall(const uint8_t *data, uint32_t len)
+{
+    i2c_health.writes++;
+    i2c_health.bytes_received += len;
+
+#if I2C_GENERAL_CALL_SAMPLE
+    if (len > 0 && data[0] == RIGHT_KEYBOARD_GC_SAMPLE) {
+        // Freshest state available right now, a scan that was preempted by
+        // this interrupt has not published yet so its predecessor is used
+#if SCAN_ON_ADDRESS_MATCH
+        if (!scan_running) {
+            ScanFromKeys(ReadRawKeys(), TimebaseNowUs());
+        }
+#endif
+        latched_report = BuildReport(debounced_word, rollover_max_keys);
+        latched_valid = true;
+    }
+#else
+    (void)data;
+    (void)len;
+#endif
+}
+
+/**
+ * Report for a key or delta read: the strobe snapshot if one is waiting,
+ * the latest published one otherwise
+ */
+HOT_PATH static uint32_t ReportForRead(void)
+{
+#if I2C_GENERAL_CALL_SAMPLE
+    if (latched_valid) {
+        latched_valid = false;
+        return latched_report;
+    }
+#endif
+    return published_report;
+}
+
+/**
+ * Hand the next frame to the transport on an address match or request
+ *
+ * @param frame Set to the frame to send, valid until RightKeyboardTxEnd()
+ * @return Frame length in bytes
+ */
+HOT_PATH uint32_t RightKeyboardTxBegin(const uint8_t **frame)
+{
+    i2c_activity++;
+    return SelectRegisterFrame(frame);
+}
+
+/**
+ * Hand the frame of the default register to a read on the report address
+ *
+ * The register pointer is left alone, it belongs to the diagnostics
+ * address (I2C_DIAG_ADDRESS).
+ *
+ * @param frame Set to the frame to send, valid until RightKeyboardTxEnd()
+ * @return Frame length in bytes
+ */
+HOT_PATH uint32_t RightKeyboardReportBegin(const uint8_t **frame)
+{
+    uint8_t pointer = register_pointer;
+
+    i2c_activity++;
+    register_pointer = default_register;
+    uint32_t len = SelectRegisterFrame(frame);
+    register_pointer = pointer;
+    return len;
+}
+
+/**
+ * Called by the transport once the master ends a read
+ *
+ * @param bytes_sent Number of frame bytes that reached the master
+ */
+HOT_PATH void RightKeyboardTxEnd(uint32_t bytes_sent)
+{
+    uint32_t payload = bytes_sent;
+#if REPORT_INTEGRITY
+    // tx_length is the payload behind the header
+    payload = bytes_sent > sizeof(RightKeyboardReportHeader) ?
+              bytes_sent - sizeof(RightKeyboardReportHeader) : 0;
+#endif
+    if (bytes_sent > 0 && payload >= tx_length) {
+        I2CFaultTransferDone();
+    }
+    CompleteRegisterFrame(bytes_sent);
+}
+
+/**
+ * Called by the transport once the master ends a write
+ *
+ * @param data Received bytes
+ * @param len Number of received bytes
+ */
+HOT_PATH void RightKeyboardRxEnd(const uint8_t *data, uint32_t len)
+{
+    i2c_activity++;
+    WriteRegisters(data, len);
+    I2CFaultTransferDone();
+}
+
+/**
+ * Called by the I2C driver once a general-call write ends
+ *
+ * @param data Received bytes
+ * @param len Number of received bytes
+ */
+HOT_PATH void RightKeyboardGeneralCall(const uint8_t *data, uint32_t len)
+{
+    i2c_activity++;
+    GeneralCall(data, len);
+}
+
+/**
+ * Called by the transport on a bus error, an early NACK or a bad frame
+ *
+ * @param errors LINK_ERROR_* bits (link.h)
+ */
+HOT_PATH void RightKeyboardLinkError(uint32_t errors)
+{
+    I2CCountErrors(errors);
+    I2CFaultLinkEvent();
+}
+
+/**
+ * Called by the transport when the bus is left in a state only a reset
+ * clears, RightKeyboardI2CService() then resets it
+ */
+void RightKeyboardLinkFault(void)
+{
+    I2CFaultLinkEvent();
+#if LINK_TRANSPORT == LINK_TRANSPORT_I2C
+    if (!i2c_recovery_requested) {
+        i2c_fault_tick = PeriphTickMs();
+        i2c_recovery_requested = true;
+    }
+#endif
+}
+
+/**
+ * Check whether the default register still holds data after a frame, for
+ * transports that push it without a request
+ *
+ * @return true while events are queued behind an event register
+ */
+HOT_PATH bool RightKeyboardPushPending(void)
+{
+#if REPORT_RECORDS_EVENTS
+    return KeyEventCount() > 0;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Published report word, for transports that stream it by DMA
+ *
+ * @return Address of the word, key bytes first (little endian)
+ */
+const volatile uint32_t *RightKeyboardPublishedWord(void)
+{
+    return &published_report;
+}
+
+/**
+ * Register a read without a pointer write returns, for transports that
+ * label the frames they push
+ */
+uint8_t RightKeyboardDefaultRegister(void)
+{
+    return default_register;
+}
+
+#if TIME_SYNC_ENABLE
+/**
+ * Move event timestamps into master time, a resync record carries keys
+ *
+ * @param events Events of a frame
+ * @param count Number of events
+ */
+HOT_PATH static void EventTimesToMaster(KeyEvent *events, uint32_t count)
+{
+    for (uint32_t n = 0; n < count; ++n) {
+        if (events[n].key != KEY_EVENT_RESYNC) {
+            events[n].timestamp = TimeSyncToMaster(events[n].timestamp);
+        }
+    }
 }
+#endif
 
-// I2C event callback - will be called by HAL when I2C events occur
-void HAL_I2C_SlaveTxCpltCallback(I2C_HandleTypeDef *hi2c)
+/**
+ * Check that the published report still matches the debounced keys
+ *
+ * For a test that just broke the link (i2c_fault.h): the key bits of the
+ * report must be what the last scan built from its word, unless a rollover
+ * change is waiting for the next scan, and the event queue within bounds.
+ *
+ * @return true if the state a master reads next is consistent
+ */
+bool RightKeyboardSnapshotConsistent(void)
 {
-    if (hi2c->Instance == I2C1) {
-        // Transmission complete, scan keyboard and prepare for next transmit request
-        RightKeyboardScan6KRO(&keyboard_state, 6);
-        HAL_I2C_Slave_Transmit_IT(&hi2c1, (uint8_t*)&keyboard_state, sizeof(keyboard_state));
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    bool consistent = rollover_changed || chord_open ||
+                      ((published_report ^ BuildReport(debounced_word, rollover_max_keys)) &
+                       RIGHT_KEYBOARD_REPORT_KEY_MASK) == 0;
+    if (KeyEventCount() > KEY_EVENT_QUEUE_LEN + 1u) {
+        consistent = false;
     }
+    __set_PRIMASK(primask);
+    return consistent;
 }
 
-void HAL_I2C_SlaveRxCpltCallback(I2C_HandleTypeDef *hi2c)
+/**
+ * Apply the rollover policy and map the debounced word into a report
+ *
+ * @param debounced_keys Debounced key word (1 = released)
+ * @param max_keys Maximum number of keys to report as pressed (0 means all)
+ * @return Report word without flags (0 = pressed, 1 = released)
+ */
+static uint32_t BuildReport(uint32_t debounced_keys, uint8_t max_keys)
+{
+    uint32_t reported = KeyPressOrderSelect(&press_order, (KeyRolloverPolicy)rollover_policy,
+                                            ~debounced_keys & KEY_WORD_MASK, max_keys);
+    return KeyReportWord(reported, RIGHT_KEYBOARD_REPORT_BYTES);
+}
+
+
+/**
+ * Add the error classes of one error interrupt to the health counters
+ *
+ * @param errors HAL_I2C_ERROR_BERR/ARLO/AF/OVR bits
+ */
+static void I2CCountErrors(uint32_t errors)
 {
-    if (hi2c->Instance == I2C1) {
-        // Received a request from master, prepare to transmit
-        RightKeyboardI2CTransmit();
+    if (errors & HAL_I2C_ERROR_BERR) {
+        i2c_health.berr++;
+    }
+    if (errors & HAL_I2C_ERROR_ARLO) {
+        i2c_health.arlo++;
+    }
+    if (errors & HAL_I2C_ERROR_AF) {
+        i2c_health.af++;
+    }
+    if (errors & HAL_I2C_ERROR_OVR) {
+        i2c_health.ovr++;
+    }
+    // The TRACE_I2C_ERROR argument uses the same bits
+    if (errors & (HAL_I2C_ERROR_BERR | HAL_I2C_ERROR_ARLO | HAL_I2C_ERROR_OVR)) {
+        TRACE(TRACE_I2C_ERROR, errors & (HAL_I2C_ERROR_BERR | HAL_I2C_ERROR_ARLO | HAL_I2C_ERROR_OVR));
     }
 }
 
-void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c)
+/**
+ * Copy the I2C health counters
+ *
+ * Callable from any context, the I2C interrupts are masked for the copy.
+ *
+ * @param health Filled with the counters as of now
+ */
+void RightKeyboardI2CHealthSnapshot(RightKeyboardI2CHealth *health)
 {
-    if (hi2c->Instance == I2C1) {
-        // Error occurred, reset I2C and prepare for next transmission
-        RightKeyboardScan6KRO(&keyboard_state, 6);
-        HAL_I2C_Slave_Transmit_IT(&hi2c1, (uint8_t*)&keyboard_state, sizeof(keyboard_state));
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    *health = i2c_health;
+    health->recoveries = i2c_recoveries;
+    health->listen_rearms = TransportListenRearms();
+    __set_PRIMASK(primask);
+
+    health->tick_ms = PeriphTickMs();
+}
+
+#if LINK_TRANSPORT == LINK_TRANSPORT_I2C
+/**
+ * Check the bus for a stuck line or a locked-up peripheral
+ *
+ * A line held low or BUSY set is normal during a transfer, it only counts
+ * as stuck once it lasts I2C_STUCK_TIMEOUT_MS without a new transfer to
+ * this slave starting.
+ *
+ * @param now Current time in milliseconds
+ * @return true if I2C1 needs a reset
+ */
+static bool I2CBusStuck(uint32_t now)
+{
+    uint32_t lines = GPIOB->IDR & BOARD_I2C_PINS;
+    bool suspect = lines != BOARD_I2C_PINS || (I2C1->SR2 & I2C_SR2_BUSY);
+    uint32_t activity = i2c_activity;
+
+    if (!suspect || activity != stuck_activity) {
+        stuck_activity = activity;
+        stuck_since = now;
+        return false;
     }
-}
\ No newline at end of file
+    return (now - stuck_since) >= I2C_STUCK_TIMEOUT_MS;
+}
+
+/**
+ * Reset I2C1 through the transport and record the recovery
+ *
+ * @param now Current time in milliseconds
+ */
+static void I2CRecover(uint32_t now)
+{
+    uint32_t fault_tick = i2c_recovery_requested ? i2c_fault_tick : stuck_since;
+
+    // Whatever was in flight is gone, nothing of it counts as delivered
+    PeriphI2CIrqEnable(false);
+    TransportReset();
+    PeriphI2CIrqEnable(true);
+
+    uint32_t downtime = PeriphTickMs() - fault_tick;
+    i2c_recovery_ms = downtime > 0xFFFFu ? 0xFFFFu : (uint16_t)downtime;
+    i2c_recoveries++;
+    i2c_recovery_requested = false;
+    stuck_since = now;
+    I2CFaultLinkEvent();
+}
+#endif /* LINK_TRANSPORT == LINK_TRANSPORT_I2C */
+
+/**
+ * Keep the I2C slave alive from thread context
+ *
+ * Resets I2C1 after a bus error or once the bus looks stuck, otherwise
+ * leaves the pass to the transport (TransportService()). The UART and SPI
+ * links have no bus state to recover, their parsers resynchronise on the
+ * next request.
+ */
+void RightKeyboardI2CService(void)
+{
+    // The USB keyboard never started the link
+    if (UsbHidRoleSelected()) {
+        return;
+    }
+#if LINK_TRANSPORT == LINK_TRANSPORT_I2C
+    uint32_t now = PeriphTickMs();
+
+    if (i2c_recovery_requested || I2CBusStuck(now)) {
+        I2CRecover(now);
+        return;
+    }
+#endif /* LINK_TRANSPORT == LINK_TRANSPORT_I2C */
+    TransportService();
+}
+
+
+#if SCAN_MODE == SCAN_MODE_EXTI
+/**
+ * Key edge interrupt, any edge starts a scan burst and wakes the main loop
+ *
+ * Called from the EXTI handlers once they cleared their pending lines.
+ */
+HOT_PATH void RightKeyboardKeyEdge(void)
+{
+    scan_burst_active = true;
+#if RTOS_ENABLE
+    SchedSignal(SCHED_TASK_SCAN);
+#endif
+}
+#endif
@@ -0,0 +1,97 @@
+/**
+ * @file scan_jitter.c
+ * @brief Scan interval jitter and missed-deadline statistics.
+ */
+
+#include "scan_jitter.h"
+#include "hot_path.h"
+#include <stdbool.h>
+#include <string.h>
+
+#if SCAN_JITTER_STATS
+// Readable from the debugger, the mean is only filled in snapshots
+ScanJitterReport scan_jitter = { .min_us = UINT32_MAX };
+static uint64_t  interval_sum;
+static uint32_t  last_scan_us;
+static bool      started;
+#endif
+
+/**
+ * Account for one scheduled scan
+ *
+ * The first call only sets the reference point.
+ *
+ * @param now Time of the scan in microseconds
+ * @param requested_us Interval the scheduler asked for since the previous one
+ */
+HOT_PATH void ScanJitterRecord(uint32_t now, uint32_t requested_us)
+{
+#if SCAN_JITTER_STATS
+    uint32_t interval = now - last_scan_us;
+    last_scan_us = now;
+    if (!started) {
+        started = true;
+        return;
+    }
+
+    uint32_t deviation = interval > requested_us ? interval - requested_us : requested_us - interval;
+    uint32_t bucket = 0;
+    if (deviation >> SCAN_JITTER_HIST_SHIFT) {
+        bucket = 32u - SCAN_JITTER_HIST_SHIFT - (uint32_t)__builtin_clz(deviation);
+        if (bucket >= SCAN_JITTER_HIST_BUCKETS) {
+            bucket = SCAN_JITTER_HIST_BUCKETS - 1u;
+        }
+    }
+
+    // The snapshot is taken in the I2C interrupt
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (scan_jitter.scans != UINT32_MAX) {
+        scan_jitter.scans++;
+        interval_sum += interval;
+    }
+    if (interval > requested_us + SCAN_JITTER_LATE_US) {
+        scan_jitter.missed++;
+    }
+    scan_jitter.requested_us = requested_us;
+    if (interval < scan_jitter.min_us) {
+        scan_jitter.min_us = interval;
+    }
+    if (interval > scan_jitter.max_us) {
+        scan_jitter.max_us = interval;
+    }
+    if (scan_jitter.hist[bucket] != UINT16_MAX) {
+        scan_jitter.hist[bucket]++;
+    }
+
+    __set_PRIMASK(primask);
+#else
+    (void)now;
+    (void)requested_us;
+#endif
+}
+
+/**
+ * Copy a consistent snapshot for a register read
+ *
+ * @param report Filled with the statistics, all zero without SCAN_JITTER_STATS
+ */
+void ScanJitterSnapshot(ScanJitterReport *report)
+{
+#if SCAN_JITTER_STATS
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    *report = scan_jitter;
+    uint64_t sum = interval_sum;
+    __set_PRIMASK(primask);
+
+    if (report->scans == 0) {
+        report->min_us = 0;
+    } else {
+        report->mean_us = (uint32_t)(sum / report->scans);
+    }
+#else
+    memset(report, 0, sizeof(*report));
+#endif
+}
@@ -0,0 +1,132 @@
+/**
+ * @file scan_rate.c
+ * @brief Adaptive scan interval for SCAN_MODE_POLL.
+ */
+
+#include "scan_rate.h"
+#include "right_side_keyboard.h"
+#include "dma_sampler.h"
+#include "hot_path.h"
+
+// Fast and slow steps can be retuned by the master (RIGHT_KEYBOARD_REG_SETTINGS)
+static uint32_t level_interval_us[] = {
+    [SCAN_RATE_FAST]   = SCAN_RATE_FAST_US,
+    [SCAN_RATE_MEDIUM] = SCAN_RATE_MEDIUM_US,
+    [SCAN_RATE_SLOW]   = SCAN_POLL_INTERVAL_MS * 1000u,
+};
+
+#if SCAN_RATE_ADAPTIVE
+static ScanRateLevel level = SCAN_RATE_FAST;
+#else
+static ScanRateLevel level = SCAN_RATE_SLOW;
+#endif
+static uint32_t last_unsettled_us;
+static uint8_t  level_changes;
+
+/**
+ * Start at the fast rate, so the keys held at boot settle quickly
+ *
+ * @param now Current time in microseconds
+ */
+void ScanRateInit(uint32_t now)
+{
+    last_unsettled_us = now;
+}
+
+/**
+ * Pick the interval to the next scan from the outcome of the last one
+ *
+ * @param settled true if the scan found every key stable
+ * @param now Time of the scan in microseconds
+ * @return Time to the next scan in microseconds
+ */
+HOT_PATH uint32_t ScanRateUpdate(bool settled, uint32_t now)
+{
+#if SCAN_RATE_ADAPTIVE
+    ScanRateLevel next;
+
+    if (!settled) {
+        last_unsettled_us = now;
+        next = SCAN_RATE_FAST;
+    } else {
+        uint32_t stable_us = now - last_unsettled_us;
+        if (stable_us >= SCAN_RATE_SLOW_AFTER_MS * 1000u) {
+            next = SCAN_RATE_SLOW;
+            // Keep the difference far from a wrap during long idle periods
+            last_unsettled_us = now - SCAN_RATE_SLOW_AFTER_MS * 1000u;
+        } else if (stable_us >= SCAN_RATE_MEDIUM_AFTER_MS * 1000u) {
+            next = SCAN_RATE_MEDIUM;
+        } else {
+            next = SCAN_RATE_FAST;
+        }
+    }
+
+    if (next != level) {
+        level = next;
+        level_changes++;
+    }
+#else
+    (void)settled;
+    (void)now;
+#endif
+    return level_interval_us[level];
+}
+
+/**
+ * Get the current rate level
+ */
+ScanRateLevel ScanRateCurrent(void)
+{
+    return level;
+}
+
+/**
+ * Get the current time between scans for the register map
+ *
+ * @return Microseconds; the DMA sample period in SCAN_MODE_DMA, 0 in
+ *         SCAN_MODE_EXTI where scans follow the key edges
+ */
+uint32_t ScanRateInterval(void)
+{
+#if SCAN_MODE == SCAN_MODE_POLL
+    return level_interval_us[level];
+#elif SCAN_MODE == SCAN_MODE_DMA && KEY_WIRING == KEY_WIRING_HALL
+    return HALL_FRAME_US;
+#elif SCAN_MODE == SCAN_MODE_DMA
+    return DMA_SAMPLE_PERIOD_US;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Retune the fast and slow intervals, from the scan between two passes
+ *
+ * The caller checks SCAN_RATE_FAST_US >= 50 and
+ * fast <= SCAN_RATE_MEDIUM_US <= slow, as the build-time checks do.
+ *
+ * @param fast_us Interval while keys are moving
+ * @param slow_us Interval once every key is stable for a while
+ */
+void ScanRateSetIntervals(uint32_t fast_us, uint32_t slow_us)
+{
+    level_interval_us[SCAN_RATE_FAST] = fast_us;
+    level_interval_us[SCAN_RATE_SLOW] = slow_us;
+}
+
+/**
+ * Get the fast and slow intervals in microseconds
+ */
+void ScanRateIntervals(uint32_t *fast_us, uint32_t *slow_us)
+{
+    *fast_us = level_interval_us[SCAN_RATE_FAST];
+    *slow_us = level_interval_us[SCAN_RATE_SLOW];
+}
+
+/**
+ * Get the number of level changes since boot, wraps
+ */
+uint8_t ScanRateChanges(void)
+{
+    return level_changes;
+}
@@ -0,0 +1,328 @@
+/**
+ * @file sched.c
+ * @brief Cooperative main-loop scheduler with deadlines and run-time stats.
+ *
+ * The pending mask and the signal times are shared with interrupts and
+ * only touched with interrupts masked. The pick runs masked too, so a
+ * signal between the last check and WFI still ends the sleep.
+ */
+
+#include "sched.h"
+#include "main.h"
+#include "right_side_keyboard.h"
+#include "irq_plan.h"
+#include "mem_budget.h"
+#include "timebase.h"
+#include "residency.h"
+#include "stm32f4xx.h"
+
+#if RTOS_ENABLE
+#include "FreeRTOS.h"
+#include "task.h"
+
+#if DEEP_IDLE_ENABLE
+#error "RTOS_ENABLE sleeps tickless, DEEP_IDLE_ENABLE is bare-metal only"
+#endif
+
+#if CLOCK_PROFILE == CLOCK_PROFILE_GOVERNOR
+#error "CLOCK_PROFILE_GOVERNOR would change the SysTick rate under the kernel"
+#endif
+
+// Kick interrupt: an unused vector, pended by software only
+#define SCHED_KICK_IRQn SPI5_IRQn
+
+static StaticTask_t task_tcb[SCHED_TASKS];
+static StackType_t  task_stack[SCHED_TASKS][SCHED_RTOS_STACK_WORDS] MEM_BSS(rtos);
+static TaskHandle_t task_handle[SCHED_TASKS];
+static StaticTask_t idle_tcb;
+static StackType_t  idle_stack[configMINIMAL_STACK_SIZE] MEM_BSS(rtos);
+static uint32_t     sleep_start_us;
+static uint32_t     sleep_carry_us;
+#endif
+
+static const SchedTask *table;
+static void (*idle_hook)(void);
+static volatile uint32_t pending;           /* signaled tasks */
+static uint32_t signaled_at[SCHED_TASKS];
+static uint32_t next_release[SCHED_TASKS];
+static SchedTaskStats stats[SCHED_TASKS];
+
+/**
+ * Install the task table and release every periodic task now
+ *
+ * @param tasks SCHED_TASKS entries, indexed by SchedTaskId
+ * @param idle Run before every sleep, NULL for none (bare metal only)
+ */
+void SchedInit(const SchedTask *tasks, void (*idle)(void))
+{
+    uint32_t now = TimebaseNowUs();
+
+    table = tasks;
+    idle_hook = idle;
+    for (uint32_t n = 0; n < SCHED_TASKS; ++n) {
+        next_release[n] = now;
+    }
+}
+
+/**
+ * Make a task ready, from thread or interrupt context
+ *
+ * A task signaled again before it ran runs once, its deadline counts from
+ * the first signal.
+ */
+void SchedSignal(SchedTaskId task)
+{
+    uint32_t bit = 1u << task;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if ((pending & bit) == 0) {
+        pending |= bit;
+        signaled_at[task] = TimebaseNowUs();
+    }
+    __set_PRIMASK(primask);
+
+#if RTOS_ENABLE
+    if (xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED) {
+        return;
+    }
+    if (__get_IPSR() == 0) {
+        xTaskNotifyGive(task_handle[task]);
+    } else {
+        NVIC_SetPendingIRQ(SCHED_KICK_IRQn);
+    }
+#endif
+}
+
+/**
+ * Check whether one task is ready and take its release, interrupts masked
+ *
+ * @param release Set to the time the task became ready
+ */
+static bool SchedTake(uint32_t n, uint32_t now, uint32_t *release)
+{
+    const SchedTask *task = &table[n];
+    uint32_t bit = 1u << n;
+
+    if (pending & bit) {
+        pending &= ~bit;
+        *release = signaled_at[n];
+        return true;
+    }
+    if (task->period_us != 0 && TimebaseReached(now, next_release[n])) {
+        *release = next_release[n];
+        // Keep the grid, unless a whole period was missed
+        next_release[n] += task->period_us;
+        if (TimebaseReached(now, next_release[n])) {
+            next_release[n] = now + task->period_us;
+        }
+        return true;
+    }
+    if (task->ready != NULL && task->ready()) {
+        *release = now;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Run one task and account for it
+ */
+static void SchedExecute(uint32_t n, uint32_t release)
+{
+    SchedTaskStats *s = &stats[n];
+    uint32_t start = TimebaseNowUs();
+
+    if (table[n].deadline_us != 0 && start - release > table[n].deadline_us && s->misses != UINT16_MAX) {
+        s->misses++;
+    }
+    table[n].run();
+    uint32_t busy = TimebaseNowUs() - start;
+    s->runs++;
+    s->busy_us += busy;
+    if (busy > s->max_us) {
+        s->max_us = busy > UINT16_MAX ? UINT16_MAX : (uint16_t)busy;
+    }
+}
+
+#if RTOS_ENABLE
+/**
+ * Body of every RTOS task: run when ready, else block until the next
+ * period slot, a signal or the next ready() check
+ *
+ * @param arg Task index
+ */
+static void SchedTaskMain(void *arg)
+{
+    uint32_t n = (uint32_t)arg;
+    const SchedTask *task = &table[n];
+
+    for (;;) {
+        uint32_t release = 0;
+        uint32_t now = TimebaseNowUs();
+        __disable_irq();
+        bool ready = SchedTake(n, now, &release);
+        __enable_irq();
+
+        if (ready) {
+            SchedExecute(n, release);
+            continue;
+        }
+
+        TickType_t wait = portMAX_DELAY;
+        if (task->period_us != 0) {
+            uint32_t left_us = next_release[n] - now;
+            wait = (TickType_t)((left_us + portTICK_PERIOD_MS * 1000u - 1u) / (portTICK_PERIOD_MS * 1000u));
+        }
+        if (task->ready != NULL && wait > SCHED_RTOS_READY_TICKS) {
+            wait = SCHED_RTOS_READY_TICKS;
+        }
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+}
+
+/**
+ * Create one task per table entry and start the kernel, does not return
+ */
+void SchedRun(void)
+{
+    for (uint32_t n = 0; n < SCHED_TASKS; ++n) {
+        // Entries a build leaves out never run, they need no task
+        if (table[n].run == NULL) {
+            continue;
+        }
+        task_handle[n] = xTaskCreateStatic(SchedTaskMain, "sched", SCHED_RTOS_STACK_WORDS, (void *)n,
+                                           (UBaseType_t)(SCHED_TASKS - n), task_stack[n], &task_tcb[n]);
+    }
+
+    HAL_NVIC_SetPriority(SCHED_KICK_IRQn, IRQ_PRIO_WAKE, 0);
+    HAL_NVIC_EnableIRQ(SCHED_KICK_IRQn);
+    vTaskStartScheduler();
+    for (;;) {
+    }
+}
+
+/**
+ * Kick interrupt: notify the tasks signaled from above the kernel's
+ * interrupt level
+ */
+void SchedKickIRQHandler(void)
+{
+    BaseType_t woken = pdFALSE;
+
+    for (uint32_t tasks = pending; tasks; tasks &= tasks - 1u) {
+        uint32_t n = (uint32_t)__builtin_ctz(tasks);
+        if (task_handle[n] != NULL) {
+            vTaskNotifyGiveFromISR(task_handle[n], &woken);
+        }
+    }
+    portYIELD_FROM_ISR(woken);
+}
+
+/**
+ * Tickless idle is about to stop SysTick (configPRE_SLEEP_PROCESSING)
+ */
+void SchedRtosPreSleep(void)
+{
+    sleep_start_us = TimebaseNowUs();
+}
+
+/**
+ * Tickless idle woke up: move the HAL tick on by the time SysTick was
+ * stopped, per TIM5 (configPOST_SLEEP_PROCESSING)
+ */
+void SchedRtosPostSleep(void)
+{
+    uint32_t now = TimebaseNowUs();
+    uint32_t slept_us = now - sleep_start_us + sleep_carry_us;
+    ResidencySleep(sleep_start_us, now);
+    uwTick += slept_us / 1000u;
+    sleep_carry_us = slept_us % 1000u;
+}
+
+/**
+ * Memory of the kernel's idle task, configSUPPORT_STATIC_ALLOCATION
+ */
+void vApplicationGetIdleTaskMemory(StaticTask_t **tcb, StackType_t **stack, uint32_t *words)
+{
+    *tcb = &idle_tcb;
+    *stack = idle_stack;
+    *words = configMINIMAL_STACK_SIZE;
+}
+
+/**
+ * A task ran past its stack, configCHECK_FOR_STACK_OVERFLOW
+ */
+void vApplicationStackOverflowHook(TaskHandle_t task, char *name)
+{
+    (void)task;
+    (void)name;
+    Error_Handler();
+}
+#else
+/**
+ * Find the most urgent ready task, interrupts masked
+ *
+ * @return Task index, SCHED_TASKS if none is ready
+ */
+static uint32_t SchedPick(uint32_t now, uint32_t *release)
+{
+    for (uint32_t n = 0; n < SCHED_TASKS; ++n) {
+        if (SchedTake(n, now, release)) {
+            return n;
+        }
+    }
+    return SCHED_TASKS;
+}
+
+/**
+ * Run the tasks forever, highest priority first, sleeping when idle
+ */
+void SchedRun(void)
+{
+    for (;;) {
+        uint32_t release = 0;
+        __disable_irq();
+        uint32_t n = SchedPick(TimebaseNowUs(), &release);
+        __enable_irq();
+
+        if (n < SCHED_TASKS) {
+            SchedExecute(n, release);
+            continue;
+        }
+
+        if (idle_hook != NULL) {
+            idle_hook();
+        }
+        // Sleep until the next interrupt (SysTick, key edge, link, DMA);
+        // with PRIMASK set an interrupt that fires between the check and
+        // WFI still wakes the core right away, and its handler runs after
+        // __enable_irq()
+        __disable_irq();
+        n = SchedPick(TimebaseNowUs(), &release);
+        if (n == SCHED_TASKS) {
+            uint32_t sleep_start = TimebaseNowUs();
+            __WFI();
+            ResidencySleep(sleep_start, TimebaseNowUs());
+        }
+        __enable_irq();
+        if (n < SCHED_TASKS) {
+            SchedExecute(n, release);
+        }
+    }
+}
+#endif /* RTOS_ENABLE */
+
+/**
+ * Copy the accounting of every task for the register map
+ *
+ * Runs in the link interrupt, a run being accounted meanwhile may show
+ * with its count but not yet its time.
+ *
+ * @param out SCHED_TASKS entries
+ */
+void SchedSnapshot(SchedTaskStats *out)
+{
+    for (uint32_t n = 0; n < SCHED_TASKS; ++n) {
+        out[n] = stats[n];
+    }
+}
@@ -0,0 +1,249 @@
+/**
+ * @file spi_link.c
+ * @brief SPI1 slave link to the left half, DMA in both directions.
+ *
+ * Transmit: DMA2 stream 3 (channel 3) feeds SPI1->DR. Between requests it
+ * runs circularly over the key bytes of the published report word, so each
+ * byte is fetched when the master clocks the one before it. After a
+ * request it sends the reply from tx_buf once and stops.
+ *
+ * Receive: DMA2 stream 0 (channel 3) writes the MOSI bytes of a
+ * transaction into rx_buf, at most SPI_LINK_RX_LEN of them.
+ *
+ * Both streams are re-armed at every NSS rise (EXTI line 15), after SPI1 is
+ * reset to drop the byte already preloaded into DR, so every transaction
+ * starts on the first byte of its frame. The EXTI interrupt runs at
+ * IRQ_PRIO_I2C, the link level of irq_plan.h.
+ */
+
+#include "spi_link.h"
+#include "hot_path.h"
+#include "irq_plan.h"
+#include "mem_budget.h"
+#include <string.h>
+
+#if LINK_TRANSPORT == LINK_TRANSPORT_SPI
+// PA5 SCK, PA6 MISO, PA7 MOSI, PA15 NSS
+#define SPI_LINK_NSS_PIN  15u
+#define SPI_LINK_NSS_LINE (1u << SPI_LINK_NSS_PIN)
+
+// The default data-ready pin, PA15, is NSS here
+_Static_assert(!DATA_READY_ENABLE || DATA_READY_PIN != GPIO_PIN_15,
+               "Move DATA_READY_PIN off PA15, the SPI link uses it as NSS");
+
+// All flags of streams 0 and 3, both in LISR/LIFCR
+#define SPI_LINK_DMA_FLAGS (DMA_LIFCR_CTCIF0 | DMA_LIFCR_CHTIF0 | DMA_LIFCR_CTEIF0 | \
+                            DMA_LIFCR_CDMEIF0 | DMA_LIFCR_CFEIF0 | \
+                            DMA_LIFCR_CTCIF3 | DMA_LIFCR_CHTIF3 | DMA_LIFCR_CTEIF3 | \
+                            DMA_LIFCR_CDMEIF3 | DMA_LIFCR_CFEIF3)
+
+// Channel 3, high priority, memory increment, byte wide in direct mode
+#define SPI_LINK_DMA_CR (DMA_SxCR_CHSEL_0 | DMA_SxCR_CHSEL_1 | DMA_SxCR_PL_1 | DMA_SxCR_MINC)
+
+static uint8_t rx_buf[SPI_LINK_RX_LEN] MEM_BSS(dma);
+static LinkParser parser;
+
+// Last complete request, answered in the next transaction
+static uint8_t  request[LINK_REQUEST_LEN];
+static uint32_t request_len;
+static bool     request_pending;
+
+static uint8_t tx_buf[LINK_REPLY_EXTRA + LINK_REPLY_LEN] MEM_BSS(dma);
+static uint32_t tx_len;             /* reply bytes armed, 0 while streaming snapshots */
+static uint32_t tx_frame_len;       /* frame bytes in the armed reply */
+
+/**
+ * Reset SPI1 and point both streams at the next transaction
+ *
+ * @param src First byte to send
+ * @param len Bytes to send, repeated while circular
+ * @param circular true to stream src over and over
+ */
+HOT_PATH static void SpiLinkArm(const volatile void *src, uint32_t len, bool circular)
+{
+    DMA2_Stream3->CR &= ~DMA_SxCR_EN;
+    DMA2_Stream0->CR &= ~DMA_SxCR_EN;
+    while ((DMA2_Stream3->CR | DMA2_Stream0->CR) & DMA_SxCR_EN) {
+    }
+
+    // Drops the preloaded byte and any overrun of an over-long transaction
+    RCC->APB2RSTR |= RCC_APB2RSTR_SPI1RST;
+    RCC->APB2RSTR &= ~RCC_APB2RSTR_SPI1RST;
+
+    DMA2->LIFCR = SPI_LINK_DMA_FLAGS;
+    DMA2_Stream0->NDTR = SPI_LINK_RX_LEN;
+    DMA2_Stream0->CR |= DMA_SxCR_EN;
+    SPI1->CR2 = SPI_CR2_RXDMAEN;
+
+    DMA2_Stream3->M0AR = (uint32_t)src;
+    DMA2_Stream3->NDTR = len;
+    DMA2_Stream3->CR = SPI_LINK_DMA_CR | DMA_SxCR_DIR_0 | (circular ? DMA_SxCR_CIRC : 0u);
+    DMA2_Stream3->CR |= DMA_SxCR_EN;
+
+    // Slave, mode 0, MSB first, NSS from the pin
+    SPI1->CR2 = SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN;
+    SPI1->CR1 = SPI_CR1_SPE;
+}
+
+/**
+ * Stream the key bytes of the published report
+ */
+HOT_PATH static void SpiLinkArmSnapshot(void)
+{
+    tx_len = 0;
+    SpiLinkArm(RightKeyboardPublishedWord(), RIGHT_KEYBOARD_REPORT_BYTES, true);
+}
+
+/**
+ * Parse the MOSI bytes of the transaction that just ended
+ */
+HOT_PATH static void SpiLinkReceive(void)
+{
+    uint32_t count = SPI_LINK_RX_LEN - DMA2_Stream0->NDTR;
+
+    for (uint32_t n = 0; n < count; ++n) {
+        if (!LinkParse(&parser, rx_buf[n])) {
+            continue;
+        }
+        if (request_pending) {
+            // A second request before the first was answered replaces it
+            RightKeyboardLinkError(LINK_ERROR_FRAME);
+        }
+        memcpy(request, parser.frame, parser.len);
+        request_len = parser.len;
+        request_pending = true;
+    }
+}
+
+/**
+ * Return the reply frame of the transaction that just ended
+ */
+HOT_PATH static void SpiLinkReplyEnd(void)
+{
+    uint32_t sent = tx_len - DMA2_Stream3->NDTR;
+
+    // A byte fetched into DR but not clocked out never reached the master
+    if (sent > 0 && !(SPI1->SR & SPI_SR_TXE)) {
+        sent--;
+    }
+    sent = sent > LINK_REPLY_HEADER ? sent - LINK_REPLY_HEADER : 0u;
+    RightKeyboardTxEnd(sent < tx_frame_len ? sent : tx_frame_len);
+}
+
+/**
+ * Apply the pending request and arm its reply
+ */
+HOT_PATH static void SpiLinkArmReply(void)
+{
+    const uint8_t *frame;
+
+    request_pending = false;
+    RightKeyboardRxEnd(request, request_len);
+    tx_frame_len = RightKeyboardTxBegin(&frame);
+    if (tx_frame_len > LINK_REPLY_LEN) {
+        tx_frame_len = LINK_REPLY_LEN;
+    }
+    tx_len = LinkReplyBuild(tx_buf, request[0], frame, tx_frame_len);
+    SpiLinkArm(tx_buf, tx_len, false);
+}
+#endif /* LINK_TRANSPORT == LINK_TRANSPORT_SPI */
+
+/**
+ * Hand PA5-PA7 and PA15 to SPI1 and start streaming snapshots
+ *
+ * Runs once from RightKeyboardInit().
+ */
+void SpiLinkStart(void)
+{
+#if LINK_TRANSPORT == LINK_TRANSPORT_SPI
+    RCC->AHB1ENR |= RCC_AHB1ENR_GPIOAEN | RCC_AHB1ENR_DMA2EN;
+    RCC->APB2ENR |= RCC_APB2ENR_SPI1EN | RCC_APB2ENR_SYSCFGEN;
+    (void)RCC->APB2ENR;
+
+    // All four on AF5, MISO driven fast, SCK held low and NSS high while
+    // the master is unpowered
+    GPIOA->AFR[0] = (GPIOA->AFR[0] & ~(0xFFFu << 20)) | (0x555u << 20);
+    GPIOA->AFR[1] = (GPIOA->AFR[1] & ~(0xFu << 28)) | (0x5u << 28);
+    GPIOA->OSPEEDR |= 3u << (2 * 6);
+    GPIOA->PUPDR = (GPIOA->PUPDR & ~((3u << (2 * 5)) | (3u << (2 * SPI_LINK_NSS_PIN)))) |
+                   (2u << (2 * 5)) | (1u << (2 * SPI_LINK_NSS_PIN));
+    GPIOA->MODER = (GPIOA->MODER & ~((0x3Fu << (2 * 5)) | (3u << (2 * SPI_LINK_NSS_PIN)))) |
+                   (0x2Au << (2 * 5)) | (2u << (2 * SPI_LINK_NSS_PIN));
+
+    DMA2_Stream0->CR = 0;
+    DMA2_Stream3->CR = 0;
+    while ((DMA2_Stream3->CR | DMA2_Stream0->CR) & DMA_SxCR_EN) {
+    }
+    DMA2_Stream0->PAR = (uint32_t)&SPI1->DR;
+    DMA2_Stream0->M0AR = (uint32_t)rx_buf;
+    DMA2_Stream0->CR = SPI_LINK_DMA_CR;
+    DMA2_Stream3->PAR = (uint32_t)&SPI1->DR;
+
+    LinkParserReset(&parser);
+    request_pending = false;
+    SpiLinkArmSnapshot();
+
+    // NSS rising edge on EXTI line 15, port A
+    SYSCFG->EXTICR[3] &= ~SYSCFG_EXTICR4_EXTI15;
+    EXTI->FTSR &= ~SPI_LINK_NSS_LINE;
+    EXTI->RTSR |= SPI_LINK_NSS_LINE;
+    EXTI->PR = SPI_LINK_NSS_LINE;
+    EXTI->IMR |= SPI_LINK_NSS_LINE;
+
+    HAL_NVIC_SetPriority(EXTI15_10_IRQn, IRQ_PRIO_I2C, 0);
+    NVIC_EnableIRQ(EXTI15_10_IRQn);
+#endif
+}
+
+/**
+ * Restart the snapshot stream because the report changed
+ *
+ * Called from the scan. The stream reads the report word as it goes, only
+ * the byte preloaded into DR is old; the NSS interrupt, pended here,
+ * fetches it again while the link is idle.
+ */
+HOT_PATH void SpiLinkRefresh(void)
+{
+#if LINK_TRANSPORT == LINK_TRANSPORT_SPI
+    NVIC_SetPendingIRQ(EXTI15_10_IRQn);
+#endif
+}
+
+/**
+ * Check whether a transaction, request or reply is under way, STOP or a
+ * clock switch would cut it
+ */
+bool SpiLinkBusy(void)
+{
+#if LINK_TRANSPORT == LINK_TRANSPORT_SPI
+    return tx_len != 0 || request_pending || !LinkParserIdle(&parser) ||
+           !(GPIOA->IDR & SPI_LINK_NSS_LINE);
+#else
+    return false;
+#endif
+}
+
+/**
+ * EXTI line 15 interrupt: NSS rose at the end of a transaction, or a
+ * snapshot refresh pended by SpiLinkRefresh()
+ */
+HOT_PATH void SpiLinkNssIRQHandler(void)
+{
+#if LINK_TRANSPORT == LINK_TRANSPORT_SPI
+    if (EXTI->PR & SPI_LINK_NSS_LINE) {
+        EXTI->PR = SPI_LINK_NSS_LINE;
+        SpiLinkReceive();
+        if (tx_len != 0) {
+            SpiLinkReplyEnd();
+        }
+        if (request_pending) {
+            SpiLinkArmReply();
+        } else {
+            SpiLinkArmSnapshot();
+        }
+    } else if (tx_len == 0 && (GPIOA->IDR & SPI_LINK_NSS_LINE)) {
+        // Between transactions; one in progress is re-armed when it ends
+        SpiLinkArmSnapshot();
+    }
+#endif
+}
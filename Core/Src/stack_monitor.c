@@ -0,0 +1,72 @@
+/**
+ * @file stack_monitor.c
+ * @brief Stack high-water mark from a painted stack reserve.
+ */
+
+#include "stack_monitor.h"
+
+#if STACK_MONITOR
+// Linker script symbols
+extern uint32_t _estack;
+extern uint32_t _Min_Stack_Size;
+
+static uint32_t *StackBottom(void)
+{
+    return (uint32_t *)((uint32_t)&_estack - (uint32_t)&_Min_Stack_Size);
+}
+#endif
+
+/**
+ * Fill the unused part of the stack reserve with STACK_PAINT_WORD
+ *
+ * Called first thing in main(), everything above the current stack pointer
+ * is in use already and left alone.
+ */
+void StackPaint(void)
+{
+#if STACK_MONITOR
+    uint32_t *top = (uint32_t *)(__get_MSP() & ~3u);
+
+    for (uint32_t *word = StackBottom(); word < top; ++word) {
+        *word = STACK_PAINT_WORD;
+    }
+#endif
+}
+
+/**
+ * Count the stack bytes that were never used since StackPaint()
+ *
+ * Walks up from the bottom of the reserve, so it costs one load per free
+ * word; cheap once the reserve is sized close to the real need.
+ *
+ * @return Untouched bytes at the bottom of the reserve, 0 without STACK_MONITOR
+ */
+uint32_t StackFreeBytes(void)
+{
+#if STACK_MONITOR
+    const uint32_t *bottom = StackBottom();
+    const uint32_t *word = bottom;
+    const uint32_t *top = &_estack;
+
+    while (word < top && *word == STACK_PAINT_WORD) {
+        ++word;
+    }
+    return (uint32_t)(word - bottom) * sizeof(uint32_t);
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Get the stack high-water mark
+ *
+ * @return Deepest stack use in bytes, 0 without STACK_MONITOR
+ */
+uint32_t StackUsedBytes(void)
+{
+#if STACK_MONITOR
+    return (uint32_t)&_Min_Stack_Size - StackFreeBytes();
+#else
+    return 0;
+#endif
+}
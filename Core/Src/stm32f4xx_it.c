@@ -22,6 +22,28 @@
 #include "stm32f4xx_it.h"
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include "right_side_keyboard.h"
+#include "dma_sampler.h"
+#include "i2c_slave.h"
+#include "uart_link.h"
+#include "spi_link.h"
+#include "usb_hid.h"
+#include "deep_idle.h"
+#include "hot_path.h"
+#include "irq_plan.h"
+#include "residency.h"
+#include "timebase.h"
+#include "profile.h"
+#include "bench.h"
+#include "retained.h"
+#include "periph.h"
+#include "sched.h"
+#include "clock_css.h"
+#include "edge_capture.h"
+#if RTOS_ENABLE
+#include "FreeRTOS.h"
+#include "task.h"
+#endif
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -46,7 +68,9 @@
 
 /* Private function prototypes -----------------------------------------------*/
 /* USER CODE BEGIN PFP */
-
+#if RTOS_ENABLE
+void xPortSysTickHandler(void);
+#endif
 /* USER CODE END PFP */
 
 /* Private user code ---------------------------------------------------------*/
@@ -57,7 +81,9 @@
 /* External variables --------------------------------------------------------*/
 extern I2C_HandleTypeDef hi2c1;
 /* USER CODE BEGIN EV */
-
+#if I2C_DRIVER == I2C_DRIVER_HAL_DMA
+extern DMA_HandleTypeDef hdma_i2c1_tx;
+#endif
 /* USER CODE END EV */
 
 /******************************************************************************/
@@ -69,7 +95,15 @@ extern I2C_HandleTypeDef hi2c1;
 void NMI_Handler(void)
 {
   /* USER CODE BEGIN NonMaskableInt_IRQn 0 */
-
+  // Record and recover (retained.h). First instruction of every fault
+  // handler: no locals and no calls, so nothing has been pushed on top of
+  // the exception frame yet. A failed HSE crystal raises NMI too, the CSS
+  // entry takes that and passes anything else on (clock_css.h).
+#if CLOCK_CSS_ENABLE
+  __asm volatile ("b ClockCssNmiEntry");
+#elif RETAINED_FAULT_HOOK
+  __asm volatile ("b RetainedFaultEntry");
+#endif
   /* USER CODE END NonMaskableInt_IRQn 0 */
   /* USER CODE BEGIN NonMaskableInt_IRQn 1 */
    while (1)
@@ -84,7 +118,9 @@ void NMI_Handler(void)
 void HardFault_Handler(void)
 {
   /* USER CODE BEGIN HardFault_IRQn 0 */
-
+#if RETAINED_FAULT_HOOK
+  __asm volatile ("b RetainedFaultEntry");
+#endif
   /* USER CODE END HardFault_IRQn 0 */
   while (1)
   {
@@ -99,7 +135,9 @@ void HardFault_Handler(void)
 void MemManage_Handler(void)
 {
   /* USER CODE BEGIN MemoryManagement_IRQn 0 */
-
+#if RETAINED_FAULT_HOOK
+  __asm volatile ("b RetainedFaultEntry");
+#endif
   /* USER CODE END MemoryManagement_IRQn 0 */
   while (1)
   {
@@ -114,7 +152,9 @@ void MemManage_Handler(void)
 void BusFault_Handler(void)
 {
   /* USER CODE BEGIN BusFault_IRQn 0 */
-
+#if RETAINED_FAULT_HOOK
+  __asm volatile ("b RetainedFaultEntry");
+#endif
   /* USER CODE END BusFault_IRQn 0 */
   while (1)
   {
@@ -129,7 +169,9 @@ void BusFault_Handler(void)
 void UsageFault_Handler(void)
 {
   /* USER CODE BEGIN UsageFault_IRQn 0 */
-
+#if RETAINED_FAULT_HOOK
+  __asm volatile ("b RetainedFaultEntry");
+#endif
   /* USER CODE END UsageFault_IRQn 0 */
   while (1)
   {
@@ -138,6 +180,8 @@ void UsageFault_Handler(void)
   }
 }
 
+#if !RTOS_ENABLE
+/* The RTOS build takes SVC and PendSV from the FreeRTOS port, see FreeRTOSConfig.h */
 /**
   * @brief This function handles System service call via SWI instruction.
   */
@@ -151,6 +195,8 @@ void SVC_Handler(void)
   /* USER CODE END SVCall_IRQn 1 */
 }
 
+#endif
+
 /**
   * @brief This function handles Debug monitor.
   */
@@ -164,6 +210,7 @@ void DebugMon_Handler(void)
   /* USER CODE END DebugMonitor_IRQn 1 */
 }
 
+#if !RTOS_ENABLE
 /**
   * @brief This function handles Pendable request for system service.
   */
@@ -176,6 +223,7 @@ void PendSV_Handler(void)
 
   /* USER CODE END PendSV_IRQn 1 */
 }
+#endif
 
 /**
   * @brief This function handles System tick timer.
@@ -183,11 +231,20 @@ void PendSV_Handler(void)
 void SysTick_Handler(void)
 {
   /* USER CODE BEGIN SysTick_IRQn 0 */
-
+  IrqPlanRecordTickLatency();
+  IRQ_PLAN_ENTER();
   /* USER CODE END SysTick_IRQn 0 */
   HAL_IncTick();
   /* USER CODE BEGIN SysTick_IRQn 1 */
-
+#if BENCH_MODE != BENCH_MODE_OFF
+  BenchTick();
+#endif
+#if RTOS_ENABLE
+  if (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED) {
+    xPortSysTickHandler();
+  }
+#endif
+  IRQ_PLAN_EXIT(IRQ_SOURCE_SYSTICK);
   /* USER CODE END SysTick_IRQn 1 */
 }
 
@@ -203,17 +260,263 @@ void SysTick_Handler(void)
 /**
   * @brief This function handles I2C1 event interrupt.
   */
-void I2C1_EV_IRQHandler(void)
+HOT_PATH void I2C1_EV_IRQHandler(void)
 {
+  IRQ_PLAN_ENTER();
+  RESIDENCY_ENTER();
+  PROFILE_BEGIN(PROFILE_I2C_EV);
+#if I2C_DRIVER == I2C_DRIVER_REGISTER
+  I2CSlaveEventIRQHandler();
+#else
   HAL_I2C_EV_IRQHandler(&hi2c1);
+#endif
+  PROFILE_END(PROFILE_I2C_EV);
+  RESIDENCY_EXIT(RESIDENCY_LINK);
+  IRQ_PLAN_EXIT(IRQ_SOURCE_I2C_EV);
 }
 
 /**
   * @brief This function handles I2C1 error interrupt.
   */
-void I2C1_ER_IRQHandler(void)
+HOT_PATH void I2C1_ER_IRQHandler(void)
 {
+  IRQ_PLAN_ENTER();
+  RESIDENCY_ENTER();
+  PROFILE_BEGIN(PROFILE_I2C_ER);
+#if I2C_DRIVER == I2C_DRIVER_REGISTER
+  I2CSlaveErrorIRQHandler();
+#else
   HAL_I2C_ER_IRQHandler(&hi2c1);
+#endif
+  PROFILE_END(PROFILE_I2C_ER);
+  RESIDENCY_EXIT(RESIDENCY_LINK);
+  IRQ_PLAN_EXIT(IRQ_SOURCE_I2C_ER);
+}
+
+#if I2C_DRIVER == I2C_DRIVER_HAL_DMA
+/**
+  * @brief This function handles DMA1 stream6 global interrupt (I2C1_TX).
+  */
+void DMA1_Stream6_IRQHandler(void)
+{
+  IRQ_PLAN_ENTER();
+  RESIDENCY_ENTER();
+  HAL_DMA_IRQHandler(&hdma_i2c1_tx);
+  RESIDENCY_EXIT(RESIDENCY_LINK);
+  IRQ_PLAN_EXIT(IRQ_SOURCE_I2C_DMA);
+}
+#endif
+
+#if LINK_TRANSPORT == LINK_TRANSPORT_UART
+/**
+  * @brief This function handles USART1 global interrupt (link idle line, errors, pushes).
+  */
+HOT_PATH void USART1_IRQHandler(void)
+{
+  IRQ_PLAN_ENTER();
+  RESIDENCY_ENTER();
+  UartLinkIRQHandler();
+  RESIDENCY_EXIT(RESIDENCY_LINK);
+  IRQ_PLAN_EXIT(IRQ_SOURCE_UART);
+}
+
+/**
+  * @brief This function handles DMA2 stream2 global interrupt (USART1_RX).
+  */
+HOT_PATH void DMA2_Stream2_IRQHandler(void)
+{
+  IRQ_PLAN_ENTER();
+  RESIDENCY_ENTER();
+  UartLinkRxDmaIRQHandler();
+  RESIDENCY_EXIT(RESIDENCY_LINK);
+  IRQ_PLAN_EXIT(IRQ_SOURCE_UART_DMA);
+}
+
+/**
+  * @brief This function handles DMA2 stream7 global interrupt (USART1_TX).
+  */
+HOT_PATH void DMA2_Stream7_IRQHandler(void)
+{
+  IRQ_PLAN_ENTER();
+  RESIDENCY_ENTER();
+  UartLinkTxDmaIRQHandler();
+  RESIDENCY_EXIT(RESIDENCY_LINK);
+  IRQ_PLAN_EXIT(IRQ_SOURCE_UART_DMA);
+}
+#endif
+
+#if LINK_TRANSPORT == LINK_TRANSPORT_SPI
+/**
+  * @brief This function handles EXTI line[15:10] interrupts (SPI1 NSS rise, snapshot refresh).
+  */
+HOT_PATH void EXTI15_10_IRQHandler(void)
+{
+  IRQ_PLAN_ENTER();
+  RESIDENCY_ENTER();
+  SpiLinkNssIRQHandler();
+  RESIDENCY_EXIT(RESIDENCY_LINK);
+  IRQ_PLAN_EXIT(IRQ_SOURCE_SPI_NSS);
+}
+#endif
+
+#if USB_HID_ENABLE
+/**
+  * @brief This function handles USB On The Go FS global interrupt (enumeration, HID reports).
+  */
+HOT_PATH void OTG_FS_IRQHandler(void)
+{
+  IRQ_PLAN_ENTER();
+  UsbHidIRQHandler();
+  IRQ_PLAN_EXIT(IRQ_SOURCE_USB);
+}
+#endif
+
+#if SCAN_MODE == SCAN_MODE_DMA && KEY_WIRING == KEY_WIRING_HALL
+/**
+  * @brief This function handles DMA2 stream4 global interrupt (ADC1, Hall sensor frames).
+  */
+HOT_PATH void DMA2_Stream4_IRQHandler(void)
+{
+  IRQ_PLAN_ENTER();
+  HallIRQHandler();
+  IRQ_PLAN_EXIT(IRQ_SOURCE_SAMPLER);
+}
+#elif SCAN_MODE == SCAN_MODE_DMA
+/**
+  * @brief This function handles DMA2 stream1 global interrupt (TIM1_CH1, GPIOB samples).
+  */
+void DMA2_Stream1_IRQHandler(void)
+{
+  IRQ_PLAN_ENTER();
+  HAL_DMA_IRQHandler(&hdma_tim1_ch1);
+  IRQ_PLAN_EXIT(IRQ_SOURCE_SAMPLER);
+}
+#endif
+
+#if SCAN_MODE == SCAN_MODE_EXTI
+/**
+  * @brief This function handles EXTI line0 interrupt.
+  */
+void EXTI0_IRQHandler(void)
+{
+  IRQ_PLAN_ENTER();
+  if (PeriphExtiTake(EXTI_PR_PR0)) {
+    RightKeyboardKeyEdge();
+  }
+  IRQ_PLAN_EXIT(IRQ_SOURCE_EXTI);
+}
+
+/**
+  * @brief This function handles EXTI line1 interrupt.
+  */
+void EXTI1_IRQHandler(void)
+{
+  IRQ_PLAN_ENTER();
+  if (PeriphExtiTake(EXTI_PR_PR1)) {
+    RightKeyboardKeyEdge();
+  }
+  IRQ_PLAN_EXIT(IRQ_SOURCE_EXTI);
+}
+
+/**
+  * @brief This function handles EXTI line2 interrupt.
+  */
+void EXTI2_IRQHandler(void)
+{
+  IRQ_PLAN_ENTER();
+  if (PeriphExtiTake(EXTI_PR_PR2)) {
+    RightKeyboardKeyEdge();
+  }
+  IRQ_PLAN_EXIT(IRQ_SOURCE_EXTI);
+}
+
+/**
+  * @brief This function handles EXTI line3 interrupt.
+  */
+void EXTI3_IRQHandler(void)
+{
+  IRQ_PLAN_ENTER();
+  if (PeriphExtiTake(EXTI_PR_PR3)) {
+    RightKeyboardKeyEdge();
+  }
+  IRQ_PLAN_EXIT(IRQ_SOURCE_EXTI);
+}
+
+/**
+  * @brief This function handles EXTI line4 interrupt.
+  */
+void EXTI4_IRQHandler(void)
+{
+  IRQ_PLAN_ENTER();
+  if (PeriphExtiTake(EXTI_PR_PR4)) {
+    RightKeyboardKeyEdge();
+  }
+  IRQ_PLAN_EXIT(IRQ_SOURCE_EXTI);
+}
+
+/**
+  * @brief This function handles EXTI line[9:5] interrupts.
+  */
+void EXTI9_5_IRQHandler(void)
+{
+  IRQ_PLAN_ENTER();
+  // Lines 5-9 at once, SDA included while deep idle owns line 7
+  if (PeriphExtiTake(0x03E0u)) {
+    RightKeyboardKeyEdge();
+  }
+  IRQ_PLAN_EXIT(IRQ_SOURCE_EXTI);
+}
+
+/**
+  * @brief This function handles EXTI line[15:10] interrupts.
+  */
+void EXTI15_10_IRQHandler(void)
+{
+  IRQ_PLAN_ENTER();
+  if (PeriphExtiTake(0xFC00u)) {
+    RightKeyboardKeyEdge();
+  }
+  IRQ_PLAN_EXIT(IRQ_SOURCE_EXTI);
+}
+#endif
+
+/**
+  * @brief This function handles TIM5 global interrupt (time base compare wake-up).
+  */
+void TIM5_IRQHandler(void)
+{
+  IRQ_PLAN_ENTER();
+  TimebaseIRQHandler();
+  EdgeCaptureIRQHandler();
+#if RTOS_ENABLE
+  // Poll deadline, the scan task waits for it
+  SchedSignal(SCHED_TASK_SCAN);
+#endif
+  IRQ_PLAN_EXIT(IRQ_SOURCE_TIMEBASE);
+}
+
+#if RTOS_ENABLE
+/**
+  * @brief This function handles the scheduler kick, pended by software on the unused SPI5 vector.
+  */
+void SPI5_IRQHandler(void)
+{
+  IRQ_PLAN_ENTER();
+  SchedKickIRQHandler();
+  IRQ_PLAN_EXIT(IRQ_SOURCE_SCHED_KICK);
+}
+#endif
+
+#if DEEP_IDLE_ENABLE
+/**
+  * @brief This function handles RTC wakeup interrupt through EXTI line 22.
+  */
+void RTC_WKUP_IRQHandler(void)
+{
+  IRQ_PLAN_ENTER();
+  DeepIdleRtcIRQHandler();
+  IRQ_PLAN_EXIT(IRQ_SOURCE_RTC);
 }
+#endif
 
 /* USER CODE END 1 */
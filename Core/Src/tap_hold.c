@@ -0,0 +1,370 @@
+/**
+ * @file tap_hold.c
+ * @brief Local tap-hold and combo decisions on the keymap codes.
+ *
+ * Everything runs in the scan, the I2C interrupt only takes actions off the
+ * queue, which is single-producer/single-consumer like key_events.c.
+ */
+
+#include "tap_hold.h"
+#include "hot_path.h"
+#include "mem_budget.h"
+#include "stm32f4xx.h"
+
+#if TAP_HOLD_ENABLE
+#define TAP_HOLD_INDEX_MASK (TAP_HOLD_QUEUE_LEN - 1u)
+
+// Tables from TAP_HOLD_TABLE and TAP_HOLD_COMBO_TABLE
+#define TAP_HOLD_KEY_BIT(key, tap, hold)   | (1u << (key))
+#define TAP_HOLD_TAP_CODE(key, tap, hold)  [key] = (tap),
+#define TAP_HOLD_HOLD_CODE(key, tap, hold) [key] = (hold),
+#define TAP_HOLD_COMBO_BITS(keys, code)    | (keys)
+#define TAP_HOLD_COMBO_ENTRY(keys, code)   { (keys), (code) },
+#define TAP_HOLD_COMBO_CHECK(keys, code) \
+    _Static_assert(__builtin_popcount(keys) >= 2 && ((keys) >> NUM_KEYS) == 0, \
+                   "A combo needs two or more existing keys");
+
+TAP_HOLD_COMBO_TABLE(TAP_HOLD_COMBO_CHECK)
+
+typedef struct {
+    uint32_t keys;
+    uint8_t  code;
+} TapHoldCombo;
+
+#define TAP_HOLD_KEYS   (0u TAP_HOLD_TABLE(TAP_HOLD_KEY_BIT))
+#define TAP_HOLD_COMBOS (0u TAP_HOLD_COMBO_TABLE(TAP_HOLD_COMBO_BITS))
+
+static const uint8_t      tap_codes[NUM_KEYS] = { TAP_HOLD_TABLE(TAP_HOLD_TAP_CODE) };
+static const uint8_t      hold_codes[NUM_KEYS] = { TAP_HOLD_TABLE(TAP_HOLD_HOLD_CODE) };
+static const TapHoldCombo combos[] = { TAP_HOLD_COMBO_TABLE(TAP_HOLD_COMBO_ENTRY) };
+
+_Static_assert((TAP_HOLD_KEYS & TAP_HOLD_COMBOS) == 0, "A key can't be both a tap-hold key and part of a combo");
+
+// One accepted edge
+typedef struct {
+    uint8_t  key;
+    bool     pressed;
+    uint32_t time;
+} TapHoldEdge;
+
+typedef enum {
+    PENDING_NONE,
+    PENDING_TAP_HOLD,   // pending_key held, tap or hold not decided yet
+    PENDING_COMBO       // pending_key pressed first, more combo keys may follow
+} PendingKind;
+
+static PendingKind pending;
+static uint8_t     pending_key;
+static uint32_t    pending_us;          /* press time of pending_key */
+static uint32_t    combo_down;          /* combo keys pressed since pending_key, itself included */
+static TapHoldEdge held_back[TAP_HOLD_BUFFER_LEN];
+static uint32_t    held_back_count;
+
+static uint8_t  key_codes[NUM_KEYS];    /* code sent on the key's press, released with it */
+static uint32_t combo_active;           /* keys of the combo that is down */
+static uint8_t  combo_code;             /* its code, KEYMAP_NONE once released */
+static uint32_t last_action_us;
+static bool     emitted;                /* an action was queued in this call */
+
+static TapHoldAction     actions[TAP_HOLD_QUEUE_LEN] MEM_BSS(events);
+static volatile uint32_t head;          /* written by the producer only */
+static volatile uint32_t tail;          /* written by the consumer only */
+
+static void Process(TapHoldEdge edge, bool allow_combo);
+
+/**
+ * Queue an action, times never go backwards (producer side)
+ */
+static void Emit(uint8_t code, bool pressed, uint32_t time)
+{
+    if (code == KEYMAP_NONE) {
+        return;
+    }
+    if ((int32_t)(time - last_action_us) < 0) {
+        time = last_action_us;
+    }
+    last_action_us = time;
+
+    uint32_t h = head;
+    if (h - tail >= TAP_HOLD_QUEUE_LEN) {
+        return;
+    }
+    TapHoldAction *action = &actions[h & TAP_HOLD_INDEX_MASK];
+    action->code = code;
+    action->pressed = pressed ? 1u : 0u;
+    action->timestamp = time;
+    __DMB();
+    head = h + 1;
+    emitted = true;
+}
+
+/**
+ * Close the open decision and run the held-back edges again
+ *
+ * @param first Edge to run before them, or NULL
+ */
+static void Replay(const TapHoldEdge *first)
+{
+    TapHoldEdge edges[TAP_HOLD_BUFFER_LEN];
+    uint32_t count = held_back_count;
+
+    for (uint32_t n = 0; n < count; n++) {
+        edges[n] = held_back[n];
+    }
+    held_back_count = 0;
+    pending = PENDING_NONE;
+
+    // The key that opened a failed combo must not open it again
+    if (first) {
+        Process(*first, false);
+    }
+    for (uint32_t n = 0; n < count; n++) {
+        Process(edges[n], true);
+    }
+}
+
+/**
+ * Decide the open tap-hold key as held
+ */
+static void DecideHold(uint32_t time)
+{
+    key_codes[pending_key] = hold_codes[pending_key];
+    Emit(hold_codes[pending_key], true, time);
+    Replay(NULL);
+}
+
+/**
+ * Give up the open combo, its first key goes through as a plain press
+ */
+static void FailCombo(void)
+{
+    TapHoldEdge first = { pending_key, true, pending_us };
+    Replay(&first);
+}
+
+/**
+ * Make the decisions whose time ran out by the given time
+ */
+static void Expire(uint32_t now)
+{
+    // Signed, a back-dated sample must not look like a long wait
+    int32_t waited = (int32_t)(now - pending_us);
+
+    if (pending == PENDING_TAP_HOLD && waited >= (int32_t)TAP_HOLD_TERM_US) {
+        DecideHold(pending_us + TAP_HOLD_TERM_US);
+    } else if (pending == PENDING_COMBO && waited >= (int32_t)TAP_HOLD_COMBO_TERM_US) {
+        FailCombo();
+    }
+}
+
+/**
+ * Fire the combo the pressed combo keys complete, if any
+ *
+ * @return true if one fired
+ */
+static bool FireCombo(uint32_t time)
+{
+    for (uint32_t n = 0; n < sizeof(combos) / sizeof(combos[0]); n++) {
+        uint32_t keys = combos[n].keys;
+        if ((keys & (1u << pending_key)) && (keys & ~combo_down) == 0) {
+            if (combo_code != KEYMAP_NONE) {
+                Emit(combo_code, false, time);
+            }
+            combo_active = keys;
+            combo_code = combos[n].code;
+            Emit(combo_code, true, time);
+
+            // The presses of its keys are used up, anything else is replayed
+            uint32_t kept = 0;
+            for (uint32_t i = 0; i < held_back_count; i++) {
+                if (!(held_back[i].pressed && (keys & (1u << held_back[i].key)))) {
+                    held_back[kept++] = held_back[i];
+                }
+            }
+            held_back_count = kept;
+            Replay(NULL);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Run one accepted edge through the stage
+ *
+ * @param edge The edge
+ * @param allow_combo false to take a combo key as a plain key
+ */
+static void Process(TapHoldEdge edge, bool allow_combo)
+{
+    uint32_t bit = 1u << edge.key;
+
+    Expire(edge.time);
+    if (pending != PENDING_NONE && held_back_count == TAP_HOLD_BUFFER_LEN) {
+        // No room to wait any longer
+        if (pending == PENDING_TAP_HOLD) {
+            DecideHold(edge.time);
+        } else {
+            FailCombo();
+        }
+    }
+
+    if (pending == PENDING_TAP_HOLD) {
+        if (!edge.pressed && edge.key == pending_key) {
+            // Released within the term: a tap
+            Emit(tap_codes[edge.key], true, pending_us);
+            Emit(tap_codes[edge.key], false, edge.time);
+            key_codes[edge.key] = KEYMAP_NONE;
+            Replay(NULL);
+        } else {
+            held_back[held_back_count++] = edge;
+        }
+        return;
+    }
+    if (pending == PENDING_COMBO) {
+        held_back[held_back_count++] = edge;
+        if (edge.pressed && (bit & TAP_HOLD_COMBOS)) {
+            combo_down |= bit;
+            FireCombo(edge.time);
+        } else {
+            // A release, or a key outside every combo
+            FailCombo();
+        }
+        return;
+    }
+
+    if (edge.pressed) {
+        if (allow_combo && (bit & TAP_HOLD_COMBOS)) {
+            pending = PENDING_COMBO;
+            pending_key = edge.key;
+            pending_us = edge.time;
+            combo_down = bit;
+        } else if (bit & TAP_HOLD_KEYS) {
+            pending = PENDING_TAP_HOLD;
+            pending_key = edge.key;
+            pending_us = edge.time;
+        } else {
+            key_codes[edge.key] = KeymapLookup(edge.key, KeymapLayers());
+            Emit(key_codes[edge.key], true, edge.time);
+        }
+    } else if (bit & combo_active) {
+        // The first release of a combo key ends the combo
+        combo_active &= ~bit;
+        if (combo_code != KEYMAP_NONE) {
+            Emit(combo_code, false, edge.time);
+            combo_code = KEYMAP_NONE;
+        }
+    } else {
+        Emit(key_codes[edge.key], false, edge.time);
+        key_codes[edge.key] = KEYMAP_NONE;
+    }
+}
+#endif /* TAP_HOLD_ENABLE */
+
+/**
+ * Feed the accepted edges of one scan, lowest key index first
+ *
+ * @param changed Keys whose debounced level changed
+ * @param pressed Pressed key word after the change (1 = pressed)
+ * @param now Time of the scan in microseconds
+ * @return true if an action was queued
+ */
+HOT_PATH bool TapHoldInput(uint32_t changed, uint32_t pressed, uint32_t now)
+{
+#if TAP_HOLD_ENABLE
+    emitted = false;
+    for (; changed; changed &= changed - 1u) {
+        uint32_t key = (uint32_t)__builtin_ctz(changed);
+        TapHoldEdge edge = { (uint8_t)key, ((pressed >> key) & 1u) != 0, now };
+        Process(edge, true);
+    }
+    return emitted;
+#else
+    (void)changed;
+    (void)pressed;
+    (void)now;
+    return false;
+#endif
+}
+
+/**
+ * Make the decisions whose time ran out, called on every scan
+ *
+ * @param now Time of the scan in microseconds
+ * @return true if an action was queued
+ */
+HOT_PATH bool TapHoldService(uint32_t now)
+{
+#if TAP_HOLD_ENABLE
+    emitted = false;
+    if (pending != PENDING_NONE) {
+        Expire(now);
+    }
+    return emitted;
+#else
+    (void)now;
+    return false;
+#endif
+}
+
+/**
+ * Check whether a decision is open, the scan has to keep running until then
+ */
+bool TapHoldBusy(void)
+{
+#if TAP_HOLD_ENABLE
+    return pending != PENDING_NONE;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Copy the oldest action without removing it (consumer side)
+ *
+ * @param action Filled with the oldest action, or KEYMAP_NONE if empty
+ * @return true if an action was available
+ */
+HOT_PATH bool TapHoldActionPeek(TapHoldAction *action)
+{
+#if TAP_HOLD_ENABLE
+    uint32_t t = tail;
+
+    if (t != head) {
+        __DMB();
+        *action = actions[t & TAP_HOLD_INDEX_MASK];
+        return true;
+    }
+#endif
+    action->code = KEYMAP_NONE;
+    action->pressed = 0;
+    action->timestamp = 0;
+    return false;
+}
+
+/**
+ * Remove the oldest action once it has been delivered (consumer side)
+ */
+HOT_PATH void TapHoldActionDrop(void)
+{
+#if TAP_HOLD_ENABLE
+    uint32_t t = tail;
+
+    if (t != head) {
+        __DMB();
+        tail = t + 1;
+    }
+#endif
+}
+
+/**
+ * Number of queued actions
+ */
+HOT_PATH uint32_t TapHoldActionCount(void)
+{
+#if TAP_HOLD_ENABLE
+    return head - tail;
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,130 @@
+/**
+ * @file time_sync.c
+ * @brief Right-half time base mapped onto the master's clock.
+ *
+ * Samples, conversions and snapshots all run from the link interrupt, the
+ * write and the reads of the timestamped registers, so the estimate needs
+ * no lock.
+ */
+
+#include "time_sync.h"
+#include "timebase.h"
+#include "hot_path.h"
+
+#if TIME_SYNC_ENABLE
+
+#define TIME_SYNC_MAX_DRIFT ((int32_t)(((int64_t)TIME_SYNC_MAX_DRIFT_PPM << 32) / 1000000))
+
+static uint32_t ref_local;
+static uint32_t ref_master;
+static int32_t  drift;              /* rate correction, 2^-32 per us */
+static int32_t  last_error;
+static uint16_t samples;
+static uint8_t  steps;
+
+/**
+ * Master time of a local time on the current estimate
+ */
+HOT_PATH static uint32_t Predict(uint32_t local_us)
+{
+    int32_t delta = (int32_t)(local_us - ref_local);
+    return ref_master + (uint32_t)delta + (uint32_t)(int32_t)(((int64_t)delta * drift) >> 32);
+}
+#endif /* TIME_SYNC_ENABLE */
+
+/**
+ * Steer the estimate with one master write
+ *
+ * @param master_us Time the master wrote
+ * @param local_us TIM5 time at which the write completed
+ */
+void TimeSyncSample(uint32_t master_us, uint32_t local_us)
+{
+#if TIME_SYNC_ENABLE
+    master_us += TIME_SYNC_LINK_DELAY_US;
+
+    if (samples == 0) {
+        ref_local = local_us;
+        ref_master = master_us;
+        drift = 0;
+        last_error = 0;
+        samples = 1;
+        return;
+    }
+
+    uint32_t predicted = Predict(local_us);
+    int32_t error = (int32_t)(master_us - predicted);
+    uint32_t interval = local_us - ref_local;
+    last_error = error;
+    if (samples < UINT16_MAX) {
+        samples++;
+    }
+
+    if (error > TIME_SYNC_STEP_US || error < -TIME_SYNC_STEP_US) {
+        // Master restarted its clock or the writes stopped for too long,
+        // the rate estimate still holds
+        ref_local = local_us;
+        ref_master = master_us;
+        steps++;
+        return;
+    }
+
+    if (interval >= TIME_SYNC_MIN_INTERVAL_US) {
+        int64_t step = (((int64_t)error << 32) / (int64_t)interval) >> TIME_SYNC_DRIFT_SHIFT;
+        int64_t next = (int64_t)drift + step;
+        if (next > TIME_SYNC_MAX_DRIFT) {
+            next = TIME_SYNC_MAX_DRIFT;
+        } else if (next < -TIME_SYNC_MAX_DRIFT) {
+            next = -TIME_SYNC_MAX_DRIFT;
+        }
+        drift = (int32_t)next;
+    }
+    ref_local = local_us;
+    ref_master = predicted + (uint32_t)(error >> TIME_SYNC_OFFSET_SHIFT);
+#else
+    (void)master_us;
+    (void)local_us;
+#endif
+}
+
+/**
+ * Convert a local timestamp to master time
+ *
+ * Valid for timestamps within 2^31 us of the last write; the identity
+ * until the master wrote its time once.
+ */
+HOT_PATH uint32_t TimeSyncToMaster(uint32_t local_us)
+{
+#if TIME_SYNC_ENABLE
+    if (samples == 0) {
+        return local_us;
+    }
+    return Predict(local_us);
+#else
+    return local_us;
+#endif
+}
+
+/**
+ * Copy the estimate for the time register
+ */
+void TimeSyncSnapshot(TimeSyncReport *report)
+{
+#if TIME_SYNC_ENABLE
+    report->local_us = TimebaseNowUs();
+    report->master_us = TimeSyncToMaster(report->local_us);
+    report->last_error_us = last_error;
+    report->drift_ppb = (int32_t)(((int64_t)drift * 1000000000) >> 32);
+    report->samples = samples;
+    report->steps = steps;
+    report->locked = samples >= 2 ? 1u : 0u;
+#else
+    report->local_us = TimebaseNowUs();
+    report->master_us = report->local_us;
+    report->last_error_us = 0;
+    report->drift_ppb = 0;
+    report->samples = 0;
+    report->steps = 0;
+    report->locked = 0;
+#endif
+}
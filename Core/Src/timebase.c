@@ -0,0 +1,74 @@
+/**
+ * @file timebase.c
+ * @brief Free-running microsecond time base on TIM5.
+ */
+
+#include "timebase.h"
+#include "irq_plan.h"
+#include "hot_path.h"
+
+/**
+ * Get the TIM5 kernel clock (APB1 timers run at 2x PCLK1 when APB1 is divided)
+ */
+static uint32_t TimebaseTimerClock(void)
+{
+    uint32_t pclk1 = HAL_RCC_GetPCLK1Freq();
+
+    if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_CFGR_PPRE1_DIV1) {
+        pclk1 *= 2;
+    }
+    return pclk1;
+}
+
+/**
+ * Start TIM5 counting microseconds from 0
+ *
+ * Every clock profile (and both clock governor states) gives TIM5 a whole
+ * MHz kernel clock, so the prescaler divides exactly.
+ */
+void TimebaseInit(void)
+{
+    __HAL_RCC_TIM5_CLK_ENABLE();
+
+    TIM5->CR1 = 0;
+    TIM5->PSC = TimebaseTimerClock() / 1000000U - 1U;
+    TIM5->ARR = 0xFFFFFFFFu;
+    TIM5->CNT = 0;
+    TIM5->EGR = TIM_EGR_UG;   // Load the prescaler now, not at the first wrap
+    TIM5->SR = 0;
+    TIM5->DIER = 0;
+    TIM5->CR1 = TIM_CR1_CEN;
+
+    // Compare wake-ups only end a WFI, like the key edges
+    HAL_NVIC_SetPriority(TIM5_IRQn, IRQ_PRIO_WAKE, 0);
+    HAL_NVIC_EnableIRQ(TIM5_IRQn);
+}
+
+/**
+ * Raise one TIM5 interrupt when the count reaches a deadline
+ *
+ * Replaces any wake-up still armed. A deadline already in the past only
+ * matches after the next wrap, so check TimebaseReached() before sleeping.
+ *
+ * @param deadline Time in microseconds
+ */
+HOT_PATH void TimebaseWakeAt(uint32_t deadline)
+{
+    TIM5->CCR1 = deadline;
+    TIM5->SR = ~(uint32_t)TIM_SR_CC1IF;
+    TIM5->DIER |= TIM_DIER_CC1IE;
+}
+
+/**
+ * TIM5 interrupt, disarms the compare wake-up that fired
+ *
+ * The capture channels of edge_capture.h share the vector, an armed
+ * wake-up that has not fired yet stays armed.
+ */
+HOT_PATH void TimebaseIRQHandler(void)
+{
+    if (TIM5->SR & TIM_SR_CC1IF) {
+        TIM5->DIER &= ~TIM_DIER_CC1IE;
+        TIM5->SR = ~(uint32_t)TIM_SR_CC1IF;
+    }
+}
@@ -0,0 +1,126 @@
+/**
+ * @file trace.c
+ * @brief ITM/SWO event trace of the scan, debounce and I2C paths.
+ *
+ * At the default 2 MBd one record (a 32-bit stimulus write, five bytes on
+ * the wire) takes 25 us to go out. The ITM FIFO absorbs short bursts, a
+ * DMA sampler batch or a fast key roll can still outrun it and loses
+ * records, which shows as a jump in trace_dropped.
+ */
+
+#include "trace.h"
+#include "timebase.h"
+#include "hot_path.h"
+#include "keyboard_layout.h"
+
+#if TRACE_ITM
+
+#define TRACE_PORT_MASK (((1u << TRACE_EVENTS) - 1u) << TRACE_PORT_BASE)
+
+_Static_assert(TRACE_PORT_BASE + TRACE_EVENTS <= 32, "TRACE_PORT_BASE leaves too few stimulus ports");
+#if TRACE_SWO_SETUP
+_Static_assert((KEY_MASK_B & (1u << 3)) == 0, "PB3 is SWO with TRACE_SWO_SETUP");
+#endif
+
+// Readable from the debugger
+uint32_t trace_dropped;
+
+static uint32_t trace_epoch;    /* bits 31-24 of the time in the last record */
+
+/**
+ * Write one word to a stimulus port unless its FIFO is full
+ *
+ * @return false if the word was dropped
+ */
+HOT_PATH static bool TracePortWrite(uint32_t port, uint32_t word)
+{
+    if (ITM->PORT[port].u32 == 0) {
+        trace_dropped++;
+        return false;
+    }
+    ITM->PORT[port].u32 = word;
+    return true;
+}
+#endif /* TRACE_ITM */
+
+/**
+ * Enable the ITM stimulus ports, and with TRACE_SWO_SETUP the SWO pin
+ *
+ * Called once the system clock is configured.
+ */
+void TraceInit(void)
+{
+#if TRACE_ITM
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+
+#if TRACE_SWO_SETUP
+    // PB3 AF0 is TRACESWO, asynchronous trace mode
+    __HAL_RCC_GPIOB_CLK_ENABLE();
+    MODIFY_REG(GPIOB->MODER, GPIO_MODER_MODER3, GPIO_MODER_MODER3_1);
+    MODIFY_REG(GPIOB->AFR[0], GPIO_AFRL_AFSEL3, 0u);
+    GPIOB->OSPEEDR |= GPIO_OSPEEDR_OSPEED3;
+    DBGMCU->CR = (DBGMCU->CR & ~DBGMCU_CR_TRACE_MODE) | DBGMCU_CR_TRACE_IOEN;
+
+    TPI->SPPR = 2u;         // NRZ (UART framing)
+    TPI->FFCR = 0x100u;     // Formatter off, ITM data goes straight out
+    TraceClockUpdate();
+
+    ITM->LAR = 0xC5ACCE55u;
+    ITM->TCR = (1u << ITM_TCR_TraceBusID_Pos) | ITM_TCR_SYNCENA_Msk | ITM_TCR_ITMENA_Msk;
+    ITM->TER |= TRACE_PORT_MASK;
+#endif
+
+    // Force a sync before the first record
+    trace_epoch = ~TimebaseNowUs() & 0xFF000000u;
+#endif
+}
+
+/**
+ * Rederive the SWO divider from the current HCLK
+ *
+ * Called after every system clock change, with interrupts masked or from
+ * the only context that traces at that moment.
+ */
+void TraceClockUpdate(void)
+{
+#if TRACE_ITM && TRACE_SWO_SETUP
+    TPI->ACPR = SystemCoreClock / TRACE_SWO_HZ - 1u;
+#endif
+}
+
+/**
+ * Send one timestamped trace record
+ *
+ * Callable from any context. Interrupts are masked for the few cycles
+ * between reading the time and writing the port, so records leave in
+ * timestamp order.
+ *
+ * @param event Record type, selects the stimulus port
+ * @param arg Event argument, values above 255 saturate
+ */
+HOT_PATH void TraceEmit(TraceEvent event, uint32_t arg)
+{
+#if TRACE_ITM
+    if (!(ITM->TCR & ITM_TCR_ITMENA_Msk) || !(ITM->TER & (1u << (TRACE_PORT_BASE + event)))) {
+        return;     // Nobody listening
+    }
+    if (arg > 0xFFu) {
+        arg = 0xFFu;
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    uint32_t now = TimebaseNowUs();
+    if ((now & 0xFF000000u) != trace_epoch &&
+        TracePortWrite(TRACE_PORT_BASE + TRACE_SYNC, now)) {
+        trace_epoch = now & 0xFF000000u;
+    }
+    TracePortWrite(TRACE_PORT_BASE + event, (arg << 24) | (now & 0x00FFFFFFu));
+
+    __set_PRIMASK(primask);
+#else
+    (void)event;
+    (void)arg;
+#endif
+}
@@ -0,0 +1,278 @@
+/**
+ * @file uart_link.c
+ * @brief Full-duplex USART1 link to the left half, DMA in both directions.
+ *
+ * Receive: DMA2 stream 2 (channel 4) fills rx_ring circularly. The USART
+ * idle-line interrupt and the DMA half/full marks hand the new bytes to the
+ * request parser, so a request is taken one character time after its last
+ * byte.
+ *
+ * Transmit: a reply is framed into tx_buf by LinkReplyBuild() and sent
+ * by DMA2 stream 7 (channel 4). The transfer-complete interrupt returns the
+ * frame to the register map and starts whatever is waiting next.
+ *
+ * The USART and both streams interrupt at IRQ_PRIO_I2C, the link level of
+ * irq_plan.h, so request, reply and push handling never preempt each other.
+ */
+
+#include "uart_link.h"
+#include "hot_path.h"
+#include "irq_plan.h"
+#include "mem_budget.h"
+#include <string.h>
+
+#if LINK_TRANSPORT == LINK_TRANSPORT_UART
+// All flags of stream 2 in LISR/LIFCR and of stream 7 in HISR/HIFCR
+#define UART_LINK_RX_FLAGS (DMA_LIFCR_CTCIF2 | DMA_LIFCR_CHTIF2 | DMA_LIFCR_CTEIF2 | \
+                            DMA_LIFCR_CDMEIF2 | DMA_LIFCR_CFEIF2)
+#define UART_LINK_TX_FLAGS (DMA_HIFCR_CTCIF7 | DMA_HIFCR_CHTIF7 | DMA_HIFCR_CTEIF7 | \
+                            DMA_HIFCR_CDMEIF7 | DMA_HIFCR_CFEIF7)
+
+static uint8_t rx_ring[UART_LINK_RING_LEN] MEM_BSS(dma);
+static uint32_t rx_tail;
+static LinkParser parser;
+
+// Last complete request, applied when the transmitter is free
+static uint8_t  request[LINK_REQUEST_LEN];
+static uint32_t request_len;
+static bool     request_pending;
+
+static uint8_t tx_buf[LINK_REPLY_EXTRA + LINK_REPLY_LEN] MEM_BSS(dma);
+static uint32_t tx_sent;            /* frame bytes of the reply in flight */
+static volatile bool tx_busy;
+static volatile bool push_pending;  /* set by UartLinkRefresh() */
+
+/**
+ * BRR for the oversampling-by-8 mode: 12.4 fixed point with the fraction in
+ * three bits
+ */
+static uint32_t UartLinkBrr(uint32_t pclk)
+{
+    uint32_t div8 = (pclk + UART_LINK_BAUD / 2u) / UART_LINK_BAUD;
+    return ((div8 & ~7u) << 1) | (div8 & 7u);
+}
+
+/**
+ * Feed one received byte to the request parser
+ */
+HOT_PATH static void UartLinkParse(uint8_t byte)
+{
+    if (!LinkParse(&parser, byte)) {
+        return;
+    }
+    if (request_pending) {
+        // A second request before the first was answered replaces it
+        RightKeyboardLinkError(LINK_ERROR_FRAME);
+    }
+    memcpy(request, parser.frame, parser.len);
+    request_len = parser.len;
+    request_pending = true;
+}
+
+/**
+ * Parse everything the receive stream wrote since the last call
+ */
+HOT_PATH static void UartLinkReceive(void)
+{
+    uint32_t head = UART_LINK_RING_LEN - DMA2_Stream2->NDTR;
+
+    if (head >= UART_LINK_RING_LEN) {
+        head = 0;
+    }
+    while (rx_tail != head) {
+        UartLinkParse(rx_ring[rx_tail]);
+        rx_tail = rx_tail + 1u < UART_LINK_RING_LEN ? rx_tail + 1u : 0u;
+    }
+}
+
+/**
+ * Start the next reply: the pending request first, then a push
+ */
+HOT_PATH static void UartLinkSend(void)
+{
+    uint8_t reg;
+
+    if (tx_busy) {
+        return;
+    }
+    if (request_pending) {
+        request_pending = false;
+        RightKeyboardRxEnd(request, request_len);
+        reg = request[0];
+#if UART_LINK_PUSH
+    } else if (push_pending) {
+        push_pending = false;
+        reg = RightKeyboardDefaultRegister();
+#endif
+    } else {
+        return;
+    }
+
+    const uint8_t *frame;
+    uint32_t len = RightKeyboardTxBegin(&frame);
+    if (len > LINK_REPLY_LEN) {
+        len = LINK_REPLY_LEN;
+    }
+    uint32_t reply_len = LinkReplyBuild(tx_buf, reg, frame, len);
+    tx_sent = len;
+    tx_busy = true;
+
+    DMA2->HIFCR = UART_LINK_TX_FLAGS;
+    DMA2_Stream7->M0AR = (uint32_t)tx_buf;
+    DMA2_Stream7->NDTR = reply_len;
+    DMA2_Stream7->CR |= DMA_SxCR_EN;
+}
+#endif /* LINK_TRANSPORT == LINK_TRANSPORT_UART */
+
+/**
+ * Hand PB6/PB7 to USART1 and start receiving
+ *
+ * Runs once from RightKeyboardInit(), after the clock setup, since the
+ * baud rate divider follows PCLK2.
+ */
+void UartLinkStart(void)
+{
+#if LINK_TRANSPORT == LINK_TRANSPORT_UART
+    RCC->AHB1ENR |= RCC_AHB1ENR_GPIOBEN | RCC_AHB1ENR_DMA2EN;
+    RCC->APB2ENR |= RCC_APB2ENR_USART1EN;
+    (void)RCC->APB2ENR;
+
+    // PB6 TX push-pull at high speed, PB7 RX with pull-up so an open line
+    // idles high, both AF7
+    GPIOB->AFR[0] = (GPIOB->AFR[0] & ~(0xFFu << 24)) | (0x77u << 24);
+    GPIOB->OSPEEDR |= 3u << (2 * 6);
+    GPIOB->PUPDR = (GPIOB->PUPDR & ~(3u << (2 * 7))) | (1u << (2 * 7));
+    GPIOB->MODER = (GPIOB->MODER & ~(0xFu << (2 * 6))) | (0xAu << (2 * 6));
+
+    USART1->CR1 = 0;
+    USART1->BRR = UartLinkBrr(HAL_RCC_GetPCLK2Freq());
+    USART1->CR3 = USART_CR3_DMAR | USART_CR3_DMAT | USART_CR3_EIE;
+
+    DMA2_Stream2->CR = 0;
+    while (DMA2_Stream2->CR & DMA_SxCR_EN) {
+    }
+    DMA2->LIFCR = UART_LINK_RX_FLAGS;
+    DMA2_Stream2->PAR = (uint32_t)&USART1->DR;
+    DMA2_Stream2->M0AR = (uint32_t)rx_ring;
+    DMA2_Stream2->NDTR = UART_LINK_RING_LEN;
+    DMA2_Stream2->CR = DMA_SxCR_CHSEL_2 | DMA_SxCR_PL_1 | DMA_SxCR_MINC | DMA_SxCR_CIRC |
+                       DMA_SxCR_HTIE | DMA_SxCR_TCIE;
+    DMA2_Stream2->CR |= DMA_SxCR_EN;
+
+    DMA2_Stream7->CR = 0;
+    while (DMA2_Stream7->CR & DMA_SxCR_EN) {
+    }
+    DMA2->HIFCR = UART_LINK_TX_FLAGS;
+    DMA2_Stream7->PAR = (uint32_t)&USART1->DR;
+    DMA2_Stream7->CR = DMA_SxCR_CHSEL_2 | DMA_SxCR_PL_1 | DMA_SxCR_MINC | DMA_SxCR_DIR_0 |
+                       DMA_SxCR_TCIE | DMA_SxCR_TEIE;
+
+    rx_tail = 0;
+    LinkParserReset(&parser);
+    request_pending = false;
+    tx_busy = false;
+
+    HAL_NVIC_SetPriority(USART1_IRQn, IRQ_PRIO_I2C, 0);
+    HAL_NVIC_SetPriority(DMA2_Stream2_IRQn, IRQ_PRIO_I2C, 0);
+    HAL_NVIC_SetPriority(DMA2_Stream7_IRQn, IRQ_PRIO_I2C, 0);
+    NVIC_EnableIRQ(USART1_IRQn);
+    NVIC_EnableIRQ(DMA2_Stream2_IRQn);
+    NVIC_EnableIRQ(DMA2_Stream7_IRQn);
+
+    USART1->CR1 = USART_CR1_OVER8 | USART_CR1_UE | USART_CR1_TE | USART_CR1_RE | USART_CR1_IDLEIE;
+#endif
+}
+
+/**
+ * Push the default register because the report changed
+ *
+ * Called from the scan. The push itself starts in the USART1 interrupt,
+ * which is pended here, so it never races a reply.
+ */
+HOT_PATH void UartLinkRefresh(void)
+{
+#if LINK_TRANSPORT == LINK_TRANSPORT_UART && UART_LINK_PUSH
+    push_pending = true;
+    NVIC_SetPendingIRQ(USART1_IRQn);
+#endif
+}
+
+/**
+ * Check whether a request or reply is under way, STOP or a clock switch
+ * would cut it
+ */
+bool UartLinkBusy(void)
+{
+#if LINK_TRANSPORT == LINK_TRANSPORT_UART
+    return tx_busy || request_pending || !LinkParserIdle(&parser);
+#else
+    return false;
+#endif
+}
+
+/**
+ * USART1 interrupt: idle line, receive errors and pushes pended by
+ * UartLinkRefresh()
+ */
+HOT_PATH void UartLinkIRQHandler(void)
+{
+#if LINK_TRANSPORT == LINK_TRANSPORT_UART
+    uint32_t sr = USART1->SR;
+
+    if (sr & (USART_SR_IDLE | USART_SR_ORE | USART_SR_FE | USART_SR_NE)) {
+        // SR then DR clears them; a pended entry with none set leaves DR
+        // to the DMA
+        (void)USART1->DR;
+        if (sr & USART_SR_ORE) {
+            RightKeyboardLinkError(LINK_ERROR_OVERRUN);
+        }
+        if (sr & (USART_SR_FE | USART_SR_NE)) {
+            RightKeyboardLinkError(LINK_ERROR_BUS);
+        }
+    }
+    UartLinkReceive();
+    UartLinkSend();
+#endif
+}
+
+/**
+ * DMA2 stream 2 interrupt: half or all of the receive ring filled
+ */
+HOT_PATH void UartLinkRxDmaIRQHandler(void)
+{
+#if LINK_TRANSPORT == LINK_TRANSPORT_UART
+    DMA2->LIFCR = UART_LINK_RX_FLAGS;
+    UartLinkReceive();
+    UartLinkSend();
+#endif
+}
+
+/**
+ * DMA2 stream 7 interrupt: reply handed to the USART, or a transfer error
+ */
+HOT_PATH void UartLinkTxDmaIRQHandler(void)
+{
+#if LINK_TRANSPORT == LINK_TRANSPORT_UART
+    uint32_t isr = DMA2->HISR;
+
+    DMA2->HIFCR = UART_LINK_TX_FLAGS;
+    if (!(isr & (DMA_HISR_TCIF7 | DMA_HISR_TEIF7)) || !tx_busy) {
+        return;
+    }
+    if (isr & DMA_HISR_TEIF7) {
+        RightKeyboardLinkError(LINK_ERROR_OVERRUN);
+        RightKeyboardTxEnd(0);
+    } else {
+        RightKeyboardTxEnd(tx_sent);
+    }
+    tx_busy = false;
+
+#if UART_LINK_PUSH
+    // Events still queued behind the default register go out one push each
+    if (RightKeyboardPushPending()) {
+        push_pending = true;
+    }
+#endif
+    UartLinkSend();
+#endif
+}
@@ -0,0 +1,613 @@
+/**
+ * @file usb_hid.c
+ * @brief USB full-speed HID keyboard on OTG FS, register level.
+ *
+ * Device mode only, two endpoints: control endpoint 0 for enumeration and
+ * the HID class requests, interrupt IN endpoint 1 for the report. Every
+ * descriptor fits one 64-byte packet, so a control read is one IN packet
+ * and the status stage. Endpoint 0 OUT stays armed for three SETUP packets
+ * and one data packet at all times, which covers both the status stage of
+ * a read and the one data byte of SET_REPORT.
+ *
+ * FIFO RAM (320 words): receive 128, endpoint 0 transmit 16, endpoint 1
+ * transmit 16.
+ *
+ * The OTG FS interrupt runs at IRQ_PRIO_I2C, the link level of irq_plan.h,
+ * so the fragment copy taken there never sees a half-published update.
+ */
+
+#include "usb_hid.h"
+#include "hid_fragment.h"
+#include "keyboard_layout.h"
+#include "hot_path.h"
+#include "irq_plan.h"
+#include <string.h>
+
+#if USB_HID_ENABLE
+#if KEY_WIRING == KEY_WIRING_MATRIX
+#include "keyboard_matrix.h"
+#define USB_HID_KEY_PINS_A MATRIX_ROW_MASK
+#elif KEY_WIRING == KEY_WIRING_HALL
+#define USB_HID_KEY_PINS_A HALL_PINS_A
+#else
+#define USB_HID_KEY_PINS_A KEY_MASK_A
+#endif
+
+// PA9 VBUS (auto role only), PA11 DM, PA12 DP
+#if USB_HID_ROLE == USB_HID_ROLE_AUTO
+#define USB_HID_PINS_A 0x1A00u
+#else
+#define USB_HID_PINS_A 0x1800u
+#endif
+_Static_assert((USB_HID_KEY_PINS_A & USB_HID_PINS_A) == 0, "Keys on PA9/PA11/PA12 collide with USB");
+
+#define USB_DEVICE    ((USB_OTG_DeviceTypeDef *)(USB_OTG_FS_PERIPH_BASE + USB_OTG_DEVICE_BASE))
+#define USB_INEP(n)   ((USB_OTG_INEndpointTypeDef *)(USB_OTG_FS_PERIPH_BASE + USB_OTG_IN_ENDPOINT_BASE + 0x20u * (n)))
+#define USB_OUTEP(n)  ((USB_OTG_OUTEndpointTypeDef *)(USB_OTG_FS_PERIPH_BASE + USB_OTG_OUT_ENDPOINT_BASE + 0x20u * (n)))
+#define USB_FIFO(n)   (*(volatile uint32_t *)(USB_OTG_FS_PERIPH_BASE + USB_OTG_FIFO_BASE + USB_OTG_FIFO_SIZE * (n)))
+#define USB_PCGCCTL   (*(volatile uint32_t *)(USB_OTG_FS_PERIPH_BASE + USB_OTG_PCGCCTL_BASE))
+
+// FIFO sizes in words
+#define USB_RX_FIFO_WORDS  128u
+#define USB_EP0_FIFO_WORDS 16u
+#define USB_EP1_FIFO_WORDS 16u
+
+#define USB_EP0_SIZE   64u
+#define USB_REPORT_LEN ((uint16_t)sizeof(HidFragment))
+
+_Static_assert(USB_REPORT_LEN <= 4u * USB_EP1_FIFO_WORDS, "HID report larger than the endpoint 1 FIFO");
+
+// GRXSTSP packet status
+#define USB_PKTSTS_OUT_DATA   2u
+#define USB_PKTSTS_SETUP_DATA 6u
+
+// Requests
+#define USB_REQ_TYPE_MASK      0x60u
+#define USB_REQ_TYPE_STANDARD  0x00u
+#define USB_REQ_TYPE_CLASS     0x20u
+
+#define USB_REQ_GET_STATUS        0x00u
+#define USB_REQ_CLEAR_FEATURE     0x01u
+#define USB_REQ_SET_FEATURE       0x03u
+#define USB_REQ_SET_ADDRESS       0x05u
+#define USB_REQ_GET_DESCRIPTOR    0x06u
+#define USB_REQ_GET_CONFIGURATION 0x08u
+#define USB_REQ_SET_CONFIGURATION 0x09u
+#define USB_REQ_GET_INTERFACE     0x0Au
+#define USB_REQ_SET_INTERFACE     0x0Bu
+
+#define HID_REQ_GET_REPORT   0x01u
+#define HID_REQ_GET_IDLE     0x02u
+#define HID_REQ_GET_PROTOCOL 0x03u
+#define HID_REQ_SET_REPORT   0x09u
+#define HID_REQ_SET_IDLE     0x0Au
+#define HID_REQ_SET_PROTOCOL 0x0Bu
+
+#define USB_DESC_DEVICE        0x01u
+#define USB_DESC_CONFIGURATION 0x02u
+#define USB_DESC_STRING        0x03u
+#define HID_DESC_HID           0x21u
+#define HID_DESC_REPORT        0x22u
+
+typedef union {
+    uint32_t words[2];
+    struct __attribute__((packed)) {
+        uint8_t  bmRequestType;
+        uint8_t  bRequest;
+        uint16_t wValue;
+        uint16_t wIndex;
+        uint16_t wLength;
+    };
+} UsbSetup;
+
+static const uint8_t device_descriptor[18] = {
+    18, USB_DESC_DEVICE, 0x00, 0x02,    // USB 2.0
+    0x00, 0x00, 0x00,                   // Class per interface
+    USB_EP0_SIZE,
+    USB_HID_VID & 0xFF, USB_HID_VID >> 8,
+    USB_HID_PID & 0xFF, USB_HID_PID >> 8,
+    0x00, 0x01,                         // Device release 1.00
+    1, 2, 0,                            // Manufacturer, product, no serial
+    1,
+};
+
+#if HID_FRAGMENT_FORMAT == HID_FRAGMENT_BOOT
+// Boot keyboard layout: modifiers, reserved byte, KEYMAP_REPORT_CODES codes
+static const uint8_t report_descriptor[] = {
+    0x05, 0x01, 0x09, 0x06, 0xA1, 0x01,             // Generic desktop, keyboard
+    0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7,             // Modifiers E0-E7
+    0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02,
+    0x95, 0x01, 0x75, 0x08, 0x81, 0x01,             // Reserved byte
+    0x05, 0x08, 0x19, 0x01, 0x29, 0x05,             // LEDs 1-5
+    0x95, 0x05, 0x75, 0x01, 0x91, 0x02,
+    0x95, 0x01, 0x75, 0x03, 0x91, 0x01,
+    0x05, 0x07, 0x19, 0x00, 0x29, 0xFF,             // Key codes
+    0x15, 0x00, 0x26, 0xFF, 0x00,
+    0x95, KEYMAP_REPORT_CODES, 0x75, 0x08, 0x81, 0x00,
+    0xC0,
+};
+#define USB_HID_SUBCLASS 1  // Boot interface
+#define USB_HID_PROTOCOL 1  // Keyboard
+#else
+// NKRO layout: modifiers, then one bit per usage below 8 * HID_FRAGMENT_NKRO_BYTES
+static const uint8_t report_descriptor[] = {
+    0x05, 0x01, 0x09, 0x06, 0xA1, 0x01,             // Generic desktop, keyboard
+    0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7,             // Modifiers E0-E7
+    0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02,
+    0x19, 0x00, 0x29, 8 * HID_FRAGMENT_NKRO_BYTES - 1,
+    0x95, 8 * HID_FRAGMENT_NKRO_BYTES, 0x81, 0x02,  // Usage bitmap
+    0x05, 0x08, 0x19, 0x01, 0x29, 0x05,             // LEDs 1-5
+    0x95, 0x05, 0x91, 0x02,
+    0x95, 0x01, 0x75, 0x03, 0x91, 0x01,
+    0xC0,
+};
+#define USB_HID_SUBCLASS 0
+#define USB_HID_PROTOCOL 0
+#endif
+
+#define USB_CONFIG_LEN (9u + 9u + 9u + 7u)
+#define USB_HID_DESC_OFFSET 18u
+
+static const uint8_t config_descriptor[USB_CONFIG_LEN] = {
+    9, USB_DESC_CONFIGURATION, USB_CONFIG_LEN, 0,
+    1, 1, 0,                            // One interface, configuration 1
+    0x80, USB_HID_MAX_POWER_MA / 2,     // Bus powered
+    // Interface 0: HID
+    9, 0x04, 0, 0, 1, 0x03, USB_HID_SUBCLASS, USB_HID_PROTOCOL, 0,
+    // HID 1.11, one report descriptor
+    9, HID_DESC_HID, 0x11, 0x01, 0, 1, HID_DESC_REPORT,
+    sizeof(report_descriptor) & 0xFF, sizeof(report_descriptor) >> 8,
+    // Endpoint 1 IN, interrupt, 1 ms
+    7, 0x05, 0x81, 0x03, USB_REPORT_LEN & 0xFF, USB_REPORT_LEN >> 8, 1,
+};
+
+static const uint8_t language_descriptor[4] = { 4, USB_DESC_STRING, 0x09, 0x04 };
+
+static bool usb_role;
+static UsbSetup setup;
+static uint8_t ep0_buf[USB_EP0_SIZE];
+static bool    ep0_set_report;      /* SET_REPORT data byte expected */
+
+static volatile bool configured;
+static bool    ep1_busy;
+static volatile bool report_dirty;  /* set by UsbHidPublish() */
+static HidFragment report;
+
+static uint8_t hid_idle;
+static uint8_t hid_protocol = 1;    /* report protocol */
+static uint8_t hid_leds;
+
+/**
+ * Copy a packet into an endpoint transmit FIFO
+ */
+HOT_PATH static void UsbFifoWrite(uint32_t ep, const uint8_t *data, uint32_t len)
+{
+    for (uint32_t n = 0; n < len; n += 4) {
+        uint32_t word = 0;
+        memcpy(&word, &data[n], len - n < 4 ? len - n : 4);
+        USB_FIFO(ep) = word;
+    }
+}
+
+/**
+ * Flush every transmit FIFO and the receive FIFO
+ */
+static void UsbFlushFifos(void)
+{
+    USB_OTG_FS->GRSTCTL = USB_OTG_GRSTCTL_TXFFLSH | (0x10u << USB_OTG_GRSTCTL_TXFNUM_Pos);
+    while (USB_OTG_FS->GRSTCTL & USB_OTG_GRSTCTL_TXFFLSH) {
+    }
+    USB_OTG_FS->GRSTCTL = USB_OTG_GRSTCTL_RXFFLSH;
+    while (USB_OTG_FS->GRSTCTL & USB_OTG_GRSTCTL_RXFFLSH) {
+    }
+}
+
+/**
+ * Keep endpoint 0 OUT ready for SETUP packets and one data packet
+ */
+static void UsbEp0OutArm(void)
+{
+    USB_OUTEP(0)->DOEPTSIZ = (3u << USB_OTG_DOEPTSIZ_STUPCNT_Pos) | (1u << USB_OTG_DOEPTSIZ_PKTCNT_Pos) |
+                             USB_EP0_SIZE;
+    USB_OUTEP(0)->DOEPCTL |= USB_OTG_DOEPCTL_EPENA | USB_OTG_DOEPCTL_CNAK;
+}
+
+/**
+ * Send the data stage of a control read, cut to what the host asked for
+ */
+static void UsbEp0Send(const uint8_t *data, uint32_t len)
+{
+    if (len > setup.wLength) {
+        len = setup.wLength;
+    }
+    if (len > USB_EP0_SIZE) {
+        len = USB_EP0_SIZE;
+    }
+    USB_INEP(0)->DIEPTSIZ = (1u << USB_OTG_DIEPTSIZ_PKTCNT_Pos) | len;
+    USB_INEP(0)->DIEPCTL |= USB_OTG_DIEPCTL_EPENA | USB_OTG_DIEPCTL_CNAK;
+    UsbFifoWrite(0, data, len);
+}
+
+/**
+ * Refuse a request, the core clears the stall on the next SETUP
+ */
+static void UsbEp0Stall(void)
+{
+    USB_INEP(0)->DIEPCTL |= USB_OTG_DIEPCTL_STALL;
+    USB_OUTEP(0)->DOEPCTL |= USB_OTG_DOEPCTL_STALL;
+}
+
+/**
+ * Build a string descriptor from ASCII in ep0_buf
+ *
+ * @return Descriptor length
+ */
+static uint32_t UsbStringDescriptor(const char *text)
+{
+    uint32_t count = 0;
+
+    while (text[count] != '\0' && 2u + 2u * (count + 1u) < USB_EP0_SIZE) {
+        ep0_buf[2 + 2 * count] = (uint8_t)text[count];
+        ep0_buf[3 + 2 * count] = 0;
+        count++;
+    }
+    ep0_buf[0] = (uint8_t)(2u + 2u * count);
+    ep0_buf[1] = USB_DESC_STRING;
+    return ep0_buf[0];
+}
+
+/**
+ * Start the report endpoint once the host picked the configuration
+ */
+static void UsbEp1Activate(void)
+{
+    USB_INEP(1)->DIEPCTL = USB_OTG_DIEPCTL_USBAEP | (3u << USB_OTG_DIEPCTL_EPTYP_Pos) |
+                           (1u << USB_OTG_DIEPCTL_TXFNUM_Pos) | USB_OTG_DIEPCTL_SD0PID_SEVNFRM |
+                           USB_REPORT_LEN;
+    USB_DEVICE->DAINTMSK |= 1u << 1;
+    ep1_busy = false;
+    report_dirty = true;
+}
+
+/**
+ * Queue the current fragment on endpoint 1 if it changed and the endpoint
+ * is free
+ */
+HOT_PATH static void UsbHidSend(void)
+{
+    if (!configured || ep1_busy || !report_dirty) {
+        return;
+    }
+    report_dirty = false;
+    HidFragmentSnapshot(&report);
+    ep1_busy = true;
+    USB_INEP(1)->DIEPTSIZ = (1u << USB_OTG_DIEPTSIZ_PKTCNT_Pos) | USB_REPORT_LEN;
+    USB_INEP(1)->DIEPCTL |= USB_OTG_DIEPCTL_EPENA | USB_OTG_DIEPCTL_CNAK;
+    UsbFifoWrite(1, (const uint8_t *)&report, USB_REPORT_LEN);
+}
+
+/**
+ * Answer GET_DESCRIPTOR
+ */
+static void UsbGetDescriptor(void)
+{
+    uint8_t type = (uint8_t)(setup.wValue >> 8);
+    uint8_t index = (uint8_t)setup.wValue;
+
+    switch (type) {
+    case USB_DESC_DEVICE:
+        UsbEp0Send(device_descriptor, sizeof(device_descriptor));
+        break;
+    case USB_DESC_CONFIGURATION:
+        UsbEp0Send(config_descriptor, sizeof(config_descriptor));
+        break;
+    case USB_DESC_STRING:
+        if (index == 0) {
+            UsbEp0Send(language_descriptor, sizeof(language_descriptor));
+        } else if (index == 1) {
+            UsbEp0Send(ep0_buf, UsbStringDescriptor(USB_HID_MANUFACTURER));
+        } else if (index == 2) {
+            UsbEp0Send(ep0_buf, UsbStringDescriptor(USB_HID_PRODUCT));
+        } else {
+            UsbEp0Stall();
+        }
+        break;
+    case HID_DESC_HID:
+        UsbEp0Send(&config_descriptor[USB_HID_DESC_OFFSET], 9);
+        break;
+    case HID_DESC_REPORT:
+        UsbEp0Send(report_descriptor, sizeof(report_descriptor));
+        break;
+    default:
+        UsbEp0Stall();
+        break;
+    }
+}
+
+/**
+ * Handle a SETUP packet on endpoint 0
+ */
+static void UsbSetupHandle(void)
+{
+    static const uint8_t zero[2];
+    uint8_t type = setup.bmRequestType & USB_REQ_TYPE_MASK;
+
+    if (type == USB_REQ_TYPE_STANDARD) {
+        switch (setup.bRequest) {
+        case USB_REQ_GET_DESCRIPTOR:
+            UsbGetDescriptor();
+            break;
+        case USB_REQ_SET_ADDRESS:
+            // The core answers the status stage with the old address
+            USB_DEVICE->DCFG = (USB_DEVICE->DCFG & ~USB_OTG_DCFG_DAD) |
+                               ((setup.wValue & 0x7Fu) << USB_OTG_DCFG_DAD_Pos);
+            UsbEp0Send(NULL, 0);
+            break;
+        case USB_REQ_SET_CONFIGURATION:
+            configured = setup.wValue == 1;
+            if (configured) {
+                UsbEp1Activate();
+            }
+            UsbEp0Send(NULL, 0);
+            break;
+        case USB_REQ_GET_CONFIGURATION:
+            ep0_buf[0] = configured ? 1u : 0u;
+            UsbEp0Send(ep0_buf, 1);
+            break;
+        case USB_REQ_GET_STATUS:
+            UsbEp0Send(zero, 2);
+            break;
+        case USB_REQ_GET_INTERFACE:
+            UsbEp0Send(zero, 1);
+            break;
+        case USB_REQ_CLEAR_FEATURE:
+        case USB_REQ_SET_FEATURE:
+        case USB_REQ_SET_INTERFACE:
+            UsbEp0Send(NULL, 0);
+            break;
+        default:
+            UsbEp0Stall();
+            break;
+        }
+    } else if (type == USB_REQ_TYPE_CLASS) {
+        switch (setup.bRequest) {
+        case HID_REQ_GET_REPORT:
+            HidFragmentSnapshot(&report);
+            UsbEp0Send((const uint8_t *)&report, USB_REPORT_LEN);
+            break;
+        case HID_REQ_GET_IDLE:
+            UsbEp0Send(&hid_idle, 1);
+            break;
+        case HID_REQ_GET_PROTOCOL:
+            UsbEp0Send(&hid_protocol, 1);
+            break;
+        case HID_REQ_SET_REPORT:
+            // LED byte follows in the data stage
+            ep0_set_report = true;
+            break;
+        case HID_REQ_SET_IDLE:
+            // Reports only go out on change, as hosts ask of keyboards
+            hid_idle = (uint8_t)(setup.wValue >> 8);
+            UsbEp0Send(NULL, 0);
+            break;
+        case HID_REQ_SET_PROTOCOL:
+            hid_protocol = (uint8_t)setup.wValue;
+            UsbEp0Send(NULL, 0);
+            break;
+        default:
+            UsbEp0Stall();
+            break;
+        }
+    } else {
+        UsbEp0Stall();
+    }
+    UsbEp0OutArm();
+}
+
+/**
+ * Pop one entry of the receive FIFO
+ */
+static void UsbRxPop(void)
+{
+    uint32_t status = USB_OTG_FS->GRXSTSP;
+    uint32_t count = (status & USB_OTG_GRXSTSP_BCNT) >> USB_OTG_GRXSTSP_BCNT_Pos;
+    uint32_t pktsts = (status & USB_OTG_GRXSTSP_PKTSTS) >> USB_OTG_GRXSTSP_PKTSTS_Pos;
+
+    if (pktsts == USB_PKTSTS_SETUP_DATA) {
+        setup.words[0] = USB_FIFO(0);
+        setup.words[1] = USB_FIFO(0);
+        ep0_set_report = false;
+    } else if (pktsts == USB_PKTSTS_OUT_DATA) {
+        for (uint32_t n = 0; n < count; n += 4) {
+            uint32_t word = USB_FIFO(0);
+            if (n == 0 && ep0_set_report) {
+                hid_leds = (uint8_t)word;
+            }
+        }
+    }
+}
+
+/**
+ * Bus reset: back to the default address, endpoint 0 only
+ */
+static void UsbBusReset(void)
+{
+    configured = false;
+    ep1_busy = false;
+    ep0_set_report = false;
+
+    if (USB_INEP(1)->DIEPCTL & USB_OTG_DIEPCTL_EPENA) {
+        USB_INEP(1)->DIEPCTL |= USB_OTG_DIEPCTL_EPDIS | USB_OTG_DIEPCTL_SNAK;
+    }
+    USB_INEP(1)->DIEPCTL &= ~USB_OTG_DIEPCTL_USBAEP;
+    USB_INEP(0)->DIEPINT = 0xFFu;
+    USB_INEP(1)->DIEPINT = 0xFFu;
+    USB_OUTEP(0)->DOEPINT = 0xFFu;
+    UsbFlushFifos();
+
+    USB_DEVICE->DCFG &= ~USB_OTG_DCFG_DAD;
+    USB_DEVICE->DAINTMSK = (1u << 0) | (1u << 16);
+    USB_DEVICE->DIEPMSK = USB_OTG_DIEPMSK_XFRCM;
+    USB_DEVICE->DOEPMSK = USB_OTG_DOEPMSK_STUPM | USB_OTG_DOEPMSK_XFRCM;
+    UsbEp0OutArm();
+}
+#endif /* USB_HID_ENABLE */
+
+/**
+ * Pick the role for this boot, VBUS on PA9 or USB_HID_ROLE_ALWAYS
+ *
+ * The pin is only read on the first call, the role then stays.
+ *
+ * @return true if this half is the USB keyboard
+ */
+bool UsbHidRoleSelected(void)
+{
+#if USB_HID_ENABLE
+    static bool selected;
+
+    if (!selected) {
+        selected = true;
+#if USB_HID_ROLE == USB_HID_ROLE_ALWAYS
+        usb_role = true;
+#else
+        // Input with pull-down, so an open PA9 reads as no VBUS
+        RCC->AHB1ENR |= RCC_AHB1ENR_GPIOAEN;
+        (void)RCC->AHB1ENR;
+        GPIOA->MODER &= ~(3u << (2 * 9));
+        GPIOA->PUPDR = (GPIOA->PUPDR & ~(3u << (2 * 9))) | (2u << (2 * 9));
+        HAL_Delay(1);
+        usb_role = (GPIOA->IDR & GPIO_PIN_9) != 0;
+#endif
+    }
+    return usb_role;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Enumerate as a keyboard: start OTG FS in device mode and connect
+ *
+ * Runs once from RightKeyboardInit(), after the clock setup, since the
+ * core needs the 48 MHz clock from PLL Q.
+ */
+void UsbHidStart(void)
+{
+#if USB_HID_ENABLE
+    RCC->AHB1ENR |= RCC_AHB1ENR_GPIOAEN;
+    RCC->AHB2ENR |= RCC_AHB2ENR_OTGFSEN;
+    (void)RCC->AHB2ENR;
+
+    // PA11 DM, PA12 DP on AF10 at very high speed
+    GPIOA->AFR[1] = (GPIOA->AFR[1] & ~(0xFFu << 12)) | (0xAAu << 12);
+    GPIOA->OSPEEDR |= 0xFu << (2 * 11);
+    GPIOA->MODER = (GPIOA->MODER & ~(0xFu << (2 * 11))) | (0xAu << (2 * 11));
+
+    USB_OTG_FS->GAHBCFG = 0;
+    USB_OTG_FS->GUSBCFG |= USB_OTG_GUSBCFG_PHYSEL;
+    while (!(USB_OTG_FS->GRSTCTL & USB_OTG_GRSTCTL_AHBIDL)) {
+    }
+    USB_OTG_FS->GRSTCTL = USB_OTG_GRSTCTL_CSRST;
+    while (USB_OTG_FS->GRSTCTL & USB_OTG_GRSTCTL_CSRST) {
+    }
+
+    // Transceiver on; VBUS was checked by the role selection, not sensed
+    USB_OTG_FS->GCCFG = USB_OTG_GCCFG_PWRDWN | USB_OTG_GCCFG_NOVBUSSENS;
+
+    // Forced device mode, turnaround for an AHB clock above 32 MHz; the
+    // mode takes 25 ms to settle
+    USB_OTG_FS->GUSBCFG = (USB_OTG_FS->GUSBCFG & ~(USB_OTG_GUSBCFG_TRDT | USB_OTG_GUSBCFG_FHMOD)) |
+                          USB_OTG_GUSBCFG_FDMOD | (6u << USB_OTG_GUSBCFG_TRDT_Pos);
+    HAL_Delay(25);
+
+    USB_PCGCCTL = 0;
+    USB_DEVICE->DCTL |= USB_OTG_DCTL_SDIS;
+    USB_DEVICE->DCFG = (USB_DEVICE->DCFG & ~USB_OTG_DCFG_DSPD) | (3u << USB_OTG_DCFG_DSPD_Pos);
+
+    USB_OTG_FS->GRXFSIZ = USB_RX_FIFO_WORDS;
+    USB_OTG_FS->DIEPTXF0_HNPTXFSIZ = (USB_EP0_FIFO_WORDS << 16) | USB_RX_FIFO_WORDS;
+    USB_OTG_FS->DIEPTXF[0] = (USB_EP1_FIFO_WORDS << 16) | (USB_RX_FIFO_WORDS + USB_EP0_FIFO_WORDS);
+    UsbFlushFifos();
+
+    USB_OTG_FS->GINTSTS = 0xFFFFFFFFu;
+    USB_OTG_FS->GINTMSK = USB_OTG_GINTMSK_USBRST | USB_OTG_GINTMSK_ENUMDNEM | USB_OTG_GINTMSK_RXFLVLM |
+                          USB_OTG_GINTMSK_IEPINT | USB_OTG_GINTMSK_OEPINT;
+
+    HAL_NVIC_SetPriority(OTG_FS_IRQn, IRQ_PRIO_I2C, 0);
+    NVIC_EnableIRQ(OTG_FS_IRQn);
+    USB_OTG_FS->GAHBCFG = USB_OTG_GAHBCFG_GINT;
+
+    // Pull-up on DP, the host sees the device
+    USB_DEVICE->DCTL &= ~USB_OTG_DCTL_SDIS;
+#endif
+}
+
+/**
+ * Send the fragment because the scan published a change
+ *
+ * Called from the scan. The report is queued in the OTG FS interrupt,
+ * which is pended here, so it never races a control transfer.
+ */
+HOT_PATH void UsbHidPublish(void)
+{
+#if USB_HID_ENABLE
+    if (usb_role) {
+        report_dirty = true;
+        NVIC_SetPendingIRQ(OTG_FS_IRQn);
+    }
+#endif
+}
+
+/**
+ * OTG FS interrupt: bus reset, enumeration, endpoint traffic and reports
+ * pended by UsbHidPublish()
+ */
+HOT_PATH void UsbHidIRQHandler(void)
+{
+#if USB_HID_ENABLE
+    uint32_t gintsts = USB_OTG_FS->GINTSTS & USB_OTG_FS->GINTMSK;
+
+    if (gintsts & USB_OTG_GINTSTS_USBRST) {
+        USB_OTG_FS->GINTSTS = USB_OTG_GINTSTS_USBRST;
+        UsbBusReset();
+    }
+    if (gintsts & USB_OTG_GINTSTS_ENUMDNE) {
+        USB_OTG_FS->GINTSTS = USB_OTG_GINTSTS_ENUMDNE;
+        // Full speed, 64-byte control packets
+        USB_INEP(0)->DIEPCTL &= ~USB_OTG_DIEPCTL_MPSIZ;
+        USB_DEVICE->DCTL |= USB_OTG_DCTL_CGINAK;
+    }
+    while (USB_OTG_FS->GINTSTS & USB_OTG_GINTSTS_RXFLVL) {
+        UsbRxPop();
+    }
+    if (gintsts & USB_OTG_GINTSTS_OEPINT) {
+        uint32_t epint = USB_OUTEP(0)->DOEPINT;
+        USB_OUTEP(0)->DOEPINT = epint;
+        if ((epint & USB_OTG_DOEPINT_XFRC) && ep0_set_report) {
+            // SET_REPORT data in, status stage
+            ep0_set_report = false;
+            UsbEp0Send(NULL, 0);
+            UsbEp0OutArm();
+        } else if (epint & USB_OTG_DOEPINT_XFRC) {
+            UsbEp0OutArm();
+        }
+        if (epint & USB_OTG_DOEPINT_STUP) {
+            UsbSetupHandle();
+        }
+    }
+    if (gintsts & USB_OTG_GINTSTS_IEPINT) {
+        uint32_t daint = USB_DEVICE->DAINT;
+        if (daint & (1u << 0)) {
+            USB_INEP(0)->DIEPINT = USB_INEP(0)->DIEPINT;
+        }
+        if (daint & (1u << 1)) {
+            uint32_t epint = USB_INEP(1)->DIEPINT;
+            USB_INEP(1)->DIEPINT = epint;
+            if (epint & USB_OTG_DIEPINT_XFRC) {
+                ep1_busy = false;
+            }
+        }
+    }
+    UsbHidSend();
+#endif
+}
@@ -0,0 +1,54 @@
+/**
+ * @file watchdog.c
+ * @brief Independent watchdog as the backstop of the recovery policy.
+ */
+
+#include "watchdog.h"
+#include "right_side_keyboard.h"
+
+#if WATCHDOG_ENABLE
+// Prescaler /32 (PR = 3) counts milliseconds up to 4 s, /256 (PR = 6) the rest
+#define WATCHDOG_PR     (WATCHDOG_TIMEOUT_MS <= 4000u ? 3u : 6u)
+#define WATCHDOG_DIV    (4u << WATCHDOG_PR)
+#define WATCHDOG_RELOAD ((LSI_VALUE / WATCHDOG_DIV) * WATCHDOG_TIMEOUT_MS / 1000u - 1u)
+
+_Static_assert(WATCHDOG_RELOAD <= IWDG_RLR_RL, "WATCHDOG_TIMEOUT_MS does not fit the reload register");
+
+#if DEEP_IDLE_ENABLE
+// STOP only wakes for the RTC poll, give it a few chances per timeout
+_Static_assert(DEEP_IDLE_POLL_MS * 4u <= WATCHDOG_TIMEOUT_MS, "DEEP_IDLE_POLL_MS is too long for WATCHDOG_TIMEOUT_MS");
+#endif
+#endif
+
+/**
+ * Start the IWDG with WATCHDOG_TIMEOUT_MS
+ *
+ * Called right after reset. Starting the IWDG turns LSI on by itself.
+ */
+void WatchdogInit(void)
+{
+#if WATCHDOG_ENABLE
+    DBGMCU->APB1FZ |= DBGMCU_APB1_FZ_DBG_IWDG_STOP;
+
+    IWDG->KR = 0xCCCCu;     // Start
+    IWDG->KR = 0x5555u;     // Unlock PR and RLR
+    IWDG->PR = WATCHDOG_PR;
+    IWDG->RLR = WATCHDOG_RELOAD;
+    while (IWDG->SR != 0) {
+        // Both values cross into the LSI domain, a few LSI cycles
+    }
+    IWDG->KR = 0xAAAAu;
+#endif
+}
+
+/**
+ * Reload the IWDG counter
+ *
+ * Called from the main loop and from deep idle wake-ups.
+ */
+void WatchdogKick(void)
+{
+#if WATCHDOG_ENABLE
+    IWDG->KR = 0xAAAAu;
+#endif
+}
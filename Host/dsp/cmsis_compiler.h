@@ -0,0 +1,66 @@
+/**
+ * @file cmsis_compiler.h
+ * @brief Host stand-in for the CMSIS SIMD intrinsics debounce.c uses.
+ *
+ * Found before the real header when a host build defines __ARM_FEATURE_DSP,
+ * so the Cortex-M4 path of IntegratorStep() runs on the host. Each
+ * intrinsic works byte by byte as the ARMv7E-M reference describes it; the
+ * GE flags USUB8 sets for SEL are a static variable.
+ */
+
+#ifndef HOST_CMSIS_COMPILER_H
+#define HOST_CMSIS_COMPILER_H
+
+#include <stdint.h>
+
+static uint32_t host_apsr_ge;   // GE[3:0], bit n = byte n
+
+static inline uint32_t __UQADD8(uint32_t op1, uint32_t op2)
+{
+    uint32_t result = 0;
+
+    for (uint32_t shift = 0; shift < 32u; shift += 8u) {
+        uint32_t sum = ((op1 >> shift) & 0xFFu) + ((op2 >> shift) & 0xFFu);
+        result |= (sum > 0xFFu ? 0xFFu : sum) << shift;
+    }
+    return result;
+}
+
+static inline uint32_t __UQSUB8(uint32_t op1, uint32_t op2)
+{
+    uint32_t result = 0;
+
+    for (uint32_t shift = 0; shift < 32u; shift += 8u) {
+        uint32_t a = (op1 >> shift) & 0xFFu;
+        uint32_t b = (op2 >> shift) & 0xFFu;
+        result |= (a > b ? a - b : 0u) << shift;
+    }
+    return result;
+}
+
+static inline uint32_t __USUB8(uint32_t op1, uint32_t op2)
+{
+    uint32_t result = 0;
+
+    host_apsr_ge = 0;
+    for (uint32_t n = 0; n < 4u; ++n) {
+        uint32_t a = (op1 >> (8u * n)) & 0xFFu;
+        uint32_t b = (op2 >> (8u * n)) & 0xFFu;
+        host_apsr_ge |= (a >= b ? 1u : 0u) << n;
+        result |= ((a - b) & 0xFFu) << (8u * n);
+    }
+    return result;
+}
+
+static inline uint32_t __SEL(uint32_t op1, uint32_t op2)
+{
+    uint32_t result = 0;
+
+    for (uint32_t n = 0; n < 4u; ++n) {
+        uint32_t lane = 0xFFu << (8u * n);
+        result |= ((host_apsr_ge >> n) & 1u) ? (op1 & lane) : (op2 & lane);
+    }
+    return result;
+}
+
+#endif /* HOST_CMSIS_COMPILER_H */
@@ -0,0 +1,151 @@
+/**
+ * @file integrator_check.c
+ * @brief Host check of the integrator debounce against a scalar model.
+ *
+ * IntegratorDebounceUpdate() steps four keys per word, with the Cortex-M4
+ * SIMD intrinsics or a byte loop. Here every sample of a synthetic trace
+ * also goes through a plain per-key counter: up one for a released key,
+ * down one for a held one, kept within 0..samples, and the key flips when
+ * its counter reaches an end. The debounced word and every counter must
+ * match after each sample, and a sample the engine reports no work for
+ * (IntegratorDebounceActive() == 0) must change neither.
+ *
+ * The integrator_check target builds the byte loop, integrator_check_dsp
+ * the SIMD path on the intrinsics of dsp/cmsis_compiler.h.
+ *
+ *   integrator_check
+ * runs CHECK_TRACES traces of CHECK_SAMPLES samples, each with its own
+ * counter range, and fails on the first mismatch.
+ */
+
+#include "debounce.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Traces and samples per trace
+#ifndef CHECK_TRACES
+#define CHECK_TRACES 64u
+#endif
+
+#ifndef CHECK_SAMPLES
+#define CHECK_SAMPLES 32768u
+#endif
+
+// Scalar model, one counter per key
+typedef struct {
+    uint32_t state;         // Debounced key word
+    uint8_t  count[32];     // 0 = pressed end, samples = released end
+    uint8_t  samples;
+} CheckModel;
+
+/**
+ * xorshift32, the traces only need to be repeatable
+ */
+static uint32_t CheckRandom(uint32_t *seed)
+{
+    uint32_t x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+    return x;
+}
+
+static void ModelInit(CheckModel *m, uint32_t initial, uint32_t samples)
+{
+    m->state = initial;
+    m->samples = (uint8_t)samples;
+    for (uint32_t k = 0; k < 32u; ++k) {
+        m->count[k] = ((initial >> k) & 1u) ? (uint8_t)samples : 0u;
+    }
+}
+
+static uint32_t ModelUpdate(CheckModel *m, uint32_t raw)
+{
+    for (uint32_t k = 0; k < 32u; ++k) {
+        if ((raw >> k) & 1u) {
+            m->count[k] += m->count[k] < m->samples ? 1u : 0u;
+        } else {
+            m->count[k] -= m->count[k] > 0u ? 1u : 0u;
+        }
+        if (m->count[k] == m->samples) {
+            m->state |= 1u << k;
+        } else if (m->count[k] == 0u) {
+            m->state &= ~(1u << k);
+        }
+    }
+    return m->state;
+}
+
+static int ModelMatches(const CheckModel *m, const IntegratorDebounce *id)
+{
+    if (m->state != id->state) {
+        return 0;
+    }
+    for (uint32_t k = 0; k < 32u; ++k) {
+        if (((id->count[k / 4u] >> (8u * (k % 4u))) & 0xFFu) != m->count[k]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Run one trace: keys flip in bursts, a burst toggles one key a few times
+ * over a few samples like bounce, with the occasional key held through
+ * single-sample dropouts; the counter range comes from the seed
+ *
+ * @return 0 on a match, 1 on the first mismatch
+ */
+static int CheckTrace(uint32_t trace, uint32_t seed)
+{
+    static const uint8_t ranges[] = { 1u, 2u, 3u, 5u, 8u, 40u, 254u, 255u };
+    uint32_t samples = (trace < sizeof(ranges)) ? ranges[trace] : 1u + CheckRandom(&seed) % 255u;
+    uint32_t raw = CheckRandom(&seed);
+    IntegratorDebounce id;
+    CheckModel model;
+
+    IntegratorDebounceInit(&id, raw, samples);
+    ModelInit(&model, raw, samples);
+    for (uint32_t n = 0; n < CHECK_SAMPLES; ++n) {
+        uint32_t r = CheckRandom(&seed);
+        if ((r & 0x7u) == 0) {
+            raw ^= 1u << ((r >> 3) & 31u);
+        }
+        uint32_t dropout = ((r >> 8) & 0x3Fu) == 0 ? 1u << ((r >> 14) & 31u) : 0u;
+        uint32_t sample = raw ^ dropout;
+
+        uint32_t before = id.state;
+        uint32_t idle = IntegratorDebounceActive(&id, sample) == 0;
+        IntegratorDebounce copy = id;
+        uint32_t got = IntegratorDebounceUpdate(&id, sample);
+        uint32_t want = ModelUpdate(&model, sample);
+        if (got != want || !ModelMatches(&model, &id)) {
+            printf("trace %u (samples %u) sample %u: state %08x, model %08x\n", trace, samples, n, got, want);
+            return 1;
+        }
+        if (idle && (got != before || ModelMatches(&model, &copy) == 0)) {
+            printf("trace %u (samples %u) sample %u: update changed an idle engine\n", trace, samples, n);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(void)
+{
+    uint32_t seed = 0x696E7467u;
+
+    for (uint32_t trace = 0; trace < CHECK_TRACES; ++trace) {
+        if (CheckTrace(trace, CheckRandom(&seed))) {
+            return EXIT_FAILURE;
+        }
+    }
+#if defined(__ARM_FEATURE_DSP)
+    printf("integrator (SIMD path): %u traces of %u samples match the scalar model\n", CHECK_TRACES, CHECK_SAMPLES);
+#else
+    printf("integrator (byte loop): %u traces of %u samples match the scalar model\n", CHECK_TRACES, CHECK_SAMPLES);
+#endif
+    return EXIT_SUCCESS;
+}
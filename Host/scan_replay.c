@@ -0,0 +1,311 @@
+/**
+ * @file scan_replay.c
+ * @brief Host replay of GPIO IDR traces through the scan pipeline.
+ *
+ * Every trace sample is the pair of IDR snapshots a scan reads, with its
+ * time, and goes through what ScanFromKeys() does with them in the default
+ * build: KEY_GATHER(), the lockout debounce, the press order and rollover,
+ * the report word and its CRC-8. The mocked GPIO is the trace itself.
+ *
+ * Next to it the same trace runs through the per-key lockout loop, rollover
+ * and byte packing the firmware used before debounce.c and key_report.c
+ * existed, and a bitwise CRC-8. Any scan where the two disagree on the
+ * debounced word, the report or the CRC counts as a mismatch; the run fails
+ * on the first trace with one.
+ *
+ *   scan_replay [trace.bin ...]
+ * runs the synthetic trace, REPLAY_SYNTH_SAMPLES samples across a wrap of
+ * the time base with gaps, back-dated DMA samples and noise on the pins
+ * that carry no key, then every recorded trace given (ReplaySample records,
+ * little endian). Prints ns/scan of the pipeline alone and the mismatches.
+ */
+
+#include "crc8.h"
+#include "debounce.h"
+#include "key_report.h"
+#include "keyboard_layout.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Settings of the default build (DEBOUNCE_TIME_MS, REPORT_MAX_KEYS)
+#define REPLAY_LOCKOUT_US   5000u
+#define REPLAY_MAX_KEYS     6u
+#define REPLAY_KEYS         KEY_MAP_COUNT
+#define REPLAY_KEY_MASK     (0xFFFFFFFFu >> (32 - REPLAY_KEYS))
+#define REPLAY_REPORT_BYTES ((REPLAY_KEYS + 7) / 8)
+
+// Samples of the synthetic trace, 8 bytes each
+#ifndef REPLAY_SYNTH_SAMPLES
+#define REPLAY_SYNTH_SAMPLES 2000000u
+#endif
+
+// One scan: both IDR snapshots and the time they were taken
+typedef struct __attribute__((packed)) {
+    uint32_t time_us;       // Time base of the scan
+    uint16_t idr_a;         // GPIOA->IDR
+    uint16_t idr_b;         // GPIOB->IDR
+} ReplaySample;
+
+// Output of one scan
+typedef struct {
+    uint32_t debounced;     // Debounced key word (1 = released)
+    uint32_t report;        // Report word (0 = pressed)
+    uint8_t  crc;           // CRC-8 of the report bytes
+} ReplayScan;
+
+// Pipeline under test, the firmware modules
+typedef struct {
+    LockoutDebounce lockout;
+    KeyPressOrder   order;
+    uint32_t        debounced;
+} ReplayPipeline;
+
+// Reference, the per-key loop of the firmware before the split
+typedef struct {
+    uint32_t lockout_until[REPLAY_KEYS];    // Time of the last accepted edge + lockout
+    uint32_t lockout_mask;                  // Keys whose lockout_until is still ahead
+    bool     debounced_state[REPLAY_KEYS];  // true = released
+} ReplayReference;
+
+/**
+ * xorshift32, the synthetic trace only needs to be repeatable
+ */
+static uint32_t ReplayRandom(uint32_t *seed)
+{
+    uint32_t x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+    return x;
+}
+
+/**
+ * Fill a trace with random key activity
+ *
+ * Scans come every 50-1500 us, starting 20 s before the time base wraps.
+ * About one scan in 16 flips a key, so close flips make bounce; one in 4096
+ * follows a gap of up to 10 s, and one in 64 is stamped up to 1 ms before
+ * the previous scan like a DMA batch after a scan from the I2C interrupt.
+ * The IDR bits that carry no key are random.
+ */
+static void ReplaySynth(ReplaySample *trace, uint32_t count, uint32_t seed)
+{
+    uint32_t keys = REPLAY_KEY_MASK;
+    uint32_t now = 0u - 20000000u;
+
+    for (uint32_t n = 0; n < count; ++n) {
+        uint32_t r = ReplayRandom(&seed);
+        uint32_t stamp;
+
+        if ((r & 0xFFFu) == 0) {
+            now += ReplayRandom(&seed) % 10000000u;
+        }
+        if ((r >> 12) % 16u == 0) {
+            keys ^= 1u << (ReplayRandom(&seed) % REPLAY_KEYS);
+        }
+        if ((r >> 16) % 64u == 0 && n > 0) {
+            stamp = now - ReplayRandom(&seed) % 1000u;
+        } else {
+            now += 50u + ReplayRandom(&seed) % 1451u;
+            stamp = now;
+        }
+
+        uint32_t noise = ReplayRandom(&seed);
+        uint32_t idr_a = noise & 0xFFFFu & ~KEY_MASK_A;
+        uint32_t idr_b = (noise >> 16) & ~KEY_MASK_B;
+        for (uint32_t k = 0; k < REPLAY_KEYS; ++k) {
+            if (!((keys >> k) & 1u)) {
+                continue;
+            }
+            // Find the pin KEY_GATHER() routes to key k
+            for (uint32_t pin = 0; pin < 16; ++pin) {
+                idr_a |= KEY_GATHER(1u << pin, 0u) == (1u << k) ? 1u << pin : 0u;
+                idr_b |= KEY_GATHER(0u, 1u << pin) == (1u << k) ? 1u << pin : 0u;
+            }
+        }
+        trace[n].time_us = stamp;
+        trace[n].idr_a = (uint16_t)idr_a;
+        trace[n].idr_b = (uint16_t)idr_b;
+    }
+}
+
+static void PipelineInit(ReplayPipeline *p, const ReplaySample *first)
+{
+    p->debounced = KEY_GATHER(first->idr_a, first->idr_b) & REPLAY_KEY_MASK;
+    LockoutDebounceInit(&p->lockout, p->debounced, REPLAY_LOCKOUT_US);
+    KeyPressOrderInit(&p->order);
+    KeyPressOrderUpdate(&p->order, ~p->debounced & REPLAY_KEY_MASK);
+}
+
+/**
+ * One scan through the firmware modules
+ */
+static void PipelineScan(ReplayPipeline *p, const ReplaySample *sample, ReplayScan *out)
+{
+    uint32_t raw = KEY_GATHER(sample->idr_a, sample->idr_b) & REPLAY_KEY_MASK;
+    uint32_t debounced = LockoutDebounceUpdate(&p->lockout, raw, sample->time_us);
+
+    if (debounced != p->debounced) {
+        KeyPressOrderUpdate(&p->order, ~debounced & REPLAY_KEY_MASK);
+        p->debounced = debounced;
+    }
+    uint32_t reported = KeyPressOrderSelect(&p->order, KEY_ROLLOVER_INDEX, ~debounced & REPLAY_KEY_MASK,
+                                            REPLAY_MAX_KEYS);
+    out->debounced = debounced;
+    out->report = KeyReportWord(reported, REPLAY_REPORT_BYTES);
+
+    uint8_t bytes[REPLAY_REPORT_BYTES];
+    for (uint32_t n = 0; n < REPLAY_REPORT_BYTES; ++n) {
+        bytes[n] = (uint8_t)(out->report >> (n * 8));
+    }
+    out->crc = Crc8Update(CRC8_INIT, bytes, REPLAY_REPORT_BYTES);
+}
+
+static void ReferenceInit(ReplayReference *r, const ReplaySample *first)
+{
+    uint32_t raw = KEY_GATHER(first->idr_a, first->idr_b);
+
+    for (uint32_t i = 0; i < REPLAY_KEYS; ++i) {
+        r->debounced_state[i] = (raw >> i) & 1u;
+    }
+    r->lockout_mask = 0;
+}
+
+/**
+ * One scan through the old per-key loop, ApplyRolloverLimit() and
+ * key_states[] packing, then a bitwise CRC-8
+ */
+static void ReferenceScan(ReplayReference *r, const ReplaySample *sample, ReplayScan *out)
+{
+    uint32_t raw_keys = KEY_GATHER(sample->idr_a, sample->idr_b);
+    uint32_t now = sample->time_us;
+    uint32_t debounced = 0;
+
+    for (uint32_t i = 0; i < REPLAY_KEYS; ++i) {
+        bool raw = (raw_keys >> i) & 1u;
+        bool locked = (r->lockout_mask >> i) & 1u;
+        if (locked && (int32_t)(now - r->lockout_until[i]) >= 0) {
+            r->lockout_mask &= ~(1u << i);
+            locked = false;
+        }
+        if (raw != r->debounced_state[i] && !locked) {
+            r->debounced_state[i] = raw;
+            r->lockout_until[i] = now + REPLAY_LOCKOUT_US;
+            r->lockout_mask |= 1u << i;
+        }
+        debounced |= (uint32_t)r->debounced_state[i] << i;
+    }
+
+    uint32_t pressed = ~debounced & REPLAY_KEY_MASK;
+    uint32_t kept = 0;
+    for (uint32_t n = 0; n < REPLAY_MAX_KEYS && pressed; ++n) {
+        uint32_t lowest = pressed & (0u - pressed);
+        kept |= lowest;
+        pressed ^= lowest;
+    }
+
+    uint8_t key_states[REPLAY_REPORT_BYTES];
+    uint8_t crc = CRC8_INIT;
+    out->report = 0;
+    for (uint32_t n = 0; n < REPLAY_REPORT_BYTES; ++n) {
+        key_states[n] = (uint8_t)~(kept >> (n * 8));
+        out->report |= (uint32_t)key_states[n] << (n * 8);
+        crc ^= key_states[n];
+        for (uint32_t bit = 0; bit < 8; ++bit) {
+            crc = (uint8_t)((crc & 0x80u) ? ((uint32_t)crc << 1) ^ 0x07u : (uint32_t)crc << 1);
+        }
+    }
+    out->debounced = debounced;
+    out->crc = crc;
+}
+
+static uint64_t HostNowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Time the pipeline over a trace, then check it scan by scan
+ *
+ * @return Scans where pipeline and reference disagree
+ */
+static uint32_t Replay(const char *name, const ReplaySample *trace, uint32_t count)
+{
+    ReplayPipeline pipeline;
+    ReplayReference reference;
+    ReplayScan got;
+    ReplayScan want;
+    uint32_t sink = 0;
+
+    if (count == 0) {
+        printf("%s: empty\n", name);
+        return 0;
+    }
+
+    PipelineInit(&pipeline, &trace[0]);
+    uint64_t start = HostNowNs();
+    for (uint32_t n = 0; n < count; ++n) {
+        PipelineScan(&pipeline, &trace[n], &got);
+        sink += got.crc;
+    }
+    uint64_t elapsed = HostNowNs() - start;
+
+    uint32_t mismatches = 0;
+    uint32_t changes = 0;
+    PipelineInit(&pipeline, &trace[0]);
+    ReferenceInit(&reference, &trace[0]);
+    for (uint32_t n = 0; n < count; ++n) {
+        uint32_t before = pipeline.debounced;
+        PipelineScan(&pipeline, &trace[n], &got);
+        ReferenceScan(&reference, &trace[n], &want);
+        changes += (uint32_t)__builtin_popcount(before ^ got.debounced);
+        if (got.debounced != want.debounced || got.report != want.report || got.crc != want.crc) {
+            if (mismatches++ == 0) {
+                printf("%s: scan %u at %u us: debounced %06x/%06x report %06x/%06x crc %02x/%02x\n", name, n,
+                       trace[n].time_us, got.debounced, want.debounced, got.report, want.report, got.crc,
+                       want.crc);
+            }
+        }
+    }
+
+    printf("%s: %u scans, %u changes, %.1f ns/scan, %u mismatches (%02x)\n", name, count, changes,
+           (double)elapsed / count, mismatches, sink & 0xFFu);
+    return mismatches;
+}
+
+/**
+ * Replay the synthetic trace, then every recorded trace named
+ */
+int main(int argc, char **argv)
+{
+    ReplaySample *trace = malloc(REPLAY_SYNTH_SAMPLES * sizeof(*trace));
+    uint32_t mismatches = 0;
+
+    if (trace == NULL) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    ReplaySynth(trace, REPLAY_SYNTH_SAMPLES, 0x6E79616Eu);
+    mismatches += Replay("synthetic", trace, REPLAY_SYNTH_SAMPLES);
+
+    for (int arg = 1; arg < argc; ++arg) {
+        FILE *file = fopen(argv[arg], "rb");
+        if (file == NULL) {
+            perror(argv[arg]);
+            free(trace);
+            return EXIT_FAILURE;
+        }
+        uint32_t count = (uint32_t)fread(trace, sizeof(trace[0]), REPLAY_SYNTH_SAMPLES, file);
+        fclose(file);
+        mismatches += Replay(argv[arg], trace, count);
+    }
+
+    free(trace);
+    return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}